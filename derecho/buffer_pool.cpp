@@ -0,0 +1,112 @@
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#include "persistence.h"
+
+namespace derecho {
+
+MessageBuffer::MessageBuffer(MessageBuffer&& other) noexcept
+        : buffer(other.buffer),
+          mr(std::move(other.mr)),
+          mr_offset(other.mr_offset),
+          capacity(other.capacity),
+          pool(std::move(other.pool)) {
+    other.buffer = nullptr;
+    other.capacity = 0;
+}
+
+MessageBuffer& MessageBuffer::operator=(MessageBuffer&& other) noexcept {
+    if(this != &other) {
+        release();
+        buffer = other.buffer;
+        mr = std::move(other.mr);
+        mr_offset = other.mr_offset;
+        capacity = other.capacity;
+        pool = std::move(other.pool);
+        other.buffer = nullptr;
+        other.capacity = 0;
+    }
+    return *this;
+}
+
+MessageBuffer::~MessageBuffer() {
+    release();
+}
+
+void MessageBuffer::release() {
+    if(pool) {
+        pool->release(buffer, std::move(mr), mr_offset, capacity);
+        pool.reset();
+    }
+    buffer = nullptr;
+    mr.reset();
+    capacity = 0;
+}
+
+BufferPool::BufferPool(std::size_t max_buffer_size) {
+    const std::size_t alignment = persistence::DIRECT_IO_ALIGNMENT;
+    const std::size_t largest_size = (max_buffer_size + alignment - 1) / alignment * alignment;
+    for(std::size_t buffer_size = alignment; ; buffer_size *= 2) {
+        size_classes.emplace_back(std::make_unique<SizeClass>());
+        size_classes.back()->buffer_size = std::min(buffer_size, largest_size);
+        if(buffer_size >= largest_size) {
+            break;
+        }
+    }
+}
+
+void BufferPool::add_slab(SizeClass& size_class) {
+    const std::size_t num_buffers = std::max(BUFFER_POOL_SLAB_SIZE / size_class.buffer_size, (std::size_t)1);
+    const std::size_t slab_size = num_buffers * size_class.buffer_size;
+    void* memory = nullptr;
+    if(posix_memalign(&memory, persistence::DIRECT_IO_ALIGNMENT, slab_size) != 0) {
+        throw std::bad_alloc();
+    }
+    std::unique_ptr<char[], aligned_array_deleter> slab((char*)memory);
+    auto mr = std::make_shared<rdma::memory_region>(slab.get(), slab_size);
+    for(std::size_t i = 0; i < num_buffers; ++i) {
+        size_class.free_buffers.push_back(FreeBuffer{slab.get() + i * size_class.buffer_size, mr,
+                                                     i * size_class.buffer_size});
+    }
+    std::lock_guard<std::mutex> lock(slabs_mutex);
+    slabs.emplace_back(std::move(slab));
+}
+
+MessageBuffer BufferPool::acquire(std::size_t size) {
+    auto size_class_iter = std::find_if(size_classes.begin(), size_classes.end(),
+                                        [size](const std::unique_ptr<SizeClass>& size_class) {
+                                            return size_class->buffer_size >= size;
+                                        });
+    if(size_class_iter == size_classes.end()) {
+        throw std::bad_alloc();
+    }
+    SizeClass& size_class = **size_class_iter;
+    std::lock_guard<std::mutex> lock(size_class.mutex);
+    if(size_class.free_buffers.empty()) {
+        add_slab(size_class);
+    }
+    FreeBuffer& free_buffer = size_class.free_buffers.back();
+    MessageBuffer message_buffer;
+    message_buffer.buffer = free_buffer.buffer;
+    message_buffer.mr = std::move(free_buffer.mr);
+    message_buffer.mr_offset = free_buffer.mr_offset;
+    message_buffer.capacity = size_class.buffer_size;
+    message_buffer.pool = shared_from_this();
+    size_class.free_buffers.pop_back();
+    return message_buffer;
+}
+
+void BufferPool::release(char* buffer, std::shared_ptr<rdma::memory_region> mr,
+                         std::size_t mr_offset, std::size_t capacity) {
+    for(auto& size_class : size_classes) {
+        if(size_class->buffer_size == capacity) {
+            std::lock_guard<std::mutex> lock(size_class->mutex);
+            size_class->free_buffers.push_back(FreeBuffer{buffer, std::move(mr), mr_offset});
+            return;
+        }
+    }
+}
+}
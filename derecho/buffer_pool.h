@@ -0,0 +1,107 @@
+/**
+ * @file buffer_pool.h
+ * @brief Contains the pool of RDMA-registered buffers that multicast messages
+ * are sent and received in.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "rdmc/rdmc.h"
+
+namespace derecho {
+
+/** The size of each block of memory the BufferPool allocates and registers at once. */
+static const std::size_t BUFFER_POOL_SLAB_SIZE = 16 * 1024 * 1024;
+
+/** Deleter for arrays allocated with posix_memalign. */
+struct aligned_array_deleter {
+    void operator()(char* ptr) const { free(ptr); }
+};
+
+class BufferPool;
+
+/**
+ * Represents a block of memory used to store a message. This object contains
+ * both the array of bytes in which the message is stored and the RDMA memory
+ * region that has registered it, which is shared with the other buffers
+ * carved out of the same slab of the BufferPool. The array is aligned and
+ * padded to persistence::DIRECT_IO_ALIGNMENT so that the FileWriter can write
+ * it to disk without copying it first. This is a move-only type, and the
+ * array is returned to its BufferPool when the MessageBuffer is destroyed.
+ */
+struct MessageBuffer {
+    char* buffer = nullptr;
+    std::shared_ptr<rdma::memory_region> mr;
+    /** The offset of buffer within mr. */
+    std::size_t mr_offset = 0;
+    /** The allocated size of buffer, which may be larger than the requested size. */
+    std::size_t capacity = 0;
+
+    MessageBuffer() {}
+    MessageBuffer(const MessageBuffer&) = delete;
+    MessageBuffer(MessageBuffer&& other) noexcept;
+    MessageBuffer& operator=(const MessageBuffer&) = delete;
+    MessageBuffer& operator=(MessageBuffer&& other) noexcept;
+    ~MessageBuffer();
+
+private:
+    friend class BufferPool;
+    /** The pool the buffer came from, which it is returned to; null if the MessageBuffer is empty. */
+    std::shared_ptr<BufferPool> pool;
+    /** Returns the buffer to its pool, leaving this MessageBuffer empty. */
+    void release();
+};
+
+/**
+ * A slab allocator for MessageBuffers, which is shared by all the subgroups
+ * of a group and kept across view changes. Buffers come in size classes of
+ * successive powers of 2, from persistence::DIRECT_IO_ALIGNMENT up to the
+ * largest message size, and a buffer is handed out from the smallest class
+ * that fits the message. Each class carves its buffers out of slabs of
+ * BUFFER_POOL_SLAB_SIZE bytes (or one buffer, if that is larger), and each
+ * slab is registered with RDMA only once, when it is first needed.
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+private:
+    struct FreeBuffer {
+        char* buffer;
+        std::shared_ptr<rdma::memory_region> mr;
+        std::size_t mr_offset;
+    };
+    struct SizeClass {
+        std::size_t buffer_size;
+        std::mutex mutex;
+        std::vector<FreeBuffer> free_buffers;
+    };
+    /** The memory of every slab; declared first so that it outlives the memory regions registering it. */
+    std::vector<std::unique_ptr<char[], aligned_array_deleter>> slabs;
+    std::mutex slabs_mutex;
+    std::vector<std::unique_ptr<SizeClass>> size_classes;
+
+    /** Allocates and registers a slab of buffers for a size class, and adds them to its free list.
+     * The caller must hold the size class's mutex. */
+    void add_slab(SizeClass& size_class);
+    /** Returns a buffer of the given capacity to its size class. */
+    void release(char* buffer, std::shared_ptr<rdma::memory_region> mr, std::size_t mr_offset, std::size_t capacity);
+    friend struct MessageBuffer;
+
+public:
+    /** @param max_buffer_size The size of the largest message that will be stored in the pool. */
+    BufferPool(std::size_t max_buffer_size);
+    BufferPool(const BufferPool&) = delete;
+
+    /**
+     * Gets a buffer that can hold a message of the given size from the pool,
+     * allocating a new slab if there are no free buffers of its size class.
+     * @throws std::bad_alloc if size is larger than the pool's largest buffers,
+     * or the memory for a new slab can't be allocated.
+     */
+    MessageBuffer acquire(std::size_t size);
+};
+}
@@ -0,0 +1,74 @@
+/**
+ * @file byte_view.h
+ * @brief Contains a non-owning view of a byte array, for RPC functions whose
+ * arguments should be read straight out of the received message.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+#include "mutils-serialization/SerializationSupport.hpp"
+
+namespace derecho {
+
+/**
+ * A pointer and a length referring to a byte array owned by someone else. It
+ * serializes like a byte array, so the caller of an RPC function that takes a
+ * ByteView can pass a view of any buffer it owns. On the receiving side, the
+ * RPC layer points the argument into the received message (the RDMC or SST
+ * buffer for an ordered send, or the buffer the P2P reader received a P2P
+ * send into) instead of deserializing a copy of it, so a handler that only
+ * reads a large blob never copies it.
+ *
+ * The bytes a ByteView argument refers to are only valid until the RPC
+ * function returns; a function that needs to keep them must copy them. For
+ * the same reason, an RPC function cannot return a ByteView.
+ */
+class ByteView : public mutils::ByteRepresentable {
+    const char* bytes;
+    std::size_t length;
+
+public:
+    ByteView() : bytes(nullptr), length(0) {}
+    ByteView(const char* bytes, std::size_t length) : bytes(bytes), length(length) {}
+
+    const char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const char* begin() const { return bytes; }
+    const char* end() const { return bytes + length; }
+
+    /**
+     * Makes a ByteView of a serialized ByteView, pointing into the buffer
+     * rather than copying out of it.
+     * @param buffer The start of the serialized ByteView
+     */
+    static ByteView view_of(char const* const buffer) {
+        return ByteView(buffer + sizeof(std::size_t), ((std::size_t const*)buffer)[0]);
+    }
+
+    std::size_t to_bytes(char* buffer) const {
+        ((std::size_t*)buffer)[0] = length;
+        memcpy(buffer + sizeof(std::size_t), bytes, length);
+        return bytes_size();
+    }
+
+    void post_object(const std::function<void(char const* const, std::size_t)>& write_func) const {
+        write_func((char const*)&length, sizeof(length));
+        write_func(bytes, length);
+    }
+
+    std::size_t bytes_size() const { return sizeof(std::size_t) + length; }
+
+    void ensure_registered(mutils::DeserializationManager&) {}
+
+    /** Deserializes a ByteView that still points into the given buffer. */
+    static std::unique_ptr<ByteView> from_bytes(mutils::DeserializationManager*, char const* const buffer) {
+        return std::make_unique<ByteView>(view_of(buffer));
+    }
+};
+}
@@ -1,41 +1,47 @@
 #include "connection_manager.h"
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <set>
+#include <sys/epoll.h>
+#include <unistd.h>
 
 namespace tcp {
 bool tcp_connections::add_connection(const node_id_t other_id,
                                      const ip_addr_t& other_ip) {
     if(other_id < my_id) {
+        const uint32_t other_port = port_of(other_id);
+        socket s;
         try {
-            sockets[other_id] = socket(other_ip, port);
+            s = socket(other_ip, other_port, connect_timeout_ms);
+            s.set_read_timeout(read_timeout_ms);
         } catch(exception) {
             std::cerr << "WARNING: failed to node " << other_id << " at "
-                      << other_ip << ":" << port << std::endl;
+                      << other_ip << ":" << other_port << std::endl;
             return false;
         }
 
         uint32_t remote_id = 0;
-        if(!sockets[other_id].exchange(my_id, remote_id)) {
+        if(!s.exchange(my_id, remote_id)) {
             std::cerr << "WARNING: failed to exchange rank with node "
-                      << other_id << " at " << other_ip << ":" << port
+                      << other_id << " at " << other_ip << ":" << other_port
                       << std::endl;
-            sockets.erase(other_id);
             return false;
         } else if(remote_id != other_id) {
-            std::cerr << "WARNING: node at " << other_ip << ":" << port
+            std::cerr << "WARNING: node at " << other_ip << ":" << other_port
                       << " replied with wrong id (expected " << other_id
                       << " but got " << remote_id << ")" << std::endl;
-
-            sockets.erase(other_id);
             return false;
         }
+        sockets[other_id] = std::make_shared<socket_entry>(std::move(s), other_id, epoll_fd);
+        watch_socket(other_id);
         return true;
     } else if(other_id > my_id) {
         while(true) {
             try {
-                socket s = conn_listener->accept();
+                socket s = conn_listener->accept(connect_timeout_ms);
+                s.set_read_timeout(read_timeout_ms);
 
                 uint32_t remote_id = 0;
                 if(!s.exchange(my_id, remote_id)) {
@@ -43,7 +49,8 @@ bool tcp_connections::add_connection(const node_id_t other_id,
                               << std::endl;
                     return false;
                 } else {
-                    sockets[remote_id] = std::move(s);
+                    sockets[remote_id] = std::make_shared<socket_entry>(std::move(s), remote_id, epoll_fd);
+                    watch_socket(remote_id);
                     //If the connection we got wasn't the intended node, keep
                     //looping and try again; there must be multiple nodes connecting
                     //simultaneously
@@ -61,7 +68,31 @@ bool tcp_connections::add_connection(const node_id_t other_id,
     return false;
 }
 
+void socket_entry::set_watched(bool watched) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    //Without EPOLLIN, EPOLLONESHOT still keeps a hangup from being reported more than once
+    event.events = watched ? (EPOLLIN | EPOLLONESHOT) : EPOLLONESHOT;
+    event.data.u32 = node_id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock.get_fd(), &event);
+}
+
+void tcp_connections::watch_socket(node_id_t node_id) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u32 = node_id;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockets.at(node_id)->sock.get_fd(), &event) < 0) {
+        std::cerr << "WARNING: failed to watch the socket of node " << node_id
+                  << ": " << strerror(errno) << std::endl;
+    }
+}
+
 void tcp_connections::establish_node_connections(const std::map<node_id_t, ip_addr_t>& ip_addrs) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0) {
+        throw connection_failure();
+    }
     conn_listener = std::make_unique<connection_listener>(port);
 
     for(auto it = ip_addrs.begin(); it != ip_addrs.end(); it++) {
@@ -79,42 +110,75 @@ void tcp_connections::establish_node_connections(const std::map<node_id_t, ip_ad
 tcp_connections::tcp_connections(node_id_t _my_id,
                                  const std::map<node_id_t, ip_addr_t>& ip_addrs,
                                  uint32_t _port)
-        : my_id(_my_id), port(_port) {
+        : my_id(_my_id), port(_port), connect_timeout_ms(0), read_timeout_ms(0) {
+    establish_node_connections(ip_addrs);
+}
+
+tcp_connections::tcp_connections(node_id_t _my_id,
+                                 const std::map<node_id_t, ip_addr_t>& ip_addrs,
+                                 const std::map<node_id_t, uint32_t>& _node_ports,
+                                 int connect_timeout_ms, int read_timeout_ms)
+        : my_id(_my_id),
+          port(_node_ports.at(_my_id)),
+          node_ports(_node_ports),
+          connect_timeout_ms(connect_timeout_ms),
+          read_timeout_ms(read_timeout_ms) {
     establish_node_connections(ip_addrs);
 }
 
+uint32_t tcp_connections::port_of(node_id_t node_id) const {
+    auto port_entry = node_ports.find(node_id);
+    return port_entry == node_ports.end() ? port : port_entry->second;
+}
+
 void tcp_connections::destroy() {
     std::lock_guard<std::mutex> lock(sockets_mutex);
     sockets.clear();
     conn_listener.reset();
+    if(epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
 }
 
-bool tcp_connections::write(node_id_t node_id, char const* buffer,
-                            size_t size) {
+std::shared_ptr<socket_entry> tcp_connections::find_socket(node_id_t node_id) {
     std::lock_guard<std::mutex> lock(sockets_mutex);
     const auto it = sockets.find(node_id);
-    assert(it != sockets.end());
-    return it->second.write(buffer, size);
+    return it == sockets.end() ? nullptr : it->second;
+}
+
+bool tcp_connections::write(node_id_t node_id, char const* buffer,
+                            size_t size) {
+    std::shared_ptr<socket_entry> entry = find_socket(node_id);
+    assert(entry);
+    std::lock_guard<std::mutex> socket_lock(entry->write_mutex);
+    return entry->sock.write(buffer, size);
 }
 
 bool tcp_connections::write_all(char const* buffer, size_t size) {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
-    bool success = true;
-    for(auto& p : sockets) {
-        if(p.first == my_id) {
-            continue;
+    std::vector<std::shared_ptr<socket_entry>> entries;
+    {
+        std::lock_guard<std::mutex> lock(sockets_mutex);
+        for(const auto& p : sockets) {
+            if(p.first != my_id) {
+                entries.push_back(p.second);
+            }
         }
-        success = success && p.second.write(buffer, size);
+    }
+    bool success = true;
+    for(const auto& entry : entries) {
+        std::lock_guard<std::mutex> socket_lock(entry->write_mutex);
+        success = success && entry->sock.write(buffer, size);
     }
     return success;
 }
 
 bool tcp_connections::read(node_id_t node_id, char* buffer,
                            size_t size) {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
-    const auto it = sockets.find(node_id);
-    assert(it != sockets.end());
-    return it->second.read(buffer, size);
+    std::shared_ptr<socket_entry> entry = find_socket(node_id);
+    assert(entry);
+    std::lock_guard<std::mutex> socket_lock(entry->read_mutex);
+    return entry->sock.read(buffer, size);
 }
 
 bool tcp_connections::add_node(node_id_t new_id, const ip_addr_t new_ip_addr) {
@@ -126,23 +190,80 @@ bool tcp_connections::add_node(node_id_t new_id, const ip_addr_t new_ip_addr) {
     return add_connection(new_id, new_ip_addr);
 }
 
-bool tcp_connections::delete_node(node_id_t remove_id) {
+bool tcp_connections::has_connection(node_id_t node_id) {
     std::lock_guard<std::mutex> lock(sockets_mutex);
-    return (sockets.erase(remove_id) > 0);
+    return sockets.count(node_id) > 0;
 }
 
-int32_t tcp_connections::probe_all() {
-    std::lock_guard<std::mutex> lock(sockets_mutex);
-    for(auto& p : sockets) {
-        bool new_data_available = p.second.probe();
-        if(new_data_available == true) {
-            return p.first;
+bool tcp_connections::delete_node(node_id_t remove_id) {
+    std::shared_ptr<socket_entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(sockets_mutex);
+        const auto it = sockets.find(remove_id);
+        if(it == sockets.end()) {
+            return false;
+        }
+        entry = std::move(it->second);
+        sockets.erase(it);
+    }
+    //Wait for any transfer in progress on this socket to finish; the socket
+    //closes once the last thread using it lets go of it
+    { exclusive_socket_lock socket_lock(*entry); }
+    return true;
+}
+
+void tcp_connections::wait_readable(std::vector<node_id_t>& ready, int timeout_ms) {
+    ready.clear();
+    epoll_event events[64];
+    int num_events = epoll_wait(epoll_fd, events, 64, timeout_ms);
+    for(int i = 0; i < num_events; ++i) {
+        ready.push_back(events[i].data.u32);
+    }
+}
+
+void tcp_connections::rearm(node_id_t node_id) {
+    std::shared_ptr<socket_entry> entry = find_socket(node_id);
+    if(!entry) {
+        return;
+    }
+    std::unique_lock<std::mutex> socket_lock(entry->read_mutex, std::try_to_lock);
+    if(socket_lock.owns_lock()) {
+        entry->set_watched(true);
+    }
+}
+
+bool tcp_connections::read_available(node_id_t node_id, std::vector<char>& buffer, bool& busy) {
+    std::shared_ptr<socket_entry> entry = find_socket(node_id);
+    if(!entry) {
+        busy = false;
+        return false;
+    }
+    std::unique_lock<std::mutex> socket_lock(entry->read_mutex, std::try_to_lock);
+    busy = !socket_lock.owns_lock();
+    if(busy) {
+        return true;
+    }
+    const std::size_t read_size = 64 * 1024;
+    while(true) {
+        const std::size_t old_size = buffer.size();
+        buffer.resize(old_size + read_size);
+        ssize_t bytes_read = entry->sock.read_available(buffer.data() + old_size, read_size);
+        buffer.resize(old_size + std::max<ssize_t>(bytes_read, 0));
+        if(bytes_read < 0) {
+            return false;
+        } else if((std::size_t)bytes_read < read_size) {
+            return true;
         }
     }
-    return -1;
 }
 
-derecho::LockedReference<std::unique_lock<std::mutex>, socket> tcp_connections::get_socket(node_id_t node_id) {
-    return derecho::LockedReference<std::unique_lock<std::mutex>, socket>(sockets.at(node_id), sockets_mutex);
+exclusive_socket_reference tcp_connections::get_socket(node_id_t node_id) {
+    std::shared_ptr<socket_entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(sockets_mutex);
+        entry = sockets.at(node_id);
+    }
+    //The socket's locks are taken after releasing sockets_mutex, and keep the entry alive
+    return exclusive_socket_reference(entry->sock, *entry);
 }
 }
@@ -2,7 +2,9 @@
 
 #include <cassert>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include "locked_reference.h"
 #include "tcp/tcp.h"
@@ -10,35 +12,182 @@
 namespace tcp {
 using ip_addr_t = std::string;
 using node_id_t = uint32_t;
+
+/**
+ * A connected socket and its locks. Reads and writes on a TCP socket don't
+ * interfere with each other, so a reader draining the socket doesn't hold up
+ * a thread writing to it, and vice versa. Entries are shared, so a thread
+ * using a socket keeps it open even if its node is deleted meanwhile.
+ */
+struct socket_entry : public std::enable_shared_from_this<socket_entry> {
+    socket sock;
+    /** The node the socket is connected to */
+    const node_id_t node_id;
+    /** The epoll instance the socket is registered with, under node_id */
+    const int epoll_fd;
+    /** Held while reading from the socket */
+    std::mutex read_mutex;
+    /** Held while writing to the socket */
+    std::mutex write_mutex;
+
+    socket_entry(socket sock, node_id_t node_id, int epoll_fd)
+            : sock(std::move(sock)), node_id(node_id), epoll_fd(epoll_fd) {}
+    /**
+     * Lets the epoll instance report the socket once more when it has data,
+     * or stops it from reporting the socket at all. Only the holder of
+     * read_mutex, or a get_socket() holder that has just released it, may
+     * change this, so a socket can't be rearmed while a transfer is using it.
+     */
+    void set_watched(bool watched);
+};
+
+/**
+ * A lock on both of a socket's mutexes, for callers of get_socket() that use
+ * the socket for a whole exchange (e.g. a state transfer) and must keep every
+ * other reader and writer off it. It keeps the socket alive while it is held.
+ */
+class exclusive_socket_lock {
+    std::shared_ptr<socket_entry> entry;
+    std::unique_lock<std::mutex> read_lock;
+    std::unique_lock<std::mutex> write_lock;
+
+public:
+    using mutex_type = socket_entry;
+    exclusive_socket_lock(socket_entry& entry)
+            : entry(entry.shared_from_this()),
+              read_lock(entry.read_mutex, std::defer_lock),
+              write_lock(entry.write_mutex, std::defer_lock) {
+        std::lock(read_lock, write_lock);
+    }
+    /** Releases both mutexes before the lock goes out of scope. */
+    void unlock() {
+        write_lock.unlock();
+        read_lock.unlock();
+    }
+};
+
+/**
+ * An exclusive_socket_lock that also keeps wait_readable() from reporting the
+ * socket while it is held, so the P2P receive thread never reads bytes that
+ * are meant for the holder. The socket is watched again once it is released.
+ */
+class unwatched_socket_lock {
+    std::shared_ptr<socket_entry> entry;
+    exclusive_socket_lock lock;
+
+public:
+    using mutex_type = socket_entry;
+    unwatched_socket_lock(socket_entry& entry)
+            : entry(entry.shared_from_this()), lock(entry) {
+        entry.set_watched(false);
+    }
+    unwatched_socket_lock(unwatched_socket_lock&&) = default;
+    ~unwatched_socket_lock() {
+        if(entry) {
+            lock.unlock();
+            entry->set_watched(true);
+        }
+    }
+};
+
+using exclusive_socket_reference = derecho::LockedReference<unwatched_socket_lock, socket>;
+
 class tcp_connections {
+    /** Guards the sockets map. It is held only while looking up a socket,
+     * never while waiting for a socket's own locks, so a long transfer on
+     * one socket can't hold up operations on the others. */
     std::mutex sockets_mutex;
+    /** An epoll instance watching every socket for incoming data, for
+     * wait_readable(). Each socket is registered one-shot, so it is only
+     * reported once until it is rearmed. */
+    int epoll_fd;
 
     node_id_t my_id;
+    /** The port this node listens on, which is also the port assumed for
+     * other nodes unless node_ports says otherwise. */
     const uint32_t port;
+    /** Ports of nodes that listen on a port other than the default, which
+     * allows several nodes to run on the same host. */
+    std::map<node_id_t, uint32_t> node_ports;
+    /** How long to try to connect to (or wait for a connection from) a
+     * node before giving up on it; 0 waits forever. */
+    const int connect_timeout_ms;
+    /** How long a read from a connected node may wait for data; 0 waits forever. */
+    const int read_timeout_ms;
     std::unique_ptr<connection_listener> conn_listener;
-    std::map<node_id_t, socket> sockets;
+    std::map<node_id_t, std::shared_ptr<socket_entry>> sockets;
+    /** @return The entry of a node's socket, or null if there is none */
+    std::shared_ptr<socket_entry> find_socket(node_id_t node_id);
     bool add_connection(const node_id_t other_id,
                         const ip_addr_t& other_ip);
+    /** Registers a newly connected socket with the epoll instance. The
+     * caller must hold sockets_mutex. */
+    void watch_socket(node_id_t node_id);
     void establish_node_connections(const std::map<node_id_t, ip_addr_t>& ip_addrs);
+    uint32_t port_of(node_id_t node_id) const;
 
 public:
     tcp_connections(node_id_t _my_id,
                     const std::map<node_id_t, ip_addr_t>& ip_addrs,
                     uint32_t _port);
+    /**
+     * Constructs connections to nodes that may each listen on a different port.
+     * @param _my_id The ID of this node
+     * @param ip_addrs The IP address of each node to connect to
+     * @param _node_ports The port of each node, including this one; nodes
+     * missing from this map use the port of this node.
+     * @param connect_timeout_ms If nonzero, how long to spend trying to reach
+     * each node before leaving it unconnected; see has_connection()
+     * @param read_timeout_ms If nonzero, how long read() may wait for data
+     * before failing
+     */
+    tcp_connections(node_id_t _my_id,
+                    const std::map<node_id_t, ip_addr_t>& ip_addrs,
+                    const std::map<node_id_t, uint32_t>& _node_ports,
+                    int connect_timeout_ms = 0, int read_timeout_ms = 0);
     void destroy();
     bool write(node_id_t node_id, char const* buffer, size_t size);
     bool write_all(char const* buffer, size_t size);
     bool read(node_id_t node_id, char* buffer, size_t size);
     bool add_node(node_id_t new_id, const ip_addr_t new_ip_addr);
+    /** @return True if there is a connection to the given node. */
+    bool has_connection(node_id_t node_id);
     bool delete_node(node_id_t remove_id);
     template <class T>
     bool exchange(node_id_t node_id, T local, T& remote) {
-        std::lock_guard<std::mutex> lock(sockets_mutex);
-        const auto it = sockets.find(node_id);
-        assert(it != sockets.end());
-        return it->second.exchange(local, remote);
+        std::shared_ptr<socket_entry> entry = find_socket(node_id);
+        assert(entry);
+        exclusive_socket_lock socket_lock(*entry);
+        return entry->sock.exchange(local, remote);
     }
-    int32_t probe_all();
-    derecho::LockedReference<std::unique_lock<std::mutex>, socket> get_socket(node_id_t node_id);
+    /**
+     * Waits for data to arrive on any of the sockets.
+     * @param ready Set to the IDs of the nodes whose sockets have data to
+     * read (or have been closed). A socket reported here is not reported
+     * again until rearm() is called for it.
+     * @param timeout_ms The longest time to wait, in milliseconds
+     */
+    void wait_readable(std::vector<node_id_t>& ready, int timeout_ms);
+    /** Lets wait_readable() report a node's socket again once it has data.
+     * Does nothing while a holder of get_socket() is using the socket, since
+     * it rearms the socket itself when it is done. */
+    void rearm(node_id_t node_id);
+    /**
+     * Appends whatever data has already arrived on a node's socket to a
+     * buffer, without blocking and without taking the socket's write lock.
+     * @param busy Set to true if the socket could not be read because a
+     * holder of get_socket() is using it, in which case nothing is read and
+     * the socket will be rearmed when the holder releases it
+     * @return False if the node has no socket, or its connection has been
+     * closed or failed
+     */
+    bool read_available(node_id_t node_id, std::vector<char>& buffer, bool& busy);
+    /**
+     * Gets exclusive access to the socket connected to a node. Only that
+     * socket is locked, so the caller can hold it for a long transfer without
+     * blocking communication with other nodes. wait_readable() doesn't report
+     * the socket until the reference is released.
+     */
+    exclusive_socket_reference get_socket(node_id_t node_id);
 };
 }
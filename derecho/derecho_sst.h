@@ -96,8 +96,9 @@ public:
     /** Array indicating whether each shard leader (indexed by subgroup number)
      * has published a global_min for the current view change*/
     SSTFieldVector<bool> global_min_ready;
-    /** for SST multicast */
-    SSTFieldVector<sst::Message> slots;
+    /** for SST multicast: the message slots of every subgroup, laid out as
+     * described by MulticastGroup's SSTSlotLayouts */
+    SSTFieldVector<char> slots;
     SSTFieldVector<long long int> num_received_sst;
 
     /** to check for failures - used by the thread running check_failures_loop in derecho_group **/
@@ -107,8 +108,10 @@ public:
      * (0, false, etc.). Initializing the MulticastGroup fields is left to MulticastGroup.
      * @param parameters The SST parameters, which will be forwarded to the
      * standard SST constructor.
+     * @param slots_size The total size, in bytes, of the SST multicast slots
+     * of all the subgroups.
      */
-    DerechoSST(const sst::SSTParams& parameters, const uint32_t num_subgroups, const uint32_t num_received_size, uint32_t window_size)
+    DerechoSST(const sst::SSTParams& parameters, const uint32_t num_subgroups, const uint32_t num_received_size, std::size_t slots_size)
             : sst::SST<DerechoSST>(this, parameters),
               seq_num(num_subgroups),
               stable_num(num_subgroups),
@@ -120,7 +123,7 @@ public:
               num_received(num_received_size),
               global_min(num_received_size),
               global_min_ready(num_subgroups),
-              slots(window_size * num_subgroups),
+              slots(slots_size),
               num_received_sst(num_received_size) {
         SSTInit(seq_num, stable_num, delivered_num,
                 persisted_num, vid, suspected, changes, joiner_ips,
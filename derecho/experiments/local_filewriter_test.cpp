@@ -1,6 +1,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "derecho/filewriter.h"
 #include "derecho/multicast_group.h"
@@ -10,8 +11,10 @@ using std::endl;
 using namespace derecho;
 
 int main(int argc, char* argv[]) {
-    auto file_written_callback = [](persistence::message m) {
-        cout << "Message " << m.index << " written to file!" << endl;
+    auto file_written_callback = [](const std::vector<persistence::message>& batch) {
+        for(const auto& m : batch) {
+            cout << "Message " << m.index << " written to file!" << endl;
+        }
     };
 
     std::string filename = "data0.dat";
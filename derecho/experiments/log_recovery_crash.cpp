@@ -2,8 +2,8 @@
  * @file log_recovery_crash.cpp
  * A test that runs a Derecho group in persistence mode for a while, then has
  * one member exit prematurely while the others keep sending. The "crashed"
- * member should then run log_recovery_restart after running the recovery
- * helper script.
+ * member should then run log_recovery_restart, which recovers the messages it
+ * missed from the other members' logs.
  */
 
 #include <chrono>
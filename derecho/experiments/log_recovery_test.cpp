@@ -0,0 +1,368 @@
+/**
+ * @file log_recovery_test.cpp
+ * A test of the log recovery protocol that runs several recovering "nodes" as
+ * processes on localhost. Each node starts with its own copy of the same log,
+ * truncated to a different length in each subgroup, and after recovery every
+ * node's log should contain all of the messages of every subgroup, in view
+ * order, and be readable through its index and manifest.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "derecho/derecho_exception.h"
+#include "derecho/filewriter.h"
+#include "derecho/log_manifest.h"
+#include "derecho/log_reader.h"
+#include "derecho/log_recovery.h"
+#include "derecho/persistence.h"
+#include "derecho/view.h"
+
+using std::cout;
+using std::endl;
+using namespace derecho;
+
+const uint64_t message_size = 10000;
+
+/** Identifies a message of the shared log. */
+struct message_id {
+    uint32_t subgroup_num;
+    uint32_t sender;
+    uint64_t index;
+    uint32_t batch_position;
+};
+
+/**
+ * A configuration of the test. The shared log of each subgroup is num_rounds
+ * rounds of messages, one batch of batch_size messages from each of the
+ * subgroup's senders in rank order, and each node starts with a prefix of
+ * each subgroup's log.
+ */
+struct scenario {
+    std::string name;
+    uint32_t base_port;
+    /** The number of members in the saved View; only the first num_nodes of them run. */
+    uint32_t num_view_members;
+    uint32_t num_nodes;
+    uint64_t num_rounds;
+    /** The node IDs of each subgroup's senders, in rank order. */
+    std::vector<std::vector<uint32_t>> subgroup_senders;
+    /** The number of messages of each subgroup in each node's log, by node ID. */
+    std::vector<std::vector<uint64_t>> prefix_lengths;
+    /** The number of messages in each batch, which share an index. */
+    uint32_t batch_size = 1;
+    /** The number of rounds delivered in each view, or 0 to deliver them all in view 1. */
+    uint64_t rounds_per_view = 0;
+    /** The segment size of the logs, or 0 if they are not segmented. */
+    uint64_t segment_size = 0;
+};
+
+std::string log_filename(uint32_t node_id) {
+    return "log_recovery_test_" + std::to_string(node_id) + ".log";
+}
+
+void remove_log_files(uint32_t node_id) {
+    for(const std::string& segment : persistence::log_segment_filenames(log_filename(node_id))) {
+        for(const std::string& extension : {std::string(), persistence::METADATA_EXTENSION,
+                                            persistence::INDEX_EXTENSION}) {
+            std::remove((segment + extension).c_str());
+        }
+    }
+    for(const std::string& extension : {std::string(), persistence::METADATA_EXTENSION,
+                                        persistence::INDEX_EXTENSION, persistence::PAXOS_STATE_EXTENSION,
+                                        persistence::MANIFEST_EXTENSION,
+                                        persistence::MANIFEST_EXTENSION + persistence::SWAP_FILE_EXTENSION}) {
+        std::remove((log_filename(node_id) + extension).c_str());
+    }
+}
+
+/** @return The view in which the messages of a round are delivered. */
+uint32_t message_view(const scenario& test, uint64_t index) {
+    return test.rounds_per_view > 0 ? 1 + index / test.rounds_per_view : 1;
+}
+
+/** @return The messages of a subgroup's shared log, in delivery order. */
+std::vector<message_id> subgroup_log(const scenario& test, uint32_t subgroup_num) {
+    std::vector<message_id> messages;
+    for(uint64_t index = 0; index < test.num_rounds; ++index) {
+        for(uint32_t sender : test.subgroup_senders[subgroup_num]) {
+            for(uint32_t batch_position = 0; batch_position < test.batch_size; ++batch_position) {
+                messages.push_back(message_id{subgroup_num, sender, index, batch_position});
+            }
+        }
+    }
+    return messages;
+}
+
+/** The contents of every message are determined by its ID, so every node can check them. */
+void fill_message(char* buffer, const message_id& id) {
+    const uint64_t seed = id.index * 31 + id.sender * 17 + id.subgroup_num * 7 + id.batch_position * 3;
+    for(uint64_t i = 0; i < message_size; ++i) {
+        buffer[i] = (char)((seed + i) % 251);
+    }
+}
+
+/**
+ * Writes this node's prefix of each subgroup's log to its log file. Nodes
+ * interleave the subgroups differently within each view, as they would if
+ * the subgroups' messages were delivered by different threads.
+ */
+void write_log(const scenario& test, uint32_t node_id) {
+    std::vector<std::vector<message_id>> subgroup_logs;
+    uint64_t num_messages = 0;
+    for(uint32_t subgroup_num = 0; subgroup_num < test.subgroup_senders.size(); ++subgroup_num) {
+        subgroup_logs.push_back(subgroup_log(test, subgroup_num));
+        subgroup_logs.back().resize(test.prefix_lengths[node_id][subgroup_num]);
+        num_messages += subgroup_logs.back().size();
+    }
+    std::atomic<uint64_t> messages_written(0);
+    auto file_written_callback = [&messages_written](const std::vector<persistence::message>& batch) {
+        messages_written += batch.size();
+    };
+    std::vector<std::unique_ptr<char[]>> buffers;
+    {
+        FileWriter file_writer(file_written_callback, log_filename(node_id), 64,
+                               std::chrono::microseconds(0), false, test.segment_size);
+        std::vector<std::size_t> next_message(subgroup_logs.size(), 0);
+        //True if the subgroup has a message left to write in the current view
+        uint32_t current_view = 1;
+        auto has_message_in_view = [&](uint32_t subgroup_num) {
+            return next_message[subgroup_num] < subgroup_logs[subgroup_num].size()
+                   && message_view(test, subgroup_logs[subgroup_num][next_message[subgroup_num]].index) == current_view;
+        };
+        for(uint32_t turn = node_id; buffers.size() < num_messages; ++turn) {
+            const uint32_t subgroup_num = turn % subgroup_logs.size();
+            //Take a run of node_id + 1 messages from the subgroup whose turn it is
+            for(uint32_t i = 0; i <= node_id && has_message_in_view(subgroup_num); ++i) {
+                const message_id& id = subgroup_logs[subgroup_num][next_message[subgroup_num]++];
+                buffers.emplace_back(new char[message_size]);
+                fill_message(buffers.back().get(), id);
+                persistence::message message{buffers.back().get(), message_size, current_view,
+                                             id.sender, id.index, false, id.subgroup_num};
+                message.batch_position = id.batch_position;
+                file_writer.write_message(message);
+            }
+            bool view_finished = true;
+            for(uint32_t subgroup = 0; subgroup < subgroup_logs.size(); ++subgroup) {
+                view_finished = view_finished && !has_message_in_view(subgroup);
+            }
+            if(view_finished) {
+                ++current_view;
+            }
+        }
+        while(messages_written < num_messages) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+/**
+ * @return True if this node's log contains exactly the messages of every
+ * subgroup's shared log, in order, with view IDs that never decrease, and
+ * if every message can be found through the log's index and every closed
+ * segment's manifest entry is accurate.
+ */
+bool check_log(const scenario& test, uint32_t node_id) {
+    std::vector<std::vector<message_id>> subgroup_logs;
+    uint64_t num_messages = 0;
+    for(uint32_t subgroup_num = 0; subgroup_num < test.subgroup_senders.size(); ++subgroup_num) {
+        subgroup_logs.push_back(subgroup_log(test, subgroup_num));
+        num_messages += subgroup_logs.back().size();
+    }
+    if(persistence::LogManifest::exists(log_filename(node_id)) != (test.segment_size > 0)) {
+        std::cerr << "Node " << node_id << "'s log is not segmented as expected" << endl;
+        return false;
+    }
+    const std::vector<std::string> segments = persistence::log_segment_filenames(log_filename(node_id));
+    persistence::LogManifest manifest(log_filename(node_id));
+    std::unique_ptr<char[]> expected(new char[message_size]);
+    std::unique_ptr<char[]> actual(new char[message_size]);
+    std::vector<std::size_t> next_message(subgroup_logs.size(), 0);
+    uint64_t num_logged = 0;
+    uint32_t last_view = 0;
+    bool correct = true;
+    for(std::size_t segment = 0; correct && segment < segments.size(); ++segment) {
+        persistence::LogReader log(segments[segment]);
+        FILE* data_file = fopen(segments[segment].c_str(), "rb");
+        std::map<uint32_t, persistence::log_position_t> last_messages;
+        for(auto record = log.begin(); record != log.end(); ++record) {
+            if(record->subgroup_num >= subgroup_logs.size()
+               || next_message[record->subgroup_num] >= subgroup_logs[record->subgroup_num].size()) {
+                std::cerr << "Node " << node_id << " has an unexpected message in subgroup " << record->subgroup_num << endl;
+                correct = false;
+                break;
+            }
+            const std::size_t position = next_message[record->subgroup_num]++;
+            const message_id& id = subgroup_logs[record->subgroup_num][position];
+            fill_message(expected.get(), id);
+            fseek(data_file, record->offset, SEEK_SET);
+            if(record->index != id.index || record->sender != id.sender
+               || record->batch_position != id.batch_position || record->length != message_size
+               || record->view_id != message_view(test, id.index)
+               || fread(actual.get(), 1, message_size, data_file) != message_size
+               || memcmp(expected.get(), actual.get(), message_size) != 0) {
+                std::cerr << "Node " << node_id << " has the wrong message at position " << position
+                          << " of subgroup " << record->subgroup_num << endl;
+                correct = false;
+                break;
+            }
+            if(record->view_id < last_view) {
+                std::cerr << "Node " << node_id << " logged a message from view " << record->view_id
+                          << " after one from view " << last_view << endl;
+                correct = false;
+                break;
+            }
+            //find returns the first message of a batch
+            if(record->batch_position == 0
+               && log.find(record->subgroup_num, record->view_id, record->sender, record->index) != record) {
+                std::cerr << "Node " << node_id << " can't find message " << position
+                          << " of subgroup " << record->subgroup_num << " in its log" << endl;
+                correct = false;
+                break;
+            }
+            last_view = record->view_id;
+            last_messages[record->subgroup_num] = persistence::log_position_t(record->view_id, record->index);
+        }
+        fclose(data_file);
+        num_logged += log.size();
+        //The entry of the segment still being written is only brought up to date when it is closed
+        if(correct && test.segment_size > 0 && segment + 1 < segments.size()
+           && manifest.segments[segment].last_messages != last_messages) {
+            std::cerr << "Node " << node_id << "'s manifest entry for segment " << segment << " is wrong" << endl;
+            correct = false;
+        }
+    }
+    if(correct && num_logged != num_messages) {
+        std::cerr << "Node " << node_id << " has " << num_logged << " messages, expected " << num_messages << endl;
+        correct = false;
+    }
+    return correct;
+}
+
+int run_node(const scenario& test, uint32_t node_id) {
+    std::vector<node_id_t> members;
+    std::map<node_id_t, uint32_t> member_ports;
+    for(uint32_t member = 0; member < test.num_view_members; ++member) {
+        members.push_back(member);
+        member_ports[member] = test.base_port + member;
+    }
+    View saved_view(message_view(test, test.num_rounds - 1), members, std::vector<ip_addr>(test.num_view_members, "127.0.0.1"),
+                    std::vector<char>(test.num_view_members, 0), 0, {}, {}, test.num_view_members, node_id);
+    persist_object(saved_view, log_filename(node_id) + persistence::PAXOS_STATE_EXTENSION);
+
+    write_log(test, node_id);
+
+    persistence::LogRecovery log_recovery(node_id, log_filename(node_id), member_ports[node_id],
+                                          test.segment_size, member_ports);
+    try {
+        std::unique_ptr<View> recovered_view = log_recovery.recover();
+        if(recovered_view->vid != saved_view.vid) {
+            std::cerr << "Node " << node_id << " recovered the wrong View" << endl;
+            return 1;
+        }
+    } catch(derecho_exception& ex) {
+        std::cerr << "Node " << node_id << " failed to recover: " << ex.what() << endl;
+        return 1;
+    }
+    return check_log(test, node_id) ? 0 : 1;
+}
+
+bool run_scenario(const scenario& test) {
+    std::vector<pid_t> children;
+    for(uint32_t node_id = 0; node_id < test.num_nodes; ++node_id) {
+        remove_log_files(node_id);
+        pid_t pid = fork();
+        if(pid == 0) {
+            _exit(run_node(test, node_id));
+        }
+        children.push_back(pid);
+    }
+    bool passed = true;
+    for(pid_t child : children) {
+        int status;
+        waitpid(child, &status, 0);
+        passed = passed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    for(uint32_t node_id = 0; node_id < test.num_nodes; ++node_id) {
+        remove_log_files(node_id);
+    }
+    cout << test.name << (passed ? " passed" : " FAILED") << endl;
+    return passed;
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_nodes = argc > 1 ? std::stoi(argv[1]) : 4;
+    uint64_t longest_log_length = argc > 2 ? std::stoull(argv[2]) : 3000;
+    if(num_nodes < 2) {
+        std::cerr << "Usage: " << argv[0] << " [num_nodes >= 2] [num_messages]" << endl;
+        return 1;
+    }
+    std::vector<scenario> scenarios;
+
+    //One subgroup with one sender: node 0 has an empty log, and each subsequent node's log is longer
+    scenario single_subgroup{"Single subgroup", 23500, num_nodes, num_nodes, longest_log_length, {{0}}, {}};
+    for(uint32_t node_id = 0; node_id < num_nodes; ++node_id) {
+        single_subgroup.prefix_lengths.push_back({node_id * longest_log_length / (num_nodes - 1)});
+    }
+    scenarios.push_back(single_subgroup);
+
+    //Two subgroups whose senders' ranks are not in the order of their IDs. In subgroup 0,
+    //nodes 1 and 2 both end in the last round, and node 2 is ahead even though its last
+    //message's sender has the lower ID. Subgroup 0 is longest at node 2 and subgroup 1 at node 0.
+    const uint64_t num_rounds = longest_log_length / 4 + 2;
+    scenarios.push_back(scenario{"Two subgroups", 23600, 4, 4, num_rounds, {{3, 1}, {2, 0}},
+                                 {{0, 2 * num_rounds},
+                                  {2 * num_rounds - 1, num_rounds + 1},
+                                  {2 * num_rounds, 3},
+                                  {num_rounds, 2 * num_rounds - 1}}});
+
+    //A View of 5 members in which only a majority restarts
+    scenario majority{"Majority of the View", 23700, 5, 3, longest_log_length, {{0}}, {}};
+    for(uint32_t node_id = 0; node_id < majority.num_nodes; ++node_id) {
+        majority.prefix_lengths.push_back({(node_id + 1) * longest_log_length / majority.num_nodes});
+    }
+    scenarios.push_back(majority);
+
+    //The same subgroups, sending batches of 3 messages that share an index. Most logs end
+    //partway through a batch; in subgroup 0, nodes 1 and 2 end in the same batch, and node 2
+    //is ahead by its position in it. Subgroup 0 is longest at node 2 and subgroup 1 at node 0.
+    const uint64_t batch_rounds = longest_log_length / 12 + 2;
+    scenarios.push_back(scenario{"Batched messages", 23800, 4, 4, batch_rounds, {{3, 1}, {2, 0}},
+                                 {{1, 6 * batch_rounds},
+                                  {6 * batch_rounds - 2, 3 * batch_rounds + 4},
+                                  {6 * batch_rounds, 8},
+                                  {3 * batch_rounds + 2, 6 * batch_rounds - 4}},
+                                 3});
+
+    //Two subgroups whose messages span several views, in segmented logs. Subgroup 0 is longest
+    //at node 0 and subgroup 1 at node 1. Nodes 0 to 2 are each missing messages from a view
+    //before the last one in their logs, so the tails they receive have to be merged into their
+    //logs rather than appended; node 2 and node 3, whose log is empty, get the tails of the
+    //two subgroups from different members.
+    const uint64_t view_rounds = longest_log_length / 4 + 2;
+    scenarios.push_back(scenario{"Multiple views", 23900, 4, 4, view_rounds, {{3, 1}, {2, 0}},
+                                 {{2 * view_rounds, view_rounds / 2},
+                                  {view_rounds, 2 * view_rounds},
+                                  {view_rounds / 2 + 1, view_rounds + 3},
+                                  {0, 0}},
+                                 1, view_rounds / 4, 64 * message_size});
+
+    bool passed = true;
+    for(const scenario& test : scenarios) {
+        passed = run_scenario(test) && passed;
+    }
+    cout << (passed ? "Log recovery test passed" : "Log recovery test FAILED") << endl;
+    return passed ? 0 : 1;
+}
@@ -1,97 +1,507 @@
 
 #include "filewriter.h"
+#include "derecho_exception.h"
+#include "log_reader.h"
 #include "mutils-serialization/SerializationSupport.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstring>
-#include <fstream>
+#include <fcntl.h>
 #include <functional>
 #include <iostream>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <thread>
+#include <unistd.h>
 #include <utility>
 
 using std::mutex;
 using std::unique_lock;
-using std::ofstream;
 
 namespace derecho {
 
 using namespace persistence;
 
-const uint8_t MAGIC_NUMBER[8] = {'D', 'E', 'R', 'E', 'C', 'H', 'O', 29};
+/**
+ * Writes the entire contents of an iovec array to a file, retrying on short
+ * writes and splitting the array into chunks of at most IOV_MAX entries.
+ * @return True if all the bytes were written, false if a write failed.
+ */
+static bool write_all_vectored(int fd, std::vector<struct iovec>& iovecs) {
+    std::size_t next = 0;
+    while(next < iovecs.size()) {
+        int count = std::min<std::size_t>(iovecs.size() - next, IOV_MAX);
+        ssize_t bytes_written = ::writev(fd, &iovecs[next], count);
+        if(bytes_written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        //Skip over the iovecs that were completely written, and adjust the first partial one
+        while(next < iovecs.size() && bytes_written >= (ssize_t)iovecs[next].iov_len) {
+            bytes_written -= iovecs[next].iov_len;
+            ++next;
+        }
+        if(bytes_written > 0) {
+            iovecs[next].iov_base = (char*)iovecs[next].iov_base + bytes_written;
+            iovecs[next].iov_len -= bytes_written;
+        }
+    }
+    return true;
+}
+
+static uint64_t round_up_to_alignment(uint64_t size) {
+    return (size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+}
 
-FileWriter::FileWriter(const std::function<void(message)>& _message_written_upcall,
-                       const std::string& filename)
-        : message_written_upcall(_message_written_upcall),
+//glibc has no wrappers for the kernel AIO system calls
+static int io_setup(unsigned nr_events, aio_context_t* ctx) {
+    return syscall(__NR_io_setup, nr_events, ctx);
+}
+static int io_destroy(aio_context_t ctx) {
+    return syscall(__NR_io_destroy, ctx);
+}
+static int io_submit(aio_context_t ctx, long nr, struct iocb** iocbpp) {
+    return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+static int io_getevents(aio_context_t ctx, long min_nr, long max_nr, struct io_event* events) {
+    return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, nullptr);
+}
+
+FileWriter::FileWriter(const batch_written_upcall_t& _batch_written_upcall,
+                       const std::string& filename,
+                       uint32_t max_batch_size,
+                       std::chrono::microseconds max_batch_latency,
+                       bool direct_io,
+                       uint64_t segment_size)
+        : batch_written_upcall(_batch_written_upcall),
+          filename(filename),
+          max_batch_size(std::max(max_batch_size, 1u)),
+          max_batch_latency(max_batch_latency),
+          direct_io(direct_io),
+          aio_context(0),
+          segment_size(segment_size),
+          data_fd(-1),
+          metadata_fd(-1),
+          index_fd(-1),
+          current_offset(0),
+          next_record_number(0),
+          manifest(filename),
+          compaction_requested(false),
+          failed(false),
           exit(false),
-          writer_thread(&FileWriter::perform_writes, this, filename),
-          callback_thread(&FileWriter::issue_callbacks, this) {}
+          writer_thread(&FileWriter::perform_writes, this),
+          callback_thread(&FileWriter::issue_callbacks, this) {
+    if(segment_size > 0) {
+        compactor_thread = std::thread(&FileWriter::compact_segments, this);
+    }
+}
 
 FileWriter::~FileWriter() {
     {
-        // must hold both mutexes to change exit, since either thread could be about
+        // must hold all the mutexes to change exit, since any thread could be about
         // to read it before calling wait()
         unique_lock<mutex> writes_lock(pending_writes_mutex);
         unique_lock<mutex> callbacks_lock(pending_callbacks_mutex);
+        unique_lock<mutex> manifest_lock(manifest_mutex);
         exit = true;
     }
     pending_callbacks_cv.notify_all();
     pending_writes_cv.notify_all();
+    compactor_cv.notify_all();
     if(writer_thread.joinable()) writer_thread.join();
     if(callback_thread.joinable()) callback_thread.join();
+    if(compactor_thread.joinable()) compactor_thread.join();
 }
 
-void FileWriter::set_message_written_upcall(
-        const std::function<void(message)>& _message_written_upcall) {
-    message_written_upcall = _message_written_upcall;
+void FileWriter::set_batch_written_upcall(const batch_written_upcall_t& _batch_written_upcall) {
+    batch_written_upcall = _batch_written_upcall;
 }
 
-void FileWriter::perform_writes(std::string filename) {
-    pthread_setname_np(pthread_self(), "writer_thread");
-    ofstream data_file(filename, std::ios::app);
-    ofstream metadata_file(filename + METADATA_EXTENSION, std::ios::app);
+bool FileWriter::write_data_buffered(const std::vector<message>& batch, int data_fd,
+                                     uint64_t& current_offset, std::vector<uint64_t>& data_offsets) {
+    std::vector<struct iovec> data_iovecs;
+    data_iovecs.reserve(batch.size());
+    for(std::size_t i = 0; i < batch.size(); ++i) {
+        data_iovecs.push_back({batch[i].data, batch[i].length});
+        data_offsets[i] = current_offset;
+        current_offset += batch[i].length;
+    }
+    return write_all_vectored(data_fd, data_iovecs);
+}
 
-    unique_lock<mutex> writes_lock(pending_writes_mutex);
+bool FileWriter::write_data_direct(const std::vector<message>& batch, int data_fd,
+                                   uint64_t& current_offset, std::vector<uint64_t>& data_offsets) {
+    std::vector<struct iocb> iocbs(batch.size());
+    std::vector<struct iocb*> iocb_ptrs(batch.size());
+    std::vector<std::unique_ptr<char, decltype(&free)>> bounce_buffers;
+    for(std::size_t i = 0; i < batch.size(); ++i) {
+        const message& m = batch[i];
+        char* source = nullptr;
+        uint64_t prefix_length = 0;
+        uint64_t write_length = 0;
+        if(m.direct_buffer != nullptr && m.data >= m.direct_buffer) {
+            //Write the whole aligned block containing the message, starting at the buffer
+            prefix_length = m.data - m.direct_buffer;
+            write_length = round_up_to_alignment(prefix_length + m.length);
+            if(write_length <= m.direct_buffer_size) {
+                source = m.direct_buffer;
+            }
+        }
+        if(source == nullptr) {
+            prefix_length = 0;
+            write_length = round_up_to_alignment(m.length);
+            void* memory = nullptr;
+            if(posix_memalign(&memory, DIRECT_IO_ALIGNMENT, std::max(write_length, (uint64_t)DIRECT_IO_ALIGNMENT)) != 0) {
+                return false;
+            }
+            bounce_buffers.emplace_back((char*)memory, &free);
+            memcpy(memory, m.data, m.length);
+            memset((char*)memory + m.length, 0, write_length - m.length);
+            source = (char*)memory;
+        }
+        memset(&iocbs[i], 0, sizeof(struct iocb));
+        iocbs[i].aio_data = i;
+        iocbs[i].aio_lio_opcode = IOCB_CMD_PWRITE;
+        iocbs[i].aio_fildes = data_fd;
+        iocbs[i].aio_buf = (uint64_t)source;
+        iocbs[i].aio_nbytes = write_length;
+        iocbs[i].aio_offset = current_offset;
+        iocb_ptrs[i] = &iocbs[i];
 
-    uint64_t current_offset = 0;
+        data_offsets[i] = current_offset + prefix_length;
+        current_offset += write_length;
+    }
 
-    persistence::header h;
-    memcpy(h.magic, MAGIC_NUMBER, sizeof(MAGIC_NUMBER));
-    h.version = 0;
-    metadata_file.write((char*)&h, sizeof(h));
+    std::size_t num_submitted = 0;
+    while(num_submitted < iocb_ptrs.size()) {
+        int submitted = io_submit(aio_context, iocb_ptrs.size() - num_submitted, &iocb_ptrs[num_submitted]);
+        if(submitted < 0) {
+            if(errno == EINTR || errno == EAGAIN) continue;
+            break;
+        }
+        num_submitted += submitted;
+    }
+    //Even if a submission failed, the ones that were submitted must finish before their buffers can be reused
+    bool success = (num_submitted == iocb_ptrs.size());
+    std::vector<struct io_event> events(num_submitted);
+    std::size_t num_completed = 0;
+    while(num_completed < num_submitted) {
+        int completed = io_getevents(aio_context, 1, num_submitted - num_completed, &events[num_completed]);
+        if(completed < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        for(int e = 0; e < completed; ++e) {
+            const struct io_event& event = events[num_completed + e];
+            if(event.res < 0 || (uint64_t)event.res != iocbs[event.data].aio_nbytes) {
+                success = false;
+            }
+        }
+        num_completed += completed;
+    }
+    return success;
+}
 
-    while(!exit) {
-        pending_writes_cv.wait(writes_lock);
+bool FileWriter::commit_batch(const std::vector<message>& batch,
+                              int data_fd, int metadata_fd, uint64_t& current_offset) {
+    std::vector<uint64_t> data_offsets(batch.size());
+    uint64_t end_offset = current_offset;
+    bool data_written = direct_io ? write_data_direct(batch, data_fd, end_offset, data_offsets)
+                                  : write_data_buffered(batch, data_fd, end_offset, data_offsets);
+    //Data must reach the disk before the metadata that points to it
+    if(!data_written || ::fdatasync(data_fd) != 0) {
+        std::cerr << "Error writing messages to log file: " << strerror(errno) << std::endl;
+        //Without metadata the partial data isn't part of the log, but trim it so later batches start where this one did
+        if(ftruncate(data_fd, current_offset) != 0) {
+            std::cerr << "Error truncating log file after a failed write: " << strerror(errno) << std::endl;
+        }
+        return false;
+    }
 
-        while(!pending_writes.empty()) {
-            using namespace std::placeholders;
+    message_metadata dummy_for_size;
+    const std::size_t size_of_metadata = mutils::bytes_size(dummy_for_size);
+    std::unique_ptr<char[]> metadata_buffer(new char[size_of_metadata * batch.size()]);
+    for(std::size_t i = 0; i < batch.size(); ++i) {
+        const message& m = batch[i];
+        message_metadata metadata{};
+        metadata.view_id = m.view_id;
+        metadata.sender = m.sender;
+        metadata.index = m.index;
+        metadata.offset = data_offsets[i];
+        metadata.length = m.length;
+        metadata.is_cooked = m.cooked;
+        metadata.subgroup_num = m.subgroup_num;
+        metadata.batch_position = m.batch_position;
+        mutils::to_bytes(metadata, metadata_buffer.get() + i * size_of_metadata);
+    }
+    struct stat metadata_stat;
+    fstat(metadata_fd, &metadata_stat);
+    std::vector<struct iovec> metadata_iovecs{{metadata_buffer.get(), size_of_metadata * batch.size()}};
+    if(!write_all_vectored(metadata_fd, metadata_iovecs) || ::fdatasync(metadata_fd) != 0) {
+        std::cerr << "Error writing message metadata to log file: " << strerror(errno) << std::endl;
+        //A partial record would make the rest of the metadata file unreadable
+        if(ftruncate(metadata_fd, metadata_stat.st_size) != 0) {
+            std::cerr << "Error truncating log metadata after a failed write: " << strerror(errno) << std::endl;
+        }
+        return false;
+    }
+    current_offset = end_offset;
+    return true;
+}
 
-            message m = pending_writes.front();
-            pending_writes.pop();
+void FileWriter::append_index_entries(const std::vector<message>& batch,
+                                      int index_fd, uint64_t& next_record_number) {
+    std::vector<index_entry> entries;
+    for(const message& m : batch) {
+        auto last_view = last_indexed_view.find(m.subgroup_num);
+        if(last_view == last_indexed_view.end() || last_view->second != m.view_id
+           || records_since_index_entry[m.subgroup_num] >= INDEX_STRIDE) {
+            entries.push_back({m.subgroup_num, m.view_id, m.index, next_record_number});
+            last_indexed_view[m.subgroup_num] = m.view_id;
+            records_since_index_entry[m.subgroup_num] = 0;
+        }
+        records_since_index_entry[m.subgroup_num]++;
+        next_record_number++;
+    }
+    if(!entries.empty()) {
+        std::vector<struct iovec> index_iovecs{{entries.data(), entries.size() * sizeof(index_entry)}};
+        if(!write_all_vectored(index_fd, index_iovecs)) {
+            std::cerr << "Error writing log index: " << strerror(errno) << std::endl;
+        }
+    }
+}
 
-            message_metadata metadata;
-            metadata.view_id = m.view_id;
-            metadata.sender = m.sender;
-            metadata.index = m.index;
-            metadata.offset = current_offset;
-            metadata.length = m.length;
-            metadata.is_cooked = m.cooked;
-            metadata.subgroup_num = m.subgroup_num;
+bool FileWriter::open_log_files(const std::string& base_filename) {
+    if(direct_io) {
+        //O_DIRECT writes go to explicit offsets, so the file isn't opened for appending
+        data_fd = ::open(base_filename.c_str(), O_WRONLY | O_CREAT | O_DIRECT, 0644);
+        if(data_fd < 0 || (aio_context == 0 && io_setup(max_batch_size, &aio_context) != 0)) {
+            std::cerr << "WARNING: Direct I/O is not available for log file " << base_filename
+                      << " (" << strerror(errno) << "), falling back to buffered writes" << std::endl;
+            if(data_fd >= 0) ::close(data_fd);
+            direct_io = false;
+        }
+    }
+    if(!direct_io) {
+        data_fd = ::open(base_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    }
+    metadata_fd = ::open((base_filename + METADATA_EXTENSION).c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    index_fd = ::open((base_filename + INDEX_EXTENSION).c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if(data_fd < 0 || metadata_fd < 0 || index_fd < 0) {
+        std::cerr << "Error opening log file " << base_filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
 
-            data_file.write(m.data, m.length);
-            mutils::post_object(std::bind(&std::ofstream::write, &metadata_file, _1, _2), metadata);
+    //If we're appending to an existing log, new offsets start at the end of its data
+    struct stat file_stat;
+    fstat(data_fd, &file_stat);
+    current_offset = direct_io ? round_up_to_alignment(file_stat.st_size) : file_stat.st_size;
 
-            data_file.flush();
-            metadata_file.flush();
+    //Only a new metadata file needs a header
+    fstat(metadata_fd, &file_stat);
+    next_record_number = 0;
+    if(file_stat.st_size > (off_t)sizeof(persistence::header)) {
+        next_record_number = (file_stat.st_size - sizeof(persistence::header)) / sizeof(message_metadata);
+    }
+    if(file_stat.st_size == 0) {
+        persistence::header h;
+        memcpy(h.magic, MAGIC_NUMBER, sizeof(MAGIC_NUMBER));
+        h.version = 0;
+        if(::write(metadata_fd, &h, sizeof(h)) != sizeof(h)) {
+            std::cerr << "Error writing log file header: " << strerror(errno) << std::endl;
+        }
+    }
+    //Record numbers in the index are relative to each file, so indexing starts over
+    last_indexed_view.clear();
+    records_since_index_entry.clear();
+    return true;
+}
 
-            current_offset += m.length;
+void FileWriter::close_log_files() {
+    ::close(data_fd);
+    ::close(metadata_fd);
+    ::close(index_fd);
+    data_fd = metadata_fd = index_fd = -1;
+}
 
+bool FileWriter::open_active_segment() {
+    std::string segment_filename;
+    {
+        unique_lock<mutex> manifest_lock(manifest_mutex);
+        if(manifest.segments.empty()) {
+            manifest.segments.push_back({0, {}});
+            if(!manifest.save()) {
+                return false;
+            }
+        } else {
+            //The manifest is only saved when a segment is closed, so the contents of the
+            //last segment may be newer than its entry; rebuild the entry from its metadata
+            segment_info& active_segment = manifest.segments.back();
+            std::string active_filename = LogManifest::segment_filename(filename, active_segment.segment_number);
+            try {
+                LogReader segment_reader(active_filename);
+                for(const message_metadata& record : segment_reader) {
+                    active_segment.last_messages[record.subgroup_num] = log_position_t(record.view_id, record.index);
+                }
+            } catch(derecho_exception& ex) {
+                //The segment's files were never created, so it has no messages
+            }
+        }
+        segment_filename = LogManifest::segment_filename(filename, manifest.segments.back().segment_number);
+    }
+    return open_log_files(segment_filename);
+}
+
+bool FileWriter::rotate_segment() {
+    close_log_files();
+    std::string segment_filename;
+    {
+        unique_lock<mutex> manifest_lock(manifest_mutex);
+        uint64_t next_segment_number = manifest.segments.back().segment_number + 1;
+        manifest.segments.push_back({next_segment_number, {}});
+        //Saving the manifest also records the final contents of the segment just closed
+        if(!manifest.save()) {
+            return false;
+        }
+        segment_filename = LogManifest::segment_filename(filename, next_segment_number);
+    }
+    return open_log_files(segment_filename);
+}
+
+void FileWriter::perform_writes() {
+    pthread_setname_np(pthread_self(), "writer_thread");
+    bool files_open = segment_size > 0 ? open_active_segment() : open_log_files(filename);
+    if(!files_open) {
+        std::cerr << "ERROR: Log " << filename << " could not be opened; no messages will be logged" << std::endl;
+        failed = true;
+        return;
+    }
+
+    unique_lock<mutex> writes_lock(pending_writes_mutex);
+
+    std::vector<message> batch;
+    while(!exit) {
+        pending_writes_cv.wait(writes_lock, [this]() { return exit || !pending_writes.empty(); });
+        //Give a partial batch a chance to fill up before committing it
+        if(max_batch_latency.count() > 0 && pending_writes.size() < max_batch_size) {
+            pending_writes_cv.wait_for(writes_lock, max_batch_latency, [this]() {
+                return exit || pending_writes.size() >= max_batch_size;
+            });
+        }
+
+        while(!pending_writes.empty()) {
+            batch.clear();
+            while(!pending_writes.empty() && batch.size() < max_batch_size) {
+                batch.push_back(pending_writes.front());
+                pending_writes.pop();
+            }
+            //Don't block write_message while waiting for the disk
+            writes_lock.unlock();
+            if(!commit_batch(batch, data_fd, metadata_fd, current_offset)) {
+                //Later messages can't be logged without leaving a gap, so stop here
+                std::cerr << "ERROR: Failed to commit a batch of messages to log " << filename
+                          << "; no further messages will be logged" << std::endl;
+                failed = true;
+                break;
+            }
+            append_index_entries(batch, index_fd, next_record_number);
+            if(segment_size > 0) {
+                {
+                    unique_lock<mutex> manifest_lock(manifest_mutex);
+                    for(const message& m : batch) {
+                        manifest.segments.back().last_messages[m.subgroup_num] = log_position_t(m.view_id, m.index);
+                    }
+                }
+                if(current_offset >= segment_size && !rotate_segment()) {
+                    std::cerr << "ERROR: Failed to start a new segment of log " << filename
+                              << "; no further messages will be logged" << std::endl;
+                    failed = true;
+                }
+            }
             {
                 unique_lock<mutex> callbacks_lock(pending_callbacks_mutex);
-                pending_callbacks.push(std::bind(message_written_upcall, m));
+                pending_callbacks.push(std::bind(batch_written_upcall, batch));
             }
             pending_callbacks_cv.notify_all();
+            if(failed) {
+                break;
+            }
+            writes_lock.lock();
+        }
+        if(failed) {
+            break;
+        }
+    }
+    if(direct_io) {
+        io_destroy(aio_context);
+    }
+    close_log_files();
+}
+
+void FileWriter::remove_covered_segments() {
+    //Must be called with manifest_mutex held
+    //The last segment is still being written, so it is never removed
+    for(auto segment = manifest.segments.begin(); segment + 1 < manifest.segments.end();) {
+        bool covered = std::all_of(segment->last_messages.begin(), segment->last_messages.end(),
+                                   [this](const std::pair<const uint32_t, log_position_t>& subgroup_last) {
+                                       auto checkpoint = checkpoints.find(subgroup_last.first);
+                                       return checkpoint != checkpoints.end()
+                                              && subgroup_last.second <= checkpoint->second;
+                                   });
+        if(!covered) {
+            ++segment;
+            continue;
+        }
+        std::string segment_filename = LogManifest::segment_filename(filename, segment->segment_number);
+        //Update the manifest before deleting any files, so a crash can't leave it naming missing segments
+        segment = manifest.segments.erase(segment);
+        if(!manifest.save()) {
+            //The segment's files are kept, since the manifest on disk may still name them
+            std::cerr << "Log segment " << segment_filename << " was not removed" << std::endl;
+            return;
+        }
+        for(const std::string& extension : {std::string(), METADATA_EXTENSION, INDEX_EXTENSION}) {
+            if(::unlink((segment_filename + extension).c_str()) != 0 && errno != ENOENT) {
+                std::cerr << "Error removing log segment file " << segment_filename + extension
+                          << ": " << strerror(errno) << std::endl;
+            }
+        }
+    }
+}
+
+void FileWriter::compact_segments() {
+    pthread_setname_np(pthread_self(), "log_compactor");
+    unique_lock<mutex> manifest_lock(manifest_mutex);
+    while(!exit) {
+        compactor_cv.wait(manifest_lock, [this]() { return exit || compaction_requested; });
+        if(exit) {
+            break;
         }
+        compaction_requested = false;
+        remove_covered_segments();
+    }
+}
+
+void FileWriter::truncate_before(uint32_t subgroup_num, uint32_t view_id, uint64_t index) {
+    unique_lock<mutex> manifest_lock(manifest_mutex);
+    log_position_t& checkpoint = checkpoints[subgroup_num];
+    checkpoint = std::max(checkpoint, log_position_t(view_id, index));
+    if(segment_size > 0) {
+        remove_covered_segments();
+    }
+}
+
+void FileWriter::report_snapshot(uint32_t subgroup_num, uint32_t view_id, uint64_t index) {
+    {
+        unique_lock<mutex> manifest_lock(manifest_mutex);
+        log_position_t& checkpoint = checkpoints[subgroup_num];
+        checkpoint = std::max(checkpoint, log_position_t(view_id, index));
+        compaction_requested = true;
     }
+    compactor_cv.notify_all();
 }
 
 void FileWriter::issue_callbacks() {
@@ -99,7 +509,7 @@ void FileWriter::issue_callbacks() {
     unique_lock<mutex> lock(pending_callbacks_mutex);
 
     while(!exit) {
-        pending_callbacks_cv.wait(lock);
+        pending_callbacks_cv.wait(lock, [this]() { return exit || !pending_callbacks.empty(); });
 
         while(!pending_callbacks.empty()) {
             auto callback = pending_callbacks.front();
@@ -111,11 +521,15 @@ void FileWriter::issue_callbacks() {
     }
 }
 
-void FileWriter::write_message(message m) {
+bool FileWriter::write_message(message m) {
+    if(failed) {
+        return false;
+    }
     {
         unique_lock<mutex> lock(pending_writes_mutex);
         pending_writes.push(m);
     }
     pending_writes_cv.notify_all();
+    return true;
 }
 }
@@ -1,18 +1,28 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <fstream>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include <linux/aio_abi.h>
+
+#include "log_manifest.h"
 #include "persistence.h"
 
 namespace derecho {
 
+/** The type of the upcall FileWriter makes once a batch of messages is durable on disk. */
+using batch_written_upcall_t = std::function<void(const std::vector<persistence::message>&)>;
+
 class FileWriter {
 public:
     //  const uint32_t MSG_LOCALLY_STABLE = 0x1;
@@ -21,7 +31,40 @@ public:
     //  const uint32_t MSG_LOCALLY_PERSISTENT = 0x8;
 
 private:
-    std::function<void(persistence::message)> message_written_upcall;
+    batch_written_upcall_t batch_written_upcall;
+
+    /** The base name of the log: the name of its data file if it is not
+     * segmented, or the prefix of its segment and manifest file names if it is. */
+    const std::string filename;
+
+    /** The maximum number of messages that will be committed to disk by a single fdatasync. */
+    const uint32_t max_batch_size;
+    /** How long the writer thread will wait for a partial batch to fill up
+     * before committing it anyway. Zero means commit whatever is queued immediately. */
+    const std::chrono::microseconds max_batch_latency;
+    /** True if message bodies are written with Linux AIO on an O_DIRECT file
+     * descriptor. Set to false by the writer thread if the file system does
+     * not support O_DIRECT. */
+    bool direct_io;
+    /** The kernel AIO context used to submit direct writes. */
+    aio_context_t aio_context;
+    /** The data file size at which the active segment is closed and a new
+     * one is started. Zero means the log is a single, unsegmented file. */
+    const uint64_t segment_size;
+
+    /* The files currently being appended to, and the write positions within
+     * them. Only accessed by the writer thread. */
+    int data_fd;
+    int metadata_fd;
+    int index_fd;
+    uint64_t current_offset;
+    uint64_t next_record_number;
+
+    /** For each subgroup, the view ID of the last message recorded in the
+     * sparse index. Only accessed by the writer thread. */
+    std::map<uint32_t, uint32_t> last_indexed_view;
+    /** For each subgroup, the number of messages written since its last index entry. */
+    std::map<uint32_t, uint64_t> records_since_index_entry;
 
     std::mutex pending_writes_mutex;
     std::condition_variable pending_writes_cv;
@@ -31,17 +74,128 @@ private:
     std::condition_variable pending_callbacks_cv;
     std::queue<std::function<void()>> pending_callbacks;
 
+    /** Guards the manifest and the checkpoints, which are shared by the writer
+     * thread, the compactor thread, and callers of truncate_before and report_snapshot. */
+    std::mutex manifest_mutex;
+    std::condition_variable compactor_cv;
+    persistence::LogManifest manifest;
+    /** For each subgroup, the message number up to which its messages are no
+     * longer needed, because they are covered by a checkpoint or snapshot. */
+    std::map<uint32_t, persistence::log_position_t> checkpoints;
+    bool compaction_requested;
+
+    /** Set by the writer thread if the log files can't be opened or a batch
+     * can't be written. After that, nothing more is written or acknowledged
+     * with batch_written_upcall, and write_message refuses new messages. */
+    std::atomic<bool> failed;
     bool exit;
 
     std::thread writer_thread;
     std::thread callback_thread;
+    std::thread compactor_thread;
 
-    void perform_writes(std::string filename);
+    void perform_writes();
     void issue_callbacks();
+    /** Waits for snapshot reports and removes the segments they cover.
+     * This function implements the compactor thread. */
+    void compact_segments();
+
+    /**
+     * Opens (or creates) the data, metadata and index files with the given
+     * base name, and sets the write positions to the ends of those files.
+     * @return True if all the files were opened
+     */
+    bool open_log_files(const std::string& base_filename);
+    void close_log_files();
+    /** Opens the files of the last segment in the manifest, creating the manifest if necessary. */
+    bool open_active_segment();
+    /** Closes the active segment and starts a new one. */
+    bool rotate_segment();
+    /** Deletes every closed segment whose messages are all covered by
+     * checkpoints. Must be called with manifest_mutex held. */
+    void remove_covered_segments();
+
+    /**
+     * Writes one batch of messages to the data and metadata files, then calls
+     * fdatasync on both files. The metadata is written only after the data
+     * it describes is on disk, so if writing the data fails the batch is not
+     * in the log; if writing the metadata fails, any partial record is
+     * truncated away.
+     * @param batch The messages to write, in the order they were delivered
+     * @param data_fd The file descriptor of the data file
+     * @param metadata_fd The file descriptor of the metadata file
+     * @param current_offset The offset in the data file at which the first
+     * message will be written; advanced past the end of the batch only if
+     * the batch was committed
+     * @return True if the whole batch was committed to disk
+     */
+    bool commit_batch(const std::vector<persistence::message>& batch,
+                      int data_fd, int metadata_fd, uint64_t& current_offset);
+
+    /**
+     * Appends sparse index entries for a batch of messages that has just been
+     * committed to the metadata file. The index is only a hint for readers,
+     * so it is not synced to disk.
+     * @param batch The messages that were committed
+     * @param index_fd The file descriptor of the index file
+     * @param next_record_number The record number of the first message in
+     * the batch; advanced past the end of the batch on return
+     */
+    void append_index_entries(const std::vector<persistence::message>& batch,
+                              int index_fd, uint64_t& next_record_number);
+
+    /**
+     * Writes the bodies of a batch of messages with a single vectored write.
+     * @param data_offsets Filled in with the file offset of each message's body
+     * @return True if all the data was written
+     */
+    bool write_data_buffered(const std::vector<persistence::message>& batch, int data_fd,
+                             uint64_t& current_offset, std::vector<uint64_t>& data_offsets);
+
+    /**
+     * Submits the bodies of a batch of messages to the kernel as one set of
+     * asynchronous O_DIRECT writes and waits for them to complete. Messages
+     * that are in an aligned buffer are written from that buffer without
+     * copying; the rest are copied into aligned bounce buffers first.
+     *
+     * This changes what the data file contains besides message bodies. A
+     * message written from its aligned buffer is written as the whole
+     * aligned block around it, starting at the beginning of the buffer, so
+     * the file also holds the bytes in front of the body (the message
+     * header) and whatever the buffer held after the body up to the next
+     * multiple of DIRECT_IO_ALIGNMENT. A copied message is padded with
+     * zeros to that boundary. Only the ranges given by the metadata
+     * records' offsets and lengths are message bodies; readers must not
+     * assume bodies are contiguous, or that the bytes between them are
+     * zero.
+     * @param data_offsets Filled in with the file offset of each message's body
+     * @return True if all the data was written
+     */
+    bool write_data_direct(const std::vector<persistence::message>& batch, int data_fd,
+                           uint64_t& current_offset, std::vector<uint64_t>& data_offsets);
 
 public:
-    FileWriter(const std::function<void(persistence::message)>& _message_written_upcall,
-               const std::string& filename);
+    /**
+     * @param _batch_written_upcall The function to call once a batch of
+     * messages has been written and synced to disk
+     * @param filename The name of the log file; the metadata file will have
+     * the same name plus METADATA_EXTENSION
+     * @param max_batch_size The maximum number of messages to commit at once
+     * @param max_batch_latency The maximum time to hold a partial batch
+     * waiting for more messages
+     * @param direct_io Whether to write message bodies with asynchronous
+     * O_DIRECT I/O instead of through the page cache. The data file then
+     * also contains message headers and padding between the bodies; see
+     * write_data_direct.
+     * @param segment_size If nonzero, the log is split into segments of
+     * approximately this many bytes of message data, listed in a manifest
+     */
+    FileWriter(const batch_written_upcall_t& _batch_written_upcall,
+               const std::string& filename,
+               uint32_t max_batch_size = 64,
+               std::chrono::microseconds max_batch_latency = std::chrono::microseconds(0),
+               bool direct_io = false,
+               uint64_t segment_size = 0);
     ~FileWriter();
 
     FileWriter(FileWriter&) = delete;
@@ -50,8 +204,34 @@ public:
     FileWriter& operator=(FileWriter&) = delete;
     FileWriter& operator=(FileWriter&&) = default;
 
-    void set_message_written_upcall(const std::function<void(persistence::message)>&
-                                            _message_written_upcall);
-    void write_message(persistence::message m);
+    void set_batch_written_upcall(const batch_written_upcall_t& _batch_written_upcall);
+    /**
+     * Queues a message to be written to the log.
+     * @return False, without queueing the message, if the log can no longer
+     * be written because its files could not be opened or an earlier batch
+     * failed to commit. Messages that were queued when that happened are
+     * never acknowledged.
+     */
+    bool write_message(persistence::message m);
+
+    /** @return True if the log can no longer be written (see write_message). */
+    bool has_failed() const { return failed; }
+
+    /**
+     * Records that a subgroup's messages up to and including the given
+     * message number have been checkpointed, and immediately deletes every
+     * closed log segment that no longer contains any needed messages. Has no
+     * effect on an unsegmented log, other than recording the checkpoint.
+     * @param subgroup_num The subgroup that took the checkpoint
+     * @param view_id The view ID of the last message covered by the checkpoint
+     * @param index The index of the last message covered by the checkpoint
+     */
+    void truncate_before(uint32_t subgroup_num, uint32_t view_id, uint64_t index);
+    /**
+     * Records that a subgroup has taken a snapshot covering its messages up
+     * to and including the given message number. Segments that are no longer
+     * needed will be deleted by the background compactor thread.
+     */
+    void report_snapshot(uint32_t subgroup_num, uint32_t view_id, uint64_t index);
 };
 }
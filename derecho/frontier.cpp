@@ -0,0 +1,136 @@
+#include "frontier.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace derecho {
+
+namespace {
+
+long long int column_min_scalar(const volatile char* base, const int64_t* offsets, std::size_t count,
+                                std::size_t& position) {
+    long long int min = *(const volatile long long int*)(base + offsets[0]);
+    position = 0;
+    for(std::size_t i = 1; i < count; ++i) {
+        long long int value = *(const volatile long long int*)(base + offsets[i]);
+        if(value < min) {
+            min = value;
+            position = i;
+        }
+    }
+    return min;
+}
+
+long long int array_min_scalar(const volatile long long int* values, std::size_t count, std::size_t& position) {
+    long long int min = values[0];
+    position = 0;
+    for(std::size_t i = 1; i < count; ++i) {
+        long long int value = values[i];
+        if(value < min) {
+            min = value;
+            position = i;
+        }
+    }
+    return min;
+}
+
+#if defined(__x86_64__)
+
+/** Reduces 4 lanes of (value, index) minima to one, preferring the lowest index on ties. */
+__attribute__((target("avx2"))) long long int reduce_lanes(__m256i mins, __m256i positions,
+                                                            std::size_t& position) {
+    alignas(32) long long int lane_mins[4];
+    alignas(32) long long int lane_positions[4];
+    _mm256_store_si256((__m256i*)lane_mins, mins);
+    _mm256_store_si256((__m256i*)lane_positions, positions);
+    long long int min = lane_mins[0];
+    position = lane_positions[0];
+    for(int lane = 1; lane < 4; ++lane) {
+        if(lane_mins[lane] < min || (lane_mins[lane] == min && (std::size_t)lane_positions[lane] < position)) {
+            min = lane_mins[lane];
+            position = lane_positions[lane];
+        }
+    }
+    return min;
+}
+
+/* Each lane keeps the minimum of every 4th element and the index where it
+ * first appeared; since lanes only take strictly smaller values, the earliest
+ * index wins ties within a lane. Both require count >= 4. */
+__attribute__((target("avx2"))) long long int column_min_avx2(const volatile char* base, const int64_t* offsets,
+                                                               std::size_t count, std::size_t& position) {
+    __m256i positions = _mm256_set_epi64x(3, 2, 1, 0);
+    __m256i mins = _mm256_i64gather_epi64((const long long int*)base, _mm256_loadu_si256((const __m256i*)offsets), 1);
+    const __m256i step = _mm256_set1_epi64x(4);
+    __m256i indices = _mm256_add_epi64(positions, step);
+    std::size_t i = 4;
+    for(; i + 4 <= count; i += 4) {
+        __m256i row_offsets = _mm256_loadu_si256((const __m256i*)(offsets + i));
+        __m256i values = _mm256_i64gather_epi64((const long long int*)base, row_offsets, 1);
+        __m256i smaller = _mm256_cmpgt_epi64(mins, values);
+        mins = _mm256_blendv_epi8(mins, values, smaller);
+        positions = _mm256_blendv_epi8(positions, indices, smaller);
+        indices = _mm256_add_epi64(indices, step);
+    }
+    long long int min = reduce_lanes(mins, positions, position);
+    for(; i < count; ++i) {
+        long long int value = *(const volatile long long int*)(base + offsets[i]);
+        if(value < min) {
+            min = value;
+            position = i;
+        }
+    }
+    return min;
+}
+
+__attribute__((target("avx2"))) long long int array_min_avx2(const volatile long long int* values,
+                                                              std::size_t count, std::size_t& position) {
+    __m256i positions = _mm256_set_epi64x(3, 2, 1, 0);
+    __m256i mins = _mm256_loadu_si256((const __m256i*)values);
+    const __m256i step = _mm256_set1_epi64x(4);
+    __m256i indices = _mm256_add_epi64(positions, step);
+    std::size_t i = 4;
+    for(; i + 4 <= count; i += 4) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(values + i));
+        __m256i smaller = _mm256_cmpgt_epi64(mins, block);
+        mins = _mm256_blendv_epi8(mins, block, smaller);
+        positions = _mm256_blendv_epi8(positions, indices, smaller);
+        indices = _mm256_add_epi64(indices, step);
+    }
+    long long int min = reduce_lanes(mins, positions, position);
+    for(; i < count; ++i) {
+        long long int value = values[i];
+        if(value < min) {
+            min = value;
+            position = i;
+        }
+    }
+    return min;
+}
+
+const bool cpu_has_avx2 = __builtin_cpu_supports("avx2");
+
+#endif
+}  // namespace
+
+long long int column_min(const volatile char* base, const int64_t* offsets, std::size_t count,
+                         std::size_t& position) {
+#if defined(__x86_64__)
+    //The vector loops start with one full vector of 4 elements
+    if(cpu_has_avx2 && count >= 4) {
+        return column_min_avx2(base, offsets, count, position);
+    }
+#endif
+    return column_min_scalar(base, offsets, count, position);
+}
+
+long long int array_min(const volatile long long int* values, std::size_t count, std::size_t& position) {
+#if defined(__x86_64__)
+    if(cpu_has_avx2 && count >= 4) {
+        return array_min_avx2(values, count, position);
+    }
+#endif
+    return array_min_scalar(values, count, position);
+}
+}
@@ -0,0 +1,75 @@
+/**
+ * @file frontier.h
+ * @brief Contains the min-reductions over SST columns that the stability,
+ * delivery and receive triggers use to advance their frontiers.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace derecho {
+
+/**
+ * Finds the smallest long long int stored at any of the given byte offsets
+ * from base, e.g. one column of an SST field across a set of rows. Uses AVX2
+ * gathers if the CPU supports them, and a scalar loop otherwise.
+ * @param base The address of the column in row 0
+ * @param offsets The byte offset of each row to read, relative to base
+ * @param count The number of offsets, which must be at least 1
+ * @param position Set to the index (in offsets) of the first row holding the minimum
+ * @return The minimum value
+ */
+long long int column_min(const volatile char* base, const int64_t* offsets, std::size_t count,
+                         std::size_t& position);
+
+/**
+ * Finds the smallest element of a contiguous array of long long ints, e.g.
+ * the entries of an SST vector field in a single row. Uses AVX2 if the CPU
+ * supports it, and a scalar loop otherwise.
+ * @param values The array, which must have at least 1 element
+ * @param count The number of elements
+ * @param position Set to the index of the first element holding the minimum
+ * @return The minimum value
+ */
+long long int array_min(const volatile long long int* values, std::size_t count, std::size_t& position);
+
+/**
+ * Caches the minimum of a set of counters that never decrease, such as the
+ * seq_num or stable_num column of a shard. Since no counter can drop below
+ * the cached minimum, the minimum can only have changed if the counter that
+ * held it has; update() checks that one counter and only re-runs the
+ * reduction if it moved.
+ */
+class FrontierMin {
+private:
+    long long int min_value = 0;
+    std::size_t min_position = 0;
+    bool valid = false;
+
+public:
+    /** Returns the minimum of the column at base over the given row offsets,
+     * which must be the same on every call. */
+    long long int update(const volatile char* base, const int64_t* offsets, std::size_t count) {
+        if(!valid || *(const volatile long long int*)(base + offsets[min_position]) != min_value) {
+            min_value = column_min(base, offsets, count, min_position);
+            valid = true;
+        }
+        return min_value;
+    }
+
+    /** Returns the minimum of a contiguous array of count counters, which
+     * must be the same array on every call. */
+    long long int update(const volatile long long int* values, std::size_t count) {
+        if(!valid || values[min_position] != min_value) {
+            min_value = array_min(values, count, min_position);
+            valid = true;
+        }
+        return min_value;
+    }
+
+    /** The index of the first counter holding the minimum, as of the last update. */
+    std::size_t position() const { return min_position; }
+};
+}
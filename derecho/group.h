@@ -11,6 +11,7 @@
 #include <mutex>
 #include <queue>
 #include <string>
+#include <thread>
 #include <typeindex>
 #include <utility>
 #include <vector>
@@ -109,7 +110,8 @@ private:
     /**
      * Updates the state of the replicated objects that correspond to subgroups
      * identified in the provided map, by receiving serialized state from the
-     * shard leader whose ID is paired with that subgroup ID.
+     * shard leader whose ID is paired with that subgroup ID. Objects from
+     * different leaders are received in parallel.
      * @param subgroups_and_leaders Pairs of (subgroup ID, leader's node ID) for
      * subgroups that need to have their state initialized from the leader.
      */
@@ -244,11 +246,14 @@ public:
           Factory<ReplicatedTypes>... factories);
     /**
      * Constructor that re-starts a failed group member from log files.
-     * It assumes the local ".paxosstate" file already contains the last known
-     * view, obtained from a quorum of members, and that any messages missing
-     * from the local log have already been appended from the longest log of a
-     * member of the last known view. (This can be accomplished by running the
-     * script log_recovery_helper.sh). Does NOT currently attempt to replay
+     * Before rejoining, it runs log recovery (see persistence::LogRecovery)
+     * with the other restarting members of the last View saved in the local
+     * ".paxosstate" file. This blocks until a majority of that View's
+     * members can reach each other; members that don't answer within the
+     * recovery timeouts are left out. The participants adopt the newest View
+     * any of them saved, and for each subgroup, the messages missing from the
+     * local log are appended from the participant whose log goes furthest in
+     * that subgroup. Does NOT currently attempt to replay
      * completion events for missing messages that were transferred over from
      * another member's log.
      *
@@ -302,15 +302,32 @@ ExternalCaller<SubgroupType>& Group<ReplicatedTypes...>::get_nonmember_subgroup(
 
 template <typename... ReplicatedTypes>
 void Group<ReplicatedTypes...>::receive_objects(const std::set<std::pair<subgroup_id_t, node_id_t>>& subgroups_and_leaders) {
-    //This will receive one object from each shard leader in ascending order of subgroup ID
+    //Each leader sends its objects in ascending order of subgroup ID over one socket,
+    //but different leaders' sockets can be read in parallel
+    std::map<node_id_t, std::vector<subgroup_id_t>> subgroups_by_leader;
     for(const auto& subgroup_and_leader : subgroups_and_leaders) {
-        LockedReference<std::unique_lock<std::mutex>, tcp::socket> leader_socket
-                = rpc_manager.get_socket(subgroup_and_leader.second);
-        std::size_t buffer_size;
-        bool success = leader_socket.get().read((char*)&buffer_size, sizeof(buffer_size));
-        assert(success);
-        char buffer[buffer_size];
-        objects_by_subgroup_id.at(subgroup_and_leader.first).get().receive_object(buffer);
+        subgroups_by_leader[subgroup_and_leader.second].push_back(subgroup_and_leader.first);
+    }
+    auto receive_from_leader = [this](node_id_t leader, const std::vector<subgroup_id_t>& subgroups) {
+        tcp::exclusive_socket_reference leader_socket
+                = rpc_manager.get_socket(leader);
+        for(subgroup_id_t subgroup_id : subgroups) {
+            std::size_t buffer_size;
+            bool success = leader_socket.get().read((char*)&buffer_size, sizeof(buffer_size));
+            assert(success);
+            //Objects can be far too large for the stack
+            std::unique_ptr<char[]> buffer(new char[buffer_size]);
+            success = leader_socket.get().read(buffer.get(), buffer_size);
+            assert(success);
+            objects_by_subgroup_id.at(subgroup_id).get().receive_object(buffer.get());
+        }
+    };
+    std::vector<std::thread> receive_threads;
+    for(const auto& leader_subgroups : subgroups_by_leader) {
+        receive_threads.emplace_back(receive_from_leader, leader_subgroups.first, std::cref(leader_subgroups.second));
+    }
+    for(auto& receive_thread : receive_threads) {
+        receive_thread.join();
     }
 }
 
@@ -7,13 +7,13 @@
  * of parsing by bash scripts.
  */
 
-#include <fstream>
 #include <iostream>
 #include <string>
-#include <strings.h>
+#include <vector>
 
+#include "log_manifest.h"
+#include "log_reader.h"
 #include "persistence.h"
-#include <mutils-serialization/SerializationSupport.hpp>
 
 using namespace derecho::persistence;
 
@@ -24,15 +24,17 @@ int main(int argc, char* argv[]) {
     }
 
     std::string filename(argv[1]);
-    std::ifstream metadata_file(filename + METADATA_EXTENSION);
     //Since metadatas are written in chronological order, the one at the end
-    //of the file is the latest one.
-    message_metadata dummy_for_size;
-    std::size_t size_of_metadata = mutils::bytes_size(dummy_for_size);
-    metadata_file.seekg(-1 * size_of_metadata, std::ios::end);
-    char buffer[size_of_metadata];
-    metadata_file.read(buffer, size_of_metadata);
-    std::unique_ptr<message_metadata> metadata = mutils::from_bytes<message_metadata>(nullptr, buffer);
-    std::cout << metadata->view_id << " " << metadata->sender << " " << metadata->index << std::endl;
-    return 0;
+    //of the last non-empty segment is the latest one.
+    std::vector<std::string> segment_filenames = log_segment_filenames(filename);
+    for(auto segment = segment_filenames.rbegin(); segment != segment_filenames.rend(); ++segment) {
+        LogReader log(*segment);
+        if(!log.empty()) {
+            const message_metadata& metadata = log.back();
+            std::cout << metadata.view_id << " " << metadata.sender << " " << metadata.index << std::endl;
+            return 0;
+        }
+    }
+    std::cerr << "The log " << filename << " contains no messages" << std::endl;
+    return 1;
 }
@@ -0,0 +1,122 @@
+#include "log_manifest.h"
+#include "persistence.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace derecho {
+
+namespace persistence {
+
+/* On disk, the manifest is a segment count followed by, for each segment,
+ * a segment_record and then that segment's subgroup_record array. */
+struct __attribute__((__packed__)) segment_record {
+    uint64_t segment_number;
+    uint32_t num_subgroups;
+};
+
+struct __attribute__((__packed__)) subgroup_record {
+    uint32_t subgroup_num;
+    uint32_t view_id;
+    uint64_t index;
+};
+
+LogManifest::LogManifest(const std::string& log_filename) : log_filename(log_filename) {
+    std::ifstream manifest_file(log_filename + MANIFEST_EXTENSION, std::ios::binary);
+    uint64_t num_segments = 0;
+    if(!manifest_file.read((char*)&num_segments, sizeof(num_segments))) {
+        return;
+    }
+    for(uint64_t i = 0; i < num_segments; ++i) {
+        segment_record segment;
+        if(!manifest_file.read((char*)&segment, sizeof(segment))) {
+            break;
+        }
+        segments.push_back({segment.segment_number, {}});
+        for(uint32_t s = 0; s < segment.num_subgroups; ++s) {
+            subgroup_record subgroup;
+            manifest_file.read((char*)&subgroup, sizeof(subgroup));
+            segments.back().last_messages[subgroup.subgroup_num] = log_position_t((uint32_t)subgroup.view_id, (uint64_t)subgroup.index);
+        }
+    }
+}
+
+bool LogManifest::exists(const std::string& log_filename) {
+    struct stat file_stat;
+    return stat((log_filename + MANIFEST_EXTENSION).c_str(), &file_stat) == 0;
+}
+
+std::string LogManifest::segment_filename(const std::string& log_filename, uint64_t segment_number) {
+    return log_filename + "." + std::to_string(segment_number);
+}
+
+/** Appends the bytes of a trivially copyable value to a buffer. */
+template <typename T>
+static void append_bytes(std::vector<char>& buffer, const T& value) {
+    buffer.insert(buffer.end(), (const char*)&value, (const char*)&value + sizeof(value));
+}
+
+bool LogManifest::save() const {
+    std::string manifest_filename = log_filename + MANIFEST_EXTENSION;
+    std::string swap_filename = manifest_filename + SWAP_FILE_EXTENSION;
+    std::vector<char> contents;
+    append_bytes(contents, (uint64_t)segments.size());
+    for(const segment_info& segment : segments) {
+        append_bytes(contents, segment_record{segment.segment_number, (uint32_t)segment.last_messages.size()});
+        for(const auto& subgroup_position : segment.last_messages) {
+            append_bytes(contents, subgroup_record{subgroup_position.first, subgroup_position.second.first,
+                                                   subgroup_position.second.second});
+        }
+    }
+    int swap_fd = ::open(swap_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+    if(swap_fd < 0) {
+        std::cerr << "Error opening log manifest swap file: " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool written = ::write(swap_fd, contents.data(), contents.size()) == (ssize_t)contents.size();
+    //The new contents must be on disk before the rename can make them the manifest
+    bool synced = written && ::fsync(swap_fd) == 0;
+    ::close(swap_fd);
+    if(!synced) {
+        std::cerr << "Error writing log manifest swap file: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if(std::rename(swap_filename.c_str(), manifest_filename.c_str()) < 0) {
+        std::cerr << "Error updating log manifest on disk! " << strerror(errno) << std::endl;
+        return false;
+    }
+    //Sync the directory, so the rename itself survives a crash
+    std::string::size_type last_slash = manifest_filename.rfind('/');
+    std::string directory = last_slash == std::string::npos ? "." : manifest_filename.substr(0, last_slash + 1);
+    int directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    bool directory_synced = directory_fd >= 0 && ::fsync(directory_fd) == 0;
+    if(directory_fd >= 0) {
+        ::close(directory_fd);
+    }
+    if(!directory_synced) {
+        std::cerr << "Error syncing the directory of log manifest " << manifest_filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> log_segment_filenames(const std::string& log_filename) {
+    if(!LogManifest::exists(log_filename)) {
+        return {log_filename};
+    }
+    std::vector<std::string> filenames;
+    for(const segment_info& segment : LogManifest(log_filename).segments) {
+        filenames.push_back(LogManifest::segment_filename(log_filename, segment.segment_number));
+    }
+    return filenames;
+}
+
+}  // namespace persistence
+}  // namespace derecho
@@ -0,0 +1,74 @@
+/**
+ * @file log_manifest.h
+ * @brief Contains the LogManifest class, which describes the segments of a
+ * segmented Derecho message log.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace derecho {
+
+namespace persistence {
+
+static const std::string MANIFEST_EXTENSION = ".manifest";
+
+/** A message number within a subgroup, as the pair (view ID, index). */
+using log_position_t = std::pair<uint32_t, uint64_t>;
+
+/** Describes one segment of a segmented log. */
+struct segment_info {
+    uint64_t segment_number;
+    /** For each subgroup with messages in this segment, the message number
+     * of the last of its messages in the segment. */
+    std::map<uint32_t, log_position_t> last_messages;
+};
+
+/**
+ * The list of segments that make up a segmented log, in the order they were
+ * written. A segment is a complete log in its own right (a data file plus
+ * its metadata and index files), named by appending its segment number to
+ * the log's file name, so LogReader can open any single segment. Logs that
+ * were written without segmentation have no manifest.
+ */
+class LogManifest {
+    std::string log_filename;
+
+public:
+    std::vector<segment_info> segments;
+
+    /**
+     * Loads the manifest for the log with the given name, if it has one.
+     * @param log_filename The base name of the log
+     */
+    explicit LogManifest(const std::string& log_filename);
+
+    /** @return True if the log is segmented, i.e. the manifest file exists on disk. */
+    static bool exists(const std::string& log_filename);
+    /** @return The base file name of a segment of the log, to which the
+     * metadata and index extensions can be added. */
+    static std::string segment_filename(const std::string& log_filename, uint64_t segment_number);
+
+    /**
+     * Saves the manifest to disk, using a swap file so a crash leaves either
+     * the old or the new version. The swap file is synced before it replaces
+     * the manifest, and the directory after, so the new version is durable
+     * once this returns true.
+     * @return False if the manifest could not be written or synced
+     */
+    bool save() const;
+};
+
+/**
+ * @return The base file names of the files that make up the log, in order:
+ * every segment of a segmented log, or just log_filename for an unsegmented log.
+ */
+std::vector<std::string> log_segment_filenames(const std::string& log_filename);
+
+}  // namespace persistence
+}  // namespace derecho
@@ -0,0 +1,141 @@
+#include "log_reader.h"
+#include "derecho_exception.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace derecho {
+
+namespace persistence {
+
+LogReader::LogReader(const std::string& filename)
+        : mapped_file(nullptr),
+          mapped_size(0),
+          records_begin(nullptr),
+          records_end(nullptr) {
+    std::string metadata_filename = filename + METADATA_EXTENSION;
+    int metadata_fd = ::open(metadata_filename.c_str(), O_RDONLY);
+    if(metadata_fd < 0) {
+        throw derecho_exception("Unable to open log metadata file " + metadata_filename + ": " + strerror(errno));
+    }
+    struct stat file_stat;
+    fstat(metadata_fd, &file_stat);
+    mapped_size = file_stat.st_size;
+    if(mapped_size > sizeof(header)) {
+        mapped_file = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, metadata_fd, 0);
+        if(mapped_file == MAP_FAILED) {
+            ::close(metadata_fd);
+            throw derecho_exception("Unable to map log metadata file " + metadata_filename + ": " + strerror(errno));
+        }
+        //The file is read sequentially by scans but randomly by binary search; let the kernel know
+        madvise(mapped_file, mapped_size, MADV_RANDOM);
+        //A crash during a write can leave a partial record at the end, which is ignored
+        std::size_t num_records = (mapped_size - sizeof(header)) / sizeof(message_metadata);
+        records_begin = reinterpret_cast<const_iterator>(static_cast<char*>(mapped_file) + sizeof(header));
+        records_end = records_begin + num_records;
+    }
+    //The mapping stays valid after the descriptor is closed
+    ::close(metadata_fd);
+    load_index(filename + INDEX_EXTENSION);
+}
+
+LogReader::~LogReader() {
+    if(mapped_file) {
+        munmap(mapped_file, mapped_size);
+    }
+}
+
+void LogReader::load_index(const std::string& index_filename) {
+    std::ifstream index_file(index_filename, std::ios::binary);
+    index_entry entry;
+    while(index_file.read((char*)&entry, sizeof(entry))) {
+        //The index isn't synced with the metadata, so ignore entries that point past the end
+        //of the log or at the wrong record
+        if(entry.record_number >= size()) {
+            continue;
+        }
+        const message_metadata& record = records_begin[entry.record_number];
+        if(record.subgroup_num != entry.subgroup_num || record.view_id != entry.view_id
+           || record.index != entry.index) {
+            continue;
+        }
+        subgroup_index[entry.subgroup_num].push_back(entry);
+    }
+}
+
+std::pair<LogReader::const_iterator, LogReader::const_iterator> LogReader::view_range(uint32_t view_id) const {
+    auto first = std::lower_bound(records_begin, records_end, view_id,
+                                  [](const message_metadata& record, uint32_t vid) {
+                                      return record.view_id < vid;
+                                  });
+    auto last = std::upper_bound(first, records_end, view_id,
+                                 [](uint32_t vid, const message_metadata& record) {
+                                     return vid < record.view_id;
+                                 });
+    return {first, last};
+}
+
+LogReader::const_iterator LogReader::find_in_subgroup(uint32_t subgroup_num, uint32_t view_id,
+                                                      uint32_t sender, uint64_t index) const {
+    auto view_records = view_range(view_id);
+    const_iterator scan_start = view_records.first;
+    auto index_entries = subgroup_index.find(subgroup_num);
+    if(index_entries != subgroup_index.end()) {
+        //Start scanning at the last index entry strictly before (view_id, index), since
+        //several senders' messages can share the same index
+        const std::vector<index_entry>& entries = index_entries->second;
+        auto after = std::lower_bound(entries.begin(), entries.end(), std::make_pair(view_id, index),
+                                      [](const index_entry& entry, const std::pair<uint32_t, uint64_t>& key) {
+                                          return std::make_pair(entry.view_id, entry.index) < key;
+                                      });
+        if(after != entries.begin()) {
+            scan_start = std::max(scan_start, records_begin + std::prev(after)->record_number);
+        }
+    }
+    //Within a view, the messages of a subgroup are logged in increasing order of index
+    for(const_iterator record = scan_start; record != view_records.second; ++record) {
+        if(record->subgroup_num != subgroup_num) {
+            continue;
+        }
+        if(record->index > index) {
+            break;
+        }
+        if(record->index == index && record->sender == sender) {
+            return record;
+        }
+    }
+    return records_end;
+}
+
+LogReader::const_iterator LogReader::find(uint32_t subgroup_num, uint32_t view_id,
+                                          uint32_t sender, uint64_t index) const {
+    return find_in_subgroup(subgroup_num, view_id, sender, index);
+}
+
+LogReader::const_iterator LogReader::find(uint32_t view_id, uint32_t sender, uint64_t index) const {
+    for(const auto& subgroup_entries : subgroup_index) {
+        const_iterator result = find_in_subgroup(subgroup_entries.first, view_id, sender, index);
+        if(result != records_end) {
+            return result;
+        }
+    }
+    //Fall back to scanning the view, in case the index is missing or incomplete
+    auto view_records = view_range(view_id);
+    const_iterator result = std::find_if(view_records.first, view_records.second, [&](const message_metadata& record) {
+        return record.sender == sender && record.index == index;
+    });
+    return result == view_records.second ? records_end : result;
+}
+
+uint64_t LogReader::file_offset_of(const_iterator record) const {
+    return sizeof(header) + (record - records_begin) * sizeof(message_metadata);
+}
+
+}  // namespace persistence
+}  // namespace derecho
@@ -0,0 +1,90 @@
+/**
+ * @file log_reader.h
+ * @brief Contains the LogReader class, which provides indexed read-only access
+ * to the metadata of a Derecho message log.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "persistence.h"
+
+namespace derecho {
+
+namespace persistence {
+
+/**
+ * A read-only view of a log's metadata file, which memory-maps the file and
+ * treats it as an array of fixed-size message_metadata records. Messages are
+ * located by binary search on the view ID, which never decreases over the
+ * log, narrowed down by the sparse per-subgroup index that FileWriter writes
+ * alongside the metadata. Logs without an index file can still be read, but
+ * lookups will scan all the records in the target view.
+ */
+class LogReader {
+public:
+    /** Iterators over the log are pointers into the mapped metadata records,
+     * so they are random-access and can be used with standard algorithms. */
+    using const_iterator = const message_metadata*;
+
+private:
+    void* mapped_file;
+    std::size_t mapped_size;
+    const_iterator records_begin;
+    const_iterator records_end;
+    /** The sparse index entries for each subgroup, in the order they were written. */
+    std::map<uint32_t, std::vector<index_entry>> subgroup_index;
+
+    void load_index(const std::string& index_filename);
+    const_iterator find_in_subgroup(uint32_t subgroup_num, uint32_t view_id,
+                                    uint32_t sender, uint64_t index) const;
+
+public:
+    /**
+     * Opens the log with the given base name.
+     * @param filename The name of the log's data file; the metadata and index
+     * files will be found by adding METADATA_EXTENSION and INDEX_EXTENSION.
+     * @throws derecho_exception if the metadata file cannot be opened or mapped.
+     */
+    explicit LogReader(const std::string& filename);
+    ~LogReader();
+
+    LogReader(const LogReader&) = delete;
+    LogReader& operator=(const LogReader&) = delete;
+
+    const_iterator begin() const { return records_begin; }
+    const_iterator end() const { return records_end; }
+    std::size_t size() const { return records_end - records_begin; }
+    bool empty() const { return records_begin == records_end; }
+    /** @return The metadata of the last message in the log. The log must not be empty. */
+    const message_metadata& back() const { return *(records_end - 1); }
+
+    /**
+     * @return The range of records for messages delivered in the given view,
+     * which is empty if the log contains no messages from that view.
+     */
+    std::pair<const_iterator, const_iterator> view_range(uint32_t view_id) const;
+
+    /**
+     * Finds the record for the message with the given message number.
+     * @return An iterator to the message's record, or end() if it is not in the log.
+     */
+    const_iterator find(uint32_t view_id, uint32_t sender, uint64_t index) const;
+    /**
+     * Finds the record for the message with the given message number in a
+     * known subgroup, which avoids searching the other subgroups' indexes.
+     * @return An iterator to the message's record, or end() if it is not in the log.
+     */
+    const_iterator find(uint32_t subgroup_num, uint32_t view_id, uint32_t sender, uint64_t index) const;
+
+    /** @return The byte offset within the metadata file at which a record starts. */
+    uint64_t file_offset_of(const_iterator record) const;
+};
+
+}  // namespace persistence
+}  // namespace derecho
@@ -0,0 +1,663 @@
+#include "log_recovery.h"
+#include "derecho_exception.h"
+#include "filewriter.h"
+#include "log_manifest.h"
+#include "persistence.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <mutils-serialization/SerializationSupport.hpp>
+
+namespace derecho {
+
+namespace persistence {
+
+static bool same_message(const log_tail_position& lhs, const log_tail_position& rhs) {
+    return lhs.subgroup_num == rhs.subgroup_num && lhs.view_id == rhs.view_id
+           && lhs.index == rhs.index && lhs.sender == rhs.sender
+           && lhs.batch_position == rhs.batch_position;
+}
+
+static bool is_message(const message_metadata& record, const log_tail_position& position) {
+    return record.subgroup_num == position.subgroup_num && record.view_id == position.view_id
+           && record.index == position.index && record.sender == position.sender
+           && record.batch_position == position.batch_position;
+}
+
+/** Sent in place of a record count to tell the receiver that a log transfer failed.
+ * A chunk of 0 records means the same partway through a transfer. */
+static const uint64_t TRANSFER_FAILED = std::numeric_limits<uint64_t>::max();
+
+/** Writes a trivially copyable value to a node, throwing if the connection fails. */
+template <typename T>
+static void send_value(tcp::tcp_connections& connections, node_id_t node, const T& value) {
+    if(!connections.write(node, (char*)&value, sizeof(value))) {
+        throw derecho_exception("Log recovery lost its connection to node " + std::to_string(node));
+    }
+}
+
+/** Reads a trivially copyable value from a node, throwing if the connection fails. */
+template <typename T>
+static T receive_value(tcp::tcp_connections& connections, node_id_t node) {
+    T value;
+    if(!connections.read(node, (char*)&value, sizeof(value))) {
+        throw derecho_exception("Log recovery lost its connection to node " + std::to_string(node));
+    }
+    return value;
+}
+
+/** 64-bit FNV-1a hash, used to check the integrity of a transferred log tail. */
+static uint64_t update_checksum(uint64_t checksum, const char* data, std::size_t length) {
+    for(std::size_t i = 0; i < length; ++i) {
+        checksum ^= (uint8_t)data[i];
+        checksum *= 1099511628211ULL;
+    }
+    return checksum;
+}
+static const uint64_t CHECKSUM_INITIAL_VALUE = 14695981039346656037ULL;
+
+LogRecovery::LogRecovery(node_id_t my_id, const std::string& log_filename, uint32_t port,
+                         uint64_t segment_size, const std::map<node_id_t, uint32_t>& member_ports)
+        : my_id(my_id),
+          log_filename(log_filename),
+          port(port),
+          segment_size(segment_size),
+          member_ports(member_ports) {}
+
+log_tails_t LogRecovery::logged_tails() const {
+    log_tails_t tails;
+    for(const std::string& segment : log_segment_filenames(log_filename)) {
+        try {
+            LogReader log(segment);
+            for(const message_metadata& record : log) {
+                tails[record.subgroup_num] = log_tail_position{record.subgroup_num, record.view_id,
+                                                               record.index, record.sender,
+                                                               record.batch_position};
+            }
+        } catch(derecho_exception& ex) {
+            //This node never wrote any messages to this file
+        }
+    }
+    return tails;
+}
+
+bool LogRecovery::log_contains(const log_tail_position& position) const {
+    for(const std::string& segment : log_segment_filenames(log_filename)) {
+        try {
+            LogReader log(segment);
+            //find returns the first message of a batch; the rest follow it in the subgroup
+            for(auto record = log.find(position.subgroup_num, position.view_id, position.sender, position.index);
+                record != log.end(); ++record) {
+                if(record->subgroup_num != position.subgroup_num) {
+                    continue;
+                }
+                if(record->view_id != position.view_id || record->index != position.index
+                   || record->sender != position.sender) {
+                    break;
+                }
+                if(record->batch_position == position.batch_position) {
+                    return true;
+                }
+            }
+        } catch(derecho_exception& ex) {
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<tcp::tcp_connections> LogRecovery::agree_on_view(std::unique_ptr<View>& latest_view,
+                                                                 std::vector<node_id_t>& participants) {
+    const std::string view_file_name = log_filename + PAXOS_STATE_EXTENSION;
+    while(true) {
+        std::map<node_id_t, ip_addr> live_member_ips;
+        std::map<node_id_t, uint32_t> live_member_ports;
+        for(int rank = 0; rank < latest_view->num_members; ++rank) {
+            if(latest_view->failed[rank]) {
+                continue;
+            }
+            node_id_t member = latest_view->members[rank];
+            live_member_ips[member] = latest_view->member_ips[rank];
+            auto port_entry = member_ports.find(member);
+            live_member_ports[member] = port_entry == member_ports.end() ? port : port_entry->second;
+        }
+        live_member_ports[my_id] = port;
+        auto connections = std::make_unique<tcp::tcp_connections>(my_id, live_member_ips, live_member_ports,
+                                                                  RECOVERY_CONNECT_TIMEOUT_MS,
+                                                                  RECOVERY_READ_TIMEOUT_MS);
+
+        //Send my View to every member that could be reached, then adopt the newest View any of them has
+        std::size_t view_size = mutils::bytes_size(*latest_view);
+        std::unique_ptr<char[]> view_buffer(new char[view_size]);
+        mutils::to_bytes(*latest_view, view_buffer.get());
+        std::vector<node_id_t> reached;
+        for(const auto& member : live_member_ips) {
+            if(member.first != my_id && connections->has_connection(member.first)
+               && connections->write(member.first, (char*)&view_size, sizeof(view_size))
+               && connections->write(member.first, view_buffer.get(), view_size)) {
+                reached.push_back(member.first);
+            }
+        }
+        std::vector<node_id_t> responders;
+        std::unique_ptr<View> newest_view;
+        for(const node_id_t member : reached) {
+            std::size_t other_view_size;
+            if(!connections->read(member, (char*)&other_view_size, sizeof(other_view_size))) {
+                continue;
+            }
+            std::unique_ptr<char[]> other_view_buffer(new char[other_view_size]);
+            if(!connections->read(member, other_view_buffer.get(), other_view_size)) {
+                continue;
+            }
+            responders.push_back(member);
+            std::unique_ptr<View> other_view = mutils::from_bytes<View>(nullptr, other_view_buffer.get());
+            if(other_view->vid > (newest_view ? newest_view : latest_view)->vid) {
+                newest_view = std::move(other_view);
+            }
+        }
+        const bool view_changed = newest_view != nullptr;
+        if(view_changed) {
+            latest_view = std::move(newest_view);
+            persist_object(*latest_view, view_file_name);
+        }
+
+        //The round succeeds if a majority of the View responded with no newer View,
+        //and every responder reached exactly the same set of members
+        std::vector<node_id_t> round_members = responders;
+        round_members.push_back(my_id);
+        std::sort(round_members.begin(), round_members.end());
+        const uint8_t ready = !view_changed && (int)round_members.size() >= latest_view->num_members / 2 + 1;
+        const uint32_t num_round_members = round_members.size();
+        bool all_ready = ready;
+        for(const node_id_t member : responders) {
+            all_ready = connections->write(member, (char*)&ready, sizeof(ready))
+                        && connections->write(member, (char*)&num_round_members, sizeof(num_round_members))
+                        && connections->write(member, (char*)round_members.data(), num_round_members * sizeof(node_id_t))
+                        && all_ready;
+        }
+        for(const node_id_t member : responders) {
+            uint8_t other_ready = 0;
+            uint32_t other_num_members = 0;
+            if(!connections->read(member, (char*)&other_ready, sizeof(other_ready))
+               || !connections->read(member, (char*)&other_num_members, sizeof(other_num_members))
+               || other_num_members != num_round_members) {
+                all_ready = false;
+                continue;
+            }
+            std::vector<node_id_t> other_round_members(other_num_members);
+            all_ready = connections->read(member, (char*)other_round_members.data(), other_num_members * sizeof(node_id_t))
+                        && other_ready && other_round_members == round_members && all_ready;
+        }
+        if(all_ready) {
+            participants = round_members;
+            return connections;
+        }
+        connections->destroy();
+        if(!view_changed) {
+            std::cout << "Log recovery reached " << round_members.size() << " of the "
+                      << latest_view->num_members << " members of View " << latest_view->vid
+                      << "; retrying" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(RECOVERY_RETRY_DELAY_MS));
+        }
+    }
+}
+
+std::unique_ptr<View> LogRecovery::recover() {
+    //Step 1: Agree with a majority of the latest View on who takes part
+    std::unique_ptr<View> latest_view = load_view(log_filename + PAXOS_STATE_EXTENSION);
+    std::vector<node_id_t> participants;
+    std::unique_ptr<tcp::tcp_connections> connections = agree_on_view(latest_view, participants);
+
+    //Step 2: Exchange the last message of each subgroup in each log
+    std::map<node_id_t, log_tails_t> tails;
+    tails[my_id] = logged_tails();
+    std::vector<log_tail_position> my_tails;
+    for(const auto& subgroup_tail : tails[my_id]) {
+        my_tails.push_back(subgroup_tail.second);
+    }
+    const uint32_t num_my_tails = my_tails.size();
+    for(const node_id_t member : participants) {
+        if(member != my_id) {
+            send_value(*connections, member, num_my_tails);
+            if(!connections->write(member, (char*)my_tails.data(), num_my_tails * sizeof(log_tail_position))) {
+                throw derecho_exception("Log recovery lost its connection to node " + std::to_string(member));
+            }
+        }
+    }
+    std::set<uint32_t> subgroups;
+    for(const node_id_t member : participants) {
+        if(member != my_id) {
+            std::vector<log_tail_position> member_tails(receive_value<uint32_t>(*connections, member));
+            if(!connections->read(member, (char*)member_tails.data(), member_tails.size() * sizeof(log_tail_position))) {
+                throw derecho_exception("Log recovery lost its connection to node " + std::to_string(member));
+            }
+            for(const log_tail_position& tail : member_tails) {
+                tails[member][tail.subgroup_num] = tail;
+            }
+        }
+        for(const auto& subgroup_tail : tails[member]) {
+            subgroups.insert(subgroup_tail.first);
+        }
+    }
+
+    //Messages with the same index in a view are delivered in the order of their senders' ranks,
+    //which aren't recorded in the log; when two logs end in the same round, the one that contains
+    //the other's last message is ahead. Each member reports which of the other tails its log contains.
+    std::map<node_id_t, std::vector<uint8_t>> contains;
+    for(const node_id_t member : participants) {
+        for(const uint32_t subgroup : subgroups) {
+            auto tail = tails[member].find(subgroup);
+            contains[my_id].push_back(tail != tails[member].end() && log_contains(tail->second));
+        }
+    }
+    for(const node_id_t member : participants) {
+        if(member != my_id && !connections->write(member, (char*)contains[my_id].data(), contains[my_id].size())) {
+            throw derecho_exception("Log recovery lost its connection to node " + std::to_string(member));
+        }
+    }
+    for(const node_id_t member : participants) {
+        if(member != my_id) {
+            contains[member].resize(contains[my_id].size());
+            if(!connections->read(member, (char*)contains[member].data(), contains[member].size())) {
+                throw derecho_exception("Log recovery lost its connection to node " + std::to_string(member));
+            }
+        }
+    }
+    auto member_contains = [&](node_id_t member, node_id_t other_member, uint32_t subgroup) {
+        const std::size_t other_position = std::lower_bound(participants.begin(), participants.end(), other_member)
+                                           - participants.begin();
+        const std::size_t subgroup_position = std::distance(subgroups.begin(), subgroups.find(subgroup));
+        return contains[member][other_position * subgroups.size() + subgroup_position] != 0;
+    };
+    //True if member's log goes further than other_member's log in the subgroup
+    auto is_ahead = [&](node_id_t member, node_id_t other_member, uint32_t subgroup) {
+        auto tail = tails[member].find(subgroup);
+        auto other_tail = tails[other_member].find(subgroup);
+        if(other_tail == tails[other_member].end()) {
+            return tail != tails[member].end();
+        } else if(tail == tails[member].end()) {
+            return false;
+        }
+        const log_tail_position& position = tail->second;
+        const log_tail_position& other_position = other_tail->second;
+        if(position.view_id != other_position.view_id || position.index != other_position.index) {
+            return std::make_pair(position.view_id, position.index)
+                   > std::make_pair(other_position.view_id, other_position.index);
+        }
+        if(position.sender == other_position.sender) {
+            return position.batch_position > other_position.batch_position;
+        }
+        return member_contains(member, other_member, subgroup);
+    };
+
+    //Step 3: For each subgroup, the member that is furthest ahead (lowest ID wins ties)
+    //sends each member that is behind it the messages it is missing
+    std::map<node_id_t, std::set<uint32_t>> subgroups_to_send;
+    std::map<node_id_t, log_tails_t> tails_to_receive;
+    for(const uint32_t subgroup : subgroups) {
+        node_id_t longest_log_node = participants.front();
+        for(const node_id_t member : participants) {
+            if(is_ahead(member, longest_log_node, subgroup)) {
+                longest_log_node = member;
+            }
+        }
+        if(longest_log_node == my_id) {
+            for(const node_id_t member : participants) {
+                if(is_ahead(my_id, member, subgroup)) {
+                    subgroups_to_send[member].insert(subgroup);
+                }
+            }
+        } else if(is_ahead(longest_log_node, my_id, subgroup)) {
+            tails_to_receive[longest_log_node][subgroup] = tails[longest_log_node][subgroup];
+        }
+    }
+    //Sends run on their own threads, so that two members sending to each other can't deadlock
+    std::vector<std::thread> send_threads;
+    for(const auto& receiver_subgroups : subgroups_to_send) {
+        const log_tails_t& receiver_tails = tails.at(receiver_subgroups.first);
+        send_threads.emplace_back([this, &connections, &receiver_subgroups, &receiver_tails]() {
+            send_log_tail(*connections, receiver_subgroups.first, receiver_subgroups.second, receiver_tails);
+        });
+    }
+    std::vector<buffered_messages> received_tails;
+    std::exception_ptr receive_error;
+    try {
+        for(const auto& sender_tails : tails_to_receive) {
+            received_tails.push_back(receive_log_tail(*connections, sender_tails.first, sender_tails.second));
+        }
+    } catch(...) {
+        receive_error = std::current_exception();
+    }
+    for(std::thread& send_thread : send_threads) {
+        send_thread.join();
+    }
+    connections->destroy();
+    if(receive_error) {
+        std::rethrow_exception(receive_error);
+    }
+
+    //Step 4: The send threads read the local log, so it is only changed once they are done
+    if(!received_tails.empty()) {
+        merge_log_tails(received_tails);
+        const log_tails_t merged_tails = logged_tails();
+        for(const auto& sender_tails : tails_to_receive) {
+            for(const auto& expected_tail : sender_tails.second) {
+                auto tail = merged_tails.find(expected_tail.first);
+                if(tail == merged_tails.end() || !same_message(tail->second, expected_tail.second)) {
+                    throw derecho_exception("Log recovery did not bring the local log up to date with node "
+                                            + std::to_string(sender_tails.first));
+                }
+            }
+        }
+    }
+    return latest_view;
+}
+
+bool LogRecovery::send_log_tail(tcp::tcp_connections& connections, node_id_t receiver,
+                                const std::set<uint32_t>& subgroups, const log_tails_t& receiver_tails) {
+    std::vector<std::string> segment_filenames = log_segment_filenames(log_filename);
+    //A subgroup's messages are sent once the scan has passed the receiver's last message in that subgroup
+    std::set<uint32_t> initial_subgroups_started;
+    for(const uint32_t subgroup : subgroups) {
+        if(receiver_tails.count(subgroup) == 0) {
+            initial_subgroups_started.insert(subgroup);
+        }
+    }
+    auto should_send = [&](const message_metadata& record, std::set<uint32_t>& subgroups_started) {
+        if(subgroups.count(record.subgroup_num) == 0) {
+            return false;
+        } else if(subgroups_started.count(record.subgroup_num) > 0) {
+            return true;
+        } else if(is_message(record, receiver_tails.at(record.subgroup_num))) {
+            subgroups_started.insert(record.subgroup_num);
+        }
+        return false;
+    };
+    bool header_sent = false;
+    try {
+        uint64_t num_records = 0;
+        std::set<uint32_t> subgroups_started = initial_subgroups_started;
+        for(const std::string& segment : segment_filenames) {
+            LogReader log(segment);
+            for(const message_metadata& record : log) {
+                num_records += should_send(record, subgroups_started);
+            }
+        }
+        if(subgroups_started.size() < subgroups.size()) {
+            //The receiver's log has diverged from this one, or this log no longer reaches back that far
+            std::cerr << "ERROR: Node " << receiver << "'s last logged message is not in this node's log" << std::endl;
+            connections.write(receiver, (char*)&TRANSFER_FAILED, sizeof(TRANSFER_FAILED));
+            return false;
+        }
+        if(!connections.write(receiver, (char*)&num_records, sizeof(num_records))) {
+            return false;
+        }
+        header_sent = true;
+
+        //Each chunk is a record count, that many metadata records with offsets relative to
+        //the start of the chunk's data, and then the data of those messages
+        uint64_t checksum = CHECKSUM_INITIAL_VALUE;
+        std::vector<message_metadata> chunk_records;
+        std::vector<char> chunk_data;
+        auto send_chunk = [&]() {
+            uint32_t chunk_size = chunk_records.size();
+            bool sent = connections.write(receiver, (char*)&chunk_size, sizeof(chunk_size))
+                        && connections.write(receiver, (char*)chunk_records.data(), chunk_size * sizeof(message_metadata))
+                        && connections.write(receiver, chunk_data.data(), chunk_data.size());
+            checksum = update_checksum(checksum, chunk_data.data(), chunk_data.size());
+            chunk_records.clear();
+            chunk_data.clear();
+            return sent;
+        };
+        subgroups_started = initial_subgroups_started;
+        for(const std::string& segment : segment_filenames) {
+            LogReader log(segment);
+            int data_fd = ::open(segment.c_str(), O_RDONLY);
+            if(data_fd < 0) {
+                throw derecho_exception("Failed to open " + segment + ": " + strerror(errno));
+            }
+            for(const message_metadata& record : log) {
+                if(!should_send(record, subgroups_started)) {
+                    continue;
+                }
+                message_metadata chunk_record = record;
+                chunk_record.offset = chunk_data.size();
+                chunk_data.resize(chunk_data.size() + record.length);
+                if(::pread(data_fd, chunk_data.data() + chunk_record.offset, record.length, record.offset) != (ssize_t)record.length) {
+                    const std::string error = strerror(errno);
+                    ::close(data_fd);
+                    throw derecho_exception("Failed to read message data from " + segment + ": " + error);
+                }
+                chunk_records.push_back(chunk_record);
+                if(chunk_data.size() >= RECOVERY_CHUNK_SIZE && !send_chunk()) {
+                    ::close(data_fd);
+                    return false;
+                }
+            }
+            ::close(data_fd);
+        }
+        if(!chunk_records.empty() && !send_chunk()) {
+            return false;
+        }
+        return connections.write(receiver, (char*)&checksum, sizeof(checksum));
+    } catch(derecho_exception& ex) {
+        std::cerr << "ERROR: Log recovery failed to send the log tail to node " << receiver << ": " << ex.what() << std::endl;
+        if(header_sent) {
+            const uint32_t abort_chunk = 0;
+            connections.write(receiver, (char*)&abort_chunk, sizeof(abort_chunk));
+        } else {
+            connections.write(receiver, (char*)&TRANSFER_FAILED, sizeof(TRANSFER_FAILED));
+        }
+        return false;
+    }
+}
+
+buffered_messages LogRecovery::receive_log_tail(tcp::tcp_connections& connections, node_id_t sender,
+                                                const log_tails_t& expected_tails) {
+    buffered_messages received;
+    uint64_t num_records = 0;
+    bool success = connections.read(sender, (char*)&num_records, sizeof(num_records))
+                   && num_records != TRANSFER_FAILED;
+    uint64_t checksum = CHECKSUM_INITIAL_VALUE;
+    while(success && received.records.size() < num_records) {
+        uint32_t chunk_size;
+        success = connections.read(sender, (char*)&chunk_size, sizeof(chunk_size));
+        //A chunk of 0 records means the sender failed partway through
+        if(!success || chunk_size == 0 || received.records.size() + chunk_size > num_records) {
+            success = false;
+            break;
+        }
+        const std::size_t first_record = received.records.size();
+        received.records.resize(first_record + chunk_size);
+        success = connections.read(sender, (char*)(received.records.data() + first_record),
+                                   chunk_size * sizeof(message_metadata));
+        if(!success) {
+            break;
+        }
+        //Rewrite the offsets to point into the received data
+        const uint64_t chunk_data_offset = received.data.size();
+        uint64_t chunk_data_size = 0;
+        for(std::size_t record = first_record; record < received.records.size(); ++record) {
+            received.records[record].offset += chunk_data_offset;
+            chunk_data_size += received.records[record].length;
+        }
+        received.data.resize(chunk_data_offset + chunk_data_size);
+        success = connections.read(sender, received.data.data() + chunk_data_offset, chunk_data_size);
+        checksum = update_checksum(checksum, received.data.data() + chunk_data_offset, chunk_data_size);
+    }
+    uint64_t sender_checksum = 0;
+    success = success && connections.read(sender, (char*)&sender_checksum, sizeof(sender_checksum))
+              && sender_checksum == checksum;
+    if(!success) {
+        throw derecho_exception("Log recovery failed to receive the log tail from node " + std::to_string(sender));
+    }
+    for(const auto& expected_tail : expected_tails) {
+        auto last_record = std::find_if(received.records.rbegin(), received.records.rend(),
+                                        [&expected_tail](const message_metadata& record) {
+                                            return record.subgroup_num == expected_tail.first;
+                                        });
+        if(last_record == received.records.rend() || !is_message(*last_record, expected_tail.second)) {
+            throw derecho_exception("Log recovery did not receive all of node " + std::to_string(sender)
+                                    + "'s log tail");
+        }
+    }
+    return received;
+}
+
+buffered_messages LogRecovery::remove_messages_after_view(uint32_t view_id) {
+    buffered_messages removed;
+    const std::vector<std::string> segment_filenames = log_segment_filenames(log_filename);
+    //The first segment with a message from a later view, and the position of that message in it
+    std::size_t cut_segment = segment_filenames.size();
+    uint64_t cut_record = 0;
+    uint64_t cut_data_offset = 0;
+    std::map<uint32_t, log_position_t> cut_segment_last_messages;
+    for(std::size_t segment = 0; segment < segment_filenames.size(); ++segment) {
+        std::unique_ptr<LogReader> log;
+        try {
+            log = std::make_unique<LogReader>(segment_filenames[segment]);
+        } catch(derecho_exception& ex) {
+            //This node never wrote any messages to this file
+            continue;
+        }
+        //View IDs never decrease over the log
+        auto first_removed = std::upper_bound(log->begin(), log->end(), view_id,
+                                              [](uint32_t vid, const message_metadata& record) {
+                                                  return vid < record.view_id;
+                                              });
+        if(first_removed == log->end()) {
+            continue;
+        }
+        if(cut_segment == segment_filenames.size()) {
+            cut_segment = segment;
+            cut_record = first_removed - log->begin();
+            cut_data_offset = first_removed->offset;
+            for(auto record = log->begin(); record != first_removed; ++record) {
+                cut_segment_last_messages[record->subgroup_num] = log_position_t(record->view_id, record->index);
+            }
+        }
+        int data_fd = ::open(segment_filenames[segment].c_str(), O_RDONLY);
+        if(data_fd < 0) {
+            throw derecho_exception("Failed to open " + segment_filenames[segment] + ": " + strerror(errno));
+        }
+        for(auto record = first_removed; record != log->end(); ++record) {
+            message_metadata removed_record = *record;
+            removed_record.offset = removed.data.size();
+            removed.data.resize(removed.data.size() + record->length);
+            if(::pread(data_fd, removed.data.data() + removed_record.offset, record->length, record->offset)
+               != (ssize_t)record->length) {
+                const std::string error = strerror(errno);
+                ::close(data_fd);
+                throw derecho_exception("Failed to read message data from " + segment_filenames[segment] + ": " + error);
+            }
+            removed.records.push_back(removed_record);
+        }
+        ::close(data_fd);
+    }
+    if(cut_segment == segment_filenames.size()) {
+        return removed;
+    }
+
+    //Drop the segments after the cut from the manifest before deleting their files,
+    //so a crash can't leave it naming missing segments
+    if(LogManifest::exists(log_filename)) {
+        LogManifest manifest(log_filename);
+        manifest.segments.resize(cut_segment + 1);
+        manifest.segments.back().last_messages = cut_segment_last_messages;
+        if(!manifest.save()) {
+            throw derecho_exception("Log recovery failed to update the manifest of log " + log_filename);
+        }
+        for(std::size_t segment = cut_segment + 1; segment < segment_filenames.size(); ++segment) {
+            for(const std::string& extension : {std::string(), METADATA_EXTENSION, INDEX_EXTENSION}) {
+                if(::unlink((segment_filenames[segment] + extension).c_str()) != 0 && errno != ENOENT) {
+                    std::cerr << "Error removing log segment file " << segment_filenames[segment] + extension
+                              << ": " << strerror(errno) << std::endl;
+                }
+            }
+        }
+    }
+    //The index entries are in record order, so the ones for removed records are at the end
+    const std::string& cut_filename = segment_filenames[cut_segment];
+    uint64_t index_entries_kept = 0;
+    int index_fd = ::open((cut_filename + INDEX_EXTENSION).c_str(), O_RDONLY);
+    if(index_fd >= 0) {
+        index_entry entry;
+        while(::read(index_fd, &entry, sizeof(entry)) == sizeof(entry) && entry.record_number < cut_record) {
+            ++index_entries_kept;
+        }
+        ::close(index_fd);
+    }
+    if(::truncate((cut_filename + METADATA_EXTENSION).c_str(), sizeof(header) + cut_record * sizeof(message_metadata)) != 0
+       || ::truncate(cut_filename.c_str(), cut_data_offset) != 0
+       || (index_fd >= 0 && ::truncate((cut_filename + INDEX_EXTENSION).c_str(), index_entries_kept * sizeof(index_entry)) != 0)) {
+        throw derecho_exception("Log recovery failed to truncate log file " + cut_filename + ": " + strerror(errno));
+    }
+    return removed;
+}
+
+void LogRecovery::merge_log_tails(std::vector<buffered_messages>& received_tails) {
+    uint32_t first_view = std::numeric_limits<uint32_t>::max();
+    for(const buffered_messages& tail : received_tails) {
+        if(!tail.records.empty()) {
+            first_view = std::min(first_view, tail.records.front().view_id);
+        }
+    }
+    //The local log's messages from later views have to be written again after the received ones
+    received_tails.insert(received_tails.begin(), remove_messages_after_view(first_view));
+
+    std::vector<message> messages;
+    for(buffered_messages& tail : received_tails) {
+        for(const message_metadata& record : tail.records) {
+            message m{tail.data.data() + record.offset, record.length, record.view_id, record.sender,
+                      record.index, record.is_cooked != 0, record.subgroup_num};
+            m.batch_position = record.batch_position;
+            messages.push_back(m);
+        }
+    }
+    //Each tail is already in view order, and a stable sort keeps the local messages
+    //first within a view, followed by each tail's messages in their original order
+    std::stable_sort(messages.begin(), messages.end(), [](const message& lhs, const message& rhs) {
+        return lhs.view_id < rhs.view_id;
+    });
+
+    std::mutex written_mutex;
+    std::condition_variable written_cv;
+    std::size_t num_written = 0;
+    bool failed = false;
+    {
+        FileWriter file_writer([&](const std::vector<message>& batch) {
+            std::lock_guard<std::mutex> lock(written_mutex);
+            num_written += batch.size();
+            written_cv.notify_all();
+        },
+                               log_filename, 64, std::chrono::microseconds(0), false, segment_size);
+        for(const message& m : messages) {
+            if(!file_writer.write_message(m)) {
+                break;
+            }
+        }
+        std::unique_lock<std::mutex> lock(written_mutex);
+        //The writer doesn't acknowledge the batch it fails on, so check for failure now and then
+        while(num_written < messages.size() && !file_writer.has_failed()) {
+            written_cv.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        failed = num_written < messages.size();
+    }
+    if(failed) {
+        throw derecho_exception("Log recovery failed to write the received messages to log " + log_filename);
+    }
+}
+
+}  // namespace persistence
+}  // namespace derecho
@@ -0,0 +1,171 @@
+/**
+ * @file log_recovery.h
+ * @brief Contains the LogRecovery class, which brings a restarting member's
+ * saved View and message log up to date with the rest of its group.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "connection_manager.h"
+#include "log_reader.h"
+#include "view.h"
+
+namespace derecho {
+
+namespace persistence {
+
+/** The number of bytes of message data sent at once while transferring a log tail. */
+static const std::size_t RECOVERY_CHUNK_SIZE = 4 * 1024 * 1024;
+/** How long, in milliseconds, a recovering member tries to connect to each
+ * other member before leaving it out of the current round. */
+static const int RECOVERY_CONNECT_TIMEOUT_MS = 1000;
+/** How long, in milliseconds, a recovering member waits for a message from
+ * another member before treating it as failed. */
+static const int RECOVERY_READ_TIMEOUT_MS = 10000;
+/** How long, in milliseconds, to wait before starting another round after
+ * failing to reach a majority of the View. */
+static const int RECOVERY_RETRY_DELAY_MS = 1000;
+
+/**
+ * The last message from one subgroup in a log, as exchanged between
+ * recovering members.
+ */
+struct __attribute__((__packed__)) log_tail_position {
+    uint32_t subgroup_num;
+    uint32_t view_id;
+    uint64_t index;
+    uint32_t sender;
+    /** The message's position in its batch, since the messages of a batch share an index */
+    uint32_t batch_position;
+};
+
+/** The last message of each subgroup that has any messages in a log, by subgroup number. */
+using log_tails_t = std::map<uint32_t, log_tail_position>;
+
+/**
+ * Messages held in memory while they are moved into a log: their metadata
+ * records, in log order, with offsets into data instead of into a data file.
+ */
+struct buffered_messages {
+    std::vector<message_metadata> records;
+    std::vector<char> data;
+};
+
+/**
+ * Runs the recovery protocol for a member restarting from its log files,
+ * replacing the old log_recovery_helper.sh script. Every restarting member
+ * of the last View saved by this node runs the protocol at the same time,
+ * over TCP connections established for that purpose:
+ * 1. The members exchange their saved Views in rounds. Members that cannot
+ *    be reached within RECOVERY_CONNECT_TIMEOUT_MS, or that don't answer
+ *    within RECOVERY_READ_TIMEOUT_MS, are left out of the round. If any
+ *    member has a newer View, everyone adopts it and starts a new round with
+ *    its members. A round succeeds once a majority of the View's members
+ *    have the same View and have all reached each other; otherwise it is
+ *    retried after RECOVERY_RETRY_DELAY_MS. Members marked as failed in the
+ *    View are not contacted.
+ * 2. The members exchange the last message of each subgroup in their logs.
+ *    Since the predicates of different subgroups can be delivered by
+ *    different threads, logs interleave subgroups differently, so the
+ *    longest log is found separately for each subgroup.
+ * 3. For each subgroup, the member whose log goes furthest in it streams to
+ *    each other member the messages of that subgroup it is missing, in
+ *    chunks of RECOVERY_CHUNK_SIZE bytes. The receiver checks each transfer
+ *    against a checksum and the expected last messages before accepting it.
+ * 4. Once every transfer has arrived, the receiver merges them into its log
+ *    in view order, writing them with a FileWriter just as if they had been
+ *    delivered, so the log's index and manifest cover them too.
+ */
+class LogRecovery {
+private:
+    const node_id_t my_id;
+    /** The base name of the local log, to which the metadata and paxos state extensions are added. */
+    const std::string log_filename;
+    const uint32_t port;
+    /** The segment size the log is written with, or 0 if it is not segmented. */
+    const uint64_t segment_size;
+    const std::map<node_id_t, uint32_t> member_ports;
+
+    /** @return The last message of each subgroup in the local log. */
+    log_tails_t logged_tails() const;
+    /** @return True if the local log contains the given message. */
+    bool log_contains(const log_tail_position& position) const;
+    /**
+     * Runs rounds of step 1 until one succeeds.
+     * @param latest_view The saved View, which is replaced by any newer View
+     * adopted along the way
+     * @param participants Set to the sorted IDs of the members (including
+     * this one) that took part in the successful round
+     * @return The connections to the other participants
+     */
+    std::unique_ptr<tcp::tcp_connections> agree_on_view(std::unique_ptr<View>& latest_view,
+                                                        std::vector<node_id_t>& participants);
+    /**
+     * Sends the receiver every message in the local log from the given
+     * subgroups that comes after its last message in that subgroup. If the
+     * local log can't be read, or doesn't contain the receiver's last
+     * message, sends a failure marker instead, which the receiver rejects.
+     * @return True if the whole transfer was sent
+     */
+    bool send_log_tail(tcp::tcp_connections& connections, node_id_t receiver,
+                       const std::set<uint32_t>& subgroups, const log_tails_t& receiver_tails);
+    /**
+     * Receives the tail of another member's log into memory, without
+     * changing the local log.
+     * @param expected_tails The last message of each subgroup the sender is
+     * sending, according to its log
+     * @return The messages received, in the order of the sender's log
+     * @throws derecho_exception if the transfer failed or did not end at
+     * expected_tails
+     */
+    buffered_messages receive_log_tail(tcp::tcp_connections& connections, node_id_t sender,
+                                       const log_tails_t& expected_tails);
+    /**
+     * Takes every message from a view after the given one out of the local
+     * log, so that messages from earlier views can be written before them.
+     * Segments left empty are removed from the manifest.
+     * @return The messages removed, in log order
+     * @throws derecho_exception if the log could not be read or changed
+     */
+    buffered_messages remove_messages_after_view(uint32_t view_id);
+    /**
+     * Writes the received log tails into the local log, merged with its
+     * messages by view ID. Within a view, the local log's messages come
+     * first, and each tail's messages keep the order they had in its log.
+     * @throws derecho_exception if the messages could not all be written
+     */
+    void merge_log_tails(std::vector<buffered_messages>& received_tails);
+
+public:
+    /**
+     * @param my_id The ID of this node
+     * @param log_filename The base name of this node's log files
+     * @param port The port on which members listen for recovery connections
+     * @param segment_size The segment size the log is written with (see
+     * DerechoParams::log_segment_size), or 0 if it is not segmented
+     * @param member_ports (Optional) Ports for members that listen on a port
+     * other than the default, so that several members can run on one host
+     */
+    LogRecovery(node_id_t my_id, const std::string& log_filename, uint32_t port,
+                uint64_t segment_size, const std::map<node_id_t, uint32_t>& member_ports = {});
+
+    /**
+     * Runs the recovery protocol, blocking until a majority of the latest
+     * View's members have taken part. On return, the local paxos state file
+     * and log are up to date.
+     * @return The latest View known to any member that took part
+     * @throws derecho_exception if a member failed partway through the
+     * protocol, or a log transfer failed
+     */
+    std::unique_ptr<View> recover();
+};
+
+}  // namespace persistence
+}  // namespace derecho
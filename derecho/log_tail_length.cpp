@@ -8,12 +8,15 @@
 
 #include <cstdint>
 #include <cstdlib>
-#include <fstream>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <sys/stat.h>
+#include <vector>
 
+#include "log_manifest.h"
+#include "log_reader.h"
 #include "persistence.h"
-#include <mutils-serialization/SerializationSupport.hpp>
 
 using namespace derecho::persistence;
 
@@ -33,45 +36,30 @@ int main(int argc, char* argv[]) {
     uint32_t target_sender = std::atoi(argv[trailing_args_start + 2]);
     uint64_t target_index = std::atol(argv[trailing_args_start + 3]);
 
-    uint64_t target_offset = 0;
-    uint64_t target_size = 0;
-    std::ifstream metadata_file(filename + METADATA_EXTENSION, std::ios::binary);
-    message_metadata dummy_for_size;
-    std::size_t size_of_metadata = mutils::bytes_size(dummy_for_size);
-    char buffer[size_of_metadata];
-    //Read the header to get past it
-    header file_header;
-    metadata_file.read((char*)&file_header, sizeof(file_header));
-    //Scan through the metadata blocks until we find the one with the right sequence number
-    uint32_t vid = 0, sender = 0;
-    uint64_t index = 0;
-    while(!(vid == target_vid && sender == target_sender && index == target_index) && metadata_file) {
-        metadata_file.read(buffer, size_of_metadata);
-        auto metadata = mutils::from_bytes<message_metadata>(nullptr, buffer);
-        vid = metadata->view_id;
-        sender = metadata->sender;
-        index = metadata->index;
-        if(print_metadata) {
-            target_offset = metadata_file.tellg();
-        } else {
-            target_offset = metadata->offset;
-            target_size = metadata->length;
+    //In a segmented log, the tail is the rest of the segment containing the
+    //message plus all the segments after it. Recent messages are in later segments.
+    std::vector<std::string> segment_filenames = log_segment_filenames(filename);
+    std::string extension = print_metadata ? METADATA_EXTENSION : std::string();
+    uint64_t distance = 0;
+    for(auto segment = segment_filenames.rbegin(); segment != segment_filenames.rend(); ++segment) {
+        //Get the size of the whole file, so we can subtract from it
+        struct stat file_stat;
+        if(stat((*segment + extension).c_str(), &file_stat) != 0) {
+            continue;
         }
+        LogReader log(*segment);
+        LogReader::const_iterator target = log.find(target_vid, target_sender, target_index);
+        if(target == log.end()) {
+            distance += file_stat.st_size;
+            continue;
+        }
+        uint64_t endoftarget = print_metadata ? log.file_offset_of(target) + sizeof(message_metadata)
+                                              : target->offset + target->length;
+        distance += file_stat.st_size - endoftarget;
+        std::cout << distance << std::endl;
+        return 0;
     }
-    //Get the size of the whole file, so we can subtract from it
-    std::streamoff file_size = 0;
-    if(print_metadata) {
-        metadata_file.seekg(0, std::ios::end);
-        file_size = metadata_file.tellg();
-        target_size = size_of_metadata;
-    } else {
-        std::ifstream logfile(filename, std::ios::binary);
-        logfile.seekg(0, std::ios::end);
-        file_size = logfile.tellg();
-    }
-
-    auto endoftarget = target_offset + target_size;
-    auto distance = file_size - endoftarget;
-    std::cout << distance << std::endl;
-    return 0;
+    std::cerr << "Message " << target_vid << " " << target_sender << " " << target_index
+              << " is not in the log " << filename << std::endl;
+    return 1;
 }
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstring>
 #include <limits>
 #include <thread>
 
@@ -28,8 +29,6 @@ size_t index_of(T container, U elem) {
  * @param my_node_id The rank (ID) of this node in the group
  * @param sst The SST this group will use; created by the GMS (membership
  * service) for this group.
- * @param _free_message_buffers RDMCMessage buffers to use for RDMC sending/receiving
- * (there must be one for each sender in the group)
  * @param _max_payload_size The size of the largest possible message that will
  * be sent in this group, in bytes
  * @param _callbacks A set of functions to call when messages have reached
@@ -57,6 +56,9 @@ MulticastGroup::MulticastGroup(
         const std::map<subgroup_id_t, uint32_t>& subgroup_to_num_received_offset,
         const std::map<subgroup_id_t, std::vector<node_id_t>>& subgroup_to_membership,
         const std::map<subgroup_id_t, Mode>& subgroup_to_mode,
+        const std::map<subgroup_id_t, SSTSlotLayout>& subgroup_to_slot_layout,
+        const std::map<subgroup_id_t, BatchSettings>& subgroup_to_batch_settings,
+        const std::map<subgroup_id_t, uint32_t>& subgroup_to_send_weight,
         const DerechoParams derecho_params,
         std::vector<char> already_failed)
         : logger(spdlog::get("debug_log")),
@@ -72,38 +74,63 @@ MulticastGroup::MulticastGroup(
           subgroup_to_shard_and_rank(subgroup_to_shard_and_rank),
           subgroup_to_senders_and_sender_rank(subgroup_to_senders_and_sender_rank),
           subgroup_to_num_received_offset(subgroup_to_num_received_offset),
-          received_intervals(sst->num_received.size(), {-1, -1}),
+          received_windows(sst->num_received.size(), ReceivedWindow(window_size)),
           subgroup_to_membership(subgroup_to_membership),
           subgroup_to_mode(subgroup_to_mode),
+          subgroup_to_slot_layout(subgroup_to_slot_layout),
+          subgroup_to_batch_settings(subgroup_to_batch_settings),
+          subgroup_to_send_weight(subgroup_to_send_weight),
           rdmc_group_num_offset(0),
+          buffer_pool(std::make_shared<BufferPool>(max_msg_size)),
           future_message_indices(total_num_subgroups, 0),
           next_sends(total_num_subgroups),
           pending_sends(total_num_subgroups),
           current_sends(total_num_subgroups),
+          current_receives(total_num_subgroups),
+          locally_stable_rdmc_messages(total_num_subgroups),
+          locally_stable_sst_messages(total_num_subgroups),
+          non_persistent_messages(total_num_subgroups),
+          non_persistent_sst_messages(total_num_subgroups),
           next_message_to_deliver(total_num_subgroups),
+          msg_state_mtxs(total_num_subgroups),
+          send_window_versions(total_num_subgroups, 0),
+          send_window_cvs(total_num_subgroups),
+          pending_sendbuffer_requests(total_num_subgroups),
+          send_window_progress(total_num_subgroups, 0),
           sender_timeout(derecho_params.timeout_ms),
+          failure_detection_pause_ms(derecho_params.failure_detection_pause_ms),
+          phi_suspicion_threshold(derecho_params.phi_suspicion_threshold),
           sst(sst),
           sst_multicast_group_ptrs(total_num_subgroups),
           receiver_pred_handles(),
           stability_pred_handles(),
           delivery_pred_handles(),
           sender_pred_handles(),
-          last_transfer_medium(total_num_subgroups) {
+          last_transfer_medium(total_num_subgroups),
+          batches(total_num_subgroups),
+          batch_mtxs(total_num_subgroups),
+          batch_deadlines(total_num_subgroups, std::chrono::steady_clock::time_point::max()) {
     assert(window_size >= 1);
 
     if(!derecho_params.filename.empty()) {
         file_writer = std::make_unique<FileWriter>(make_file_written_callback(),
-                                                   derecho_params.filename);
+                                                   derecho_params.filename,
+                                                   derecho_params.filewriter_batch_size,
+                                                   std::chrono::microseconds(derecho_params.filewriter_batch_latency_us),
+                                                   derecho_params.filewriter_direct_io,
+                                                   derecho_params.log_segment_size);
     }
 
     for(uint i = 0; i < num_members; ++i) {
         node_id_to_sst_index[members[i]] = i;
     }
+    build_shard_indices();
 
-    for(const auto p : subgroup_to_shard_and_rank) {
-        auto num_shard_members = subgroup_to_membership.at(p.first).size();
-        while(free_message_buffers[p.first].size() < window_size * num_shard_members) {
-            free_message_buffers[p.first].emplace_back(max_msg_size);
+    allocate_message_rings();
+    initialize_send_scheduler();
+    for(const auto& p : subgroup_to_batch_settings) {
+        if(subgroup_to_shard_and_rank.count(p.first)) {
+            batches[p.first].buffer.resize(p.second.max_batch_size);
         }
     }
 
@@ -124,6 +151,9 @@ MulticastGroup::MulticastGroup(
     register_predicates();
     sender_thread = std::thread(&MulticastGroup::send_loop, this);
     timeout_thread = std::thread(&MulticastGroup::check_failures_loop, this);
+    if(!subgroup_to_batch_settings.empty()) {
+        batch_flush_thread = std::thread(&MulticastGroup::flush_batches_loop, this);
+    }
 }
 
 MulticastGroup::MulticastGroup(
@@ -136,6 +166,9 @@ MulticastGroup::MulticastGroup(
         const std::map<subgroup_id_t, uint32_t>& subgroup_to_num_received_offset,
         const std::map<subgroup_id_t, std::vector<node_id_t>>& subgroup_to_membership,
         const std::map<subgroup_id_t, Mode>& subgroup_to_mode,
+        const std::map<subgroup_id_t, SSTSlotLayout>& subgroup_to_slot_layout,
+        const std::map<subgroup_id_t, BatchSettings>& subgroup_to_batch_settings,
+        const std::map<subgroup_id_t, uint32_t>& subgroup_to_send_weight,
         std::vector<char> already_failed, uint32_t rpc_port)
         : logger(old_group.logger),
           members(_members),
@@ -150,24 +183,43 @@ MulticastGroup::MulticastGroup(
           subgroup_to_shard_and_rank(subgroup_to_shard_and_rank),
           subgroup_to_senders_and_sender_rank(subgroup_to_senders_and_sender_rank),
           subgroup_to_num_received_offset(subgroup_to_num_received_offset),
-          received_intervals(sst->num_received.size(), {-1, -1}),
+          received_windows(sst->num_received.size(), ReceivedWindow(window_size)),
           subgroup_to_membership(subgroup_to_membership),
           subgroup_to_mode(subgroup_to_mode),
+          subgroup_to_slot_layout(subgroup_to_slot_layout),
+          subgroup_to_batch_settings(subgroup_to_batch_settings),
+          subgroup_to_send_weight(subgroup_to_send_weight),
           rpc_callback(old_group.rpc_callback),
           rdmc_group_num_offset(old_group.rdmc_group_num_offset + old_group.num_members),
+          buffer_pool(old_group.buffer_pool),
           future_message_indices(total_num_subgroups, 0),
           next_sends(total_num_subgroups),
           pending_sends(total_num_subgroups),
           current_sends(total_num_subgroups),
+          current_receives(total_num_subgroups),
+          locally_stable_rdmc_messages(total_num_subgroups),
+          locally_stable_sst_messages(total_num_subgroups),
+          non_persistent_messages(total_num_subgroups),
+          non_persistent_sst_messages(total_num_subgroups),
           next_message_to_deliver(total_num_subgroups),
+          msg_state_mtxs(total_num_subgroups),
+          send_window_versions(total_num_subgroups, 0),
+          send_window_cvs(total_num_subgroups),
+          pending_sendbuffer_requests(total_num_subgroups),
+          send_window_progress(total_num_subgroups, 0),
           sender_timeout(old_group.sender_timeout),
+          failure_detection_pause_ms(old_group.failure_detection_pause_ms),
+          phi_suspicion_threshold(old_group.phi_suspicion_threshold),
           sst(sst),
           sst_multicast_group_ptrs(total_num_subgroups),
           receiver_pred_handles(),
           stability_pred_handles(),
           delivery_pred_handles(),
           sender_pred_handles(),
-          last_transfer_medium(total_num_subgroups) {
+          last_transfer_medium(total_num_subgroups),
+          batches(total_num_subgroups),
+          batch_mtxs(total_num_subgroups),
+          batch_deadlines(total_num_subgroups, std::chrono::steady_clock::time_point::max()) {
     // Make sure rdmc_group_num_offset didn't overflow.
     assert(old_group.rdmc_group_num_offset <= std::numeric_limits<uint16_t>::max() - old_group.num_members - num_members);
 
@@ -177,6 +229,7 @@ MulticastGroup::MulticastGroup(
     for(uint i = 0; i < num_members; ++i) {
         node_id_to_sst_index[members[i]] = i;
     }
+    build_shard_indices();
 
     // Convience function that takes a msg from the old group and
     // produces one suitable for this group.
@@ -184,7 +237,7 @@ MulticastGroup::MulticastGroup(
         msg.sender_id = members[member_index];
         msg.index = future_message_indices[subgroup_num]++;
 
-        header* h = (header*)msg.message_buffer.buffer.get();
+        header* h = (header*)msg.message_buffer.buffer;
         future_message_indices[subgroup_num] += h->pause_sending_turns;
 
         return std::move(msg);
@@ -202,61 +255,51 @@ MulticastGroup::MulticastGroup(
         return std::move(msg);
     };
 
-    for(const auto p : subgroup_to_shard_and_rank) {
-        auto num_shard_members = subgroup_to_membership.at(p.first).size();
-        while(free_message_buffers[p.first].size() < window_size * num_shard_members) {
-            free_message_buffers[p.first].emplace_back(max_msg_size);
+    allocate_message_rings();
+    initialize_send_scheduler();
+    for(const auto& p : subgroup_to_batch_settings) {
+        if(subgroup_to_shard_and_rank.count(p.first)) {
+            batches[p.first].buffer.resize(p.second.max_batch_size);
         }
     }
 
-    // Reclaim RDMCMessageBuffers from the old group, and supplement them with
-    // additional if the group has grown.
-    std::lock_guard<std::mutex> lock(old_group.msg_state_mtx);
-    for(const auto p : subgroup_to_shard_and_rank) {
-        const auto subgroup_num = p.first;
-        auto num_shard_members = subgroup_to_membership.at(p.first).size();
-        // for later: don't move extra message buffers
-        free_message_buffers[subgroup_num].swap(old_group.free_message_buffers[subgroup_num]);
-        while(free_message_buffers[subgroup_num].size() < old_group.window_size * num_shard_members) {
-            free_message_buffers[subgroup_num].emplace_back(max_msg_size);
-        }
+    // Message buffers of the old group's unfinished receives go back to the
+    // shared buffer pool when they are cleared.
+    std::vector<std::unique_lock<std::mutex>> old_group_locks;
+    for(std::mutex& old_msg_state_mtx : old_group.msg_state_mtxs) {
+        old_group_locks.emplace_back(old_msg_state_mtx);
     }
-
-    for(auto& msg : old_group.current_receives) {
-        free_message_buffers[msg.first.first].push_back(std::move(msg.second.message_buffer));
+    for(auto& subgroup_receives : old_group.current_receives) {
+        subgroup_receives.clear();
     }
-    old_group.current_receives.clear();
 
     // Assume that any locally stable messages failed. If we were the sender
     // than re-attempt, otherwise discard. TODO: Presumably the ragged edge
     // cleanup will want the chance to deliver some of these.
-    for(auto& p : old_group.locally_stable_rdmc_messages) {
-        if(p.second.size() == 0) {
+    for(subgroup_id_t subgroup_num = 0; subgroup_num < old_group.locally_stable_rdmc_messages.size(); ++subgroup_num) {
+        if(subgroup_num >= total_num_subgroups) {
             continue;
         }
-
-        for(auto& q : p.second) {
-            if(q.second.sender_id == members[member_index]) {
-                pending_sends[p.first].push(convert_msg(q.second, p.first));
-            } else {
-                free_message_buffers[p.first].push_back(std::move(q.second.message_buffer));
+        old_group.locally_stable_rdmc_messages[subgroup_num].for_each([&](long long int seq, RDMCMessage& msg) {
+            if(msg.sender_id == members[member_index]) {
+                pending_sends[subgroup_num].push(convert_msg(msg, subgroup_num));
             }
-        }
+        });
+        old_group.locally_stable_rdmc_messages[subgroup_num].clear();
     }
-    old_group.locally_stable_rdmc_messages.clear();
 
-    for(auto& p : old_group.locally_stable_sst_messages) {
-        if(p.second.size() == 0) {
-            continue;
-        }
+    for(auto& subgroup_messages : old_group.locally_stable_sst_messages) {
+        subgroup_messages.clear();
     }
-    old_group.locally_stable_sst_messages.clear();
 
     // Any messages that were being sent should be re-attempted.
     for(auto p : subgroup_to_shard_and_rank) {
         auto subgroup_num = p.first;
-        if(old_group.current_sends.size() > subgroup_num && old_group.current_sends[subgroup_num]) {
-            pending_sends[subgroup_num].push(convert_msg(*old_group.current_sends[subgroup_num], subgroup_num));
+        if(old_group.current_sends.size() > subgroup_num) {
+            for(auto& msg : old_group.current_sends[subgroup_num]) {
+                pending_sends[subgroup_num].push(convert_msg(msg, subgroup_num));
+            }
+            old_group.current_sends[subgroup_num].clear();
         }
 
         if(old_group.pending_sends.size() > subgroup_num) {
@@ -270,22 +313,57 @@ MulticastGroup::MulticastGroup(
             next_sends[subgroup_num] = convert_msg(*old_group.next_sends[subgroup_num], subgroup_num);
         }
 
-        for(auto& entry : old_group.non_persistent_messages[subgroup_num]) {
-            non_persistent_messages[subgroup_num].emplace(entry.first,
-                                                          convert_msg(entry.second, subgroup_num));
+        if(old_group.non_persistent_messages.size() > subgroup_num) {
+            old_group.non_persistent_messages[subgroup_num].for_each([&](long long int seq, RDMCMessage& msg) {
+                non_persistent_messages[subgroup_num].insert(seq, convert_msg(msg, subgroup_num));
+            });
+            old_group.non_persistent_messages[subgroup_num].clear();
+        }
+        if(old_group.non_persistent_sst_messages.size() > subgroup_num) {
+            old_group.non_persistent_sst_messages[subgroup_num].for_each([&](long long int seq, SSTMessage& msg) {
+                non_persistent_sst_messages[subgroup_num].insert(seq, convert_sst_msg(msg, subgroup_num));
+            });
+            old_group.non_persistent_sst_messages[subgroup_num].clear();
+        }
+    }
+
+    // Messages in the old group's open batches are sent in this group's
+    // batches, as soon as possible since they have already waited. If they
+    // don't fit in this group's batch, they are sent unbatched instead.
+    for(subgroup_id_t subgroup_num = 0; subgroup_num < old_group.batches.size(); ++subgroup_num) {
+        MessageBatch& old_batch = old_group.batches[subgroup_num];
+        const std::size_t old_carried_over_size = old_batch.carried_over.size() - old_batch.carried_over_sent;
+        if(!old_batch.num_messages && !old_carried_over_size) {
+            continue;
         }
-        old_group.non_persistent_messages.clear();
-        for(auto& entry : old_group.non_persistent_sst_messages[subgroup_num]) {
-            non_persistent_sst_messages[subgroup_num].emplace(entry.first,
-                                                              convert_sst_msg(entry.second, subgroup_num));
+        if(subgroup_num >= total_num_subgroups || batches[subgroup_num].buffer.empty()
+           || subgroup_to_senders_and_sender_rank.find(subgroup_num) == subgroup_to_senders_and_sender_rank.end()
+           || subgroup_to_senders_and_sender_rank.at(subgroup_num).second < 0) {
+            std::cerr << "WARNING: Messages batched in subgroup " << subgroup_num
+                      << " in the last view were not sent, since this node is no longer one of its senders" << std::endl;
+            continue;
+        }
+        MessageBatch& batch = batches[subgroup_num];
+        if(!old_carried_over_size && batch.buffer.size() >= old_batch.used) {
+            memcpy(batch.buffer.data(), old_batch.buffer.data(), old_batch.used);
+            batch.used = old_batch.used;
+            batch.num_messages = old_batch.num_messages;
+            batch.transfer_medium = old_batch.transfer_medium;
+        } else {
+            batch.carried_over.assign(old_batch.carried_over.begin() + old_batch.carried_over_sent,
+                                      old_batch.carried_over.end());
+            batch.carried_over.insert(batch.carried_over.end(), old_batch.buffer.begin(),
+                                      old_batch.buffer.begin() + old_batch.used);
+            batch.carried_over_transfer_medium = old_carried_over_size ? old_batch.carried_over_transfer_medium
+                                                                       : old_batch.transfer_medium;
         }
-        old_group.non_persistent_sst_messages.clear();
+        batch_deadlines[subgroup_num] = std::chrono::steady_clock::now();
     }
 
     // If the old group was using persistence, we should transfer its state to the new group
     file_writer = std::move(old_group.file_writer);
     if(file_writer) {
-        file_writer->set_message_written_upcall(make_file_written_callback());
+        file_writer->set_batch_written_upcall(make_file_written_callback());
     }
 
     initialize_sst_row();
@@ -305,36 +383,90 @@ MulticastGroup::MulticastGroup(
     register_predicates();
     sender_thread = std::thread(&MulticastGroup::send_loop, this);
     timeout_thread = std::thread(&MulticastGroup::check_failures_loop, this);
+    if(!subgroup_to_batch_settings.empty()) {
+        batch_flush_thread = std::thread(&MulticastGroup::flush_batches_loop, this);
+    }
 }
 
-std::function<void(persistence::message)> MulticastGroup::make_file_written_callback() {
-    return [this](persistence::message m) {
-        callbacks.local_persistence_callback(m.subgroup_num, m.sender, m.index, m.data,
-                                             m.length);
-        //m.sender is an ID, not a rank
-        uint sender_rank;
-        for(sender_rank = 0; sender_rank < num_members; ++sender_rank) {
-            if(members[sender_rank] == m.sender) break;
+batch_written_upcall_t MulticastGroup::make_file_written_callback() {
+    return [this](const std::vector<persistence::message>& batch) {
+        for(const persistence::message& m : batch) {
+            callbacks.local_persistence_callback(m.subgroup_num, m.sender, m.index, m.data,
+                                                 m.length);
         }
-        // m.data points to the char[] buffer in a MessageBuffer, so we need to find
-        // the msg corresponding to m and put its MessageBuffer on free_message_buffers
-        auto sequence_number = m.index * num_members + sender_rank;
-        {
-            std::lock_guard<std::mutex> lock(msg_state_mtx);
-            auto find_result = non_persistent_messages[m.subgroup_num].find(sequence_number);
-            assert(find_result != non_persistent_messages[m.subgroup_num].end());
-            RDMCMessage& m_msg = find_result->second;
-            free_message_buffers[m.subgroup_num].push_back(std::move(m_msg.message_buffer));
-            non_persistent_messages[m.subgroup_num].erase(find_result);
-            sst->persisted_num[member_index][m.subgroup_num] = sequence_number;
-            sst->put(get_shard_sst_indices(m.subgroup_num),
-                     (char*)std::addressof(sst->persisted_num[0][m.subgroup_num]) - sst->getBaseAddress(),
+        //Messages are written in delivery order, so the last one in each subgroup is the
+        //highest sequence number, and persisted_num only needs to be pushed once per subgroup
+        std::map<subgroup_id_t, long long int> highest_persisted;
+        for(const persistence::message& m : batch) {
+            std::lock_guard<std::mutex> lock(msg_state_mtxs[m.subgroup_num]);
+            //m.sender is an ID, not a rank; the sequence number uses its within-shard sender rank
+            const ShardIndex& shard_index = shard_indices[m.subgroup_num];
+            long long int sequence_number = m.index * shard_index.num_senders() + shard_index.sender_rank_of(m.sender);
+            // m.data points to the char[] buffer in a MessageBuffer, so we need to find
+            // the msg corresponding to m; erasing it returns its MessageBuffer to the pool.
+            // Each message of a batch is its own record, so the multicast is only
+            // persisted, and its buffer free, once the record ending it is written.
+            RDMCMessage* m_msg = non_persistent_messages[m.subgroup_num].find(sequence_number);
+            if(m_msg) {
+                if(m.data + m.length == m_msg->message_buffer.buffer + m_msg->size) {
+                    non_persistent_messages[m.subgroup_num].erase(sequence_number);
+                    highest_persisted[m.subgroup_num] = sequence_number;
+                }
+            } else {
+                //SST messages live in the SST slots, so there is no buffer to return
+                SSTMessage* m_sst_msg = non_persistent_sst_messages[m.subgroup_num].find(sequence_number);
+                assert(m_sst_msg);
+                if(m.data + m.length == m_sst_msg->buf + m_sst_msg->size) {
+                    non_persistent_sst_messages[m.subgroup_num].erase(sequence_number);
+                    highest_persisted[m.subgroup_num] = sequence_number;
+                }
+            }
+        }
+        for(const auto& subgroup_and_seq : highest_persisted) {
+            sst->persisted_num[member_index][subgroup_and_seq.first] = subgroup_and_seq.second;
+            sst->put(get_shard_sst_indices(subgroup_and_seq.first),
+                     (char*)std::addressof(sst->persisted_num[0][subgroup_and_seq.first]) - sst->getBaseAddress(),
                      sizeof(long long int));
         }
-
     };
 }
 
+void MulticastGroup::build_shard_indices() {
+    shard_indices.resize(total_num_subgroups);
+    shard_frontiers.resize(total_num_subgroups);
+    for(const auto& p : subgroup_to_membership) {
+        const std::vector<node_id_t>& shard_members = p.second;
+        const std::vector<int>& shard_senders = subgroup_to_senders_and_sender_rank.at(p.first).first;
+        ShardIndex& shard_index = shard_indices[p.first];
+        for(uint32_t shard_rank = 0; shard_rank < shard_members.size(); ++shard_rank) {
+            const uint32_t sst_row = node_id_to_sst_index.at(shard_members[shard_rank]);
+            shard_index.sst_rows.push_back(sst_row);
+            shard_index.row_offsets.push_back((int64_t)sst_row * sst->seq_num.rowLen);
+            if(shard_senders[shard_rank]) {
+                shard_index.sender_ranks_by_id.emplace_back(shard_members[shard_rank],
+                                                            shard_index.sender_sst_rows.size());
+                shard_index.sender_sst_rows.push_back(sst_row);
+                shard_index.sender_shard_ranks.push_back(shard_rank);
+            }
+        }
+        std::sort(shard_index.sender_ranks_by_id.begin(), shard_index.sender_ranks_by_id.end());
+    }
+}
+
+void MulticastGroup::allocate_message_rings() {
+    for(const auto& p : subgroup_to_shard_and_rank) {
+        subgroup_id_t subgroup_num = p.first;
+        // Each sender can have at most window_size messages in flight, so the
+        // sequence numbers a subgroup is tracking at once span no more than this
+        const std::size_t capacity = window_size * get_num_senders(subgroup_to_senders_and_sender_rank.at(subgroup_num).first);
+        current_receives[subgroup_num] = SequenceRing<RDMCMessage>(capacity);
+        locally_stable_rdmc_messages[subgroup_num] = SequenceRing<RDMCMessage>(capacity);
+        locally_stable_sst_messages[subgroup_num] = SequenceRing<SSTMessage>(capacity);
+        non_persistent_messages[subgroup_num] = SequenceRing<RDMCMessage>(capacity);
+        non_persistent_sst_messages[subgroup_num] = SequenceRing<SSTMessage>(capacity);
+    }
+}
+
 bool MulticastGroup::create_rdmc_sst_groups() {
     for(const auto& p : subgroup_to_membership) {
         uint32_t subgroup_num = p.first;
@@ -345,7 +477,10 @@ bool MulticastGroup::create_rdmc_sst_groups() {
         shard_senders = subgroup_to_senders_and_sender_rank.at(subgroup_num).first;
         num_shard_senders = get_num_senders(shard_senders);
         auto shard_sst_indices = get_shard_sst_indices(subgroup_num);
-        sst_multicast_group_ptrs[subgroup_num] = std::make_unique<sst::multicast_group<DerechoSST>>(sst, shard_sst_indices, window_size, shard_senders, subgroup_to_num_received_offset.at(subgroup_num), window_size * subgroup_num);
+        const SSTSlotLayout& slot_layout = subgroup_to_slot_layout.at(subgroup_num);
+        sst_multicast_group_ptrs[subgroup_num] = std::make_unique<sst::multicast_group<DerechoSST>>(
+                sst, shard_sst_indices, slot_layout.window_size, shard_senders,
+                subgroup_to_num_received_offset.at(subgroup_num), slot_layout.offset, slot_layout.max_msg_size);
         for(uint shard_rank = 0, sender_rank = -1; shard_rank < num_shard_members; ++shard_rank) {
             // don't create RDMC group if the shard member is never going to send
             if(!shard_senders[shard_rank]) {
@@ -360,7 +495,7 @@ bool MulticastGroup::create_rdmc_sst_groups() {
                 rdmc_receive_handler = [this, subgroup_num, shard_rank, sender_rank, node_id, num_shard_members, num_shard_senders, shard_sst_indices](char* data, size_t size) {
                     assert(this->sst);
                     uint32_t num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
-                    std::lock_guard<std::mutex> lock(msg_state_mtx);
+                    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
                     header* h = (header*)data;
                     long long int index = h->index;
                     auto beg_index = index;
@@ -370,21 +505,21 @@ bool MulticastGroup::create_rdmc_sst_groups() {
 
                     // Move message from current_receives to locally_stable_rdmc_messages.
                     if(node_id == members[member_index]) {
-                        assert(current_sends[subgroup_num]);
-                        locally_stable_rdmc_messages[subgroup_num][sequence_number] = std::move(*current_sends[subgroup_num]);
-                        current_sends[subgroup_num] = std::experimental::nullopt;
+                        assert(!current_sends[subgroup_num].empty());
+                        assert(current_sends[subgroup_num].front().index == index);
+                        locally_stable_rdmc_messages[subgroup_num].insert(sequence_number, std::move(current_sends[subgroup_num].front()));
+                        current_sends[subgroup_num].pop_front();
                     } else {
-                        auto it = current_receives.find({subgroup_num, sequence_number});
-                        assert(it != current_receives.end());
-                        auto& message = it->second;
-                        locally_stable_rdmc_messages[subgroup_num].emplace(sequence_number, std::move(message));
-                        current_receives.erase(it);
+                        RDMCMessage* message = current_receives[subgroup_num].find(sequence_number);
+                        assert(message);
+                        locally_stable_rdmc_messages[subgroup_num].insert(sequence_number, std::move(*message));
+                        current_receives[subgroup_num].erase(sequence_number);
                     }
                     // Add empty messages to locally_stable_rdmc_messages for each turn that the sender is skipping.
                     for(unsigned int j = 0; j < h->pause_sending_turns; ++j) {
                         index++;
                         sequence_number += num_shard_senders;
-                        locally_stable_rdmc_messages[subgroup_num][sequence_number] = {node_id, index, 0, 0};
+                        locally_stable_rdmc_messages[subgroup_num].insert(sequence_number, RDMCMessage{node_id, index, 0, {}});
                     }
 
                     auto new_num_received = resolve_num_received(beg_index, index, num_received_offset + sender_rank);
@@ -392,10 +527,10 @@ bool MulticastGroup::create_rdmc_sst_groups() {
                     if(new_num_received > sst->num_received[member_index][num_received_offset + sender_rank]) {
                         sst->num_received[member_index][num_received_offset + sender_rank] = new_num_received;
                         std::atomic_signal_fence(std::memory_order_acq_rel);
-                        auto* min_ptr = std::min_element(&sst->num_received[member_index][num_received_offset],
-                                                         &sst->num_received[member_index][num_received_offset + num_shard_senders]);
-                        uint min_index = std::distance(&sst->num_received[member_index][num_received_offset], min_ptr);
-                        auto new_seq_num = (*min_ptr + 1) * num_shard_senders + min_index - 1;
+                        ShardFrontiers& frontiers = shard_frontiers[subgroup_num];
+                        long long int min_num_received = frontiers.num_received.update(&sst->num_received[member_index][num_received_offset],
+                                                                                          num_shard_senders);
+                        long long int new_seq_num = (min_num_received + 1) * num_shard_senders + (long long int)frontiers.num_received.position() - 1;
                         if((long long int)new_seq_num > sst->seq_num[member_index][subgroup_num]) {
                             logger->debug("Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num);
                             sst->seq_num[member_index][subgroup_num] = new_seq_num;
@@ -415,7 +550,7 @@ bool MulticastGroup::create_rdmc_sst_groups() {
                                         shard_sst_indices](char* data, size_t size) {
                     assert(this->sst);
                     uint32_t num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
-                    std::lock_guard<std::mutex> lock(msg_state_mtx);
+                    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
                     header* h = (header*)data;
                     long long int index = h->index;
                     auto beg_index = index;
@@ -425,21 +560,21 @@ bool MulticastGroup::create_rdmc_sst_groups() {
 
                     // Move message from current_receives to locally_stable_rdmc_messages.
                     if(node_id == members[member_index]) {
-                        assert(current_sends[subgroup_num]);
-                        locally_stable_rdmc_messages[subgroup_num][sequence_number] = std::move(*current_sends[subgroup_num]);
-                        current_sends[subgroup_num] = std::experimental::nullopt;
+                        assert(!current_sends[subgroup_num].empty());
+                        assert(current_sends[subgroup_num].front().index == index);
+                        locally_stable_rdmc_messages[subgroup_num].insert(sequence_number, std::move(current_sends[subgroup_num].front()));
+                        current_sends[subgroup_num].pop_front();
                     } else {
-                        auto it = current_receives.find({subgroup_num, sequence_number});
-                        assert(it != current_receives.end());
-                        auto& message = it->second;
-                        locally_stable_rdmc_messages[subgroup_num].emplace(sequence_number, std::move(message));
-                        current_receives.erase(it);
+                        RDMCMessage* message = current_receives[subgroup_num].find(sequence_number);
+                        assert(message);
+                        locally_stable_rdmc_messages[subgroup_num].insert(sequence_number, std::move(*message));
+                        current_receives[subgroup_num].erase(sequence_number);
                     }
                     // Add empty messages to locally_stable_rdmc_messages for each turn that the sender is skipping.
                     for(unsigned int j = 0; j < h->pause_sending_turns; ++j) {
                         index++;
                         sequence_number += num_shard_senders;
-                        locally_stable_rdmc_messages[subgroup_num][sequence_number] = {node_id, index, 0, 0};
+                        locally_stable_rdmc_messages[subgroup_num].insert(sequence_number, RDMCMessage{node_id, index, 0, {}});
                     }
 
                     auto new_num_received = resolve_num_received(beg_index, index, num_received_offset + sender_rank);
@@ -447,39 +582,35 @@ bool MulticastGroup::create_rdmc_sst_groups() {
                     for(uint i = sst->num_received[member_index][num_received_offset + sender_rank] + 1; i <= new_num_received; ++i) {
                         auto seq_num = i * num_shard_senders + sender_rank;
                         if(!locally_stable_sst_messages[subgroup_num].empty()
-                           && locally_stable_sst_messages[subgroup_num].begin()->first == seq_num) {
-                            auto& msg = locally_stable_sst_messages[subgroup_num].begin()->second;
+                           && locally_stable_sst_messages[subgroup_num].front_seq() == seq_num) {
+                            auto& msg = locally_stable_sst_messages[subgroup_num].front();
                             if(msg.size > 0) {
                                 char* buf = const_cast<char*>(msg.buf);
-                                header* h = (header*)(buf);
-                                callbacks.global_stability_callback(subgroup_num, msg.sender_id,
-                                                                    msg.index, buf + h->header_size,
-                                                                    msg.size - h->header_size);
+                                for_each_message(buf, msg.size, [&](char* payload, long long unsigned int payload_size, bool cooked_send) {
+                                    callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index, payload, payload_size);
+                                });
                             }
-                            locally_stable_sst_messages[subgroup_num].erase(locally_stable_sst_messages[subgroup_num].begin());
+                            locally_stable_sst_messages[subgroup_num].pop_front();
                         } else {
                             assert(!locally_stable_rdmc_messages[subgroup_num].empty());
-                            auto it2 = locally_stable_rdmc_messages[subgroup_num].begin();
-                            assert(it2->first == seq_num);
-                            auto& msg = it2->second;
+                            assert(locally_stable_rdmc_messages[subgroup_num].front_seq() == seq_num);
+                            auto& msg = locally_stable_rdmc_messages[subgroup_num].front();
                             if(msg.size > 0) {
-                                char* buf = msg.message_buffer.buffer.get();
-                                header* h = (header*)(buf);
-                                callbacks.global_stability_callback(subgroup_num, msg.sender_id,
-                                                                    msg.index, buf + h->header_size,
-                                                                    msg.size - h->header_size);
-                                free_message_buffers[subgroup_num].push_back(std::move(msg.message_buffer));
+                                char* buf = msg.message_buffer.buffer;
+                                for_each_message(buf, msg.size, [&](char* payload, long long unsigned int payload_size, bool cooked_send) {
+                                    callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index, payload, payload_size);
+                                });
                             }
-                            locally_stable_rdmc_messages[subgroup_num].erase(it2);
+                            locally_stable_rdmc_messages[subgroup_num].pop_front();
                         }
                     }
                     if(new_num_received > sst->num_received[member_index][num_received_offset + sender_rank]) {
                         sst->num_received[member_index][num_received_offset + sender_rank] = new_num_received;
                         std::atomic_signal_fence(std::memory_order_acq_rel);
-                        auto* min_ptr = std::min_element(&sst->num_received[member_index][num_received_offset],
-                                                         &sst->num_received[member_index][num_received_offset + num_shard_senders]);
-                        uint min_index = std::distance(&sst->num_received[member_index][num_received_offset], min_ptr);
-                        auto new_seq_num = (*min_ptr + 1) * num_shard_senders + min_index - 1;
+                        ShardFrontiers& frontiers = shard_frontiers[subgroup_num];
+                        long long int min_num_received = frontiers.num_received.update(&sst->num_received[member_index][num_received_offset],
+                                                                                          num_shard_senders);
+                        long long int new_seq_num = (min_num_received + 1) * num_shard_senders + (long long int)frontiers.num_received.position() - 1;
                         if((long long int)new_seq_num > sst->seq_num[member_index][subgroup_num]) {
                             logger->debug("Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num);
                             sst->seq_num[member_index][subgroup_num] = new_seq_num;
@@ -496,10 +627,10 @@ bool MulticastGroup::create_rdmc_sst_groups() {
             }
             // Capture rdmc_receive_handler by copy! The reference to it won't be valid after this constructor ends!
             auto receive_handler_plus_notify =
-                    [this, rdmc_receive_handler](char* data, size_t size) {
+                    [this, subgroup_num, rdmc_receive_handler](char* data, size_t size) {
                         rdmc_receive_handler(data, size);
                         // signal background writer thread
-                        sender_cv.notify_all();
+                        wake_sender_thread(subgroup_num);
                     };
 
             // Create a "rotated" vector of members in which the currently selected shard member (shard_rank) is first
@@ -531,19 +662,17 @@ bool MulticastGroup::create_rdmc_sst_groups() {
                 if(!rdmc::create_group(
                            rdmc_group_num_offset, rotated_shard_members, block_size, type,
                            [this, subgroup_num, node_id, sender_rank, num_shard_senders](size_t length) {
-                               std::lock_guard<std::mutex> lock(msg_state_mtx);
-                               assert(!free_message_buffers[subgroup_num].empty());
+                               std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
                                //Create a Message struct to receive the data into.
                                RDMCMessage msg;
                                msg.sender_id = node_id;
                                msg.index = sst->num_received[member_index][subgroup_to_num_received_offset.at(subgroup_num) + sender_rank] + 1;
                                msg.size = length;
-                               msg.message_buffer = std::move(free_message_buffers[subgroup_num].back());
-                               free_message_buffers[subgroup_num].pop_back();
+                               msg.message_buffer = buffer_pool->acquire(length);
 
-                               rdmc::receive_destination ret{msg.message_buffer.mr, 0};
+                               rdmc::receive_destination ret{msg.message_buffer.mr, msg.message_buffer.mr_offset};
                                auto sequence_number = msg.index * num_shard_senders + sender_rank;
-                               current_receives[{subgroup_num, sequence_number}] = std::move(msg);
+                               current_receives[subgroup_num].insert(sequence_number, std::move(msg));
 
                                assert(ret.mr->buffer != nullptr);
                                return ret;
@@ -581,42 +710,50 @@ void MulticastGroup::initialize_sst_row() {
     sst->sync_with_members();
 }
 
+std::vector<persistence::message> MulticastGroup::make_log_records(char* buf, long long unsigned int msg_size,
+                                                                  node_id_t sender_id, long long int index,
+                                                                  subgroup_id_t subgroup_num) {
+    std::vector<persistence::message> records;
+    for_each_message(buf, msg_size, [&](char* payload, long long unsigned int payload_size, bool cooked_send) {
+        records.push_back(persistence::message{payload, payload_size, (uint32_t)sst->vid[member_index],
+                                               sender_id, (uint64_t)index, cooked_send, subgroup_num});
+        records.back().batch_position = records.size() - 1;
+    });
+    return records;
+}
+
 void MulticastGroup::deliver_message(RDMCMessage& msg, subgroup_id_t subgroup_num) {
     if(msg.size > 0) {
-        char* buf = msg.message_buffer.buffer.get();
+        char* buf = msg.message_buffer.buffer;
         header* h = (header*)(buf);
-        // cooked send
-        if(h->cooked_send) {
-            buf += h->header_size;
-            auto payload_size = msg.size - h->header_size;
-            rpc_callback(subgroup_num, msg.sender_id, buf, payload_size);
-        }
-        // raw send
-        else {
-            callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index,
-                                                buf + h->header_size, msg.size - h->header_size);
-        }
+        for_each_message(buf, msg.size, [&](char* payload, long long unsigned int payload_size, bool cooked_send) {
+            if(cooked_send) {
+                rpc_callback(subgroup_num, msg.sender_id, payload, payload_size);
+            } else {
+                callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index,
+                                                    payload, payload_size);
+            }
+        });
         if(file_writer) {
-            persistence::message msg_for_filewriter{buf + h->header_size,
-                                                    msg.size, (uint32_t)sst->vid[member_index],
-                                                    msg.sender_id, (uint64_t)msg.index,
-                                                    h->cooked_send};
+            std::vector<persistence::message> msgs_for_filewriter = make_log_records(buf, msg.size, msg.sender_id,
+                                                                                     msg.index, subgroup_num);
+            if(!h->batched) {
+                //The MessageBuffer is aligned for direct I/O, so it can be written without a copy
+                msgs_for_filewriter.front().direct_buffer = msg.message_buffer.buffer;
+                msgs_for_filewriter.front().direct_buffer_size = msg.message_buffer.capacity;
+            }
             //the sequence number needs to use the sender's within-shard rank, not its ID
-            auto& shard_members = subgroup_to_membership.at(subgroup_num);
-            std::vector<int> shard_senders = subgroup_to_senders_and_sender_rank.at(subgroup_num).first;
-            auto num_shard_senders = get_num_senders(shard_senders);
-            uint shard_rank;
-            uint sender_rank = 0;
-            for(shard_rank = 0; shard_rank < shard_members.size(); ++shard_rank) {
-                if(shard_members[shard_rank] == msg.sender_id) break;
-                if(shard_senders[shard_rank])
-                    sender_rank++;
+            const ShardIndex& shard_index = shard_indices[subgroup_num];
+            auto sequence_number = msg.index * shard_index.num_senders() + shard_index.sender_rank_of(msg.sender_id);
+            non_persistent_messages[subgroup_num].insert(sequence_number, std::move(msg));
+            for(const persistence::message& msg_for_filewriter : msgs_for_filewriter) {
+                if(!file_writer->write_message(msg_for_filewriter)) {
+                    report_log_failure();
+                    break;
+                }
             }
-            auto sequence_number = msg.index * num_shard_senders + sender_rank;
-            non_persistent_messages[subgroup_num].emplace(sequence_number, std::move(msg));
-            file_writer->write_message(msg_for_filewriter);
         } else {
-            free_message_buffers[subgroup_num].push_back(std::move(msg.message_buffer));
+            msg.message_buffer = MessageBuffer();
         }
     }
 }
@@ -624,46 +761,45 @@ void MulticastGroup::deliver_message(RDMCMessage& msg, subgroup_id_t subgroup_nu
 void MulticastGroup::deliver_message(SSTMessage& msg, subgroup_id_t subgroup_num) {
     if(msg.size > 0) {
         char* buf = const_cast<char*>(msg.buf);
-        header* h = (header*)(buf);
-        // cooked send
-        if(h->cooked_send) {
-            buf += h->header_size;
-            auto payload_size = msg.size - h->header_size;
-            rpc_callback(subgroup_num, msg.sender_id, buf, payload_size);
-        }
-        // raw send
-        else {
-            callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index,
-                                                buf + h->header_size, msg.size - h->header_size);
-        }
+        for_each_message(buf, msg.size, [&](char* payload, long long unsigned int payload_size, bool cooked_send) {
+            if(cooked_send) {
+                rpc_callback(subgroup_num, msg.sender_id, payload, payload_size);
+            } else {
+                callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index,
+                                                    payload, payload_size);
+            }
+        });
         if(file_writer) {
-            persistence::message msg_for_filewriter{buf + h->header_size,
-                                                    msg.size, (uint32_t)sst->vid[member_index],
-                                                    msg.sender_id, (uint64_t)msg.index,
-                                                    h->cooked_send};
+            std::vector<persistence::message> msgs_for_filewriter = make_log_records(buf, msg.size, msg.sender_id,
+                                                                                     msg.index, subgroup_num);
             //the sequence number needs to use the sender's within-shard rank, not its ID
-            auto& shard_members = subgroup_to_membership.at(subgroup_num);
-            std::vector<int> shard_senders = subgroup_to_senders_and_sender_rank.at(subgroup_num).first;
-            auto num_shard_senders = get_num_senders(shard_senders);
-            uint shard_rank;
-            uint sender_rank = 0;
-            for(shard_rank = 0; shard_rank < shard_members.size(); ++shard_rank) {
-                if(shard_members[shard_rank] == msg.sender_id) break;
-                if(shard_senders[shard_rank])
-                    sender_rank++;
+            const ShardIndex& shard_index = shard_indices[subgroup_num];
+            auto sequence_number = msg.index * shard_index.num_senders() + shard_index.sender_rank_of(msg.sender_id);
+            non_persistent_sst_messages[subgroup_num].insert(sequence_number, std::move(msg));
+            for(const persistence::message& msg_for_filewriter : msgs_for_filewriter) {
+                if(!file_writer->write_message(msg_for_filewriter)) {
+                    report_log_failure();
+                    break;
+                }
             }
-            auto sequence_number = msg.index * num_shard_senders + sender_rank;
-            non_persistent_sst_messages[subgroup_num].emplace(sequence_number, std::move(msg));
-            file_writer->write_message(msg_for_filewriter);
         }
     }
 }
 
+void MulticastGroup::report_log_failure() {
+    if(log_failure_reported.exchange(true)) {
+        return;
+    }
+    std::cerr << "ERROR: This node's log can no longer be written, so it is reporting itself as failed" << std::endl;
+    sst->suspected[member_index][member_index] = true;
+    sst->put((char*)std::addressof(sst->suspected[0][member_index]) - sst->getBaseAddress(), sizeof(bool));
+}
+
 void MulticastGroup::deliver_messages_upto(
         const std::vector<long long int>& max_indices_for_senders,
         subgroup_id_t subgroup_num, uint32_t num_shard_senders) {
     assert(max_indices_for_senders.size() == (size_t)num_shard_senders);
-    std::lock_guard<std::mutex> lock(msg_state_mtx);
+    std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
     auto curr_seq_num = sst->delivered_num[member_index][subgroup_num];
     auto max_seq_num = curr_seq_num;
     for(uint sender = 0; sender < num_shard_senders; sender++) {
@@ -671,15 +807,15 @@ void MulticastGroup::deliver_messages_upto(
                                max_indices_for_senders[sender] * num_shard_senders + sender);
     }
     for(auto seq_num = curr_seq_num; seq_num <= max_seq_num; seq_num++) {
-        auto msg_ptr = locally_stable_rdmc_messages[subgroup_num].find(seq_num);
-        if(msg_ptr != locally_stable_rdmc_messages[subgroup_num].end()) {
-            deliver_message(msg_ptr->second, subgroup_num);
-            locally_stable_rdmc_messages[subgroup_num].erase(msg_ptr);
+        RDMCMessage* msg_ptr = locally_stable_rdmc_messages[subgroup_num].find(seq_num);
+        if(msg_ptr) {
+            deliver_message(*msg_ptr, subgroup_num);
+            locally_stable_rdmc_messages[subgroup_num].erase(seq_num);
         } else {
-            auto sst_msg_ptr = locally_stable_sst_messages[subgroup_num].find(seq_num);
-            if(sst_msg_ptr != locally_stable_sst_messages[subgroup_num].end()) {
-                deliver_message(sst_msg_ptr->second, subgroup_num);
-                locally_stable_sst_messages[subgroup_num].erase(sst_msg_ptr);
+            SSTMessage* sst_msg_ptr = locally_stable_sst_messages[subgroup_num].find(seq_num);
+            if(sst_msg_ptr) {
+                deliver_message(*sst_msg_ptr, subgroup_num);
+                locally_stable_sst_messages[subgroup_num].erase(seq_num);
             }
         }
     }
@@ -688,71 +824,66 @@ void MulticastGroup::deliver_messages_upto(
 void MulticastGroup::register_predicates() {
     for(const auto& p : subgroup_to_shard_and_rank) {
         subgroup_id_t subgroup_num = p.first;
-        uint32_t shard_num, shard_index;
-        std::tie(shard_num, shard_index) = p.second;
-        std::vector<node_id_t> shard_members = subgroup_to_membership.at(subgroup_num);
-        auto num_shard_members = shard_members.size();
+        // shard_indices doesn't change until the next view, so the predicates can keep a pointer to it
+        const ShardIndex* shard_index = &shard_indices[subgroup_num];
+        auto num_shard_members = shard_index->sst_rows.size();
         auto num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
         std::vector<int> shard_senders = subgroup_to_senders_and_sender_rank.at(subgroup_num).first;
-        auto num_shard_senders = get_num_senders(shard_senders);
-        std::map<uint32_t, uint32_t> shard_ranks_by_sender_rank;
-        for(uint j = 0, l = 0; j < num_shard_members; ++j) {
-            if(shard_senders[j]) {
-                shard_ranks_by_sender_rank[l] = j;
-                l++;
-            }
-        }
+        auto num_shard_senders = shard_index->num_senders();
+        const SSTSlotLayout slot_layout = subgroup_to_slot_layout.at(subgroup_num);
+        // The predicates for a shard only read the shard members' rows (including this node's)
+        const std::vector<uint32_t>& shard_sst_indices = shard_index->sst_rows;
 
         if(subgroup_to_mode.at(subgroup_num) != Mode::RAW) {
-            auto receiver_pred = [this, subgroup_num, shard_members, num_shard_members, shard_ranks_by_sender_rank, num_shard_senders, num_received_offset](const DerechoSST& sst) {
+            auto receiver_pred = [this, subgroup_num, shard_index, num_shard_members, num_shard_senders, num_received_offset, slot_layout](const DerechoSST& sst) {
                 for(uint j = 0; j < num_shard_senders; ++j) {
                     auto num_received = sst.num_received_sst[member_index][num_received_offset + j] + 1;
-                    uint32_t slot = num_received % window_size;
-                    if((long long int)sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])][subgroup_num * window_size + slot].next_seq
-                       == num_received / window_size + 1) {
+                    volatile char* slot = get_sst_slot(sst, shard_index->sender_sst_rows[j], slot_layout, num_received);
+                    if((long long int)sst::trailer_of(slot, slot_layout.max_msg_size)->next_seq
+                       == num_received / slot_layout.window_size + 1) {
                         return true;
                     }
                 }
                 return false;
             };
-            auto num_times = window_size / 2;
+            auto num_times = slot_layout.window_size / 2;
             if(!num_times) {
                 num_times = 1;
             }
-            auto sst_receive_handler = [this, subgroup_num, shard_members, num_shard_members, shard_ranks_by_sender_rank, num_shard_senders, num_received_offset](uint32_t sender_rank, uint64_t index_ignored, volatile char* data, uint32_t size) {
+            auto sst_receive_handler = [this, subgroup_num, shard_index, num_shard_members, num_shard_senders, num_received_offset](uint32_t sender_rank, uint64_t index_ignored, volatile char* data, uint32_t size) {
                 header* h = (header*)data;
                 long long int index = h->index;
                 auto beg_index = index;
                 long long int sequence_number = index * num_shard_senders + sender_rank;
                 logger->debug("Locally received message in subgroup {}, sender rank {}, index {}", subgroup_num, sender_rank, index);
 
-                auto node_id = shard_members[shard_ranks_by_sender_rank.at(sender_rank)];
+                auto node_id = members[shard_index->sender_sst_rows[sender_rank]];
 
-                locally_stable_sst_messages[subgroup_num][sequence_number] = {node_id, index, size, data};
+                locally_stable_sst_messages[subgroup_num].insert(sequence_number, SSTMessage{node_id, index, size, data});
 
                 // Add empty messages to locally_stable_sst_messages for each turn that the sender is skipping.
                 for(unsigned int j = 0; j < h->pause_sending_turns; ++j) {
                     index++;
                     sequence_number += num_shard_senders;
-                    locally_stable_sst_messages[subgroup_num][sequence_number] = {node_id, index, 0, 0};
+                    locally_stable_sst_messages[subgroup_num].insert(sequence_number, SSTMessage{node_id, index, 0, 0});
                 }
 
                 auto new_num_received = resolve_num_received(beg_index, index, num_received_offset + sender_rank);
                 sst->num_received[member_index][num_received_offset + sender_rank] = new_num_received;
             };
-            auto receiver_trig = [this, num_times, sst_receive_handler, subgroup_num, shard_members,
-                                  num_shard_members, shard_ranks_by_sender_rank,
-                                  num_shard_senders, num_received_offset](DerechoSST& sst) {
-                std::lock_guard<std::mutex> lock(msg_state_mtx);
+            auto receiver_trig = [this, num_times, sst_receive_handler, subgroup_num,
+                                  num_shard_members, shard_index,
+                                  num_shard_senders, num_received_offset, slot_layout](DerechoSST& sst) {
+                std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
                 for(uint i = 0; i < num_times; ++i) {
                     for(uint j = 0; j < num_shard_senders; ++j) {
                         auto num_received = sst.num_received_sst[member_index][num_received_offset + j] + 1;
-                        uint32_t slot = num_received % window_size;
-                        long long int next_seq = (long long int)sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])][subgroup_num * window_size + slot].next_seq;
-                        if(next_seq == num_received / window_size + 1) {
+                        volatile char* slot = get_sst_slot(sst, shard_index->sender_sst_rows[j], slot_layout, num_received);
+                        long long int next_seq = (long long int)sst::trailer_of(slot, slot_layout.max_msg_size)->next_seq;
+                        if(next_seq == num_received / slot_layout.window_size + 1) {
                             sst_receive_handler(j, num_received,
-                                                sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])][subgroup_num * window_size + slot].buf,
-                                                sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])][subgroup_num * window_size + slot].size);
+                                                sst::payload_of(slot, slot_layout.max_msg_size),
+                                                sst::trailer_of(slot, slot_layout.max_msg_size)->size);
                             sst.num_received_sst[member_index][num_received_offset + j] = num_received;
                         }
                     }
@@ -760,10 +891,10 @@ void MulticastGroup::register_predicates() {
                 sst.put((char*)std::addressof(sst.num_received_sst[0][num_received_offset]) - sst.getBaseAddress(),
                         sizeof(sst.num_received_sst[0][0]) * num_shard_senders);
                 // std::atomic_signal_fence(std::memory_order_acq_rel);
-                auto* min_ptr = std::min_element(&sst.num_received[member_index][num_received_offset],
-                                                 &sst.num_received[member_index][num_received_offset + num_shard_senders]);
-                int min_index = std::distance(&sst.num_received[member_index][num_received_offset], min_ptr);
-                auto new_seq_num = (*min_ptr + 1) * num_shard_senders + min_index - 1;
+                ShardFrontiers& frontiers = shard_frontiers[subgroup_num];
+                long long int min_num_received = frontiers.num_received.update(&sst.num_received[member_index][num_received_offset],
+                                                                                  num_shard_senders);
+                long long int new_seq_num = (min_num_received + 1) * num_shard_senders + (long long int)frontiers.num_received.position() - 1;
                 if(new_seq_num > sst.seq_num[member_index][subgroup_num]) {
                     logger->debug("Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num);
                     sst.seq_num[member_index][subgroup_num] = new_seq_num;
@@ -774,21 +905,16 @@ void MulticastGroup::register_predicates() {
                         sizeof(long long int) * num_shard_senders);
             };
             receiver_pred_handles.emplace_back(sst->predicates.insert(receiver_pred, receiver_trig,
-                                                                         sst::PredicateType::RECURRENT));
+                                                                         sst::PredicateType::RECURRENT,
+                                                                         shard_sst_indices, subgroup_num));
 
             auto stability_pred = [this](
                     const DerechoSST& sst) { return true; };
             auto stability_trig =
-                    [this, subgroup_num, shard_members, num_shard_members](DerechoSST& sst) {
+                    [this, subgroup_num, shard_index, num_shard_members](DerechoSST& sst) {
                         // compute the min of the seq_num
-                        long long int min_seq_num
-                                = sst.seq_num[node_id_to_sst_index.at(shard_members[0])][subgroup_num];
-                        for(uint i = 0; i < num_shard_members; ++i) {
-                            if(sst.seq_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < min_seq_num) {
-                                min_seq_num
-                                        = sst.seq_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num];
-                            }
-                        }
+                        long long int min_seq_num = shard_frontiers[subgroup_num].seq_num.update(
+                                (volatile char*)&sst.seq_num[0][subgroup_num], shard_index->row_offsets.data(), num_shard_members);
                         if(min_seq_num > sst.stable_num[member_index][subgroup_num]) {
                             logger->debug("Subgroup {}, updating stable_num to {}", subgroup_num, min_seq_num);
                             sst.stable_num[member_index][subgroup_num] = min_seq_num;
@@ -798,21 +924,16 @@ void MulticastGroup::register_predicates() {
                         }
                     };
             stability_pred_handles.emplace_back(sst->predicates.insert(
-                    stability_pred, stability_trig, sst::PredicateType::RECURRENT));
+                    stability_pred, stability_trig, sst::PredicateType::RECURRENT, shard_sst_indices, subgroup_num));
 
             auto delivery_pred = [this](
                     const DerechoSST& sst) { return true; };
-            auto delivery_trig = [this, subgroup_num, shard_members, num_shard_members](
+            auto delivery_trig = [this, subgroup_num, shard_index, num_shard_members](
                     DerechoSST& sst) {
-                std::lock_guard<std::mutex> lock(msg_state_mtx);
+                std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
                 // compute the min of the stable_num
-                long long int min_stable_num
-                        = sst.stable_num[node_id_to_sst_index.at(shard_members[0])][subgroup_num];
-                for(uint i = 0; i < num_shard_members; ++i) {
-                    if(sst.stable_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < min_stable_num) {
-                        min_stable_num = sst.stable_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num];
-                    }
-                }
+                long long int min_stable_num = shard_frontiers[subgroup_num].stable_num.update(
+                        (volatile char*)&sst.stable_num[0][subgroup_num], shard_index->row_offsets.data(), num_shard_members);
 
                 bool update_sst = false;
                 while(true) {
@@ -822,27 +943,27 @@ void MulticastGroup::register_predicates() {
                     long long int least_undelivered_rdmc_seq_num, least_undelivered_sst_seq_num;
                     least_undelivered_rdmc_seq_num = least_undelivered_sst_seq_num = std::numeric_limits<long long int>::max();
                     if(!locally_stable_rdmc_messages[subgroup_num].empty()) {
-                        least_undelivered_rdmc_seq_num = locally_stable_rdmc_messages[subgroup_num].begin()->first;
+                        least_undelivered_rdmc_seq_num = locally_stable_rdmc_messages[subgroup_num].front_seq();
                     }
                     if(!locally_stable_sst_messages[subgroup_num].empty()) {
-                        least_undelivered_sst_seq_num = locally_stable_sst_messages[subgroup_num].begin()->first;
+                        least_undelivered_sst_seq_num = locally_stable_sst_messages[subgroup_num].front_seq();
                     }
                     if(least_undelivered_rdmc_seq_num < least_undelivered_sst_seq_num && least_undelivered_rdmc_seq_num <= min_stable_num) {
                         update_sst = true;
                         logger->debug("Subgroup {}, can deliver a locally stable message: min_stable_num={} and least_undelivered_seq_num={}",
                                       subgroup_num, min_stable_num, least_undelivered_rdmc_seq_num);
-                        RDMCMessage& msg = locally_stable_rdmc_messages[subgroup_num].begin()->second;
+                        RDMCMessage& msg = locally_stable_rdmc_messages[subgroup_num].front();
                         deliver_message(msg, subgroup_num);
                         sst.delivered_num[member_index][subgroup_num] = least_undelivered_rdmc_seq_num;
-                        locally_stable_rdmc_messages[subgroup_num].erase(locally_stable_rdmc_messages[subgroup_num].begin());
+                        locally_stable_rdmc_messages[subgroup_num].pop_front();
                     } else if(least_undelivered_sst_seq_num < least_undelivered_rdmc_seq_num && least_undelivered_sst_seq_num <= min_stable_num) {
                         update_sst = true;
                         logger->debug("Subgroup {}, can deliver a locally stable message: min_stable_num={} and least_undelivered_seq_num={}",
                                       subgroup_num, min_stable_num, least_undelivered_sst_seq_num);
-                        SSTMessage& msg = locally_stable_sst_messages[subgroup_num].begin()->second;
+                        SSTMessage& msg = locally_stable_sst_messages[subgroup_num].front();
                         deliver_message(msg, subgroup_num);
                         sst.delivered_num[member_index][subgroup_num] = least_undelivered_sst_seq_num;
-                        locally_stable_sst_messages[subgroup_num].erase(locally_stable_sst_messages[subgroup_num].begin());
+                        locally_stable_sst_messages[subgroup_num].pop_front();
                     } else {
                         break;
                     }
@@ -854,51 +975,54 @@ void MulticastGroup::register_predicates() {
                 }
             };
 
-            delivery_pred_handles.emplace_back(sst->predicates.insert(delivery_pred, delivery_trig, sst::PredicateType::RECURRENT));
+            // Messages only become deliverable when stable_num changes or a
+            // receive updates this node's row, so delivery can wait for those too
+            delivery_pred_handles.emplace_back(sst->predicates.insert(delivery_pred, delivery_trig,
+                                                                         sst::PredicateType::RECURRENT,
+                                                                         shard_sst_indices, subgroup_num));
 
             int shard_sender_index;
             std::tie(shard_senders, shard_sender_index) = subgroup_to_senders_and_sender_rank.at(subgroup_num);
             num_shard_senders = get_num_senders(shard_senders);
             if(shard_sender_index >= 0) {
-                auto sender_pred = [this, subgroup_num, shard_members, num_shard_members, shard_sender_index, num_shard_senders](const DerechoSST& sst) {
+                auto sender_pred = [this, subgroup_num, shard_index, num_shard_members, shard_sender_index, num_shard_senders](const DerechoSST& sst) {
                     long long int seq_num = next_message_to_deliver[subgroup_num] * num_shard_senders + shard_sender_index;
                     for(uint i = 0; i < num_shard_members; ++i) {
-                        if(sst.delivered_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < seq_num
-                           || (file_writer && sst.persisted_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < seq_num)) {
+                        if(sst.delivered_num[shard_index->sst_rows[i]][subgroup_num] < seq_num
+                           || (file_writer && sst.persisted_num[shard_index->sst_rows[i]][subgroup_num] < seq_num)) {
                             return false;
                         }
                     }
                     return true;
                 };
                 auto sender_trig = [this, subgroup_num](DerechoSST& sst) {
-                    sender_cv.notify_all();
+                    wake_sender_thread(subgroup_num);
                     next_message_to_deliver[subgroup_num]++;
                 };
                 sender_pred_handles.emplace_back(sst->predicates.insert(sender_pred, sender_trig,
-                                                                           sst::PredicateType::RECURRENT));
+                                                                           sst::PredicateType::RECURRENT,
+                                                                           shard_sst_indices, subgroup_num));
             }
         } else {
-            auto receiver_pred = [this, subgroup_num, shard_members, num_shard_members,
-                                  shard_ranks_by_sender_rank, num_shard_senders,
-                                  num_received_offset](const DerechoSST& sst) {
+            auto receiver_pred = [this, subgroup_num, num_shard_members,
+                                  shard_index, num_shard_senders,
+                                  num_received_offset, slot_layout](const DerechoSST& sst) {
                 for(uint j = 0; j < num_shard_senders; ++j) {
                     auto num_received = sst.num_received_sst[member_index][num_received_offset + j] + 1;
-                    uint32_t slot = num_received % window_size;
-                    if((long long int)sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])]
-                                               [subgroup_num * window_size + slot]
-                                                       .next_seq
-                       == num_received / window_size + 1) {
+                    volatile char* slot = get_sst_slot(sst, shard_index->sender_sst_rows[j], slot_layout, num_received);
+                    if((long long int)sst::trailer_of(slot, slot_layout.max_msg_size)->next_seq
+                       == num_received / slot_layout.window_size + 1) {
                         return true;
                     }
                 }
                 return false;
             };
-            auto num_times = window_size / 2;
+            auto num_times = slot_layout.window_size / 2;
             if(!num_times) {
                 num_times = 1;
             }
-            auto sst_receive_handler = [this, subgroup_num, shard_members, num_shard_members,
-                                        shard_ranks_by_sender_rank, num_shard_senders,
+            auto sst_receive_handler = [this, subgroup_num, num_shard_members,
+                                        shard_index, num_shard_senders,
                                         num_received_offset](uint32_t sender_rank, uint64_t index_ignored,
                                                              volatile char* data, uint32_t size) {
                 header* h = (header*)data;
@@ -907,15 +1031,15 @@ void MulticastGroup::register_predicates() {
                 long long int sequence_number = index * num_shard_senders + sender_rank;
                 logger->debug("Locally received message in subgroup {}, sender rank {}, index {}", subgroup_num, sender_rank, index);
 
-                auto node_id = shard_members[shard_ranks_by_sender_rank.at(sender_rank)];
+                auto node_id = members[shard_index->sender_sst_rows[sender_rank]];
 
-                locally_stable_sst_messages[subgroup_num][sequence_number] = {node_id, index, size, data};
+                locally_stable_sst_messages[subgroup_num].insert(sequence_number, SSTMessage{node_id, index, size, data});
 
                 // Add empty messages to locally_stable_sst_messages for each turn that the sender is skipping.
                 for(unsigned int j = 0; j < h->pause_sending_turns; ++j) {
                     index++;
                     sequence_number += num_shard_senders;
-                    locally_stable_sst_messages[subgroup_num][sequence_number] = {node_id, index, 0, 0};
+                    locally_stable_sst_messages[subgroup_num].insert(sequence_number, SSTMessage{node_id, index, 0, 0});
                 }
 
                 auto new_num_received = resolve_num_received(beg_index, index, num_received_offset + sender_rank);
@@ -923,47 +1047,43 @@ void MulticastGroup::register_predicates() {
                 for(uint i = sst->num_received[member_index][num_received_offset + sender_rank] + 1; i <= new_num_received; ++i) {
                     auto seq_num = i * num_shard_senders + sender_rank;
                     if(!locally_stable_sst_messages[subgroup_num].empty()
-                       && locally_stable_sst_messages[subgroup_num].begin()->first == seq_num) {
-                        auto& msg = locally_stable_sst_messages[subgroup_num].begin()->second;
+                       && locally_stable_sst_messages[subgroup_num].front_seq() == seq_num) {
+                        auto& msg = locally_stable_sst_messages[subgroup_num].front();
                         if(msg.size > 0) {
                             char* buf = const_cast<char*>(msg.buf);
-                            header* h = (header*)(buf);
-                            callbacks.global_stability_callback(subgroup_num, msg.sender_id,
-                                                                msg.index, buf + h->header_size,
-                                                                msg.size - h->header_size);
+                            for_each_message(buf, msg.size, [&](char* payload, long long unsigned int payload_size, bool cooked_send) {
+                                callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index, payload, payload_size);
+                            });
                         }
-                        locally_stable_sst_messages[subgroup_num].erase(locally_stable_sst_messages[subgroup_num].begin());
+                        locally_stable_sst_messages[subgroup_num].pop_front();
                     } else {
                         assert(!locally_stable_rdmc_messages[subgroup_num].empty());
-                        auto it2 = locally_stable_rdmc_messages[subgroup_num].begin();
-                        assert(it2->first == seq_num);
-                        auto& msg = it2->second;
+                        assert(locally_stable_rdmc_messages[subgroup_num].front_seq() == seq_num);
+                        auto& msg = locally_stable_rdmc_messages[subgroup_num].front();
                         if(msg.size > 0) {
-                            char* buf = msg.message_buffer.buffer.get();
-                            header* h = (header*)(buf);
-                            callbacks.global_stability_callback(subgroup_num, msg.sender_id,
-                                                                msg.index, buf + h->header_size,
-                                                                msg.size - h->header_size);
-                            free_message_buffers[subgroup_num].push_back(std::move(msg.message_buffer));
+                            char* buf = msg.message_buffer.buffer;
+                            for_each_message(buf, msg.size, [&](char* payload, long long unsigned int payload_size, bool cooked_send) {
+                                callbacks.global_stability_callback(subgroup_num, msg.sender_id, msg.index, payload, payload_size);
+                            });
                         }
-                        locally_stable_rdmc_messages[subgroup_num].erase(it2);
+                        locally_stable_rdmc_messages[subgroup_num].pop_front();
                     }
                 }
                 sst->num_received[member_index][num_received_offset + sender_rank] = new_num_received;
             };
-            auto receiver_trig = [this, num_times, sst_receive_handler, subgroup_num, shard_members,
-                                  num_shard_members, shard_ranks_by_sender_rank,
-                                  num_shard_senders, num_received_offset](DerechoSST& sst) {
-                std::lock_guard<std::mutex> lock(msg_state_mtx);
+            auto receiver_trig = [this, num_times, sst_receive_handler, subgroup_num,
+                                  num_shard_members, shard_index,
+                                  num_shard_senders, num_received_offset, slot_layout](DerechoSST& sst) {
+                std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
                 for(uint i = 0; i < num_times; ++i) {
                     for(uint j = 0; j < num_shard_senders; ++j) {
                         auto num_received = sst.num_received_sst[member_index][num_received_offset + j] + 1;
-                        uint32_t slot = num_received % window_size;
-                        long long int next_seq = (long long int)sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])][subgroup_num * window_size + slot].next_seq;
-                        if(next_seq == num_received / window_size + 1) {
+                        volatile char* slot = get_sst_slot(sst, shard_index->sender_sst_rows[j], slot_layout, num_received);
+                        long long int next_seq = (long long int)sst::trailer_of(slot, slot_layout.max_msg_size)->next_seq;
+                        if(next_seq == num_received / slot_layout.window_size + 1) {
                             sst_receive_handler(j, num_received,
-                                                sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])][subgroup_num * window_size + slot].buf,
-                                                sst.slots[node_id_to_sst_index.at(shard_members[shard_ranks_by_sender_rank.at(j)])][subgroup_num * window_size + slot].size);
+                                                sst::payload_of(slot, slot_layout.max_msg_size),
+                                                sst::trailer_of(slot, slot_layout.max_msg_size)->size);
                             sst.num_received_sst[member_index][num_received_offset + j] = num_received;
                         }
                     }
@@ -971,10 +1091,10 @@ void MulticastGroup::register_predicates() {
                 sst.put((char*)std::addressof(sst.num_received_sst[0][num_received_offset]) - sst.getBaseAddress(),
                         sizeof(sst.num_received_sst[0][0]) * num_shard_senders);
                 // std::atomic_signal_fence(std::memory_order_acq_rel);
-                auto* min_ptr = std::min_element(&sst.num_received[member_index][num_received_offset],
-                                                 &sst.num_received[member_index][num_received_offset + num_shard_senders]);
-                int min_index = std::distance(&sst.num_received[member_index][num_received_offset], min_ptr);
-                auto new_seq_num = (*min_ptr + 1) * num_shard_senders + min_index - 1;
+                ShardFrontiers& frontiers = shard_frontiers[subgroup_num];
+                long long int min_num_received = frontiers.num_received.update(&sst.num_received[member_index][num_received_offset],
+                                                                                  num_shard_senders);
+                long long int new_seq_num = (min_num_received + 1) * num_shard_senders + (long long int)frontiers.num_received.position() - 1;
                 if(new_seq_num > sst.seq_num[member_index][subgroup_num]) {
                     logger->debug("Updating seq_num for subgroup {} to {}", subgroup_num, new_seq_num);
                     sst.seq_num[member_index][subgroup_num] = new_seq_num;
@@ -985,16 +1105,16 @@ void MulticastGroup::register_predicates() {
                         sizeof(long long int) * num_shard_senders);
             };
             receiver_pred_handles.emplace_back(sst->predicates.insert(receiver_pred, receiver_trig,
-                                                                         sst::PredicateType::RECURRENT));
+                                                                         sst::PredicateType::RECURRENT,
+                                                                         shard_sst_indices, subgroup_num));
 
             int shard_sender_index;
             std::tie(shard_senders, shard_sender_index) = subgroup_to_senders_and_sender_rank.at(subgroup_num);
             num_shard_senders = get_num_senders(shard_senders);
             if(shard_sender_index >= 0) {
-                auto sender_pred = [this, subgroup_num, shard_members, num_shard_members, shard_sender_index, num_shard_senders](const DerechoSST& sst) {
+                auto sender_pred = [this, subgroup_num, shard_index, num_shard_members, shard_sender_index, num_received_offset](const DerechoSST& sst) {
                     for(uint i = 0; i < num_shard_members; ++i) {
-                        auto num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
-                        if(sst.num_received[node_id_to_sst_index.at(shard_members[i])][num_received_offset + shard_sender_index]
+                        if(sst.num_received[shard_index->sst_rows[i]][num_received_offset + shard_sender_index]
                            < (long long int)(future_message_indices[subgroup_num] - 1 - window_size)) {
                             return false;
                         }
@@ -1002,12 +1122,41 @@ void MulticastGroup::register_predicates() {
                     return true;
                 };
                 auto sender_trig = [this, subgroup_num](DerechoSST& sst) {
-                    sender_cv.notify_all();
+                    wake_sender_thread(subgroup_num);
                 };
                 sender_pred_handles.emplace_back(sst->predicates.insert(sender_pred, sender_trig,
-                                                                           sst::PredicateType::RECURRENT));
+                                                                           sst::PredicateType::RECURRENT,
+                                                                           {}, subgroup_num));
             }
         }
+
+        // Threads waiting for space in this node's send window are woken
+        // whenever a shard member makes progress on the messages filling it
+        const int my_sender_rank = subgroup_to_senders_and_sender_rank.at(subgroup_num).second;
+        if(my_sender_rank >= 0) {
+            auto send_window_progress_of = [subgroup_num, shard_sst_indices, num_received_offset,
+                                            my_sender_rank](const DerechoSST& sst) {
+                long long int progress = 0;
+                for(const uint32_t row : shard_sst_indices) {
+                    progress += sst.delivered_num[row][subgroup_num] + sst.persisted_num[row][subgroup_num]
+                                + sst.num_received[row][num_received_offset + my_sender_rank]
+                                + sst.num_received_sst[row][num_received_offset + my_sender_rank];
+                }
+                return progress;
+            };
+            auto send_window_pred = [this, subgroup_num, send_window_progress_of](const DerechoSST& sst) {
+                return send_window_progress_of(sst) != send_window_progress[subgroup_num];
+            };
+            auto send_window_trig = [this, subgroup_num, send_window_progress_of](DerechoSST& sst) {
+                send_window_progress[subgroup_num] = send_window_progress_of(sst);
+                notify_send_window(subgroup_num);
+                // The same progress may let a pending RDMC send go out
+                wake_sender_thread(subgroup_num);
+            };
+            sender_pred_handles.emplace_back(sst->predicates.insert(send_window_pred, send_window_trig,
+                                                                       sst::PredicateType::RECURRENT,
+                                                                       shard_sst_indices, subgroup_num));
+        }
     }
 }
 
@@ -1028,6 +1177,17 @@ long long unsigned int MulticastGroup::compute_max_msg_size(
     return max_msg_size;
 }
 
+void MulticastGroup::truncate_log(subgroup_id_t subgroup_num, uint32_t view_id, uint64_t index, bool background) {
+    if(!file_writer) {
+        return;
+    }
+    if(background) {
+        file_writer->report_snapshot(subgroup_num, view_id, index);
+    } else {
+        file_writer->truncate_before(subgroup_num, view_id, index);
+    }
+}
+
 void MulticastGroup::wedge() {
     bool thread_shutdown_existing = thread_shutdown.exchange(true);
     if(thread_shutdown_existing) {  // Wedge has already been called
@@ -1051,20 +1211,35 @@ void MulticastGroup::wedge() {
         sst->predicates.remove(*handle_iter);
         handle_iter = delivery_pred_handles.erase(handle_iter);
     }
+    // Release any threads waiting for space in a send window, which will never open now
+    for(subgroup_id_t subgroup_num = 0; subgroup_num < total_num_subgroups; ++subgroup_num) {
+        notify_send_window(subgroup_num);
+    }
+    // Triggers of the removed predicates may still be running on other predicate threads
+    sst->predicates.wait_for_running_triggers();
 
     for(uint i = 0; i < num_members; ++i) {
         rdmc::destroy_group(i + rdmc_group_num_offset);
     }
 
+    {
+        std::lock_guard<std::mutex> lock(sender_mtx);
+    }
     sender_cv.notify_all();
     if(sender_thread.joinable()) {
         sender_thread.join();
     }
+    {
+        std::lock_guard<std::mutex> lock(batch_flush_mtx);
+    }
+    batch_flush_cv.notify_all();
+    if(batch_flush_thread.joinable()) {
+        batch_flush_thread.join();
+    }
 }
 
 void MulticastGroup::send_loop() {
     pthread_setname_np(pthread_self(), "sender_thread");
-    subgroup_id_t subgroup_to_send = 0;
     auto should_send_to_subgroup = [&](subgroup_id_t subgroup_num) {
         if(!rdmc_sst_groups_created) {
             return false;
@@ -1073,38 +1248,28 @@ void MulticastGroup::send_loop() {
             return false;
         }
         RDMCMessage& msg = pending_sends[subgroup_num].front();
-        uint32_t shard_num;
-        uint32_t shard_index;
-
-        std::tie(shard_num, shard_index) = subgroup_to_shard_and_rank.at(subgroup_num);
-        uint32_t num_shard_senders;
-        int shard_sender_index;
-        std::vector<int> shard_senders;
-        std::tie(shard_senders, shard_sender_index) = subgroup_to_senders_and_sender_rank.at(subgroup_num);
-        num_shard_senders = get_num_senders(shard_senders);
+        const ShardIndex& shard_index = shard_indices[subgroup_num];
+        const uint32_t num_shard_senders = shard_index.num_senders();
+        const int shard_sender_index = subgroup_to_senders_and_sender_rank.at(subgroup_num).second;
         assert(shard_sender_index >= 0);
 
         // std::cout << "num_received offset = " << subgroup_to_num_received_offset.at(subgroup_num) + shard_sender_index <<
         //         ", num_received entry " <<  sst->num_received[member_index][subgroup_to_num_received_offset.at(subgroup_num) + shard_sender_index] <<
         //         ", message index = " << msg.index << std::endl;
-        if(sst->num_received[member_index][subgroup_to_num_received_offset.at(subgroup_num) + shard_sender_index] < msg.index - 1) {
-            return false;
-        }
-
-        std::vector<node_id_t> shard_members = subgroup_to_membership.at(subgroup_num);
-        auto num_shard_members = shard_members.size();
-        assert(num_shard_members >= 1);
+        // The previous message doesn't have to have finished: RDMC queues this one
+        // behind it, and the window checks below bound how many are in flight.
+        assert(!shard_index.sst_rows.empty());
         if(subgroup_to_mode.at(subgroup_num) != Mode::RAW) {
-            for(uint i = 0; i < num_shard_members; ++i) {
-                if(sst->delivered_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < (long long int)((msg.index - window_size) * num_shard_senders + shard_sender_index)
-                   || (file_writer && sst->persisted_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < (long long int)((msg.index - window_size) * num_shard_senders + shard_sender_index))) {
+            for(const uint32_t row : shard_index.sst_rows) {
+                if(sst->delivered_num[row][subgroup_num] < (long long int)((msg.index - window_size) * num_shard_senders + shard_sender_index)
+                   || (file_writer && sst->persisted_num[row][subgroup_num] < (long long int)((msg.index - window_size) * num_shard_senders + shard_sender_index))) {
                     return false;
                 }
             }
         } else {
-            for(uint i = 0; i < num_shard_members; ++i) {
-                auto num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
-                if(sst->num_received[node_id_to_sst_index.at(shard_members[i])][num_received_offset + shard_sender_index] < (long long int)(future_message_indices[subgroup_num] - 1 - window_size)) {
+            auto num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
+            for(const uint32_t row : shard_index.sst_rows) {
+                if(sst->num_received[row][num_received_offset + shard_sender_index] < (long long int)(future_message_indices[subgroup_num] - 1 - window_size)) {
                     return false;
                 }
             }
@@ -1112,29 +1277,63 @@ void MulticastGroup::send_loop() {
 
         return true;
     };
-    auto should_send = [&]() {
-        for(uint i = 1; i <= total_num_subgroups; ++i) {
-            if(should_send_to_subgroup((subgroup_to_send + i) % total_num_subgroups)) {
-                subgroup_to_send = (subgroup_to_send + i) % total_num_subgroups;
-                return true;
-            }
-        }
-        return false;
-    };
-    auto should_wake = [&]() { return thread_shutdown || should_send(); };
+    std::vector<subgroup_id_t> subgroups_to_check;
+    std::vector<subgroup_id_t> ready_subgroups;
     try {
-        std::unique_lock<std::mutex> lock(msg_state_mtx);
+        std::unique_lock<std::mutex> lock(sender_mtx);
         while(!thread_shutdown) {
-            sender_cv.wait(lock, should_wake);
-            if(!thread_shutdown) {
-                current_sends[subgroup_to_send] = std::move(pending_sends[subgroup_to_send].front());
-                logger->debug("Calling send in subgroup {} on message {} from sender {}", subgroup_to_send, current_sends[subgroup_to_send]->index, current_sends[subgroup_to_send]->sender_id);
-                if(!rdmc::send(subgroup_to_rdmc_group[subgroup_to_send],
-                               current_sends[subgroup_to_send]->message_buffer.mr, 0,
-                               current_sends[subgroup_to_send]->size)) {
-                    throw std::runtime_error("rdmc::send returned false");
+            sender_cv.wait(lock, [&]() { return thread_shutdown || !send_candidates.empty(); });
+            if(thread_shutdown) {
+                break;
+            }
+            subgroups_to_check.swap(send_candidates);
+            ready_subgroups.clear();
+            for(const subgroup_id_t subgroup_num : subgroups_to_check) {
+                is_send_candidate[subgroup_num] = false;
+                std::lock_guard<std::mutex> subgroup_lock(msg_state_mtxs[subgroup_num]);
+                if(should_send_to_subgroup(subgroup_num)) {
+                    ready_subgroups.push_back(subgroup_num);
+                }
+            }
+            subgroups_to_check.clear();
+            // RDMC calls the completion handler, which takes msg_state_mtx and sender_mtx,
+            // with its own lock held, so no send can be made while holding either of them
+            // now that RDMC may still be sending an earlier message from the subgroup.
+            lock.unlock();
+            // Each subgroup has its own RDMC group, so all of their sends can be in flight at once.
+            // A subgroup posts up to its send weight in messages per pass, so when several
+            // subgroups have messages backed up, each gets a share of the sends in proportion to it.
+            for(const subgroup_id_t subgroup_to_send : ready_subgroups) {
+                for(uint32_t num_sent = 0; num_sent < send_quotas[subgroup_to_send]; ++num_sent) {
+                    std::shared_ptr<rdma::memory_region> mr;
+                    size_t mr_offset, size;
+                    {
+                        std::lock_guard<std::mutex> subgroup_lock(msg_state_mtxs[subgroup_to_send]);
+                        if(num_sent > 0 && !should_send_to_subgroup(subgroup_to_send)) {
+                            break;
+                        }
+                        current_sends[subgroup_to_send].push_back(std::move(pending_sends[subgroup_to_send].front()));
+                        pending_sends[subgroup_to_send].pop();
+                        const RDMCMessage& msg = current_sends[subgroup_to_send].back();
+                        logger->debug("Calling send in subgroup {} on message {} from sender {}", subgroup_to_send, msg.index, msg.sender_id);
+                        mr = msg.message_buffer.mr;
+                        mr_offset = msg.message_buffer.mr_offset;
+                        size = msg.size;
+                    }
+                    // Only this thread adds to current_sends, so messages still reach RDMC in order
+                    if(!rdmc::send(subgroup_to_rdmc_group[subgroup_to_send], mr, mr_offset, size)) {
+                        throw std::runtime_error("rdmc::send returned false");
+                    }
+                }
+            }
+            lock.lock();
+            // The next message of a subgroup that just sent can follow it into the RDMC queue
+            // if the window allows, without waiting for this one to complete
+            for(const subgroup_id_t subgroup_num : ready_subgroups) {
+                if(!is_send_candidate[subgroup_num]) {
+                    is_send_candidate[subgroup_num] = true;
+                    send_candidates.push_back(subgroup_num);
                 }
-                pending_sends[subgroup_to_send].pop();
             }
         }
         std::cout << "DerechoGroup send thread shutting down" << std::endl;
@@ -1143,26 +1342,121 @@ void MulticastGroup::send_loop() {
     }
 }
 
+void MulticastGroup::initialize_send_scheduler() {
+    send_quotas.assign(total_num_subgroups, 1);
+    for(const auto& p : subgroup_to_send_weight) {
+        send_quotas[p.first] = p.second;
+    }
+    is_send_candidate.assign(total_num_subgroups, false);
+    for(const auto& p : subgroup_to_shard_and_rank) {
+        send_candidates.push_back(p.first);
+        is_send_candidate[p.first] = true;
+    }
+}
+
+void MulticastGroup::wake_sender_thread(subgroup_id_t subgroup_num) {
+    {
+        //Taking the lock ensures the sender thread is either waiting or has
+        //not yet checked the candidates this notification adds to
+        std::lock_guard<std::mutex> lock(sender_mtx);
+        if(is_send_candidate[subgroup_num]) {
+            return;
+        }
+        is_send_candidate[subgroup_num] = true;
+        send_candidates.push_back(subgroup_num);
+    }
+    sender_cv.notify_all();
+}
+
+void MulticastGroup::notify_send_window(subgroup_id_t subgroup_num) {
+    std::list<SendBufferRequest> requests;
+    {
+        std::lock_guard<std::mutex> lock(send_window_mtx);
+        send_window_versions[subgroup_num]++;
+        requests.swap(pending_sendbuffer_requests[subgroup_num]);
+    }
+    send_window_cvs[subgroup_num].notify_all();
+    while(!requests.empty()) {
+        SendBufferRequest& request = requests.front();
+        char* buf = get_sendbuffer_ptr(subgroup_num, request.payload_size, request.transfer_medium,
+                                       request.pause_sending_turns, request.cooked_send, request.null_send);
+        // the window is full again, so the rest must keep waiting
+        if(!buf && !thread_shutdown) {
+            break;
+        }
+        request.promise.set_value(buf);
+        requests.pop_front();
+    }
+    if(!requests.empty()) {
+        std::lock_guard<std::mutex> lock(send_window_mtx);
+        auto& pending_requests = pending_sendbuffer_requests[subgroup_num];
+        pending_requests.splice(pending_requests.begin(), requests);
+    }
+}
+
 void MulticastGroup::check_failures_loop() {
     pthread_setname_np(pthread_self(), "timeout_thread");
+    if(!sst) {
+        return;
+    }
+    const uint32_t num_rows = sst->get_num_rows();
+    const uint32_t my_row = sst->get_local_index();
+    // Any write from a row's owner changes the row's version, so application
+    // traffic counts as a sign of life and heartbeats are only needed when idle
+    std::vector<sst::PhiAccrualDetector> detectors;
+    std::vector<uint64_t> last_row_versions(num_rows);
+    std::vector<uint64_t> last_put_versions(num_rows);
+    const auto start_time = sst::PhiAccrualDetector::clock::now();
+    for(uint32_t row = 0; row < num_rows; ++row) {
+        detectors.emplace_back(sender_timeout, failure_detection_pause_ms, sender_timeout, 128, start_time);
+        last_row_versions[row] = sst->get_row_version(row);
+        last_put_versions[row] = sst->get_last_put_version(row);
+    }
+    std::vector<uint32_t> idle_rows;
+    std::vector<uint32_t> suspected_rows;
     while(!thread_shutdown) {
         std::this_thread::sleep_for(std::chrono::milliseconds(sender_timeout));
-        if(sst) {
-            sst->put_with_completion((char*)std::addressof(sst->heartbeat[0]) - sst->getBaseAddress(), sizeof(bool));
+        const auto now = sst::PhiAccrualDetector::clock::now();
+        idle_rows.clear();
+        suspected_rows.clear();
+        for(uint32_t row = 0; row < num_rows; ++row) {
+            if(row == my_row || sst->is_frozen(row)) {
+                continue;
+            }
+            const uint64_t row_version = sst->get_row_version(row);
+            if(row_version != last_row_versions[row]) {
+                last_row_versions[row] = row_version;
+                detectors[row].heartbeat(now);
+            } else if(detectors[row].phi(now) > phi_suspicion_threshold) {
+                suspected_rows.push_back(row);
+                continue;
+            }
+            const uint64_t put_version = sst->get_last_put_version(row);
+            if(put_version == last_put_versions[row]) {
+                idle_rows.push_back(row);
+            }
+            last_put_versions[row] = put_version;
+        }
+        // A single non-blocking put covers every idle row, so a slow node can't delay the others
+        if(!idle_rows.empty()) {
+            sst->put(idle_rows, (char*)std::addressof(sst->heartbeat[0]) - sst->getBaseAddress(), sizeof(bool));
+            for(const uint32_t row : idle_rows) {
+                last_put_versions[row] = sst->get_last_put_version(row);
+            }
+        }
+        for(const uint32_t row : suspected_rows) {
+            std::cerr << "Failure detector suspects row " << row
+                      << ": no writes from it for longer than its suspicion threshold" << std::endl;
+            sst->freeze(row);
         }
     }
 
     std::cout << "timeout_thread shutting down" << std::endl;
 }
 
-char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
-                                         long long unsigned int payload_size,
-                                         bool transfer_medium, int pause_sending_turns,
-                                         bool cooked_send, bool null_send) {
-    // if rdmc groups were not created because of failures, return NULL
-    if(!rdmc_sst_groups_created) {
-        return NULL;
-    }
+long long unsigned int MulticastGroup::get_msg_size(subgroup_id_t subgroup_num,
+                                                    long long unsigned int payload_size,
+                                                    bool transfer_medium, bool null_send) {
     long long unsigned int msg_size = payload_size + sizeof(header);
     // payload_size is 0 when max_msg_size is desired, useful for ordered send/query
     if(!payload_size) {
@@ -1171,35 +1465,171 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
     if(null_send) {
         msg_size = sizeof(header);
     }
-    if(msg_size > max_msg_size) {
+    // messages sent over the SST are limited by the size of the subgroup's slots
+    long long unsigned int medium_max_msg_size = max_msg_size;
+    if(!transfer_medium) {
+        medium_max_msg_size = subgroup_to_slot_layout.at(subgroup_num).max_msg_size;
+        if(!payload_size && !null_send) {
+            msg_size = medium_max_msg_size;
+        }
+    }
+    if(msg_size > medium_max_msg_size) {
         std::cout << "Can't send messages of size larger than the maximum message "
                      "size which is equal to "
-                  << max_msg_size << std::endl;
+                  << medium_max_msg_size << std::endl;
+        return 0;
+    }
+    return msg_size;
+}
+
+char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
+                                         long long unsigned int payload_size,
+                                         bool transfer_medium, int pause_sending_turns,
+                                         bool cooked_send, bool null_send) {
+    if(!subgroup_to_batch_settings.count(subgroup_num)) {
+        return get_multicast_buffer_ptr(subgroup_num, payload_size, transfer_medium,
+                                        pause_sending_turns, cooked_send, null_send);
+    }
+    if(thread_shutdown || !rdmc_sst_groups_created) {
         return nullptr;
     }
+    std::lock_guard<std::mutex> lock(batch_mtxs[subgroup_num]);
+    MessageBatch& batch = batches[subgroup_num];
+    // Asking for another buffer abandons any message that wasn't sent
+    batch.reserved_size = 0;
+    // A message of unknown size (payload_size 0) can't be batched, and neither
+    // can a null send or a send that skips turns, since they need their own index
+    const std::size_t batched_size = sizeof(batched_message_header) + payload_size;
+    const bool batchable = payload_size && !pause_sending_turns && !null_send
+                           && batched_size <= get_batch_capacity(subgroup_num, transfer_medium);
+    if((batch.num_messages || !batch.carried_over.empty())
+       && (!batchable || batch.transfer_medium != transfer_medium
+           || batch.used + batched_size > get_batch_capacity(subgroup_num, batch.transfer_medium))) {
+        // The open batch (and anything carried over) must be sent first, to keep the messages in order
+        if(!flush_batch(subgroup_num)) {
+            return nullptr;
+        }
+    }
+    if(!batchable) {
+        return get_multicast_buffer_ptr(subgroup_num, payload_size, transfer_medium,
+                                        pause_sending_turns, cooked_send, null_send);
+    }
+    batch.transfer_medium = transfer_medium;
+    batched_message_header* message_header = (batched_message_header*)(batch.buffer.data() + batch.used);
+    message_header->size = payload_size;
+    message_header->cooked_send = cooked_send;
+    batch.reserved_size = batched_size;
+    return (char*)(message_header + 1);
+}
 
-    uint32_t shard_num, shard_index;
-    std::tie(shard_num, shard_index) = subgroup_to_shard_and_rank.at(subgroup_num);
-    std::vector<node_id_t> shard_members = subgroup_to_membership.at(subgroup_num);
-    auto num_shard_members = shard_members.size();
+std::size_t MulticastGroup::get_batch_capacity(subgroup_id_t subgroup_num, bool transfer_medium) {
+    const std::size_t medium_max_msg_size = transfer_medium ? max_msg_size
+                                                            : subgroup_to_slot_layout.at(subgroup_num).max_msg_size;
+    return std::min(batches[subgroup_num].buffer.size(), medium_max_msg_size - sizeof(header));
+}
+
+bool MulticastGroup::flush_batch(subgroup_id_t subgroup_num) {
+    MessageBatch& batch = batches[subgroup_num];
+    while(batch.carried_over_sent < batch.carried_over.size()) {
+        batched_message_header* message_header = (batched_message_header*)(batch.carried_over.data() + batch.carried_over_sent);
+        // A message that fit in the last view's SST batch may not fit in this view's SST slots
+        const bool transfer_medium = batch.carried_over_transfer_medium
+                                     || message_header->size + sizeof(header) > subgroup_to_slot_layout.at(subgroup_num).max_msg_size;
+        char* buf = get_multicast_buffer_ptr(subgroup_num, message_header->size, transfer_medium, 0,
+                                             message_header->cooked_send, false);
+        if(!buf) {
+            return false;
+        }
+        memcpy(buf, message_header + 1, message_header->size);
+        send_multicast(subgroup_num);
+        batch.carried_over_sent += sizeof(batched_message_header) + message_header->size;
+    }
+    batch.carried_over.clear();
+    batch.carried_over_sent = 0;
+    if(!batch.num_messages) {
+        std::lock_guard<std::mutex> lock(batch_flush_mtx);
+        batch_deadlines[subgroup_num] = std::chrono::steady_clock::time_point::max();
+        return true;
+    }
+    assert(!batch.reserved_size);
+    char* buf = get_multicast_buffer_ptr(subgroup_num, batch.used, batch.transfer_medium, 0, false, false);
+    if(!buf) {
+        return false;
+    }
+    memcpy(buf, batch.buffer.data(), batch.used);
+    ((header*)(buf - sizeof(header)))->batched = true;
+    send_multicast(subgroup_num);
+    batch.used = 0;
+    batch.num_messages = 0;
+    std::lock_guard<std::mutex> lock(batch_flush_mtx);
+    batch_deadlines[subgroup_num] = std::chrono::steady_clock::time_point::max();
+    return true;
+}
+
+void MulticastGroup::flush_batches_loop() {
+    pthread_setname_np(pthread_self(), "batch_flush");
+    std::unique_lock<std::mutex> lock(batch_flush_mtx);
+    while(!thread_shutdown) {
+        const auto next_deadline = *std::min_element(batch_deadlines.begin(), batch_deadlines.end());
+        if(next_deadline == std::chrono::steady_clock::time_point::max()) {
+            batch_flush_cv.wait(lock);
+            continue;
+        }
+        if(batch_flush_cv.wait_until(lock, next_deadline) == std::cv_status::no_timeout) {
+            // An earlier deadline may have been set
+            continue;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        std::vector<subgroup_id_t> due_subgroups;
+        for(subgroup_id_t subgroup_num = 0; subgroup_num < batch_deadlines.size(); ++subgroup_num) {
+            if(batch_deadlines[subgroup_num] <= now) {
+                due_subgroups.push_back(subgroup_num);
+            }
+        }
+        lock.unlock();
+        for(const subgroup_id_t subgroup_num : due_subgroups) {
+            std::lock_guard<std::mutex> batch_lock(batch_mtxs[subgroup_num]);
+            // If the application is writing a message into the batch, or the
+            // send window is full, try again after another delay
+            if(batches[subgroup_num].reserved_size || !flush_batch(subgroup_num)) {
+                std::lock_guard<std::mutex> deadline_lock(batch_flush_mtx);
+                batch_deadlines[subgroup_num] = now + std::chrono::microseconds(
+                                                              subgroup_to_batch_settings.at(subgroup_num).max_batch_delay_us);
+            }
+        }
+        lock.lock();
+    }
+}
+
+char* MulticastGroup::get_multicast_buffer_ptr(subgroup_id_t subgroup_num,
+                                               long long unsigned int payload_size,
+                                               bool transfer_medium, int pause_sending_turns,
+                                               bool cooked_send, bool null_send) {
+    // if rdmc groups were not created because of failures, return NULL
+    if(!rdmc_sst_groups_created) {
+        return NULL;
+    }
+    const long long unsigned int msg_size = get_msg_size(subgroup_num, payload_size, transfer_medium, null_send);
+    if(!msg_size) {
+        return nullptr;
+    }
+
+    const ShardIndex& shard_index = shard_indices[subgroup_num];
+    const uint32_t num_shard_senders = shard_index.num_senders();
     // if the current node is not a sender, shard_sender_index will be -1
-    uint32_t num_shard_senders;
-    int shard_sender_index;
-    std::vector<int> shard_senders;
-    std::tie(shard_senders, shard_sender_index) = subgroup_to_senders_and_sender_rank.at(subgroup_num);
-    num_shard_senders = get_num_senders(shard_senders);
+    const int shard_sender_index = subgroup_to_senders_and_sender_rank.at(subgroup_num).second;
     assert(shard_sender_index >= 0);
 
     if(subgroup_to_mode.at(subgroup_num) != Mode::RAW) {
-        for(uint i = 0; i < num_shard_members; ++i) {
-            if(sst->delivered_num[node_id_to_sst_index.at(shard_members[i])][subgroup_num] < (long long int)((future_message_indices[subgroup_num] - window_size) * num_shard_senders + shard_sender_index)) {
+        for(const uint32_t row : shard_index.sst_rows) {
+            if(sst->delivered_num[row][subgroup_num] < (long long int)((future_message_indices[subgroup_num] - window_size) * num_shard_senders + shard_sender_index)) {
                 return nullptr;
             }
         }
     } else {
-        for(uint i = 0; i < num_shard_members; ++i) {
-            auto num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
-            if(sst->num_received[node_id_to_sst_index.at(shard_members[i])][num_received_offset + shard_sender_index] < (long long int)(future_message_indices[subgroup_num] - window_size)) {
+        auto num_received_offset = subgroup_to_num_received_offset.at(subgroup_num);
+        for(const uint32_t row : shard_index.sst_rows) {
+            if(sst->num_received[row][num_received_offset + shard_sender_index] < (long long int)(future_message_indices[subgroup_num] - window_size)) {
                 return nullptr;
             }
         }
@@ -1210,23 +1640,21 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
     }
 
     if(transfer_medium) {
-        std::unique_lock<std::mutex> lock(msg_state_mtx);
-        if(free_message_buffers[subgroup_num].empty()) return nullptr;
-
+        std::unique_lock<std::mutex> lock(msg_state_mtxs[subgroup_num]);
         // Create new Message
         RDMCMessage msg;
         msg.sender_id = members[member_index];
         msg.index = future_message_indices[subgroup_num];
         msg.size = msg_size;
-        msg.message_buffer = std::move(free_message_buffers[subgroup_num].back());
-        free_message_buffers[subgroup_num].pop_back();
+        msg.message_buffer = buffer_pool->acquire(msg_size);
 
         // Fill header
-        char* buf = msg.message_buffer.buffer.get();
+        char* buf = msg.message_buffer.buffer;
         ((header*)buf)->header_size = sizeof(header);
         ((header*)buf)->pause_sending_turns = pause_sending_turns;
         ((header*)buf)->index = msg.index;
         ((header*)buf)->cooked_send = cooked_send;
+        ((header*)buf)->batched = false;
 
         next_sends[subgroup_num] = std::move(msg);
         future_message_indices[subgroup_num] += pause_sending_turns + 1;
@@ -1242,6 +1670,7 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
         ((header*)buf)->pause_sending_turns = pause_sending_turns;
         ((header*)buf)->index = future_message_indices[subgroup_num];
         ((header*)buf)->cooked_send = cooked_send;
+        ((header*)buf)->batched = false;
         future_message_indices[subgroup_num] += pause_sending_turns + 1;
 
         last_transfer_medium[subgroup_num] = transfer_medium;
@@ -1249,16 +1678,112 @@ char* MulticastGroup::get_sendbuffer_ptr(subgroup_id_t subgroup_num,
     }
 }
 
+char* MulticastGroup::wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num,
+                                              long long unsigned int payload_size,
+                                              std::experimental::optional<std::chrono::steady_clock::time_point> deadline,
+                                              bool transfer_medium, int pause_sending_turns,
+                                              bool cooked_send, bool null_send) {
+    if(!rdmc_sst_groups_created || !get_msg_size(subgroup_num, payload_size, transfer_medium, null_send)) {
+        return nullptr;
+    }
+    std::unique_lock<std::mutex> lock(send_window_mtx);
+    while(!thread_shutdown) {
+        const uint64_t version = send_window_versions[subgroup_num];
+        lock.unlock();
+        char* buf = get_sendbuffer_ptr(subgroup_num, payload_size, transfer_medium,
+                                       pause_sending_turns, cooked_send, null_send);
+        if(buf) {
+            return buf;
+        }
+        lock.lock();
+        auto window_changed = [&]() {
+            return send_window_versions[subgroup_num] != version || thread_shutdown;
+        };
+        if(deadline) {
+            if(!send_window_cvs[subgroup_num].wait_until(lock, *deadline, window_changed)) {
+                return nullptr;
+            }
+        } else {
+            send_window_cvs[subgroup_num].wait(lock, window_changed);
+        }
+    }
+    return nullptr;
+}
+
+std::future<char*> MulticastGroup::get_sendbuffer_ptr_async(subgroup_id_t subgroup_num,
+                                                            long long unsigned int payload_size,
+                                                            bool transfer_medium, int pause_sending_turns,
+                                                            bool cooked_send, bool null_send) {
+    SendBufferRequest request{payload_size, transfer_medium, pause_sending_turns, cooked_send, null_send, {}};
+    std::future<char*> result = request.promise.get_future();
+    if(!rdmc_sst_groups_created || !get_msg_size(subgroup_num, payload_size, transfer_medium, null_send)) {
+        request.promise.set_value(nullptr);
+        return result;
+    }
+    std::unique_lock<std::mutex> lock(send_window_mtx);
+    // Requests are fulfilled in order, so only try to get a buffer now if none are waiting
+    while(pending_sendbuffer_requests[subgroup_num].empty() && !thread_shutdown) {
+        const uint64_t version = send_window_versions[subgroup_num];
+        lock.unlock();
+        char* buf = get_sendbuffer_ptr(subgroup_num, payload_size, transfer_medium,
+                                       pause_sending_turns, cooked_send, null_send);
+        if(buf) {
+            request.promise.set_value(buf);
+            return result;
+        }
+        lock.lock();
+        // If the window didn't change while we were trying, the next notification will fulfill the request
+        if(send_window_versions[subgroup_num] == version) {
+            break;
+        }
+    }
+    if(thread_shutdown) {
+        request.promise.set_value(nullptr);
+    } else {
+        pending_sendbuffer_requests[subgroup_num].push_back(std::move(request));
+    }
+    return result;
+}
+
 bool MulticastGroup::send(subgroup_id_t subgroup_num) {
     if(thread_shutdown || !rdmc_sst_groups_created) {
         return false;
     }
+    auto batch_settings = subgroup_to_batch_settings.find(subgroup_num);
+    if(batch_settings != subgroup_to_batch_settings.end()) {
+        std::lock_guard<std::mutex> lock(batch_mtxs[subgroup_num]);
+        MessageBatch& batch = batches[subgroup_num];
+        if(batch.reserved_size) {
+            batch.used += batch.reserved_size;
+            batch.reserved_size = 0;
+            if(++batch.num_messages == 1) {
+                {
+                    std::lock_guard<std::mutex> deadline_lock(batch_flush_mtx);
+                    batch_deadlines[subgroup_num] = std::chrono::steady_clock::now()
+                                                    + std::chrono::microseconds(batch_settings->second.max_batch_delay_us);
+                }
+                batch_flush_cv.notify_all();
+            }
+            // Once no more messages fit, send the batch; if the window is full,
+            // the next get_sendbuffer_ptr or the batch's deadline will retry
+            if(batch.used + sizeof(batched_message_header) >= get_batch_capacity(subgroup_num, batch.transfer_medium)) {
+                flush_batch(subgroup_num);
+            }
+            return true;
+        }
+    }
+    return send_multicast(subgroup_num);
+}
+
+bool MulticastGroup::send_multicast(subgroup_id_t subgroup_num) {
     if(last_transfer_medium[subgroup_num]) {
-        std::lock_guard<std::mutex> lock(msg_state_mtx);
-        assert(next_sends[subgroup_num]);
-        pending_sends[subgroup_num].push(std::move(*next_sends[subgroup_num]));
-        next_sends[subgroup_num] = std::experimental::nullopt;
-        sender_cv.notify_all();
+        {
+            std::lock_guard<std::mutex> lock(msg_state_mtxs[subgroup_num]);
+            assert(next_sends[subgroup_num]);
+            pending_sends[subgroup_num].push(std::move(*next_sends[subgroup_num]));
+            next_sends[subgroup_num] = std::experimental::nullopt;
+        }
+        wake_sender_thread(subgroup_num);
         return true;
     } else {
         sst_multicast_group_ptrs[subgroup_num]->send();
@@ -1266,16 +1791,6 @@ bool MulticastGroup::send(subgroup_id_t subgroup_num) {
     }
 }
 
-std::vector<uint32_t> MulticastGroup::get_shard_sst_indices(subgroup_id_t subgroup_num) {
-    std::vector<node_id_t> shard_members = subgroup_to_membership.at(subgroup_num);
-
-    std::vector<uint32_t> shard_sst_indices;
-    for(auto m : shard_members) {
-        shard_sst_indices.push_back(node_id_to_sst_index.at(m));
-    }
-    return shard_sst_indices;
-}
-
 void MulticastGroup::debug_print() {
     using std::cout;
     using std::endl;
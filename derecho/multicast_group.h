@@ -1,27 +1,38 @@
 #pragma once
 
+#include <algorithm>
 #include <assert.h>
+#include <chrono>
+#include <cstdlib>
 #include <condition_variable>
+#include <deque>
 #include <experimental/optional>
 #include <functional>
+#include <future>
 #include <list>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <ostream>
 #include <queue>
 #include <set>
 #include <tuple>
 #include <vector>
 
+#include "buffer_pool.h"
 #include "connection_manager.h"
 #include "derecho_modes.h"
 #include "derecho_sst.h"
 #include "filewriter.h"
+#include "frontier.h"
 #include "mutils-serialization/SerializationMacros.hpp"
 #include "mutils-serialization/SerializationSupport.hpp"
 #include "rdmc/rdmc.h"
+#include "received_window.h"
+#include "sequence_ring.h"
 #include "spdlog/spdlog.h"
+#include "sst/failure_detector.h"
 #include "sst/multicast.h"
 #include "sst/sst.h"
 #include "subgroup_info.h"
@@ -54,6 +65,36 @@ struct DerechoParams : public mutils::ByteRepresentable {
     unsigned int timeout_ms = 1;
     rdmc::send_algorithm type = rdmc::BINOMIAL_SEND;
     uint32_t rpc_port = 12487;
+    /** The maximum number of messages the FileWriter commits to disk with one fdatasync. */
+    uint32_t filewriter_batch_size = 64;
+    /** How long, in microseconds, the FileWriter may hold a partial batch
+     * waiting for more messages before committing it. */
+    uint32_t filewriter_batch_latency_us = 0;
+    /** Whether the FileWriter should write message bodies with asynchronous
+     * O_DIRECT I/O straight from the message buffers, bypassing the page cache. */
+    bool filewriter_direct_io = false;
+    /** If nonzero, the size in bytes at which the message log is split into
+     * a new segment. Zero keeps the whole log in a single file. */
+    uint64_t log_segment_size = 0;
+    /** The size of the largest message (including its header) that can be
+     * sent through the SST rather than RDMC, which sets the size of the SST
+     * multicast slots. Subgroup types can override it in SubgroupInfo. */
+    uint32_t sst_max_msg_size = sst::max_msg_size;
+    /** The number of threads evaluating the SST predicates. Each subgroup's
+     * predicates are assigned to one of them, so that delivery in different
+     * subgroups can proceed in parallel. */
+    uint32_t num_predicate_threads = 1;
+    /** How long, in milliseconds, a node may go without writing to this node
+     * beyond its usual interval between writes before the failure detector
+     * starts to suspect it. */
+    uint32_t failure_detection_pause_ms = 2000;
+    /** The level of suspicion (phi) at which the failure detector reports a
+     * silent node as failed; each increase of 1 makes a false suspicion
+     * 10 times less likely. */
+    double phi_suspicion_threshold = 8.0;
+    /** The number of threads running the handlers of P2P RPC messages. Each
+     * sender's messages are always handled by the same thread, in order. */
+    uint32_t p2p_worker_threads = 1;
 
     DerechoParams(long long unsigned int max_payload_size,
                   long long unsigned int block_size,
@@ -61,17 +102,38 @@ struct DerechoParams : public mutils::ByteRepresentable {
                   unsigned int window_size = 3,
                   unsigned int timeout_ms = 1,
                   rdmc::send_algorithm type = rdmc::BINOMIAL_SEND,
-                  uint32_t rpc_port = 12487)
+                  uint32_t rpc_port = 12487,
+                  uint32_t filewriter_batch_size = 64,
+                  uint32_t filewriter_batch_latency_us = 0,
+                  bool filewriter_direct_io = false,
+                  uint64_t log_segment_size = 0,
+                  uint32_t sst_max_msg_size = sst::max_msg_size,
+                  uint32_t num_predicate_threads = 1,
+                  uint32_t failure_detection_pause_ms = 2000,
+                  double phi_suspicion_threshold = 8.0,
+                  uint32_t p2p_worker_threads = 1)
             : max_payload_size(max_payload_size),
               block_size(block_size),
               filename(filename),
               window_size(window_size),
               timeout_ms(timeout_ms),
               type(type),
-              rpc_port(rpc_port) {
+              rpc_port(rpc_port),
+              filewriter_batch_size(filewriter_batch_size),
+              filewriter_batch_latency_us(filewriter_batch_latency_us),
+              filewriter_direct_io(filewriter_direct_io),
+              log_segment_size(log_segment_size),
+              sst_max_msg_size(sst_max_msg_size),
+              num_predicate_threads(num_predicate_threads),
+              failure_detection_pause_ms(failure_detection_pause_ms),
+              phi_suspicion_threshold(phi_suspicion_threshold),
+              p2p_worker_threads(p2p_worker_threads) {
     }
 
-    DEFAULT_SERIALIZATION_SUPPORT(DerechoParams, max_payload_size, block_size, filename, window_size, timeout_ms, type, rpc_port);
+    DEFAULT_SERIALIZATION_SUPPORT(DerechoParams, max_payload_size, block_size, filename, window_size, timeout_ms, type, rpc_port,
+                                  filewriter_batch_size, filewriter_batch_latency_us, filewriter_direct_io, log_segment_size,
+                                  sst_max_msg_size, num_predicate_threads, failure_detection_pause_ms,
+                                  phi_suspicion_threshold, p2p_worker_threads);
 };
 
 struct __attribute__((__packed__)) header {
@@ -79,29 +141,14 @@ struct __attribute__((__packed__)) header {
     uint32_t pause_sending_turns;
     uint32_t index;
     bool cooked_send;
+    /** True if the payload is a batch of messages, each one preceded by a batched_message_header. */
+    bool batched;
 };
 
-/**
- * Represents a block of memory used to store a message. This object contains
- * both the array of bytes in which the message is stored and the corresponding
- * RDMA memory region (which has registered that array of bytes as its buffer).
- * This is a move-only type, since memory regions can't be copied.
- */
-struct MessageBuffer {
-    std::unique_ptr<char[]> buffer;
-    std::shared_ptr<rdma::memory_region> mr;
-
-    MessageBuffer() {}
-    MessageBuffer(size_t size) {
-        if(size != 0) {
-            buffer = std::unique_ptr<char[]>(new char[size]);
-            mr = std::make_shared<rdma::memory_region>(buffer.get(), size);
-        }
-    }
-    MessageBuffer(const MessageBuffer&) = delete;
-    MessageBuffer(MessageBuffer&&) = default;
-    MessageBuffer& operator=(const MessageBuffer&) = delete;
-    MessageBuffer& operator=(MessageBuffer&&) = default;
+/** Precedes each message in a batch sent by a subgroup that batches its messages. */
+struct __attribute__((__packed__)) batched_message_header {
+    uint32_t size;
+    bool cooked_send;
 };
 
 struct RDMCMessage {
@@ -115,6 +162,15 @@ struct RDMCMessage {
     MessageBuffer message_buffer;
 };
 
+/** The position of a subgroup's SST multicast slots in each SST row, and their shape. */
+struct SSTSlotLayout {
+    /** The offset in bytes of the subgroup's first slot within the slots field. */
+    std::size_t offset;
+    uint32_t max_msg_size;
+    /** The number of slots each sender in the subgroup has. */
+    uint32_t window_size;
+};
+
 struct SSTMessage {
     /** The unique node ID of the message's sender. */
     uint32_t sender_id;
@@ -126,6 +182,47 @@ struct SSTMessage {
     volatile char* buf;
 };
 
+/**
+ * The mappings between shard ranks, sender ranks, node IDs and SST rows for
+ * one subgroup's shard, flattened into arrays once per view so that the
+ * predicates and receive handlers can look them up without searching a map
+ * or allocating.
+ */
+struct ShardIndex {
+    /** The SST row of each shard member, indexed by shard rank */
+    std::vector<uint32_t> sst_rows;
+    /** The byte offset of each shard member's SST row from row 0, indexed by shard rank */
+    std::vector<int64_t> row_offsets;
+    /** The SST row of each sender, indexed by sender rank */
+    std::vector<uint32_t> sender_sst_rows;
+    /** The shard rank of each sender, indexed by sender rank */
+    std::vector<uint32_t> sender_shard_ranks;
+    /** (node ID, sender rank) for each sender, sorted by node ID */
+    std::vector<std::pair<node_id_t, uint32_t>> sender_ranks_by_id;
+
+    uint32_t num_senders() const { return sender_sst_rows.size(); }
+    /** @return The sender rank of the node with this ID, or -1 if it is not a sender in the shard */
+    int sender_rank_of(node_id_t node_id) const {
+        auto it = std::lower_bound(sender_ranks_by_id.begin(), sender_ranks_by_id.end(),
+                                   std::make_pair(node_id, (uint32_t)0));
+        if(it == sender_ranks_by_id.end() || it->first != node_id) {
+            return -1;
+        }
+        return it->second;
+    }
+};
+
+/** The cached minima that the stability, delivery and receive triggers of a shard advance. */
+struct ShardFrontiers {
+    /** The minimum seq_num across the shard */
+    FrontierMin seq_num;
+    /** The minimum stable_num across the shard */
+    FrontierMin stable_num;
+    /** The minimum of this node's num_received counters for the shard's senders;
+     * updated by both RDMC and SST receives, under the subgroup's msg_state_mtxs entry */
+    FrontierMin num_received;
+};
+
 /** Implements the low-level mechanics of tracking multicasts in a Derecho group,
  * using RDMC to deliver messages and SST to track their arrival and stability.
  * This class should only be used as part of a Group, since it does not know how
@@ -164,13 +261,24 @@ private:
     /** Maps subgroup IDs (for subgroups this node is a member of) to the offset
      * of this node's num_received counter within that subgroup's SST section */
     const std::map<subgroup_id_t, uint32_t> subgroup_to_num_received_offset;
-    /** Used for synchronizing receives by RDMC and SST */
-    std::vector<std::list<long long int>> received_intervals;
+    /** Used for synchronizing receives by RDMC and SST; one for each num_received entry */
+    std::vector<ReceivedWindow> received_windows;
     /** Maps subgroup IDs (for subgroups this node is a member of) to the members
      * of this node's shard of that subgroup */
     const std::map<subgroup_id_t, std::vector<node_id_t>> subgroup_to_membership;
     /** Maps subgroup IDs to operation mode */
     const std::map<subgroup_id_t, Mode> subgroup_to_mode;
+    /** Maps subgroup IDs to the layout of that subgroup's SST multicast slots */
+    const std::map<subgroup_id_t, SSTSlotLayout> subgroup_to_slot_layout;
+    /** Maps the IDs of the subgroups that batch their messages to their batching settings */
+    const std::map<subgroup_id_t, BatchSettings> subgroup_to_batch_settings;
+    /** Maps the IDs of the subgroups that have a send weight other than 1 to their weight */
+    const std::map<subgroup_id_t, uint32_t> subgroup_to_send_weight;
+    /** The shard index of each subgroup this node is a member of, indexed by subgroup ID */
+    std::vector<ShardIndex> shard_indices;
+    /** The frontiers of each subgroup this node is a member of, indexed by subgroup ID;
+     * each is only used by its subgroup's predicate triggers */
+    std::vector<ShardFrontiers> shard_frontiers;
     std::map<subgroup_id_t, uint32_t> subgroup_to_rdmc_group;
     /** These two callbacks are internal, not exposed to clients, so they're not in CallbackSet */
     rpc_handler_t rpc_callback;
@@ -179,9 +287,9 @@ private:
     uint16_t rdmc_group_num_offset;
     /** false if RDMC groups haven't been created successfully */
     bool rdmc_sst_groups_created = false;
-    /** Stores message buffers not currently in use. Protected by
-     * msg_state_mtx */
-    std::map<uint32_t, std::vector<MessageBuffer>> free_message_buffers;
+    /** The pool that message buffers for every subgroup are taken from; it is
+     * handed on to the next view's MulticastGroup, so buffers are never reallocated. */
+    std::shared_ptr<BufferPool> buffer_pool;
 
     /** Index to be used the next time get_sendbuffer_ptr is called.
      * When next_message is not none, then next_message.index = future_message_index-1 */
@@ -190,30 +298,73 @@ private:
     /** next_message is the message that will be sent when send is called the next time.
      * It is boost::none when there is no message to send. */
     std::vector<std::experimental::optional<RDMCMessage>> next_sends;
-    /** Messages that are ready to be sent, but must wait until the current send finishes. */
+    /** Messages that are ready to be sent, but must wait until the send window has room for them. */
     std::vector<std::queue<RDMCMessage>> pending_sends;
-    /** Vector of messages that are currently being sent out using RDMC, or boost::none otherwise. */
-    /** one per subgroup */
-    std::vector<std::experimental::optional<RDMCMessage>> current_sends;
+    /** Messages that have been handed to RDMC and are still being sent, for each subgroup,
+     * in the order they were sent; RDMC completes them in the same order. */
+    std::vector<std::deque<RDMCMessage>> current_sends;
 
-    /** Messages that are currently being received. */
-    std::map<std::pair<uint32_t, long long int>, RDMCMessage> current_receives;
+    /** Messages that are currently being received, for each subgroup, by sequence number. */
+    std::vector<SequenceRing<RDMCMessage>> current_receives;
 
     /** Messages that have finished sending/receiving but aren't yet globally stable */
-    std::map<uint32_t, std::map<long long int, RDMCMessage>> locally_stable_rdmc_messages;
-    /** Parallel map for SST messages */
-    std::map<uint32_t, std::map<long long int, SSTMessage>> locally_stable_sst_messages;
+    std::vector<SequenceRing<RDMCMessage>> locally_stable_rdmc_messages;
+    /** Parallel ring for SST messages */
+    std::vector<SequenceRing<SSTMessage>> locally_stable_sst_messages;
     /** Messages that are currently being written to persistent storage */
-    std::map<uint32_t, std::map<long long int, RDMCMessage>> non_persistent_messages;
+    std::vector<SequenceRing<RDMCMessage>> non_persistent_messages;
     /** Messages that are currently being written to persistent storage */
-    std::map<uint32_t, std::map<long long int, SSTMessage>> non_persistent_sst_messages;
+    std::vector<SequenceRing<SSTMessage>> non_persistent_sst_messages;
 
     std::vector<long long int> next_message_to_deliver;
-    std::mutex msg_state_mtx;
+    /** One lock for each subgroup's message state (the per-subgroup entries of
+     * the message buffer and message maps above), so that messages in
+     * different subgroups can be received and delivered in parallel */
+    std::vector<std::mutex> msg_state_mtxs;
+    /** Mutex for sender_cv. It is always acquired before, never while
+     * holding, a subgroup's lock in msg_state_mtxs. */
+    std::mutex sender_mtx;
     std::condition_variable sender_cv;
-
-    /** The time, in milliseconds, that a sender can wait to send a message before it is considered failed. */
+    /** The subgroups whose send state has changed since the sender thread last
+     * checked them, so that one of their pending sends may be able to go out.
+     * Protected by sender_mtx. */
+    std::vector<subgroup_id_t> send_candidates;
+    /** True for each subgroup currently in send_candidates. Protected by sender_mtx. */
+    std::vector<char> is_send_candidate;
+    /** The number of messages each subgroup may post to RDMC in one pass of
+     * the sender thread, which is its send weight. Only used by the sender thread. */
+    std::vector<uint32_t> send_quotas;
+
+    /** A call to get_sendbuffer_ptr_async that is waiting for space in the send window. */
+    struct SendBufferRequest {
+        long long unsigned int payload_size;
+        bool transfer_medium;
+        int pause_sending_turns;
+        bool cooked_send;
+        bool null_send;
+        std::promise<char*> promise;
+    };
+    /** Guards send_window_versions, send_window_cvs, and pending_sendbuffer_requests. */
+    std::mutex send_window_mtx;
+    /** Incremented, for each subgroup, whenever space may have opened up in
+     * this node's send window, so that waiters can't miss a notification. */
+    std::vector<uint64_t> send_window_versions;
+    /** Notified along with each increment of send_window_versions. */
+    std::vector<std::condition_variable> send_window_cvs;
+    /** Requests from get_sendbuffer_ptr_async to fulfill, in order, when space opens up. */
+    std::vector<std::list<SendBufferRequest>> pending_sendbuffer_requests;
+    /** For each subgroup, the sum of the SST counters that open up this node's
+     * send window as of the last notification. Only read and written by the
+     * subgroup's predicate thread. */
+    std::vector<long long int> send_window_progress;
+
+    /** The period, in milliseconds, of the failure detector's checks, and of
+     * the heartbeats sent to nodes this node has not otherwise written to. */
     unsigned int sender_timeout;
+    /** See DerechoParams::failure_detection_pause_ms */
+    unsigned int failure_detection_pause_ms;
+    /** See DerechoParams::phi_suspicion_threshold */
+    double phi_suspicion_threshold;
 
     /** Indicates that the group is being destroyed. */
     std::atomic<bool> thread_shutdown{false};
@@ -237,22 +388,139 @@ private:
     std::vector<bool> last_transfer_medium;
 
     std::unique_ptr<FileWriter> file_writer;
-
-    /** Continuously waits for a new pending send, then sends it. This function
-     * implements the sender thread. */
+    /** Set once this node has reported that its log can no longer be written */
+    std::atomic<bool> log_failure_reported{false};
+
+    /** The messages collected so far into the next batch, for a subgroup that batches its messages. */
+    struct MessageBatch {
+        /** Holds the batch's messages, each preceded by a batched_message_header */
+        std::vector<char> buffer;
+        /** The number of bytes of buffer holding messages that have been sent */
+        std::size_t used = 0;
+        uint32_t num_messages = 0;
+        /** The size (with its batched_message_header) of the message after the
+         * used bytes that get_sendbuffer_ptr has handed out, if it hasn't been sent yet */
+        std::size_t reserved_size = 0;
+        /** The medium the batch will be sent with; only messages for the same one can join it */
+        bool transfer_medium = true;
+        /** Messages from the previous view's open batch that didn't fit in this
+         * batch's buffer, each preceded by its batched_message_header. They are
+         * sent one per multicast, ahead of this batch. */
+        std::vector<char> carried_over;
+        /** The number of bytes of carried_over that have been sent */
+        std::size_t carried_over_sent = 0;
+        /** The medium the carried-over messages were going to be sent with */
+        bool carried_over_transfer_medium = true;
+    };
+    /** The open batch of each subgroup, which only has a buffer if the subgroup batches its messages */
+    std::vector<MessageBatch> batches;
+    /** One lock for each subgroup's entry in batches */
+    std::vector<std::mutex> batch_mtxs;
+    /** Guards batch_deadlines and batch_flush_cv. It is acquired after, never before, one of batch_mtxs. */
+    std::mutex batch_flush_mtx;
+    std::condition_variable batch_flush_cv;
+    /** The time at which each subgroup's open batch must be sent, or time_point::max() if it is empty */
+    std::vector<std::chrono::steady_clock::time_point> batch_deadlines;
+    /** The background thread that sends batches when they reach their deadlines. */
+    std::thread batch_flush_thread;
+
+    /** Sets up the sender thread's scheduling state, with every subgroup
+     * marked as a send candidate so that the thread checks them all once. */
+    void initialize_send_scheduler();
+    /** Continuously waits for subgroups to become send candidates, then sends
+     * up to send_quotas pending messages of each candidate that is ready.
+     * This function implements the sender thread. */
     void send_loop();
-
-    /** Checks for failures when a sender reaches its timeout. This function
-     * implements the timeout thread. */
+    /** Marks a subgroup as a send candidate and wakes the sender thread to check
+     * whether its next pending send can go out. Must not be called while holding
+     * any of msg_state_mtxs. */
+    void wake_sender_thread(subgroup_id_t subgroup_num);
+    /** Wakes the threads waiting for space in a subgroup's send window, and
+     * fulfills as many of its pending get_sendbuffer_ptr_async requests as
+     * the window now allows. */
+    void notify_send_window(subgroup_id_t subgroup_num);
+    /** @return The size of the message to allocate for a get_sendbuffer_ptr
+     * call with these arguments, or 0 if it is too large for the medium. */
+    long long unsigned int get_msg_size(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                        bool transfer_medium, bool null_send);
+
+    /** Watches the SST rows for signs of life from the other members and
+     * reports a member as failed once a phi-accrual detector suspects it,
+     * sending heartbeats to the members this node has been idle toward.
+     * This function implements the timeout thread. */
     void check_failures_loop();
+    /** Waits for open batches to reach their deadlines, then sends them. This
+     * function implements the batch flush thread. */
+    void flush_batches_loop();
+    /** Sends the subgroup's open batch as one multicast, if it has any messages,
+     * after sending any messages carried over from the previous view's batch.
+     * The caller must hold the subgroup's lock in batch_mtxs.
+     * @return False if the batch could not be sent because the send window is full. */
+    bool flush_batch(subgroup_id_t subgroup_num);
+    /** @return The most bytes of messages a batch sent with the given medium can hold. */
+    std::size_t get_batch_capacity(subgroup_id_t subgroup_num, bool transfer_medium);
+    /** The unbatched implementation of get_sendbuffer_ptr. */
+    char* get_multicast_buffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                   bool transfer_medium, int pause_sending_turns,
+                                   bool cooked_send, bool null_send);
+    /** The unbatched implementation of send. */
+    bool send_multicast(subgroup_id_t subgroup_num);
+
+    /** Calls f(payload, payload_size, cooked_send) on each message carried
+     * by the multicast whose header starts at buf, which is more than one
+     * message if the multicast is a batch. */
+    template <typename F>
+    static void for_each_message(char* buf, long long unsigned int msg_size, F&& f) {
+        header* h = (header*)buf;
+        char* payload = buf + h->header_size;
+        long long unsigned int payload_size = msg_size - h->header_size;
+        if(!h->batched) {
+            f(payload, payload_size, h->cooked_send);
+            return;
+        }
+        long long unsigned int offset = 0;
+        while(offset + sizeof(batched_message_header) <= payload_size) {
+            batched_message_header* message_header = (batched_message_header*)(payload + offset);
+            offset += sizeof(batched_message_header);
+            f(payload + offset, (long long unsigned int)message_header->size, message_header->cooked_send);
+            offset += message_header->size;
+        }
+    }
 
-    std::function<void(persistence::message)> make_file_written_callback();
+    /** @return The log records for the multicast whose header starts at buf:
+     * one for each message it carries, with the payload of that message. */
+    std::vector<persistence::message> make_log_records(char* buf, long long unsigned int msg_size,
+                                                       node_id_t sender_id, long long int index,
+                                                       subgroup_id_t subgroup_num);
+    batch_written_upcall_t make_file_written_callback();
+    /** Sizes the per-subgroup message rings for this view's senders and window size. */
+    void allocate_message_rings();
     bool create_rdmc_sst_groups();
     void initialize_sst_row();
     void register_predicates();
 
     void deliver_message(RDMCMessage& msg, uint32_t subgroup_num);
     void deliver_message(SSTMessage& msg, uint32_t subgroup_num);
+    /**
+     * Called when the FileWriter refuses a message because the log can no
+     * longer be written. Since this node can no longer persist messages, it
+     * reports itself as failed by marking its own row as suspected, as a
+     * node leaving the group does, so the rest of the group removes it in
+     * the next view instead of waiting forever for it to persist messages.
+     */
+    void report_log_failure();
+
+    /** Fills in shard_indices from the membership of the current view, and
+     * allocates shard_frontiers. */
+    void build_shard_indices();
+
+    /** Returns the SST slot in the sender's row that holds the given message
+     * (numbered within its sender) of the subgroup with the given slot layout. */
+    volatile char* get_sst_slot(const DerechoSST& sst, uint32_t sender_sst_row,
+                                const SSTSlotLayout& slot_layout, long long int message_num) const {
+        return sst.slots[sender_sst_row] + slot_layout.offset
+               + (message_num % slot_layout.window_size) * sst::slot_size(slot_layout.max_msg_size);
+    }
 
     uint32_t get_num_senders(std::vector<int> shard_senders) {
         uint32_t num = 0;
@@ -264,43 +532,11 @@ private:
         return num;
     };
 
+    /** Records that the messages beg_index through end_index have been received
+     * from the sender whose num_received counter is num_received_entry.
+     * @return The new value of that num_received counter */
     long long int resolve_num_received(long long beg_index, long long end_index, uint32_t num_received_entry) {
-        // std::cout << "num_received_entry = " << num_received_entry << std::endl;
-        // std::cout << "beg_index = " << beg_index << std::endl;
-        // std::cout << "end_index = " << end_index << std::endl;
-        auto it = received_intervals[num_received_entry].end();
-        it--;
-        while(*it > beg_index) {
-            it--;
-        }
-        if(std::next(it) == received_intervals[num_received_entry].end()) {
-            if(*it == beg_index - 1) {
-                *it = end_index;
-            } else {
-                received_intervals[num_received_entry].push_back(beg_index);
-                received_intervals[num_received_entry].push_back(end_index);
-            }
-        } else {
-            auto next_it = std::next(it);
-            if(*it != beg_index - 1) {
-                received_intervals[num_received_entry].insert(next_it, beg_index);
-                if(*next_it != end_index + 1) {
-                    received_intervals[num_received_entry].insert(next_it, end_index);
-                } else {
-                    received_intervals[num_received_entry].erase(next_it);
-                }
-            } else {
-                if(*next_it != end_index + 1) {
-                    received_intervals[num_received_entry].insert(next_it, end_index);
-                } else {
-                    received_intervals[num_received_entry].erase(next_it);
-                }
-                received_intervals[num_received_entry].erase(it);
-            }
-        }
-        // std::cout << "Returned value: "
-        //           << *std::next(received_intervals[num_received_entry].begin()) << std::endl;
-        return *std::next(received_intervals[num_received_entry].begin());
+        return received_windows[num_received_entry].receive(beg_index, end_index);
     }
 
 public:
@@ -314,6 +550,9 @@ public:
             const std::map<subgroup_id_t, uint32_t>& subgroup_to_num_received_offset,
             const std::map<subgroup_id_t, std::vector<node_id_t>>& subgroup_to_membership,
             const std::map<subgroup_id_t, Mode>& subgroup_to_mode,
+            const std::map<subgroup_id_t, SSTSlotLayout>& subgroup_to_slot_layout,
+            const std::map<subgroup_id_t, BatchSettings>& subgroup_to_batch_settings,
+            const std::map<subgroup_id_t, uint32_t>& subgroup_to_send_weight,
             const DerechoParams derecho_params,
             std::vector<char> already_failed = {});
     /** Constructor to initialize a new MulticastGroup from an old one,
@@ -328,6 +567,9 @@ public:
             const std::map<subgroup_id_t, uint32_t>& subgroup_to_num_received_offset,
             const std::map<subgroup_id_t, std::vector<node_id_t>>& subgroup_to_membership,
             const std::map<subgroup_id_t, Mode>& subgroup_to_mode,
+            const std::map<subgroup_id_t, SSTSlotLayout>& subgroup_to_slot_layout,
+            const std::map<subgroup_id_t, BatchSettings>& subgroup_to_batch_settings,
+            const std::map<subgroup_id_t, uint32_t>& subgroup_to_send_weight,
             std::vector<char> already_failed = {}, uint32_t rpc_port = 12487);
 
     ~MulticastGroup();
@@ -339,17 +581,51 @@ public:
     void register_rpc_callback(rpc_handler_t handler) { rpc_callback = std::move(handler); }
 
     void deliver_messages_upto(const std::vector<long long int>& max_indices_for_senders, uint32_t subgroup_num, uint32_t num_shard_senders);
-    /** Get a pointer into the current buffer, to write data into it before sending */
+    /** Get a pointer into the current buffer, to write data into it before sending.
+     * In a subgroup that batches its messages, a message with a payload_size
+     * that fits in a batch gets space in the subgroup's open batch instead. */
     char* get_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
                              bool transfer_medium = true, int pause_sending_turns = 0,
                              bool cooked_send = false, bool null_send = false);
+    /**
+     * Like get_sendbuffer_ptr, but if this node's send window is full, blocks
+     * until a shard member's progress opens it up instead of returning nullptr.
+     * @param deadline The time to give up waiting at, or none to wait forever.
+     * @return nullptr if the deadline passed, the message is too large, or
+     * this group was wedged while waiting.
+     */
+    char* wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                  std::experimental::optional<std::chrono::steady_clock::time_point> deadline,
+                                  bool transfer_medium = true, int pause_sending_turns = 0,
+                                  bool cooked_send = false, bool null_send = false);
+    /**
+     * Like get_sendbuffer_ptr, but if this node's send window is full, returns
+     * a future that will be fulfilled by the predicate thread once the window
+     * opens up. The future contains nullptr if the message is too large or this
+     * group is wedged first. Only one request per subgroup should be
+     * outstanding at a time, since the buffer it returns must be sent before
+     * the next one is requested.
+     */
+    std::future<char*> get_sendbuffer_ptr_async(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                                bool transfer_medium = true, int pause_sending_turns = 0,
+                                                bool cooked_send = false, bool null_send = false);
     /** Note that get_sendbuffer_ptr and send are called one after the another - regexp for using the two is (get_sendbuffer_ptr.send)*
-     * This still allows making multiple send calls without acknowledgement; at a single point in time, however,
-     * there is only one message per sender in the RDMC pipeline */
+     * This allows making multiple send calls without acknowledgement; up to window_size messages per sender
+     * can be in the RDMC pipeline at once, and RDMC starts each one as soon as the previous one has been sent */
     bool send(subgroup_id_t subgroup_num);
 
     /** Stops all sending and receiving in this group, in preparation for shutting it down. */
     void wedge();
+    /** @return True if wedge() has been called on this group. */
+    bool is_wedged() const { return thread_shutdown; }
+    /**
+     * Tells the FileWriter that a subgroup has checkpointed its state up to
+     * and including the message (view_id, index), so log segments containing
+     * only older messages can be deleted. If background is true, they will be
+     * deleted by the compactor thread; otherwise they are deleted before this
+     * function returns. Has no effect if the group is not persistent.
+     */
+    void truncate_log(subgroup_id_t subgroup_num, uint32_t view_id, uint64_t index, bool background = false);
     /** Debugging function; prints the current state of the SST to stdout. */
     void debug_print();
     static long long unsigned int compute_max_msg_size(
@@ -363,6 +639,8 @@ public:
     const std::map<subgroup_id_t, uint32_t>& get_subgroup_to_num_received_offset() {
         return subgroup_to_num_received_offset;
     }
-    std::vector<uint32_t> get_shard_sst_indices(uint32_t subgroup_num);
+    const std::vector<uint32_t>& get_shard_sst_indices(uint32_t subgroup_num) const {
+        return shard_indices[subgroup_num].sst_rows;
+    }
 };
 }  // namespace derecho
@@ -22,20 +22,38 @@ struct message {
     uint64_t index;
     bool cooked;
     uint32_t subgroup_num;
+    /** The position of the message within the multicast that carried it,
+     * which is only nonzero in a subgroup that batches its messages. */
+    uint32_t batch_position = 0;
+    /** If the message is stored in a buffer suitable for O_DIRECT writes
+     * (aligned to DIRECT_IO_ALIGNMENT), the start of that buffer; otherwise
+     * null, and the message must be copied before it can be written directly. */
+    char* direct_buffer = nullptr;
+    /** The usable size of direct_buffer, a multiple of DIRECT_IO_ALIGNMENT. */
+    uint64_t direct_buffer_size = 0;
 };
 
+/** The alignment required for buffers, lengths and file offsets of O_DIRECT writes. */
+static const std::size_t DIRECT_IO_ALIGNMENT = 4096;
+
 struct __attribute__((__packed__)) header {
     uint8_t magic[8];
     uint32_t version;
 };
 
+/** The magic number at the start of every metadata file's header. */
+static const uint8_t MAGIC_NUMBER[8] = {'D', 'E', 'R', 'E', 'C', 'H', 'O', 29};
+
 struct __attribute__((__packed__)) message_metadata {
     uint32_t view_id;
     uint8_t is_cooked;
     uint8_t padding0;
     uint16_t padding1;
     uint32_t sender;
-    uint32_t padding2;
+    /** The position of the message within its batch. The messages of a batch
+     * share its index, and are logged as consecutive records of their
+     * subgroup, in batch_position order; an unbatched message has position 0. */
+    uint32_t batch_position;
     uint64_t index;
     uint32_t subgroup_num;
     uint32_t padding3;
@@ -43,7 +61,26 @@ struct __attribute__((__packed__)) message_metadata {
     uint64_t length;
 };
 
+/**
+ * An entry in the sparse index of a log's metadata file. The FileWriter
+ * records the position of the first message from each subgroup in each view,
+ * and of every INDEX_STRIDE'th message from a subgroup after that, so readers
+ * can find a message without scanning the whole metadata file.
+ */
+struct __attribute__((__packed__)) index_entry {
+    uint32_t subgroup_num;
+    uint32_t view_id;
+    uint64_t index;
+    /** The position of the indexed message_metadata record in the metadata file,
+     * counting from 0 for the first record after the header. */
+    uint64_t record_number;
+};
+
+/** The number of messages from a subgroup between consecutive index entries. */
+static const uint64_t INDEX_STRIDE = 1024;
+
 static const std::string METADATA_EXTENSION = ".metadata";
+static const std::string INDEX_EXTENSION = ".index";
 static const std::string PAXOS_STATE_EXTENSION = ".paxosstate";
 static const std::string PARAMATERS_EXTENSION = ".params";
 static const std::string SWAP_FILE_EXTENSION = ".swp";
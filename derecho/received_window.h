@@ -0,0 +1,128 @@
+/**
+ * @file received_window.h
+ * @brief Contains a bitmap for tracking which message indices from a sender
+ * have arrived.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace derecho {
+
+/**
+ * Tracks the set of message indices received from one sender, when messages
+ * can arrive out of order (e.g. because the sender alternates between RDMC
+ * and SST). The indices up to the contiguous prefix that has been received
+ * are summarized by a single counter; only the indices that arrived ahead of
+ * it are kept, as bits in a ring buffer indexed by the message index modulo
+ * the ring's size. Recording a message and advancing the prefix are a few
+ * word operations and bit scans, and the ring is only reallocated if a
+ * message arrives further ahead of the prefix than it has ever done before.
+ */
+class ReceivedWindow {
+private:
+    /** The highest index such that every index up to it has been received */
+    long long int prefix_end;
+    std::vector<uint64_t> words;
+    /** words.size() - 1; the number of words is always a power of 2 */
+    std::size_t word_mask;
+
+    std::size_t capacity() const { return words.size() * 64; }
+
+    uint64_t& word_of(long long int index) {
+        return words[(index >> 6) & word_mask];
+    }
+
+    /** Sets the bits of the indices in [beg_index, end_index], which must all fit in the ring. */
+    void set_range(long long int beg_index, long long int end_index) {
+        while(beg_index <= end_index) {
+            const unsigned int first_bit = beg_index & 63;
+            const long long int bits_in_word = std::min<long long int>(64 - first_bit, end_index - beg_index + 1);
+            const uint64_t mask = (bits_in_word == 64 ? ~0ULL : ((1ULL << bits_in_word) - 1)) << first_bit;
+            word_of(beg_index) |= mask;
+            beg_index += bits_in_word;
+        }
+    }
+
+    /** Reallocates the ring so that it can hold every index up to end_index. */
+    void grow(long long int end_index) {
+        std::size_t new_num_words = words.size();
+        while(new_num_words * 64 < (std::size_t)(end_index - prefix_end)) {
+            new_num_words *= 2;
+        }
+        std::vector<uint64_t> old_words(new_num_words, 0);
+        old_words.swap(words);
+        const std::size_t old_word_mask = word_mask;
+        word_mask = new_num_words - 1;
+        // Every set bit is for an index in (prefix_end, prefix_end + old capacity],
+        // so the word holding prefix_end + 1 shares its slot with the word one
+        // old capacity later: its bits below prefix_end + 1 belong to that word.
+        const long long int first_word = (prefix_end + 1) >> 6;
+        const uint64_t first_word_mask = ~0ULL << ((prefix_end + 1) & 63);
+        const long long int old_num_words = old_word_mask + 1;
+        words[first_word & word_mask] = old_words[first_word & old_word_mask] & first_word_mask;
+        for(long long int w = first_word + 1; w < first_word + old_num_words; ++w) {
+            words[w & word_mask] = old_words[w & old_word_mask];
+        }
+        words[(first_word + old_num_words) & word_mask] |= old_words[first_word & old_word_mask] & ~first_word_mask;
+    }
+
+    /** Advances prefix_end over any indices after it that have already been received. */
+    void advance_prefix() {
+        while(true) {
+            const long long int next_index = prefix_end + 1;
+            const unsigned int first_bit = next_index & 63;
+            uint64_t& word = word_of(next_index);
+            const uint64_t missing = ~word >> first_bit;
+            const unsigned int run_length = missing ? __builtin_ctzll(missing) : 64 - first_bit;
+            if(run_length == 0) {
+                return;
+            }
+            word &= ~((run_length == 64 ? ~0ULL : ((1ULL << run_length) - 1)) << first_bit);
+            prefix_end += run_length;
+            if(first_bit + run_length < 64) {
+                return;
+            }
+        }
+    }
+
+public:
+    /** @param initial_capacity The number of indices beyond the prefix the window should hold without reallocating. */
+    explicit ReceivedWindow(std::size_t initial_capacity = 64) : prefix_end(-1) {
+        std::size_t num_words = 1;
+        while(num_words * 64 < initial_capacity) {
+            num_words *= 2;
+        }
+        words.assign(num_words, 0);
+        word_mask = num_words - 1;
+    }
+
+    /**
+     * Records that the messages with indices beg_index through end_index
+     * (inclusive) have been received.
+     * @return The highest index such that every index up to it has been received
+     */
+    long long int receive(long long int beg_index, long long int end_index) {
+        if(end_index <= prefix_end) {
+            return prefix_end;
+        }
+        if(beg_index <= prefix_end + 1) {
+            prefix_end = end_index;
+        } else {
+            if((std::size_t)(end_index - prefix_end) > capacity()) {
+                grow(end_index);
+            }
+            set_range(beg_index, end_index);
+            return prefix_end;
+        }
+        advance_prefix();
+        return prefix_end;
+    }
+
+    long long int get_prefix_end() const { return prefix_end; }
+};
+}
@@ -6,19 +6,55 @@
 
 #pragma once
 
+#include <algorithm>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
 
 #include "mutils-serialization/SerializationSupport.hpp"
 #include "mutils/FunctionalMap.hpp"
 #include "mutils/tuple_extras.hpp"
 
+#include "byte_view.h"
 #include "rpc_utils.h"
 
 namespace derecho {
 
 namespace rpc {
 
+/**
+ * Unpacks an RPC function argument of type T from a received message. By
+ * default the argument is deserialized into a new object, which owns a copy
+ * of its data.
+ */
+template <typename T>
+struct argument_unpacker {
+    using holder_t = std::unique_ptr<T>;
+    static holder_t unpack(mutils::DeserializationManager* dsm, char const* const buf) {
+        return mutils::from_bytes<T>(dsm, buf);
+    }
+    static std::size_t size(const holder_t& arg) { return mutils::bytes_size(*arg); }
+};
+
+/** A ByteView argument points into the received message, so that its bytes
+ * are never copied or allocated. */
+template <>
+struct argument_unpacker<ByteView> {
+    using holder_t = ByteView;
+    static holder_t unpack(mutils::DeserializationManager*, char const* const buf) {
+        return ByteView::view_of(buf);
+    }
+    static std::size_t size(const holder_t& arg) { return arg.bytes_size(); }
+};
+
+/** Gets the argument held by an argument_unpacker<T>::holder_t. The holder
+ * owns a deserialized copy, so RPC functions may take it by non-const reference. */
+template <typename T>
+T& unpacked(const std::unique_ptr<T>& arg) { return *arg; }
+inline const ByteView& unpacked(const ByteView& arg) { return arg; }
+
 //Technically, RemoteInvocable "specializes" this template for the case where
 //the second parameter is a std::function<Ret(Args...)>. However, there is no
 //implementation for any other specialization, so this template is meaningless.
@@ -44,11 +80,29 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
     const Opcode invoke_opcode;
     const Opcode reply_opcode;
 
-    //Maps invocation-instance IDs to results sets
-    std::map<std::size_t, PendingResults<Ret>> results_map;
+    //Maps invocation-instance IDs to results sets, for the calls that are still
+    //awaiting replies. Entries are removed when the last reply arrives, and
+    //swept out once the caller drops the call's QueryResults.
+    std::map<std::size_t, std::weak_ptr<PendingResults<Ret>>> results_map;
+    //The size of results_map at which it should next be swept
+    std::size_t results_map_sweep_size = 64;
     std::mutex map_lock;
     using lock_t = std::unique_lock<std::mutex>;
 
+    /** Removes the entries of calls that are complete or have been abandoned
+     * by their callers. The caller must hold map_lock. */
+    void sweep_results_map() {
+        for(auto it = results_map.begin(); it != results_map.end();) {
+            auto pending = it->second.lock();
+            if(!pending || pending->is_complete()) {
+                it = results_map.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        results_map_sweep_size = std::max<std::size_t>(64, 2 * results_map.size());
+    }
+
     /* use this from within a derived class to retrieve precisely this RemoteInvoker
      * (this way, all the inherited RemoteInvoker methods in the subclass do not need
      * to worry about type collisions)*/
@@ -82,7 +136,7 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
         std::size_t size;
         char* buf;
         QueryResults<Ret> results;
-        PendingResults<Ret>& pending;
+        std::shared_ptr<PendingResults<Ret>> pending;
     };
 
     /**
@@ -107,11 +161,17 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
             assert(check_size == size);
         }
 
-        lock_t l{map_lock};
-        // default-initialize the maps
-        PendingResults<Ret>& pending_results = results_map[invocation_id];
+        auto pending_results = std::make_shared<PendingResults<Ret>>();
+        //Void functions don't send replies, so there is nothing to look up later
+        if(!std::is_void<Ret>::value) {
+            lock_t l{map_lock};
+            if(results_map.size() >= results_map_sweep_size) {
+                sweep_results_map();
+            }
+            results_map[invocation_id] = pending_results;
+        }
 
-        return send_return{size, serialized_args, pending_results.get_future(),
+        return send_return{size, serialized_args, pending_results->get_future(),
                            pending_results};
     }
 
@@ -128,13 +188,24 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
             const std::function<definitely_char*(int)>&) {
         bool is_exception = response[0];
         long int invocation_id = ((long int*)(response + 1))[0];
-        assert(results_map.count(invocation_id));
         lock_t l{map_lock};
-        // TODO: garbage collection for the responses.
+        auto entry = results_map.find(invocation_id);
+        if(entry == results_map.end()) {
+            return recv_ret{Opcode(), 0, nullptr, nullptr};
+        }
+        auto pending_results = entry->second.lock();
+        // The caller dropped its QueryResults, so nobody is waiting for this reply
+        if(!pending_results) {
+            results_map.erase(entry);
+            return recv_ret{Opcode(), 0, nullptr, nullptr};
+        }
         if(is_exception) {
-            results_map.at(invocation_id).set_exception(nid, std::make_exception_ptr(remote_exception_occurred{nid}));
+            pending_results->set_exception(nid, std::make_exception_ptr(remote_exception_occurred{nid}));
         } else {
-            results_map.at(invocation_id).set_value(nid, *mutils::from_bytes<Ret>(dsm, response + 1 + sizeof(invocation_id)));
+            pending_results->set_value(nid, *mutils::from_bytes<Ret>(dsm, response + 1 + sizeof(invocation_id)));
+        }
+        if(pending_results->is_complete()) {
+            results_map.erase(entry);
         }
         return recv_ret{Opcode(), 0, nullptr, nullptr};
     }
@@ -174,7 +245,10 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
      * @param who The list of nodes that will service this RPC call
      */
     inline void fulfill_pending_results_map(long int invocation_id, const node_list_t& who) {
-        results_map.at(invocation_id).fulfill_map(who);
+        lock_t l{map_lock};
+        if(auto pending_results = results_map.at(invocation_id).lock()) {
+            pending_results->fulfill_map(who);
+        }
     }
 
     /**
@@ -185,16 +259,22 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
      * (The actual function implementation is not needed, since only the
      * remote side needs to know how to implement the RPC function.)
      *
-     * @param receivers A map from RPC message opcodes to handler functions,
+     * @param class_id The class_hash() of the class the function belongs to
+     * @param receivers A table from RPC message opcodes to handler functions,
      * which this RemoteInvoker should add its functions to.
      */
-    RemoteInvoker(const std::type_index& class_id, uint32_t instance_id,
-                  std::map<Opcode, receive_fun_t>& receivers)
-            : invoke_opcode{class_id, instance_id, Tag, false},
-              reply_opcode{class_id, instance_id, Tag, true} {
-        receivers[reply_opcode] = [this](auto... a) {
-            return this->receive_response(a...);
-        };
+    RemoteInvoker(uint64_t class_id, uint32_t instance_id,
+                  ReceiverTable& receivers)
+            : invoke_opcode(make_opcode(class_id, instance_id, Tag, false)),
+              reply_opcode(make_opcode(class_id, instance_id, Tag, true)) {
+        receivers.insert(reply_opcode, &RemoteInvoker::receive_response_thunk, this);
+    }
+
+    /** The receive_fun_t registered for replies, which forwards them to receive_response. */
+    static recv_ret receive_response_thunk(void* invoker, mutils::DeserializationManager* dsm,
+                                           const node_id_t& nid, const char* response,
+                                           const std::function<char*(int)>& f) {
+        return static_cast<RemoteInvoker*>(invoker)->receive_response(dsm, nid, response, f);
     }
 };
 
@@ -210,6 +290,8 @@ struct RemoteInvoker<Tag, std::function<Ret(Args...)>> {
  */
 template <FunctionTag Tag, typename Ret, typename... Args>
 struct RemoteInvocable<Tag, std::function<Ret(Args...)>> {
+    static_assert(!std::is_same<std::decay_t<Ret>, ByteView>::value,
+                  "An RPC function can't return a ByteView, since the bytes it refers to don't outlive the function");
     using remote_function_type = std::function<Ret(Args...)>;
     const remote_function_type remote_invocable_function;
     const Opcode invoke_opcode;
@@ -230,24 +312,25 @@ struct RemoteInvocable<Tag, std::function<Ret(Args...)>> {
     }
 
     template <typename fst, typename... rst>
-    std::tuple<std::unique_ptr<fst>, std::unique_ptr<rst>...> _deserialize(
+    std::tuple<typename argument_unpacker<fst>::holder_t, typename argument_unpacker<rst>::holder_t...> _deserialize(
             mutils::DeserializationManager* dsm, char const* const buf, fst*,
             rst*... rest) {
-        using Type = std::decay_t<fst>;
-        auto ds = mutils::from_bytes<Type>(dsm, buf);
-        const auto size = mutils::bytes_size(*ds);
+        auto ds = argument_unpacker<fst>::unpack(dsm, buf);
+        const auto size = argument_unpacker<fst>::size(ds);
         return std::tuple_cat(std::make_tuple(std::move(ds)),
                               _deserialize(dsm, buf + size, rest...));
     }
 
     /**
      * Deserializes a buffer containing a list of arguments into a tuple
-     * containing the arguments, deserialized.
+     * containing the arguments, deserialized. ByteView arguments are not
+     * copied, and point into the buffer.
      * @param dsm
      * @param buf The buffer containing serialized objects
-     * @return A tuple of deserialized objects
+     * @return A tuple of deserialized objects, each of which can be passed to
+     * unpacked() to get the argument
      */
-    std::tuple<std::unique_ptr<std::decay_t<Args>>...> deserialize(
+    std::tuple<typename argument_unpacker<std::decay_t<Args>>::holder_t...> deserialize(
             mutils::DeserializationManager* dsm, char const* const buf) {
         return _deserialize(dsm, buf, ((std::decay_t<Args>*)(nullptr))...);
     }
@@ -266,7 +349,7 @@ struct RemoteInvocable<Tag, std::function<Ret(Args...)>> {
         long int invocation_id = ((long int*)_recv_buf)[0];
         auto recv_buf = _recv_buf + sizeof(long int);
         try {
-            const auto result = mutils::callFunc([&](const auto&... args) { return remote_invocable_function(*args...); },
+            const auto result = mutils::callFunc([&](const auto&... args) { return remote_invocable_function(unpacked(args)...); },
                                                  deserialize(dsm, recv_buf));
             // const auto result = remote_invocable_function(*deserialize<Args>(dsm, recv_buf)...);
             const auto result_size = mutils::bytes_size(result) + sizeof(long int) + 1;
@@ -294,7 +377,7 @@ struct RemoteInvocable<Tag, std::function<Ret(Args...)>> {
                                  const std::function<char*(int)>&) {
         //TODO: Need to catch exceptions here, and possibly send them back, since void functions can still throw exceptions!
         auto recv_buf = _recv_buf + sizeof(long int);
-        mutils::callFunc([&](const auto&... args) { remote_invocable_function(*args...); },
+        mutils::callFunc([&](const auto&... args) { remote_invocable_function(unpacked(args)...); },
                          deserialize(dsm, recv_buf));
         // remote_invocable_function(*deserialize<Args>(dsm, recv_buf)...);
         return recv_ret{reply_opcode, 0, nullptr};
@@ -321,20 +404,26 @@ struct RemoteInvocable<Tag, std::function<Ret(Args...)>> {
      * Constructs a RemoteInvocable that provides RPC call handling for a
      * specific function, and registers the RPC-handling functions in the
      * given "receivers" map.
-     * @param receivers A map from RPC message opcodes to handler functions,
+     * @param class_id The class_hash() of the class the function belongs to
+     * @param receivers A table from RPC message opcodes to handler functions,
      * which this RemoteInvocable should add its functions to.
      * @param f The actual function that should be called when an RPC call
      * arrives.
      */
-    RemoteInvocable(const std::type_index& class_id, uint32_t instance_id,
-                    std::map<Opcode, receive_fun_t>& receivers,
+    RemoteInvocable(uint64_t class_id, uint32_t instance_id,
+                    ReceiverTable& receivers,
                     std::function<Ret(Args...)> f)
             : remote_invocable_function(f),
-              invoke_opcode{class_id, instance_id, Tag, false},
-              reply_opcode{class_id, instance_id, Tag, true} {
-        receivers[invoke_opcode] = [this](auto... a) {
-            return this->receive_call(a...);
-        };
+              invoke_opcode(make_opcode(class_id, instance_id, Tag, false)),
+              reply_opcode(make_opcode(class_id, instance_id, Tag, true)) {
+        receivers.insert(invoke_opcode, &RemoteInvocable::receive_call_thunk, this);
+    }
+
+    /** The receive_fun_t registered for calls, which forwards them to receive_call. */
+    static recv_ret receive_call_thunk(void* invocable, mutils::DeserializationManager* dsm,
+                                       const node_id_t& who, const char* recv_buf,
+                                       const std::function<char*(int)>& out_alloc) {
+        return static_cast<RemoteInvocable*>(invocable)->receive_call(dsm, who, recv_buf, out_alloc);
     }
 };
 
@@ -423,9 +512,9 @@ struct RemoteInvocablePairs;
 template <FunctionTag id, typename FunType>
 struct RemoteInvocablePairs<wrapped<id, FunType>>
         : public RemoteInvoker<id, FunType>, public RemoteInvocable<id, FunType> {
-    RemoteInvocablePairs(const std::type_index& class_id,
+    RemoteInvocablePairs(uint64_t class_id,
                          uint32_t instance_id,
-                         std::map<Opcode, receive_fun_t>& receivers, FunType function_ptr)
+                         ReceiverTable& receivers, FunType function_ptr)
             : RemoteInvoker<id, FunType>(class_id, instance_id, receivers),
               RemoteInvocable<id, FunType>(class_id, instance_id, receivers, function_ptr) {}
 
@@ -449,9 +538,9 @@ template <FunctionTag id, typename FunType, typename... rest>
 struct RemoteInvocablePairs<wrapped<id, FunType>, rest...>
         : public RemoteInvoker<id, FunType>, public RemoteInvocable<id, FunType>, public RemoteInvocablePairs<rest...> {
     template <typename... RestFunTypes>
-    RemoteInvocablePairs(const std::type_index& class_id,
+    RemoteInvocablePairs(uint64_t class_id,
                          uint32_t instance_id,
-                         std::map<Opcode, receive_fun_t>& receivers,
+                         ReceiverTable& receivers,
                          FunType function_ptr,
                          RestFunTypes&&... function_ptrs)
             : RemoteInvoker<id, FunType>(class_id, instance_id, receivers),
@@ -478,9 +567,9 @@ struct RemoteInvokers;
  */
 template <FunctionTag Tag, typename FunType>
 struct RemoteInvokers<wrapped<Tag, FunType>> : public RemoteInvoker<Tag, FunType> {
-    RemoteInvokers(const std::type_index& class_id,
+    RemoteInvokers(uint64_t class_id,
                    uint32_t instance_id,
-                   std::map<Opcode, receive_fun_t>& receivers)
+                   ReceiverTable& receivers)
             : RemoteInvoker<Tag, FunType>(class_id, instance_id, receivers) {}
 
     using RemoteInvoker<Tag, FunType>::get_invoker;
@@ -499,9 +588,9 @@ struct RemoteInvokers<wrapped<Tag, FunType>> : public RemoteInvoker<Tag, FunType
 template <FunctionTag Tag, typename FunType, typename... RestWrapped>
 struct RemoteInvokers<wrapped<Tag, FunType>, RestWrapped...>
         : public RemoteInvoker<Tag, FunType>, public RemoteInvokers<RestWrapped...> {
-    RemoteInvokers(const std::type_index& class_id,
+    RemoteInvokers(uint64_t class_id,
                    uint32_t instance_id,
-                   std::map<Opcode, receive_fun_t>& receivers)
+                   ReceiverTable& receivers)
             : RemoteInvoker<Tag, FunType>(class_id, instance_id, receivers),
               RemoteInvokers<RestWrapped...>(class_id, instance_id, receivers) {}
 
@@ -512,7 +601,7 @@ struct RemoteInvokers<wrapped<Tag, FunType>, RestWrapped...>
 /**
  * Transforms a class into a "replicated object" with methods that can be
  * invoked by RPC, given a place to store RPC message handlers (which should be
- * the "receivers map" of RPCManager). Each RPC-invokable method must be
+ * the "receivers table" of RPCManager). Each RPC-invokable method must be
  * supplied as a template parameter, in order to associate it with a compile-time
  * constant name (the tag).
  * @tparam IdentifyingClass The class to make into an RPC-invokable class
@@ -525,8 +614,8 @@ public:
     const node_id_t nid;
 
     RemoteInvocableClass(node_id_t nid, uint32_t instance_id,
-                         std::map<Opcode, receive_fun_t>& rvrs, const WrappedFuns&... fs)
-            : RemoteInvocablePairs<WrappedFuns...>(std::type_index(typeid(IdentifyingClass)), instance_id, rvrs, fs.fun...),
+                         ReceiverTable& rvrs, const WrappedFuns&... fs)
+            : RemoteInvocablePairs<WrappedFuns...>(class_hash<IdentifyingClass>(), instance_id, rvrs, fs.fun...),
               nid(nid) {}
 
     /**
@@ -563,7 +652,7 @@ public:
         */
         struct send_return {
             QueryResults<Ret> results;
-            PendingResults<Ret>& pending;
+            std::shared_ptr<PendingResults<Ret>> pending;
         };
         return send_return{std::move(sent_return.results),
                            sent_return.pending};
@@ -582,7 +671,7 @@ public:
  * @param instance_id A number uniquely identifying this instance of the
  * template-parameter class; in practice, the ID of the subgroup that will be
  * replicating this object.
- * @param rvrs A map from RPC opcodes to RPC message handler functions, into
+ * @param rvrs A table from RPC opcodes to RPC message handler functions, into
  * which new handlers will be added for this RemoteInvocableClass
  * @param fs A list of "wrapped" function pointers to members of the wrapped
  * class, each associated with a name, which should become RPC functions
@@ -590,14 +679,14 @@ public:
  */
 template <class IdentifyingClass, typename... WrappedFuns>
 auto build_remote_invocable_class(const node_id_t nid, const uint32_t instance_id,
-                                  std::map<Opcode, receive_fun_t>& rvrs,
+                                  ReceiverTable& rvrs,
                                   const WrappedFuns&... fs) {
     return std::make_unique<RemoteInvocableClass<IdentifyingClass, WrappedFuns...>>(nid, instance_id, rvrs, fs...);
 }
 
 /**
  * Transforms a class into an RPC client for the methods of that class, given a
- * place to store RPC message handlers (which should be the "receivers map" of
+ * place to store RPC message handlers (which should be the "receivers table" of
  * RPCManager). Each RPC-invokable method must be supplied as a template
  * parameter, in order to associate it with a compile-time constant name (the
  * tag). This must be the same tag that the "RPC server" being contacted used
@@ -612,8 +701,8 @@ public:
     const node_id_t nid;
 
     RemoteInvokerForClass(node_id_t nid, uint32_t instance_id,
-                          std::map<Opcode, receive_fun_t>& rvrs)
-            : RemoteInvokers<WrappedFuns...>(std::type_index(typeid(IdentifyingClass)), instance_id, rvrs),
+                          ReceiverTable& rvrs)
+            : RemoteInvokers<WrappedFuns...>(class_hash<IdentifyingClass>(), instance_id, rvrs),
               nid(nid) {}
 
     template <FunctionTag Tag, typename... Args>
@@ -640,7 +729,7 @@ public:
         */
         struct send_return {
             QueryResults<Ret> results;
-            PendingResults<Ret>& pending;
+            std::shared_ptr<PendingResults<Ret>> pending;
         };
         return send_return{std::move(sent_return.results),
                            sent_return.pending};
@@ -655,13 +744,13 @@ public:
  * when calling RPC methods on this class (since more than one instance of the
  * template-parameter class could be running as a RemoteInvocableClass); in
  * practice this is the subgroup ID of the subgroup to contact.
- * @param rvrs A map from RPC opcodes to RPC message handler functions, into
+ * @param rvrs A table from RPC opcodes to RPC message handler functions, into
  * which new handlers will be added for this RemoteInvokerForClass
  * @return A unique_ptr to a RemoteInvokerForClass of type IdentifyingClass
  */
 template <class IdentifyingClass, typename... WrappedFuns>
 auto build_remote_invoker_for_class(const node_id_t nid, const uint32_t instance_id,
-                                    std::map<Opcode, receive_fun_t>& rvrs) {
+                                    ReceiverTable& rvrs) {
     return std::make_unique<RemoteInvokerForClass<IdentifyingClass, WrappedFuns...>>(nid, instance_id, rvrs);
 }
 }
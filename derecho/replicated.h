@@ -19,6 +19,7 @@
 #include "remote_invocable.h"
 #include "rpc_manager.h"
 #include "rpc_utils.h"
+#include "state_transfer.h"
 
 namespace derecho {
 
@@ -55,17 +56,15 @@ private:
     rpc::RPCManager& group_rpc_manager;
     /** The actual implementation of Replicated<T>, hiding its ugly template parameters. */
     std::unique_ptr<rpc::RemoteInvocableOf<T>> wrapped_this;
-    /** Buffer for replying to P2P messages, cached here so it doesn't need to be
-     * created in every p2p_send call. */
-    std::unique_ptr<char[]> p2pSendBuffer;
 
     template <rpc::FunctionTag tag, typename... Args>
     auto ordered_send_or_query(const std::vector<node_id_t>& destination_nodes,
                                Args&&... args) {
         if(is_valid()) {
-            char* buffer;
-            while(!(buffer = group_rpc_manager.view_manager.get_sendbuffer_ptr(subgroup_id, 0, true, 0, true))) {
-            };
+            char* buffer = group_rpc_manager.view_manager.wait_for_sendbuffer_ptr(subgroup_id, 0, true, 0, true);
+            if(!buffer) {
+                throw derecho_exception("Could not get a send buffer because the group is shutting down");
+            }
             std::shared_lock<std::shared_timed_mutex> view_read_lock(group_rpc_manager.view_manager.view_mutex);
 
             std::size_t max_payload_size;
@@ -83,7 +82,7 @@ private:
                     },
                     std::forward<Args>(args)...);
 
-            group_rpc_manager.finish_rpc_send(subgroup_id, destination_nodes, send_return_struct.pending);
+            group_rpc_manager.finish_rpc_send(subgroup_id, destination_nodes, send_return_struct.pending, view_read_lock);
             return std::move(send_return_struct.results);
         } else {
             throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
@@ -97,18 +96,20 @@ private:
             //Ensure a view change isn't in progress
             std::shared_lock<std::shared_timed_mutex> view_read_lock(group_rpc_manager.view_manager.view_mutex);
             size_t size;
-            auto max_payload_size = group_rpc_manager.view_manager.curr_view->multicast_group->max_msg_size - sizeof(header);
+            const std::size_t max_payload_size = group_rpc_manager.max_p2p_payload_size;
+            //Other threads may be sending through this object too, so borrow a buffer for this send
+            rpc::RPCManager::P2PSendBuffer send_buffer = group_rpc_manager.get_p2p_send_buffer();
             auto return_pair = wrapped_this->template send<tag>(
-                    [this, &max_payload_size, &size](size_t _size) -> char* {
+                    [&send_buffer, &max_payload_size, &size](size_t _size) -> char* {
                         size = _size;
                         if(size <= max_payload_size) {
-                            return p2pSendBuffer.get();
+                            return send_buffer.get();
                         } else {
                             return nullptr;
                         }
                     },
                     std::forward<Args>(args)...);
-            group_rpc_manager.finish_p2p_send(dest_node, p2pSendBuffer.get(), size, return_pair.pending);
+            group_rpc_manager.finish_p2p_send(dest_node, send_buffer.get(), size, return_pair.pending);
             return std::move(return_pair.results);
         } else {
             throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
@@ -133,8 +134,7 @@ public:
               node_id(nid),
               subgroup_id(subgroup_id),
               group_rpc_manager(group_rpc_manager),
-              wrapped_this(group_rpc_manager.make_remote_invocable_class(user_object_ptr.get(), subgroup_id, T::register_functions())),
-              p2pSendBuffer(new char[group_rpc_manager.view_manager.derecho_params.max_payload_size]) {}
+              wrapped_this(group_rpc_manager.make_remote_invocable_class(user_object_ptr.get(), subgroup_id, T::register_functions())) {}
 
     /**
      * Constructs a Replicated<T> for an object without actually constructing an
@@ -153,8 +153,7 @@ public:
               node_id(nid),
               subgroup_id(subgroup_id),
               group_rpc_manager(group_rpc_manager),
-              wrapped_this(group_rpc_manager.make_remote_invocable_class(user_object_ptr.get(), subgroup_id, T::register_functions())),
-              p2pSendBuffer(new char[group_rpc_manager.view_manager.derecho_params.max_payload_size]) {}
+              wrapped_this(group_rpc_manager.make_remote_invocable_class(user_object_ptr.get(), subgroup_id, T::register_functions())) {}
 
     Replicated(Replicated&&) = default;
     Replicated(const Replicated&) = delete;
@@ -289,13 +288,16 @@ public:
      * Serializes and sends the state of the "wrapped" object (of type T) for
      * this Replicated<T> over the given socket. (This includes sending the
      * object's size before its data, so the receiver knows the size of buffer
-     * to allocate).
+     * to allocate). The object is sent in chunks of STATE_TRANSFER_CHUNK_SIZE
+     * bytes as it is serialized, so it is never copied in full.
      * @param receiver_socket
      */
     void send_object(tcp::socket& receiver_socket) const {
-        auto bind_socket_write = [&receiver_socket](const char* bytes, std::size_t size) { receiver_socket.write(bytes, size); };
+        ChunkedSocketWriter socket_writer(receiver_socket);
+        auto bind_socket_write = [&socket_writer](const char* bytes, std::size_t size) { socket_writer.write(bytes, size); };
         mutils::post_object(bind_socket_write, object_size());
-        send_object_raw(receiver_socket);
+        mutils::post_object(bind_socket_write, **user_object_ptr);
+        socket_writer.finish();
     }
 
     /**
@@ -307,8 +309,10 @@ public:
      * @param receiver_socket
      */
     void send_object_raw(tcp::socket& receiver_socket) const {
-        auto bind_socket_write = [&receiver_socket](const char* bytes, std::size_t size) { receiver_socket.write(bytes, size); };
+        ChunkedSocketWriter socket_writer(receiver_socket);
+        auto bind_socket_write = [&socket_writer](const char* bytes, std::size_t size) { socket_writer.write(bytes, size); };
         mutils::post_object(bind_socket_write, **user_object_ptr);
+        socket_writer.finish();
     }
 
     /**
@@ -338,9 +342,6 @@ private:
     rpc::RPCManager& group_rpc_manager;
     /** The actual implementation of ExternalCaller, which has lots of ugly template parameters */
     std::unique_ptr<rpc::RemoteInvokerFor<T>> wrapped_this;
-    /** Buffer for replying to P2P messages, cached here so it doesn't need to be
-     * created in every p2p_send call. */
-    std::unique_ptr<char[]> p2pSendBuffer;
 
     //This is literally copied and pasted from Replicated<T>. I wish I could let them share code with inheritance,
     //but I'm afraid that will introduce unnecessary overheads.
@@ -351,18 +352,20 @@ private:
             //Ensure a view change isn't in progress
             std::shared_lock<std::shared_timed_mutex> view_read_lock(group_rpc_manager.view_manager.view_mutex);
             size_t size;
-            auto max_payload_size = group_rpc_manager.view_manager.curr_view->multicast_group->max_msg_size - sizeof(header);
+            const std::size_t max_payload_size = group_rpc_manager.max_p2p_payload_size;
+            //Other threads may be sending through this object too, so borrow a buffer for this send
+            rpc::RPCManager::P2PSendBuffer send_buffer = group_rpc_manager.get_p2p_send_buffer();
             auto return_pair = wrapped_this->template send<tag>(
-                    [this, &max_payload_size, &size](size_t _size) -> char* {
+                    [&send_buffer, &max_payload_size, &size](size_t _size) -> char* {
                         size = _size;
                         if(size <= max_payload_size) {
-                            return p2pSendBuffer.get();
+                            return send_buffer.get();
                         } else {
                             return nullptr;
                         }
                     },
                     std::forward<Args>(args)...);
-            group_rpc_manager.finish_p2p_send(dest_node, p2pSendBuffer.get(), size, return_pair.pending);
+            group_rpc_manager.finish_p2p_send(dest_node, send_buffer.get(), size, return_pair.pending);
             return std::move(return_pair.results);
         } else {
             throw derecho::empty_reference_exception{"Attempted to use an empty Replicated<T>"};
@@ -374,8 +377,7 @@ public:
             : node_id(nid),
               subgroup_id(subgroup_id),
               group_rpc_manager(group_rpc_manager),
-              wrapped_this(group_rpc_manager.make_remote_invoker<T>(subgroup_id, T::register_functions())),
-              p2pSendBuffer(new char[group_rpc_manager.view_manager.derecho_params.max_payload_size]) {}
+              wrapped_this(group_rpc_manager.make_remote_invoker<T>(subgroup_id, T::register_functions())) {}
 
     ExternalCaller(ExternalCaller&&) = default;
     ExternalCaller(const ExternalCaller&) = delete;
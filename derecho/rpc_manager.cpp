@@ -4,6 +4,7 @@
  * @date Feb 7, 2017
  */
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
@@ -18,10 +19,19 @@ RPCManager::~RPCManager() {
     if(rpc_thread.joinable()) {
         rpc_thread.join();
     }
+    for(auto& worker : p2p_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->queue_mutex);
+        }
+        worker->queue_cv.notify_all();
+        if(worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
     connections.destroy();
 }
 
-LockedReference<std::unique_lock<std::mutex>, tcp::socket> RPCManager::get_socket(node_id_t node) {
+tcp::exclusive_socket_reference RPCManager::get_socket(node_id_t node) {
     return connections.get_socket(node);
 }
 
@@ -31,7 +41,7 @@ std::exception_ptr RPCManager::handle_receive(
     using namespace remote_invocation_utilities;
     assert(payload_size);
     auto reply_header_size = header_space();
-    //TODO: Check that the given Opcode is actually in our receivers map,
+    //TODO: Check that the given Opcode is actually in our receivers table,
     //and reply with a "no such method error" if it is not
     recv_ret reply_return = receivers->at(indx)(
             &dsm, received_from, buf,
@@ -77,11 +87,17 @@ void RPCManager::rpc_message_handler(subgroup_id_t subgroup_id, node_id_t sender
     }
     if(in_dest || dest_size == 0) {
         auto max_payload_size = view_manager.curr_view->multicast_group->max_msg_size - sizeof(header);
+        //Messages in different subgroups can be delivered by different predicate
+        //threads at once, so each thread has its own buffer for replies
+        thread_local std::vector<char> reply_buffer;
+        if(reply_buffer.size() < max_payload_size) {
+            reply_buffer.resize(max_payload_size);
+        }
         size_t reply_size = 0;
-        handle_receive(msg_buf, payload_size, [this, &reply_size, &max_payload_size](size_t size) -> char* {
+        handle_receive(msg_buf, payload_size, [&reply_size, &max_payload_size](size_t size) -> char* {
             reply_size = size;
             if(reply_size <= max_payload_size) {
-                return replySendBuffer.get();
+                return reply_buffer.data();
             } else {
                 return nullptr;
             }
@@ -89,45 +105,53 @@ void RPCManager::rpc_message_handler(subgroup_id_t subgroup_id, node_id_t sender
         if(reply_size > 0) {
             if(sender_id == nid) {
                 handle_receive(
-                        replySendBuffer.get(), reply_size,
+                        reply_buffer.data(), reply_size,
                         [](size_t size) -> char* { assert(false); });
                 if(dest_size == 0) {
                     //Destination was "all nodes in my shard of the subgroup"
                     int my_shard = view_manager.curr_view->multicast_group->get_subgroup_to_shard_and_rank().at(subgroup_id).first;
                     std::lock_guard<std::mutex> lock(pending_results_mutex);
-                    toFulfillQueue.front().get().fulfill_map(
-                            view_manager.curr_view->subgroup_shard_views.at(subgroup_id).at(my_shard).members);
-                    fulfilledList.push_back(std::move(toFulfillQueue.front()));
+                    //If the caller has already dropped its QueryResults, nobody needs the replies
+                    if(auto pending_results = toFulfillQueue.front().lock()) {
+                        const auto& shard_members = view_manager.curr_view->subgroup_shard_views.at(subgroup_id).at(my_shard).members;
+                        pending_results->fulfill_map(shard_members);
+                        track_pending_results(pending_results, shard_members);
+                    }
                     toFulfillQueue.pop();
                 }
             } else {
-                connections.write(sender_id, replySendBuffer.get(), reply_size);
+                connections.write(sender_id, reply_buffer.data(), reply_size);
             }
         }
     }
 }
 
-void RPCManager::p2p_message_handler(node_id_t sender_id, char* msg_buf, uint32_t buffer_size) {
+void RPCManager::p2p_message_handler(node_id_t sender_id, char* msg_buf, std::size_t msg_size) {
     using namespace remote_invocation_utilities;
     const std::size_t header_size = header_space();
-    connections.read(sender_id, msg_buf, header_size);
     std::size_t payload_size;
     Opcode indx;
     node_id_t received_from;
     retrieve_header(nullptr, msg_buf, payload_size, indx, received_from);
-    connections.read(sender_id, msg_buf + header_size, payload_size);
+    //Workers don't hold the view lock, so they use the bound computed at construction
+    const std::size_t max_payload_size = max_p2p_payload_size;
+    //Each worker replies from its own buffer, so replies don't wait for the message to be released
+    thread_local std::vector<char> reply_buffer;
+    if(reply_buffer.size() < max_payload_size) {
+        reply_buffer.resize(max_payload_size);
+    }
     size_t reply_size = 0;
     handle_receive(indx, received_from, msg_buf + header_size, payload_size,
-                   [&msg_buf, &buffer_size, &reply_size](size_t _size) -> char* {
+                   [&max_payload_size, &reply_size](size_t _size) -> char* {
                        reply_size = _size;
-                       if(reply_size <= buffer_size) {
-                           return msg_buf;
+                       if(reply_size <= max_payload_size) {
+                           return reply_buffer.data();
                        } else {
                            return nullptr;
                        }
                    });
     if(reply_size > 0) {
-        connections.write(received_from, msg_buf, reply_size);
+        connections.write(received_from, reply_buffer.data(), reply_size);
     }
 }
 
@@ -154,10 +178,37 @@ void RPCManager::new_view_callback(const View& new_view) {
     }
 
     std::lock_guard<std::mutex> lock(pending_results_mutex);
-    for(auto& pending : fulfilledList) {
-        for(auto removed_id : new_view.departed) {
-            pending.get().set_exception_for_removed_node(removed_id);
+    for(auto removed_id : new_view.departed) {
+        auto calls_entry = pending_calls_by_node.find(removed_id);
+        if(calls_entry == pending_calls_by_node.end()) {
+            continue;
+        }
+        for(const auto& call : calls_entry->second.calls) {
+            if(auto pending_results = call.lock()) {
+                pending_results->set_exception_for_removed_node(removed_id);
+            }
+        }
+        pending_calls_by_node.erase(calls_entry);
+    }
+}
+
+void RPCManager::track_pending_results(const std::shared_ptr<PendingBase>& pending_results,
+                                       const node_list_t& dest_nodes) {
+    if(pending_results->is_complete()) {
+        return;
+    }
+    for(const node_id_t dest_node : dest_nodes) {
+        PendingCalls& node_calls = pending_calls_by_node[dest_node];
+        if(node_calls.calls.size() >= node_calls.sweep_size) {
+            node_calls.calls.erase(std::remove_if(node_calls.calls.begin(), node_calls.calls.end(),
+                                                  [](const std::weak_ptr<PendingBase>& call) {
+                                                      auto pending = call.lock();
+                                                      return !pending || pending->is_complete();
+                                                  }),
+                                   node_calls.calls.end());
+            node_calls.sweep_size = std::max<std::size_t>(64, 2 * node_calls.calls.size());
         }
+        node_calls.calls.emplace_back(pending_results);
     }
 }
 
@@ -179,35 +230,120 @@ int RPCManager::populate_nodelist_header(const std::vector<node_id_t>& dest_node
     return header_size;
 }
 
-void RPCManager::finish_rpc_send(uint32_t subgroup_id, const std::vector<node_id_t>& dest_nodes, PendingBase& pending_results_handle) {
+void RPCManager::finish_rpc_send(uint32_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                                 const std::shared_ptr<PendingBase>& pending_results_handle,
+                                 std::shared_lock<std::shared_timed_mutex>& view_read_lock) {
+    //If the destinations are known, the map must be ready before a reply can arrive
+    if(dest_nodes.size()) {
+        pending_results_handle->fulfill_map(dest_nodes);
+    }
+    // send() only fails while the view is changing, and the change can't
+    // finish until this thread releases its lock on the view
     while(!view_manager.curr_view->multicast_group->send(subgroup_id)) {
+        view_manager.view_change_cv.wait(view_read_lock);
     }
     std::lock_guard<std::mutex> lock(pending_results_mutex);
     if(dest_nodes.size()) {
-        pending_results_handle.fulfill_map(dest_nodes);
-        fulfilledList.push_back(pending_results_handle);
+        track_pending_results(pending_results_handle, dest_nodes);
     } else {
         toFulfillQueue.push(pending_results_handle);
     }
 }
 
-void RPCManager::finish_p2p_send(node_id_t dest_node, char* msg_buf, std::size_t size, PendingBase& pending_results_handle) {
+void RPCManager::finish_p2p_send(node_id_t dest_node, char* msg_buf, std::size_t size,
+                                 const std::shared_ptr<PendingBase>& pending_results_handle) {
+    //The map must be ready before the reply can arrive
+    pending_results_handle->fulfill_map({dest_node});
+    {
+        std::lock_guard<std::mutex> lock(pending_results_mutex);
+        track_pending_results(pending_results_handle, {dest_node});
+    }
     connections.write(dest_node, msg_buf, size);
-    pending_results_handle.fulfill_map({dest_node});
-    std::lock_guard<std::mutex> lock(pending_results_mutex);
-    fulfilledList.push_back(pending_results_handle);
+}
+
+RPCManager::P2PSendBuffer RPCManager::get_p2p_send_buffer() {
+    std::unique_lock<std::mutex> lock(p2p_send_buffers_mutex);
+    if(free_p2p_send_buffers.empty()) {
+        lock.unlock();
+        //This is the bound that p2p_send_or_query checks each message against
+        return P2PSendBuffer(this, std::unique_ptr<char[]>(new char[max_p2p_payload_size]));
+    }
+    std::unique_ptr<char[]> buffer = std::move(free_p2p_send_buffers.back());
+    free_p2p_send_buffers.pop_back();
+    return P2PSendBuffer(this, std::move(buffer));
+}
+
+void RPCManager::release_p2p_send_buffer(std::unique_ptr<char[]> buffer) {
+    std::lock_guard<std::mutex> lock(p2p_send_buffers_mutex);
+    free_p2p_send_buffers.emplace_back(std::move(buffer));
 }
 
 void RPCManager::p2p_receive_loop() {
     pthread_setname_np(pthread_self(), "rpc_thread");
-    auto max_payload_size = view_manager.curr_view->multicast_group->max_msg_size - sizeof(header);
-    std::unique_ptr<char[]> rpcBuffer = std::unique_ptr<char[]>(new char[max_payload_size]);
+    using namespace remote_invocation_utilities;
+    const std::size_t header_size = header_space();
+    //The bytes received from each node since the last whole message it sent. Workers
+    //read whole messages in place, so a buffer is never appended to once one of its
+    //messages has been handed out; the next read goes into a new buffer instead.
+    std::map<node_id_t, std::shared_ptr<std::vector<char>>> receive_buffers;
+    std::vector<node_id_t> ready_nodes;
     while(!thread_shutdown) {
-        auto other_id = connections.probe_all();
-        if(other_id < 0) {
-            continue;
+        connections.wait_readable(ready_nodes, 100);
+        for(const node_id_t sender_id : ready_nodes) {
+            std::shared_ptr<std::vector<char>>& buffer = receive_buffers[sender_id];
+            if(!buffer) {
+                buffer = std::make_shared<std::vector<char>>();
+            }
+            bool busy;
+            if(!connections.read_available(sender_id, *buffer, busy)) {
+                //The connection is gone, and will be cleaned up by the next view change
+                receive_buffers.erase(sender_id);
+                continue;
+            }
+            if(busy) {
+                //The holder of get_socket() rearms the socket when it releases it
+                continue;
+            }
+            std::size_t offset = 0;
+            while(buffer->size() - offset >= header_size) {
+                std::size_t payload_size;
+                Opcode indx;
+                node_id_t received_from;
+                retrieve_header(nullptr, buffer->data() + offset, payload_size, indx, received_from);
+                const std::size_t msg_size = header_size + payload_size;
+                if(buffer->size() - offset < msg_size) {
+                    break;
+                }
+                P2PWorker& worker = *p2p_workers[sender_id % p2p_workers.size()];
+                {
+                    std::lock_guard<std::mutex> lock(worker.queue_mutex);
+                    worker.messages.push(P2PMessage{sender_id, buffer, offset, msg_size});
+                }
+                worker.queue_cv.notify_one();
+                offset += msg_size;
+            }
+            if(offset > 0) {
+                //Only the start of a partial message, if any, is copied into the new buffer
+                buffer = std::make_shared<std::vector<char>>(buffer->begin() + offset, buffer->end());
+            }
+            connections.rearm(sender_id);
+        }
+    }
+}
+
+void RPCManager::p2p_worker_loop(P2PWorker& worker) {
+    pthread_setname_np(pthread_self(), "p2p_worker");
+    std::unique_lock<std::mutex> lock(worker.queue_mutex);
+    while(true) {
+        worker.queue_cv.wait(lock, [&]() { return thread_shutdown || !worker.messages.empty(); });
+        if(worker.messages.empty()) {
+            return;
         }
-        p2p_message_handler(other_id, rpcBuffer.get(), max_payload_size);
+        P2PMessage message = std::move(worker.messages.front());
+        worker.messages.pop();
+        lock.unlock();
+        p2p_message_handler(message.sender_id, message.buffer->data() + message.offset, message.size);
+        lock.lock();
     }
 }
 }
@@ -6,11 +6,16 @@
 
 #pragma once
 
+#include <algorithm>
+#include <condition_variable>
 #include <exception>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <thread>
 #include <vector>
 
 #include "mutils-serialization/SerializationSupport.hpp"
@@ -32,11 +37,11 @@ class RPCManager {
     static_assert(std::is_trivially_copyable<Opcode>::value, "Oh no! Opcode is not trivially copyable!");
     /** The ID of the node this RPCManager is running on. */
     const node_id_t nid;
-    /** A map from FunctionIDs to RPC functions, either the "server" stubs that receive
+    /** A table from Opcodes to RPC functions, either the "server" stubs that receive
      * remote calls to invoke functions, or the "client" stubs that receive responses
      * from the targets of an earlier remote call.
-     * Note that a FunctionID is (class ID, subgroup ID, Function Tag). */
-    std::unique_ptr<std::map<Opcode, receive_fun_t>> receivers;
+     * Note that an Opcode is a hash of (class name, subgroup ID, Function Tag, is-reply). */
+    std::unique_ptr<ReceiverTable> receivers;
     /** An emtpy DeserializationManager, in case we need it later. */
     mutils::DeserializationManager dsm{{}};
 
@@ -50,31 +55,108 @@ class RPCManager {
 
     /** Contains a TCP connection to each member of the group. */
     tcp::tcp_connections connections;
+    /** The largest P2P message or reply, which depends only on the group's
+     * DerechoParams, so P2P workers don't need to read the current View. */
+    const std::size_t max_p2p_payload_size;
+
+    /** The calls that are awaiting replies from one node, which may include
+     * calls that have completed or been abandoned since the last sweep. */
+    struct PendingCalls {
+        std::vector<std::weak_ptr<PendingBase>> calls;
+        /** The size of calls at which it should next be swept */
+        std::size_t sweep_size = 64;
+    };
 
     std::mutex pending_results_mutex;
-    std::queue<std::reference_wrapper<PendingBase>> toFulfillQueue;
-    std::list<std::reference_wrapper<PendingBase>> fulfilledList;
+    /** Ordered sends to the whole shard, whose destination nodes will be known once they are delivered. */
+    std::queue<std::weak_ptr<PendingBase>> toFulfillQueue;
+    /** For each node, the calls that are waiting for it to reply, so that
+     * they can be given an exception if the node fails. */
+    std::map<node_id_t, PendingCalls> pending_calls_by_node;
 
-    /** This is not accessed outside invocations of cooked_send_callback,
-     * it's just a member so it won't be newly allocated every time. */
-    std::unique_ptr<char[]> replySendBuffer;
+    /**
+     * Records that a call is waiting for replies from a set of nodes. Sweeps
+     * out the complete and abandoned calls of a node whenever its list has
+     * doubled in size since the last sweep, so the lists stay proportional
+     * to the number of live calls. The caller must hold pending_results_mutex.
+     */
+    void track_pending_results(const std::shared_ptr<PendingBase>& pending_results, const node_list_t& dest_nodes);
 
     std::atomic<bool> thread_shutdown{false};
     std::thread rpc_thread;
 
-    /** Listens for P2P RPC calls over the TCP connections and handles them. */
+    /** A complete P2P message, as a slice of the buffer it was received into. */
+    struct P2PMessage {
+        node_id_t sender_id;
+        /** Keeps the receive buffer alive until the message has been handled */
+        std::shared_ptr<std::vector<char>> buffer;
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    /** A thread that runs the handlers of the P2P messages from some of the senders. */
+    struct P2PWorker {
+        std::mutex queue_mutex;
+        std::condition_variable queue_cv;
+        /** Complete messages waiting to be handled */
+        std::queue<P2PMessage> messages;
+        std::thread thread;
+    };
+    /** The messages from node n are handled by worker n % p2p_workers.size(),
+     * so each sender's messages are handled in the order they were sent. */
+    std::vector<std::unique_ptr<P2PWorker>> p2p_workers;
+
+    /**
+     * Waits for data on the TCP connections, reassembles it into P2P
+     * messages, and hands each complete message to a worker as a slice of
+     * the buffer it was read into, without copying it. Reads never
+     * block, and only take the read lock of the socket being read, so this
+     * thread doesn't hold up anyone sending on the connections.
+     */
     void p2p_receive_loop();
 
+    /** Handles the messages queued for one P2P worker until shutdown. */
+    void p2p_worker_loop(P2PWorker& worker);
+
     /**
-     * Handler to be called by rpc_process_loop each time it receives a
-     * peer-to-peer message over a TCP connection.
+     * Handler to be called by a P2P worker for each peer-to-peer message
+     * received over a TCP connection.
      * @param sender_id The ID of the node that sent the message
-     * @param msg_buf A buffer containing the message
-     * @param buffer_size The size of the buffer, in bytes
+     * @param msg_buf A buffer containing the message, including its header
+     * @param msg_size The size of the message, in bytes
      */
-    void p2p_message_handler(node_id_t sender_id, char* msg_buf, uint32_t buffer_size);
+    void p2p_message_handler(node_id_t sender_id, char* msg_buf, std::size_t msg_size);
+
+    std::mutex p2p_send_buffers_mutex;
+    /** P2P send buffers that are not in use, all of the same size. The pool
+     * grows to the largest number of P2P sends that have been in progress at
+     * once, and never shrinks. */
+    std::vector<std::unique_ptr<char[]>> free_p2p_send_buffers;
 
 public:
+    /**
+     * A buffer for marshalling one P2P message, borrowed from the RPCManager's
+     * pool and returned to it when this object is destroyed. Each P2P send
+     * takes its own buffer, so that any number of threads can be sending P2P
+     * messages, even through the same Replicated<T>, at once.
+     */
+    class P2PSendBuffer {
+        RPCManager* owner;
+        std::unique_ptr<char[]> buffer;
+
+    public:
+        P2PSendBuffer(RPCManager* owner, std::unique_ptr<char[]> buffer)
+                : owner(owner), buffer(std::move(buffer)) {}
+        P2PSendBuffer(P2PSendBuffer&&) = default;
+        P2PSendBuffer& operator=(P2PSendBuffer&&) = default;
+        ~P2PSendBuffer() {
+            if(buffer) {
+                owner->release_p2p_send_buffer(std::move(buffer));
+            }
+        }
+        char* get() const { return buffer.get(); }
+    };
+
     RPCManager(node_id_t node_id, ViewManager& group_view_manager)
             : nid(node_id),
               receivers(new std::decay_t<decltype(*receivers)>()),
@@ -83,7 +165,16 @@ public:
               //Connections is initially empty, all connections are added in the new view callback
               connections(node_id, std::map<node_id_t, ip_addr>(),
                           group_view_manager.derecho_params.rpc_port),
-              replySendBuffer(new char[group_view_manager.derecho_params.max_payload_size]) {
+              max_p2p_payload_size(MulticastGroup::compute_max_msg_size(group_view_manager.derecho_params.max_payload_size,
+                                                                        group_view_manager.derecho_params.block_size)
+                                   - sizeof(header)) {
+        const uint32_t num_workers = std::max(group_view_manager.derecho_params.p2p_worker_threads, 1u);
+        for(uint32_t i = 0; i < num_workers; ++i) {
+            p2p_workers.emplace_back(std::make_unique<P2PWorker>());
+        }
+        for(auto& worker : p2p_workers) {
+            worker->thread = std::thread(&RPCManager::p2p_worker_loop, this, std::ref(*worker));
+        }
         rpc_thread = std::thread(&RPCManager::p2p_receive_loop, this);
     }
 
@@ -206,7 +297,7 @@ public:
      * @param node The ID of the node to get a TCP connection to
      * @return A LockedReference containing a reference to that node's socket.
      */
-    LockedReference<std::unique_lock<std::mutex>, tcp::socket> get_socket(node_id_t node);
+    tcp::exclusive_socket_reference get_socket(node_id_t node);
 
     /**
      * Writes the "list of destination nodes" header field into the given
@@ -225,10 +316,15 @@ public:
      * assumed to be an RPC message prepared by earlier functions) and registers
      * the "promise object" in pending_results_handle to await replies.
      * @param dest_nodes The list of node IDs the message is being sent to
-     * @param pending_results_handle A reference to the "promise object" in the
+     * @param pending_results_handle A pointer to the "promise object" in the
      * send_return for this send.
+     * @param view_read_lock The caller's lock on the ViewManager's view_mutex,
+     * which is released while waiting for a view change if the send can't
+     * happen in the current view.
      */
-    void finish_rpc_send(uint32_t subgroup_id, const std::vector<node_id_t>& dest_nodes, PendingBase& pending_results_handle);
+    void finish_rpc_send(uint32_t subgroup_id, const std::vector<node_id_t>& dest_nodes,
+                         const std::shared_ptr<PendingBase>& pending_results_handle,
+                         std::shared_lock<std::shared_timed_mutex>& view_read_lock);
 
     /**
      * Sends the message in msg_buf to the node identified by dest_node over a
@@ -237,10 +333,20 @@ public:
      * @param dest_node The node to send the message to
      * @param msg_buf A buffer containing the message
      * @param size The size of the message, in bytes
-     * @param pending_results_handle A reference to the "promise object" in the
+     * @param pending_results_handle A pointer to the "promise object" in the
      * send_return for this send.
      */
-    void finish_p2p_send(node_id_t dest_node, char* msg_buf, std::size_t size, PendingBase& pending_results_handle);
+    void finish_p2p_send(node_id_t dest_node, char* msg_buf, std::size_t size,
+                         const std::shared_ptr<PendingBase>& pending_results_handle);
+
+    /**
+     * Borrows a buffer for the largest P2P message from the pool of P2P send
+     * buffers, allocating a new one if they are all in use. The caller must
+     * hold a lock on the current view.
+     */
+    P2PSendBuffer get_p2p_send_buffer();
+    /** Returns a buffer to the pool of P2P send buffers; called by ~P2PSendBuffer(). */
+    void release_p2p_send_buffer(std::unique_ptr<char[]> buffer);
 };
 
 //Now that RPCManager is finished being declared, we can declare these convenience types
@@ -6,18 +6,21 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <functional>
 #include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <type_traits>
-#include <typeindex>
 #include <utility>
 #include <vector>
 
@@ -34,23 +37,140 @@ using FunctionTag = unsigned long long;
 
 /**
  * An RPC function call can be uniquely identified by the tuple
- * (class, subgroup ID, function ID, is-reply), which is what this struct
- * encapsulates. Its comparsion operators simply inherit the ones from
- * std::tuple.
+ * (class, subgroup ID, function ID, is-reply). An Opcode is a 64-bit hash of
+ * that tuple, which is sent in the header of each RPC message. The class is
+ * identified by a hash of its name rather than by its type_info, so the same
+ * function gets the same opcode in every process, even ones running
+ * different binaries.
  */
-struct Opcode {
-    std::type_index class_id = std::type_index(typeid(void));
-    uint32_t subgroup_id;
-    FunctionTag function_id;
-    bool is_reply;
-};
-bool operator<(const Opcode& lhs, const Opcode& rhs) {
-    return std::tie(lhs.class_id, lhs.subgroup_id, lhs.function_id, lhs.is_reply)
-           < std::tie(rhs.class_id, rhs.subgroup_id, rhs.function_id, rhs.is_reply);
+using Opcode = uint64_t;
+
+namespace opcode_hashing {
+
+/** @return True if the characters in [c, end) start with the string prefix. */
+constexpr bool starts_with(const char* c, const char* end, const char* prefix) {
+    for(; *prefix; ++c, ++prefix) {
+        if(c == end || *c != *prefix) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @return A pointer to the null terminator of the string s. */
+constexpr const char* string_end(const char* s) {
+    while(*s) {
+        ++s;
+    }
+    return s;
+}
+
+/**
+ * The 64-bit FNV-1a hash of the type name in [begin, end), skipping the
+ * parts of its spelling that differ between compilers and standard
+ * libraries for the same type: whitespace (GCC writes "> >" where Clang
+ * writes ">>") and the inline namespaces std::__cxx11:: of libstdc++ and
+ * std::__1:: of libc++.
+ */
+constexpr uint64_t normalized_name_hash(const char* begin, const char* end) {
+    uint64_t hash = 14695981039346656037ULL;
+    for(const char* c = begin; c != end; ++c) {
+        if(*c == ' ') {
+            continue;
+        }
+        if(c - begin >= 2 && c[-1] == ':' && c[-2] == ':') {
+            if(starts_with(c, end, "__cxx11::")) {
+                c += 8;
+                continue;
+            } else if(starts_with(c, end, "__1::")) {
+                c += 4;
+                continue;
+            }
+        }
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/** The splitmix64 finalizer, which spreads every input bit over the whole word. */
+constexpr uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Hashes the name of T as the compiler spells it in the signature of this
+ * function, which GCC and Clang print as "[with T = name; ...]" and
+ * "[T = name]". Only the name itself is hashed, after normalization, so a
+ * plain class in a named namespace gets the same hash from both. The
+ * spelling of other types can still differ: Clang keeps typedef names such
+ * as std::string in template arguments and writes "unsigned long" where GCC
+ * writes "long unsigned int", and they name anonymous namespaces differently.
+ */
+template <typename T>
+constexpr uint64_t type_name_hash() {
+    const char* signature = __PRETTY_FUNCTION__;
+    const char* begin = signature;
+    while(*begin && !(begin[0] == 'T' && begin[1] == ' ' && begin[2] == '=' && begin[3] == ' ')) {
+        ++begin;
+    }
+    begin += 4;
+    const char* end = begin;
+    int depth = 0;
+    for(; *end; ++end) {
+        if(*end == '<' || *end == '[' || *end == '(') {
+            ++depth;
+        } else if(depth > 0 && (*end == '>' || *end == ']' || *end == ')')) {
+            --depth;
+        } else if(depth == 0 && (*end == ';' || *end == ']')) {
+            break;
+        }
+    }
+    return normalized_name_hash(begin, end);
+}
+
+/** Detects whether T names itself for its opcodes with a static member rpc_class_name. */
+template <typename T, typename = void>
+struct has_rpc_class_name : std::false_type {};
+template <typename T>
+struct has_rpc_class_name<T, decltype(void(T::rpc_class_name))> : std::true_type {};
+
+template <typename T>
+constexpr uint64_t class_name_hash(std::true_type) {
+    return normalized_name_hash(T::rpc_class_name, string_end(T::rpc_class_name));
+}
+template <typename T>
+constexpr uint64_t class_name_hash(std::false_type) {
+    return type_name_hash<T>();
+}
+}  // namespace opcode_hashing
+
+/**
+ * A hash of the name of a class, computed at compile time, that is used in
+ * the opcodes of its RPC functions. A class that declares
+ * static constexpr const char* rpc_class_name = "...";
+ * is identified by that name; otherwise, its name is taken from the
+ * compiler (see type_name_hash). Processes built by different compilers
+ * only agree on the opcodes of a class template instance, or a class in an
+ * anonymous namespace, if it declares rpc_class_name.
+ */
+template <typename T>
+constexpr uint64_t class_hash() {
+    return std::integral_constant<uint64_t, opcode_hashing::class_name_hash<T>(
+                                                    opcode_hashing::has_rpc_class_name<T>{})>::value;
 }
-bool operator==(const Opcode& lhs, const Opcode& rhs) {
-    return lhs.class_id == rhs.class_id && lhs.subgroup_id == rhs.subgroup_id
-           && lhs.function_id == rhs.function_id && lhs.is_reply == rhs.is_reply;
+
+/**
+ * Combines the parts of an RPC function's identity into its Opcode.
+ * @param class_id The class_hash() of the class the function belongs to
+ * @param subgroup_id The subgroup the function is called in
+ * @param function_id The function's tag
+ * @param is_reply True for the opcode of replies to the function, false for calls to it
+ */
+constexpr Opcode make_opcode(uint64_t class_id, uint32_t subgroup_id, FunctionTag function_id, bool is_reply) {
+    using opcode_hashing::mix;
+    return mix(mix(mix(class_id ^ function_id) ^ subgroup_id) ^ (is_reply ? 1 : 0));
 }
 
 using node_list_t = std::vector<node_id_t>;
@@ -101,13 +221,85 @@ struct recv_ret {
 };
 
 /**
- * Type signature for all the RemoteInvocable::receive_* methods. This alias is
- * helpful for declaring a map of "RPC receive handlers" that are called when
- * some RPC message is received.
+ * Type signature for the thunks that RemoteInvoker and RemoteInvocable
+ * register to receive RPC messages, which forward the message to their
+ * receive_* methods. The first argument is the object that registered the
+ * thunk.
  */
-using receive_fun_t = std::function<recv_ret(
-        mutils::DeserializationManager* dsm, const node_id_t&, const char* recv_buf,
-        const std::function<char*(int)>& out_alloc)>;
+using receive_fun_t = recv_ret (*)(void* receiver, mutils::DeserializationManager* dsm,
+                                   const node_id_t&, const char* recv_buf,
+                                   const std::function<char*(int)>& out_alloc);
+
+/**
+ * The table of "RPC receive handlers" that are called when some RPC message
+ * is received, indexed by the message's opcode. Since opcodes are already
+ * well-mixed hashes, this is a flat open-addressing table that uses the low
+ * bits of the opcode as the starting slot and probes linearly from there.
+ */
+class ReceiverTable {
+public:
+    struct Receiver {
+        Opcode opcode;
+        /** The thunk to call, or nullptr if this slot is empty */
+        receive_fun_t fun;
+        void* receiver;
+
+        /** Calls the thunk on the object that registered it. */
+        recv_ret operator()(mutils::DeserializationManager* dsm, const node_id_t& who,
+                            const char* recv_buf, const std::function<char*(int)>& out_alloc) const {
+            return fun(receiver, dsm, who, recv_buf, out_alloc);
+        }
+    };
+
+private:
+    std::vector<Receiver> slots;
+    std::size_t num_receivers = 0;
+
+    std::size_t find_slot(Opcode opcode) const {
+        const std::size_t mask = slots.size() - 1;
+        std::size_t slot = opcode & mask;
+        while(slots[slot].fun && slots[slot].opcode != opcode) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+public:
+    ReceiverTable() : slots(64, Receiver{0, nullptr, nullptr}) {}
+
+    /**
+     * Registers a thunk for an opcode, replacing any thunk already registered
+     * for it. The table is kept at most half full.
+     */
+    void insert(Opcode opcode, receive_fun_t fun, void* receiver) {
+        if(2 * (num_receivers + 1) > slots.size()) {
+            std::vector<Receiver> old_slots(2 * slots.size(), Receiver{0, nullptr, nullptr});
+            old_slots.swap(slots);
+            for(const Receiver& entry : old_slots) {
+                if(entry.fun) {
+                    slots[find_slot(entry.opcode)] = entry;
+                }
+            }
+        }
+        Receiver& entry = slots[find_slot(opcode)];
+        if(!entry.fun) {
+            ++num_receivers;
+        }
+        entry = Receiver{opcode, fun, receiver};
+    }
+
+    /**
+     * @return The receiver registered for an opcode
+     * @throws std::out_of_range if no receiver is registered for it
+     */
+    const Receiver& at(Opcode opcode) const {
+        const Receiver& entry = slots[find_slot(opcode)];
+        if(!entry.fun) {
+            throw std::out_of_range("No RPC function is registered for this opcode");
+        }
+        return entry;
+    }
+};
 
 /**
  * The type of map contained in a QueryResults::ReplyMap. The template parameter
@@ -116,6 +308,8 @@ using receive_fun_t = std::function<recv_ret(
 template <typename T>
 using reply_map = std::map<node_id_t, std::future<T>>;
 
+class PendingBase;
+
 /**
  * Data structure that (indirectly) holds a set of futures for a single RPC
  * function call; there is one future for each node contacted to make the
@@ -133,7 +327,12 @@ struct QueryResults {
     using type = Ret;
 
     map_fut pending_rmap;
-    QueryResults(map_fut pm) : pending_rmap(std::move(pm)) {}
+    /** Keeps the PendingResults for this call alive; once the caller drops
+     * its QueryResults, nobody can read the replies, so the call's record
+     * is reclaimed even if some replies are still outstanding. */
+    std::shared_ptr<PendingBase> pending;
+    QueryResults(map_fut pm, std::shared_ptr<PendingBase> pending)
+            : pending_rmap(std::move(pm)), pending(std::move(pending)) {}
 
     struct ReplyMap {
     private:
@@ -179,6 +378,7 @@ private:
 public:
     QueryResults(QueryResults&& o)
             : pending_rmap{std::move(o.pending_rmap)},
+              pending{std::move(o.pending)},
               replies{std::move(o.replies)} {}
     QueryResults(const QueryResults&) = delete;
 
@@ -224,12 +424,22 @@ struct QueryResults<void> {
 /**
  * Abstract base type for PendingResults. This allows us to store a pointer to
  * any template specialization of PendingResults without knowing the template
- * parameter.
+ * parameter. PendingResults are always owned by shared_ptrs: the caller's
+ * QueryResults holds one, and everything else that tracks the call holds a
+ * weak_ptr, so the call's record goes away as soon as the caller stops
+ * waiting for it.
  */
-class PendingBase {
+class PendingBase : public std::enable_shared_from_this<PendingBase> {
+protected:
+    /** Set once the destination nodes are known and every one of them has
+     * replied or been removed from the group. */
+    std::atomic<bool> complete{false};
+
 public:
     virtual void fulfill_map(const node_list_t&) = 0;
     virtual void set_exception_for_removed_node(const node_id_t&) = 0;
+    /** @return True if no more replies are expected for this call */
+    bool is_complete() const { return complete; }
     virtual ~PendingBase() {}
 };
 
@@ -248,13 +458,17 @@ struct PendingResults : public PendingBase {
 
     bool map_fulfilled = false;
     std::set<node_id_t> dest_nodes, responded_nodes;
+    /** Protects all of the above, since the sender fills in the map while
+     * replies and removed-node exceptions arrive on other threads. */
+    std::mutex state_mutex;
 
     /**
      * Fill the result map with an entry for each node that will be contacted
-     * in this RPC call
+     * in this RPC call. Replies that arrived before this call are kept.
      * @param who A list of nodes that will be contacted
      */
     void fulfill_map(const node_list_t& who) {
+        std::lock_guard<std::mutex> lock(state_mutex);
         map_fulfilled = true;
         std::unique_ptr<reply_map<Ret>> to_add = std::make_unique<reply_map<Ret>>();
         for(const auto& e : who) {
@@ -262,30 +476,45 @@ struct PendingResults : public PendingBase {
         }
         dest_nodes.insert(who.begin(), who.end());
         pending_map.set_value(std::move(to_add));
+        check_complete();
+    }
+
+    /** The caller must hold state_mutex. */
+    void check_complete() {
+        if(map_fulfilled && responded_nodes.size() >= dest_nodes.size()) {
+            complete = true;
+        }
     }
 
     void set_exception_for_removed_node(const node_id_t& removed_nid) {
+        std::lock_guard<std::mutex> lock(state_mutex);
         assert(map_fulfilled);
         if(dest_nodes.find(removed_nid) != dest_nodes.end()
            && responded_nodes.find(removed_nid) == responded_nodes.end()) {
-            set_exception(removed_nid,
-                          std::make_exception_ptr(
-                                  node_removed_from_group_exception{removed_nid}));
+            responded_nodes.insert(removed_nid);
+            populated_promises[removed_nid].set_exception(
+                    std::make_exception_ptr(node_removed_from_group_exception{removed_nid}));
+            check_complete();
         }
     }
 
     void set_value(const node_id_t& nid, const Ret& v) {
+        std::lock_guard<std::mutex> lock(state_mutex);
         responded_nodes.insert(nid);
         populated_promises[nid].set_value(v);
+        check_complete();
     }
 
     void set_exception(const node_id_t& nid, const std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(state_mutex);
         responded_nodes.insert(nid);
         populated_promises[nid].set_exception(e);
+        check_complete();
     }
 
+    /** Must only be called on a PendingResults owned by a shared_ptr. */
     QueryResults<Ret> get_future() {
-        return QueryResults<Ret>{pending_map.get_future()};
+        return QueryResults<Ret>{pending_map.get_future(), shared_from_this()};
     }
 };
 
@@ -295,6 +524,9 @@ struct PendingResults<void> : public PendingBase {
        we might want to have in both this and the non-void variant.
     */
 
+    //No replies are expected for void functions
+    PendingResults() { complete = true; }
+
     void fulfill_map(const node_list_t&) {}
     void set_exception_for_removed_node(const node_id_t&) {}
     QueryResults<void> get_future() { return QueryResults<void>{}; }
@@ -0,0 +1,159 @@
+/**
+ * @file sequence_ring.h
+ * @brief Contains a ring buffer for tracking messages by sequence number.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <cstddef>
+#include <experimental/optional>
+#include <utility>
+#include <vector>
+
+namespace derecho {
+
+/**
+ * A map from sequence numbers to messages that is stored as a ring buffer,
+ * indexed by the sequence number modulo the buffer's capacity. It is meant for
+ * the messages a subgroup is tracking, whose sequence numbers are non-negative
+ * and always lie in a window bounded by the multicast window size times the
+ * number of senders, so looking up, inserting, and removing a message never
+ * allocates or walks a tree. If a sequence number ever falls outside the
+ * window the buffer can hold, the buffer is reallocated with enough capacity.
+ */
+template <typename T>
+class SequenceRing {
+private:
+    std::vector<std::experimental::optional<T>> slots;
+    /** slots.size() - 1; the capacity is always a power of 2 */
+    std::size_t mask;
+    /** The lowest sequence number in the ring, if it is not empty */
+    long long int low;
+    /** One more than the highest sequence number in the ring, if it is not empty */
+    long long int high;
+    std::size_t num_entries;
+
+    std::experimental::optional<T>& slot(long long int seq) {
+        return slots[seq & mask];
+    }
+
+    /** Reallocates the ring so that it can hold every sequence number in [new_low, new_high). */
+    void grow(long long int new_low, long long int new_high) {
+        std::size_t new_capacity = slots.size();
+        while(new_capacity < (std::size_t)(new_high - new_low)) {
+            new_capacity *= 2;
+        }
+        std::vector<std::experimental::optional<T>> new_slots(new_capacity);
+        for(long long int seq = low; seq < high; ++seq) {
+            if(slot(seq)) {
+                new_slots[seq & (new_capacity - 1)] = std::move(slot(seq));
+            }
+        }
+        slots.swap(new_slots);
+        mask = new_capacity - 1;
+    }
+
+public:
+    /** @param capacity The number of consecutive sequence numbers the ring should hold without reallocating. */
+    explicit SequenceRing(std::size_t capacity = 1) : mask(0), low(0), high(0), num_entries(0) {
+        std::size_t rounded_capacity = 1;
+        while(rounded_capacity < capacity) {
+            rounded_capacity *= 2;
+        }
+        slots.resize(rounded_capacity);
+        mask = rounded_capacity - 1;
+    }
+    SequenceRing(SequenceRing&&) = default;
+    SequenceRing& operator=(SequenceRing&&) = default;
+
+    bool empty() const { return num_entries == 0; }
+    std::size_t size() const { return num_entries; }
+
+    /** @return A pointer to the message with this sequence number, or nullptr if there is none. */
+    T* find(long long int seq) {
+        if(num_entries == 0 || seq < low || seq >= high) {
+            return nullptr;
+        }
+        auto& entry = slot(seq);
+        return entry ? &*entry : nullptr;
+    }
+
+    /** Stores a message under a sequence number, replacing any message already stored under it. */
+    T& insert(long long int seq, T value) {
+        assert(seq >= 0);
+        if(num_entries == 0) {
+            low = seq;
+            high = seq + 1;
+        } else {
+            long long int new_low = std::min(low, seq);
+            long long int new_high = std::max(high, seq + 1);
+            if((std::size_t)(new_high - new_low) > slots.size()) {
+                grow(new_low, new_high);
+            }
+            low = new_low;
+            high = new_high;
+        }
+        auto& entry = slot(seq);
+        if(!entry) {
+            ++num_entries;
+        }
+        entry = std::move(value);
+        return *entry;
+    }
+
+    /** Removes the message with this sequence number, if there is one. */
+    void erase(long long int seq) {
+        if(!find(seq)) {
+            return;
+        }
+        slot(seq) = std::experimental::nullopt;
+        --num_entries;
+        if(num_entries == 0) {
+            return;
+        }
+        while(!slot(low)) {
+            ++low;
+        }
+        while(!slot(high - 1)) {
+            --high;
+        }
+    }
+
+    /** @return The lowest sequence number in the ring, which must not be empty. */
+    long long int front_seq() const {
+        assert(num_entries > 0);
+        return low;
+    }
+    /** @return The message with the lowest sequence number in the ring, which must not be empty. */
+    T& front() {
+        assert(num_entries > 0);
+        return *slot(low);
+    }
+    void pop_front() {
+        erase(front_seq());
+    }
+
+    /** Calls f(sequence number, message) on every message in the ring, in sequence number order. */
+    template <typename F>
+    void for_each(F&& f) {
+        if(num_entries == 0) {
+            return;
+        }
+        for(long long int seq = low; seq < high; ++seq) {
+            if(slot(seq)) {
+                f(seq, *slot(seq));
+            }
+        }
+    }
+
+    /** Removes every message, keeping the ring's capacity. */
+    void clear() {
+        for(auto& entry : slots) {
+            entry = std::experimental::nullopt;
+        }
+        num_entries = 0;
+    }
+};
+}
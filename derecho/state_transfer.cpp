@@ -0,0 +1,83 @@
+#include "state_transfer.h"
+
+#include <cstring>
+#include <utility>
+
+namespace derecho {
+
+ChunkedSocketWriter::ChunkedSocketWriter(tcp::socket& socket, std::size_t chunk_size)
+        : socket(socket),
+          chunk_size(chunk_size),
+          fill_buffer(new char[chunk_size]),
+          fill_size(0),
+          send_buffer(new char[chunk_size]),
+          send_size(0),
+          socket_ok(true),
+          finished(false),
+          send_thread(&ChunkedSocketWriter::send_chunks, this) {}
+
+ChunkedSocketWriter::~ChunkedSocketWriter() {
+    finish();
+}
+
+void ChunkedSocketWriter::send_chunks() {
+    std::unique_lock<std::mutex> lock(send_mutex);
+    while(true) {
+        send_cv.wait(lock, [this]() { return send_size > 0 || finished; });
+        if(send_size == 0) {
+            return;
+        }
+        //The caller only touches send_buffer after waiting for send_size to be 0
+        lock.unlock();
+        bool success = socket.write(send_buffer.get(), send_size);
+        lock.lock();
+        socket_ok = socket_ok && success;
+        send_size = 0;
+        send_cv.notify_all();
+    }
+}
+
+void ChunkedSocketWriter::wait_for_send_thread(std::unique_lock<std::mutex>& lock) {
+    send_cv.wait(lock, [this]() { return send_size == 0; });
+}
+
+void ChunkedSocketWriter::send_fill_buffer() {
+    std::unique_lock<std::mutex> lock(send_mutex);
+    wait_for_send_thread(lock);
+    std::swap(fill_buffer, send_buffer);
+    send_size = fill_size;
+    fill_size = 0;
+    send_cv.notify_all();
+}
+
+void ChunkedSocketWriter::write(const char* bytes, std::size_t size) {
+    if(fill_size + size > chunk_size && fill_size > 0) {
+        send_fill_buffer();
+    }
+    if(size >= chunk_size) {
+        //A large region is already serialized in memory, so there is nothing
+        //to overlap with sending it; send it directly instead of copying it
+        std::unique_lock<std::mutex> lock(send_mutex);
+        wait_for_send_thread(lock);
+        socket_ok = socket_ok && socket.write(bytes, size);
+        return;
+    }
+    memcpy(fill_buffer.get() + fill_size, bytes, size);
+    fill_size += size;
+}
+
+bool ChunkedSocketWriter::finish() {
+    if(send_thread.joinable()) {
+        if(fill_size > 0) {
+            send_fill_buffer();
+        }
+        {
+            std::lock_guard<std::mutex> lock(send_mutex);
+            finished = true;
+        }
+        send_cv.notify_all();
+        send_thread.join();
+    }
+    return socket_ok;
+}
+}
@@ -0,0 +1,72 @@
+/**
+ * @file state_transfer.h
+ * @brief Contains helpers for transferring the state of a replicated object
+ * to a new member over TCP.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "tcp/tcp.h"
+
+namespace derecho {
+
+/** The size of the chunks in which object state is sent to a joining member. */
+static const std::size_t STATE_TRANSFER_CHUNK_SIZE = 1024 * 1024;
+
+/**
+ * Sends a stream of bytes over a socket in bounded chunks, using a background
+ * thread so that the caller can serialize the next chunk while the previous
+ * one is being sent. This lets a large object be serialized directly to the
+ * socket (e.g. with mutils::post_object) without ever holding more than two
+ * chunks of it in memory.
+ */
+class ChunkedSocketWriter {
+private:
+    tcp::socket& socket;
+    const std::size_t chunk_size;
+    /** The chunk being filled by the caller. */
+    std::unique_ptr<char[]> fill_buffer;
+    std::size_t fill_size;
+    /** The chunk being sent by the send thread. */
+    std::unique_ptr<char[]> send_buffer;
+    /** The number of bytes in send_buffer still to be sent; 0 if the send thread is idle. */
+    std::size_t send_size;
+    /** False if any write to the socket has failed. */
+    bool socket_ok;
+    bool finished;
+    std::mutex send_mutex;
+    std::condition_variable send_cv;
+    std::thread send_thread;
+
+    void send_chunks();
+    /** Blocks until the send thread has sent the previous chunk. */
+    void wait_for_send_thread(std::unique_lock<std::mutex>& lock);
+    /** Hands the chunk in fill_buffer to the send thread. */
+    void send_fill_buffer();
+
+public:
+    ChunkedSocketWriter(tcp::socket& socket, std::size_t chunk_size = STATE_TRANSFER_CHUNK_SIZE);
+    /** Sends any remaining bytes, if finish() has not been called. */
+    ~ChunkedSocketWriter();
+    ChunkedSocketWriter(const ChunkedSocketWriter&) = delete;
+
+    /**
+     * Adds bytes to the stream. They may not be sent until a later call to
+     * write() or finish(), so the caller must not expect them to have reached
+     * the socket when this returns.
+     */
+    void write(const char* bytes, std::size_t size);
+
+    /**
+     * Sends all the bytes written so far and stops the send thread.
+     * @return True if every write to the socket succeeded.
+     */
+    bool finish();
+};
+}
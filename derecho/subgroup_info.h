@@ -50,10 +50,36 @@ using subgroup_shard_layout_t = std::vector<std::vector<SubView>>;
  * as input and outputs a vector-of-vectors representing subgroups and shards. */
 using shard_view_generator_t = std::function<subgroup_shard_layout_t(const View&)>;
 
+/**
+ * The size and number of the SST multicast slots for the subgroups of one
+ * type. Each sender in a subgroup has window_size slots, each big enough for
+ * a message (including its header) of max_msg_size bytes. A field left at 0
+ * takes its value from DerechoParams.
+ */
+struct SSTSlotSettings {
+    uint32_t max_msg_size = 0;
+    uint32_t window_size = 0;
+};
+
+/**
+ * Settings for packing small messages into batches, for the subgroups of one
+ * type. While batching, each message sent with an explicit payload size is
+ * added to a batch instead of being multicast on its own, and the batch is
+ * multicast once it holds max_batch_size bytes or max_batch_delay_us has
+ * passed since its first message was sent. Receivers deliver the messages in
+ * a batch one at a time, in the order they were sent, and log each one as its
+ * own record, but they share the batch's message index in the stability and
+ * persistence callbacks and in the log, where records also carry their
+ * position in the batch.
+ */
+struct BatchSettings {
+    uint32_t max_batch_size = 0;
+    uint32_t max_batch_delay_us = 0;
+};
+
 /**
  * Container for whatever information is needed to describe a Group's subgroups
- * and shards. This used to contain more members, but right now it only contains
- * one.
+ * and shards.
  */
 struct SubgroupInfo {
     /**
@@ -62,5 +88,26 @@ struct SubgroupInfo {
      * they describe.
      */
     std::map<std::type_index, shard_view_generator_t> subgroup_membership_functions;
+    /**
+     * SST multicast slot settings for the subgroups of some types, indexed the
+     * same way. Types with no entry use DerechoParams::sst_max_msg_size and
+     * DerechoParams::window_size.
+     */
+    std::map<std::type_index, SSTSlotSettings> sst_slot_settings;
+    /**
+     * Batching settings for the subgroups of some types, indexed the same way.
+     * Types with no entry, or with a max_batch_size of 0, don't batch messages.
+     */
+    std::map<std::type_index, BatchSettings> batch_settings;
+    /**
+     * The relative share of this node's sender thread that the subgroups of
+     * some types get, indexed the same way. In each pass, the sender thread
+     * posts up to weight messages from each subgroup that has messages ready,
+     * so while several subgroups have messages backed up, a subgroup with
+     * weight 2 sends twice as many as one with weight 1. A subgroup can only
+     * use its whole share if its send window allows that many messages in
+     * flight. Types with no entry, or with a weight of 0, have weight 1.
+     */
+    std::map<std::type_index, uint32_t> send_weights;
 };
 }
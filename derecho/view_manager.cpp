@@ -7,6 +7,7 @@
 #include <arpa/inet.h>
 
 #include "derecho_exception.h"
+#include "log_recovery.h"
 #include "persistence.h"
 #include "view_manager.h"
 
@@ -99,7 +100,14 @@ ViewManager::ViewManager(const std::string& recovery_filename,
           view_upcalls(_view_upcalls),
           subgroup_info(subgroup_info),
           derecho_params(0, 0) {
-    auto last_view = load_view(view_file_name);
+    //Bring the saved View and the local log up to date with the other members that are restarting.
+    //The RPC port is not in use yet, so recovery listens on it
+    const DerechoParams recovery_params = _derecho_params
+                                                  ? _derecho_params.value()
+                                                  : *load_object<DerechoParams>(recovery_filename + persistence::PARAMATERS_EXTENSION);
+    persistence::LogRecovery log_recovery(my_id, recovery_filename, recovery_params.rpc_port,
+                                          recovery_params.log_segment_size);
+    auto last_view = log_recovery.recover();
 
     if(my_id != last_view->members[last_view->rank_of_leader()]) {
         tcp::socket leader_socket(last_view->member_ips[last_view->rank_of_leader()], gms_port);
@@ -107,7 +115,7 @@ ViewManager::ViewManager(const std::string& recovery_filename,
         //derecho_params will be initialized by the existing view's leader
     } else {
         /* This should only happen if an entire group failed and the leader is restarting;
-         * otherwise the view obtained from the recovery script will have a leader that is
+         * otherwise the view obtained from log recovery will have a leader that is
          * not me. So reset to an empty view and wait for the first non-leader member to
          * restart and join. */
         curr_view = std::make_unique<View>(last_view->vid + 1,
@@ -653,6 +661,7 @@ void ViewManager::register_predicates() {
                 }
                 // One of those view upcalls is to RPCManager, which will set up TCP connections to the new members
                 // After doing that, shard leaders can send them RPC objects
+                std::map<node_id_t, std::vector<subgroup_id_t>> subgroups_by_joiner;
                 for(subgroup_id_t subgroup_id = 0; subgroup_id < old_shard_leaders_by_id.size(); ++subgroup_id) {
                     for(uint32_t shard = 0; shard < old_shard_leaders_by_id[subgroup_id].size(); ++shard) {
                         //if I was the leader of the shard in the old view...
@@ -660,12 +669,25 @@ void ViewManager::register_predicates() {
                             //send its object state to the new members
                             for(node_id_t shard_joiner : curr_view->subgroup_shard_views[subgroup_id][shard].joined) {
                                 if(shard_joiner != my_id) {
-                                    send_subgroup_object(subgroup_id, shard_joiner);
+                                    subgroups_by_joiner[shard_joiner].push_back(subgroup_id);
                                 }
                             }
                         }
                     }
                 }
+                // Each joiner expects its objects in ascending order of subgroup ID, but
+                // different joiners' sockets can be written in parallel
+                std::vector<std::thread> send_threads;
+                for(const auto& joiner_subgroups : subgroups_by_joiner) {
+                    send_threads.emplace_back([this, &joiner_subgroups]() {
+                        for(subgroup_id_t subgroup_id : joiner_subgroups.second) {
+                            send_subgroup_object(subgroup_id, joiner_subgroups.first);
+                        }
+                    });
+                }
+                for(auto& send_thread : send_threads) {
+                    send_thread.join();
+                }
 
                 // Re-initialize this node's RPC objects, which includes receiving them
                 // from shard leaders if it is newly a member of a subgroup
@@ -706,19 +728,26 @@ void ViewManager::construct_multicast_group(CallbackSet callbacks,
                                                     subgroup_to_num_received_offset,
                                                     subgroup_to_membership,
                                                     subgroup_to_mode);
+    std::map<subgroup_id_t, SSTSlotLayout> subgroup_to_slot_layout;
+    std::size_t slots_size = make_slot_layouts(*curr_view, derecho_params, subgroup_to_slot_layout);
+    std::map<subgroup_id_t, BatchSettings> subgroup_to_batch_settings;
+    make_batch_settings(*curr_view, subgroup_to_batch_settings);
+    std::map<subgroup_id_t, uint32_t> subgroup_to_send_weight;
+    make_send_weights(*curr_view, subgroup_to_send_weight);
     const auto num_subgroups = curr_view->subgroup_shard_views.size();
     curr_view->gmsSST = std::make_shared<DerechoSST>(
             sst::SSTParams(curr_view->members, curr_view->members[curr_view->my_rank],
-                           [this](const uint32_t node_id) { report_failure(node_id); }, curr_view->failed, false),
-            num_subgroups, num_received_size, derecho_params.window_size);
+                           [this](const uint32_t node_id) { report_failure(node_id); }, curr_view->failed, false,
+                           derecho_params.num_predicate_threads),
+            num_subgroups, num_received_size, slots_size);
 
     curr_view->multicast_group = std::make_unique<MulticastGroup>(
             curr_view->members, curr_view->members[curr_view->my_rank],
             curr_view->gmsSST, callbacks, num_subgroups, subgroup_to_shard_and_rank,
             subgroup_to_senders_and_sender_rank,
             subgroup_to_num_received_offset, subgroup_to_membership,
-            subgroup_to_mode,
-            derecho_params, curr_view->failed);
+            subgroup_to_mode, subgroup_to_slot_layout, subgroup_to_batch_settings,
+            subgroup_to_send_weight, derecho_params, curr_view->failed);
 }
 
 void ViewManager::transition_multicast_group() {
@@ -732,18 +761,26 @@ void ViewManager::transition_multicast_group() {
                                                     subgroup_to_num_received_offset,
                                                     subgroup_to_membership,
                                                     subgroup_to_mode);
+    std::map<subgroup_id_t, SSTSlotLayout> subgroup_to_slot_layout;
+    std::size_t slots_size = make_slot_layouts(*next_view, derecho_params, subgroup_to_slot_layout);
+    std::map<subgroup_id_t, BatchSettings> subgroup_to_batch_settings;
+    make_batch_settings(*next_view, subgroup_to_batch_settings);
+    std::map<subgroup_id_t, uint32_t> subgroup_to_send_weight;
+    make_send_weights(*next_view, subgroup_to_send_weight);
     const auto num_subgroups = next_view->subgroup_shard_views.size();
     next_view->gmsSST = std::make_shared<DerechoSST>(
             sst::SSTParams(next_view->members, next_view->members[next_view->my_rank],
-                           [this](const uint32_t node_id) { report_failure(node_id); }, next_view->failed, false),
-            num_subgroups, num_received_size, derecho_params.window_size);
+                           [this](const uint32_t node_id) { report_failure(node_id); }, next_view->failed, false,
+                           derecho_params.num_predicate_threads),
+            num_subgroups, num_received_size, slots_size);
 
     next_view->multicast_group = std::make_unique<MulticastGroup>(
             next_view->members, next_view->members[next_view->my_rank], next_view->gmsSST,
             std::move(*curr_view->multicast_group), num_subgroups,
             subgroup_to_shard_and_rank, subgroup_to_senders_and_sender_rank,
             subgroup_to_num_received_offset, subgroup_to_membership,
-            subgroup_to_mode, next_view->failed);
+            subgroup_to_mode, subgroup_to_slot_layout, subgroup_to_batch_settings,
+            subgroup_to_send_weight, next_view->failed);
 
     curr_view->multicast_group.reset();
 
@@ -868,6 +905,62 @@ uint32_t ViewManager::make_subgroup_maps(const std::unique_ptr<View>& prev_view,
     return num_received_offset;
 }
 
+std::size_t ViewManager::make_slot_layouts(const View& view, const DerechoParams& derecho_params,
+                                           std::map<subgroup_id_t, SSTSlotLayout>& subgroup_to_slot_layout) const {
+    //Every member's row must have the same layout, so every subgroup gets slots,
+    //including those this node is not a member of, in subgroup ID order
+    std::vector<SSTSlotSettings> settings_by_id(view.subgroup_shard_views.size());
+    for(const auto& type_to_ids : view.subgroup_ids_by_type) {
+        auto settings_iter = subgroup_info.sst_slot_settings.find(type_to_ids.first);
+        if(settings_iter == subgroup_info.sst_slot_settings.end()) {
+            continue;
+        }
+        for(const subgroup_id_t subgroup_id : type_to_ids.second) {
+            settings_by_id[subgroup_id] = settings_iter->second;
+        }
+    }
+    std::size_t offset = 0;
+    for(subgroup_id_t subgroup_id = 0; subgroup_id < settings_by_id.size(); ++subgroup_id) {
+        SSTSlotLayout layout;
+        layout.offset = offset;
+        layout.max_msg_size = settings_by_id[subgroup_id].max_msg_size
+                                      ? settings_by_id[subgroup_id].max_msg_size
+                                      : derecho_params.sst_max_msg_size;
+        layout.window_size = settings_by_id[subgroup_id].window_size
+                                     ? settings_by_id[subgroup_id].window_size
+                                     : derecho_params.window_size;
+        subgroup_to_slot_layout[subgroup_id] = layout;
+        offset += layout.window_size * sst::slot_size(layout.max_msg_size);
+    }
+    return offset;
+}
+
+void ViewManager::make_batch_settings(const View& view,
+                                      std::map<subgroup_id_t, BatchSettings>& subgroup_to_batch_settings) const {
+    for(const auto& type_to_ids : view.subgroup_ids_by_type) {
+        auto settings_iter = subgroup_info.batch_settings.find(type_to_ids.first);
+        if(settings_iter == subgroup_info.batch_settings.end() || !settings_iter->second.max_batch_size) {
+            continue;
+        }
+        for(const subgroup_id_t subgroup_id : type_to_ids.second) {
+            subgroup_to_batch_settings[subgroup_id] = settings_iter->second;
+        }
+    }
+}
+
+void ViewManager::make_send_weights(const View& view,
+                                    std::map<subgroup_id_t, uint32_t>& subgroup_to_send_weight) const {
+    for(const auto& type_to_ids : view.subgroup_ids_by_type) {
+        auto weight_iter = subgroup_info.send_weights.find(type_to_ids.first);
+        if(weight_iter == subgroup_info.send_weights.end() || !weight_iter->second) {
+            continue;
+        }
+        for(const subgroup_id_t subgroup_id : type_to_ids.second) {
+            subgroup_to_send_weight[subgroup_id] = weight_iter->second;
+        }
+    }
+}
+
 /**
  * Constructs a map from subgroup type -> index -> shard -> node ID of that shard's leader.
  * If a shard has no leader in the current view (because it has no members), the vector will
@@ -1078,6 +1171,8 @@ void ViewManager::leave() {
     curr_view->gmsSST->suspected[curr_view->my_rank][curr_view->my_rank] = true;
     curr_view->gmsSST->put((char*)std::addressof(curr_view->gmsSST->suspected[0][curr_view->my_rank]) - curr_view->gmsSST->getBaseAddress(), sizeof(bool));
     thread_shutdown = true;
+    // Release any senders waiting for a new view, since there won't be one
+    view_change_cv.notify_all();
 }
 
 char* ViewManager::get_sendbuffer_ptr(subgroup_id_t subgroup_num, unsigned long long int payload_size,
@@ -1087,6 +1182,55 @@ char* ViewManager::get_sendbuffer_ptr(subgroup_id_t subgroup_num, unsigned long
     return curr_view->multicast_group->get_sendbuffer_ptr(subgroup_num, payload_size, transfer_medium, pause_sending_turns, cooked_send, null_send);
 }
 
+char* ViewManager::wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num, unsigned long long int payload_size,
+                                           bool transfer_medium, int pause_sending_turns,
+                                           bool cooked_send, bool null_send) {
+    return wait_for_sendbuffer_ptr(subgroup_num, payload_size, std::experimental::nullopt,
+                                   transfer_medium, pause_sending_turns, cooked_send, null_send);
+}
+
+char* ViewManager::wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num, unsigned long long int payload_size,
+                                           std::chrono::milliseconds timeout,
+                                           bool transfer_medium, int pause_sending_turns,
+                                           bool cooked_send, bool null_send) {
+    return wait_for_sendbuffer_ptr(subgroup_num, payload_size, std::chrono::steady_clock::now() + timeout,
+                                   transfer_medium, pause_sending_turns, cooked_send, null_send);
+}
+
+char* ViewManager::wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num, unsigned long long int payload_size,
+                                           std::experimental::optional<std::chrono::steady_clock::time_point> deadline,
+                                           bool transfer_medium, int pause_sending_turns,
+                                           bool cooked_send, bool null_send) {
+    shared_lock_t lock(view_mutex);
+    while(true) {
+        MulticastGroup& multicast_group = *curr_view->multicast_group;
+        char* buf = multicast_group.wait_for_sendbuffer_ptr(subgroup_num, payload_size, deadline, transfer_medium,
+                                                            pause_sending_turns, cooked_send, null_send);
+        if(buf || !multicast_group.is_wedged() || thread_shutdown) {
+            return buf;
+        }
+        // The view is changing, so the window will open up in the next one.
+        // Waiting on view_change_cv releases the view lock so the change can happen.
+        const int32_t vid = curr_view->vid;
+        auto view_changed = [&]() { return curr_view->vid != vid || thread_shutdown; };
+        if(deadline) {
+            if(!view_change_cv.wait_until(lock, *deadline, view_changed)) {
+                return nullptr;
+            }
+        } else {
+            view_change_cv.wait(lock, view_changed);
+        }
+    }
+}
+
+std::future<char*> ViewManager::get_sendbuffer_ptr_async(subgroup_id_t subgroup_num, unsigned long long int payload_size,
+                                                         bool transfer_medium, int pause_sending_turns,
+                                                         bool cooked_send, bool null_send) {
+    shared_lock_t lock(view_mutex);
+    return curr_view->multicast_group->get_sendbuffer_ptr_async(subgroup_num, payload_size, transfer_medium,
+                                                                pause_sending_turns, cooked_send, null_send);
+}
+
 void ViewManager::send(subgroup_id_t subgroup_num) {
     shared_lock_t lock(view_mutex);
     while(true) {
@@ -5,6 +5,9 @@
  */
 #pragma once
 
+#include <chrono>
+#include <experimental/optional>
+#include <future>
 #include <map>
 #include <mutex>
 #include <shared_mutex>
@@ -200,6 +203,28 @@ private:
                                 std::map<subgroup_id_t, uint32_t>& subgroup_to_num_received_offset,
                                 std::map<subgroup_id_t, std::vector<node_id_t>>& subgroup_to_membership,
                                 std::map<subgroup_id_t, Mode>& subgroup_to_mode);
+    /**
+     * Lays out the SST multicast slots of every subgroup in the given View,
+     * using each subgroup type's SSTSlotSettings from SubgroupInfo and falling
+     * back to the slot size and window size in derecho_params.
+     * @param view A View whose subgroup IDs have been assigned by make_subgroup_maps
+     * @param derecho_params The group's parameters
+     * @param subgroup_to_slot_layout A map to fill with the slot layout of each subgroup
+     * @return The total size, in bytes, of all the subgroups' slots
+     */
+    std::size_t make_slot_layouts(const View& view, const DerechoParams& derecho_params,
+                                  std::map<subgroup_id_t, SSTSlotLayout>& subgroup_to_slot_layout) const;
+    /** Fills subgroup_to_batch_settings with the BatchSettings from SubgroupInfo
+     * of each subgroup in the given View that batches its messages. */
+    void make_batch_settings(const View& view, std::map<subgroup_id_t, BatchSettings>& subgroup_to_batch_settings) const;
+    /** Fills subgroup_to_send_weight with the send weight from SubgroupInfo
+     * of each subgroup in the given View that has one. */
+    void make_send_weights(const View& view, std::map<subgroup_id_t, uint32_t>& subgroup_to_send_weight) const;
+    /** Implements both versions of wait_for_sendbuffer_ptr; a deadline of none waits forever. */
+    char* wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                  std::experimental::optional<std::chrono::steady_clock::time_point> deadline,
+                                  bool transfer_medium, int pause_sending_turns,
+                                  bool cooked_send, bool null_send);
     /** Constructs a map from node ID -> IP address from the parallel vectors in the given View. */
     static std::map<node_id_t, ip_addr> make_member_ips_map(const View& view);
 
@@ -295,6 +320,32 @@ public:
     char* get_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
                              bool transfer_medium = true, int pause_sending_turns = 0,
                              bool cooked_send = false, bool null_send = false);
+    /**
+     * Like get_sendbuffer_ptr, but blocks until there is space in the send
+     * window instead of returning nullptr when it is full. If the view changes
+     * while waiting, it keeps waiting in the new view.
+     * @return nullptr only if the message is too large or the group is shutting down.
+     */
+    char* wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                  bool transfer_medium = true, int pause_sending_turns = 0,
+                                  bool cooked_send = false, bool null_send = false);
+    /**
+     * Like wait_for_sendbuffer_ptr, but gives up and returns nullptr if there
+     * is still no space in the send window after the timeout.
+     */
+    char* wait_for_sendbuffer_ptr(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                  std::chrono::milliseconds timeout,
+                                  bool transfer_medium = true, int pause_sending_turns = 0,
+                                  bool cooked_send = false, bool null_send = false);
+    /**
+     * Like get_sendbuffer_ptr, but returns a future that is fulfilled when
+     * there is space in the send window. The future contains nullptr if the
+     * message is too large or the current view ends first, in which case the
+     * caller should request a buffer again.
+     */
+    std::future<char*> get_sendbuffer_ptr_async(subgroup_id_t subgroup_num, long long unsigned int payload_size,
+                                                bool transfer_medium = true, int pause_sending_turns = 0,
+                                                bool cooked_send = false, bool null_send = false);
     /** Instructs the managed DerechoGroup's to send the next message. This
      * returns immediately; the send is scheduled to happen some time in the future. */
     void send(subgroup_id_t subgroup_num);
@@ -269,17 +269,24 @@ void polling_group::send_message(shared_ptr<memory_region> message_mr, size_t of
     if(length == 0) throw rdmc::invalid_args();
     if(offset + length > message_mr->size) throw rdmc::invalid_args();
     if(member_index > 0) throw rdmc::nonroot_sender();
+    if((length - 1) / block_size + 1 > std::numeric_limits<uint16_t>::max())
+        throw rdmc::invalid_args();
 
-    // Queueing sends is not supported
-    if(receive_step > 0) throw rdmc::group_busy();
-    if(send_step > 0) throw rdmc::group_busy();
-
+    // If a message is already being sent, this one will be started by
+    // complete_message() once the current one has been sent.
+    if(mr) {
+        LOG_EVENT(group_number, message_number, -1, "queued_message");
+        queued_sends.push(outgoing_message{message_mr, offset, length});
+        return;
+    }
+    start_message(message_mr, offset, length);
+}
+void polling_group::start_message(shared_ptr<memory_region> message_mr,
+                                  size_t offset, size_t length) {
     mr = message_mr;
     mr_offset = offset;
     message_size = length;
     num_blocks = (message_size - 1) / block_size + 1;
-    if(num_blocks > std::numeric_limits<uint16_t>::max())
-        throw rdmc::invalid_args();
     // printf("message_size = %lu, block_size = %lu, num_blocks = %lu\n",
     //        message_size, block_size, num_blocks);
     LOG_EVENT(group_number, message_number, -1, "send_message");
@@ -391,6 +398,10 @@ void polling_group::complete_message() {
         // cout << "Issued Ready For Block DDDDDDD (target = " <<
         // transfer->target
         //      << ")" << endl;
+    } else if(!queued_sends.empty()) {
+        outgoing_message next = std::move(queued_sends.front());
+        queued_sends.pop();
+        start_message(std::move(next.mr), next.offset, next.length);
     }
 }
 void polling_group::post_recv(schedule::block_transfer transfer) {
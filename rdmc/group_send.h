@@ -10,6 +10,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <queue>
 #include <set>
 #include <vector>
 
@@ -73,6 +74,18 @@ private:
     bool sending = false;  // Whether a block send is in progress
     size_t send_step = 0;  // Number of blocks sent/stalls so far
 
+    // Messages passed to send_message while another message was still
+    // being sent, in the order they should be sent in. The sender starts
+    // the next one as soon as it has sent the last block of the current
+    // one, so its first blocks travel down the schedule while the relays
+    // are still forwarding the last blocks of the previous message.
+    struct outgoing_message {
+        std::shared_ptr<rdma::memory_region> mr;
+        size_t offset;
+        size_t length;
+    };
+    std::queue<outgoing_message> queued_sends;
+
     // Total number of blocks received and the number of chunks
     // received for ecah block, respectively.
     size_t num_received_blocks = 0;
@@ -108,6 +121,8 @@ private:
     void post_recv(schedule::block_transfer transfer);
     void send_next_block();
     void complete_message();
+    void start_message(std::shared_ptr<rdma::memory_region> message_mr,
+                       size_t offset, size_t length);
     void prepare_for_next_message();
     void send_ready_for_block(uint32_t neighbor);
     void connect(uint32_t neighbor);
@@ -69,6 +69,10 @@ bool create_group(uint16_t group_number, std::vector<uint32_t> members,
         __attribute__((warn_unused_result));
 void destroy_group(uint16_t group_number);
 
+// Sends a message from the group's root. If a previous message is still being
+// sent, the message is queued and started as soon as the previous one has
+// been sent, so the group may have several messages in flight at once; they
+// complete in the order they were sent.
 bool send(uint16_t group_number, std::shared_ptr<rdma::memory_region> mr,
           size_t offset, size_t length) __attribute__((warn_unused_result));
 
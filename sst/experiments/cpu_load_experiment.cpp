@@ -103,10 +103,11 @@ int main() {
         for(uint i = 0; i < num_times; ++i) {
             for(uint j = 0; j < num_nodes; ++j) {
                 uint32_t slot = sst.num_received_sst[node_id][j] % window_size;
-                if((int64_t)sst.slots[j][slot].next_seq == (sst.num_received_sst[node_id][j]) / window_size + 1) {
+                volatile char* slot_ptr = sst.slots[j] + slot * slot_size(max_msg_size);
+                if((int64_t)trailer_of(slot_ptr, max_msg_size)->next_seq == (sst.num_received_sst[node_id][j]) / window_size + 1) {
                     sst_receive_handler(j, sst.num_received_sst[node_id][j],
-                                        sst.slots[j][slot].buf,
-                                        sst.slots[j][slot].size);
+                                        payload_of(slot_ptr, max_msg_size),
+                                        trailer_of(slot_ptr, max_msg_size)->size);
                     sst.num_received_sst[node_id][j]++;
                     update_sst = true;
                 }
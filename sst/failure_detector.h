@@ -0,0 +1,104 @@
+/**
+ * @file failure_detector.h
+ * @brief Contains the phi-accrual failure detector used to decide when the
+ * owner of a silent SST row should be suspected.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace sst {
+
+/**
+ * A phi-accrual failure detector for one remote node. Instead of suspecting
+ * the node after a fixed timeout, it keeps a sliding window of the intervals
+ * between the signs of life observed from the node (e.g. changes to the
+ * version of its SST row), and measures the current silence by
+ * phi = -log10(P(interval >= silence)), under a normal distribution fitted to
+ * the window. The node should be suspected once phi exceeds a threshold, so a
+ * node whose writes arrive irregularly gets more leeway than one that writes
+ * at a steady rate.
+ *
+ * Since a node that stops sending application traffic falls back to periodic
+ * heartbeats, the mean is padded by an acceptable pause, which covers the
+ * switch from a busy stream of writes to heartbeats as well as scheduling
+ * hiccups on the remote node.
+ */
+class PhiAccrualDetector {
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    /** Ring buffer of the most recent intervals between arrivals, in milliseconds */
+    std::vector<double> intervals_ms;
+    std::size_t next_interval = 0;
+    std::size_t num_intervals = 0;
+    double interval_sum = 0;
+    double interval_square_sum = 0;
+    clock::time_point last_arrival;
+    double acceptable_pause_ms;
+    double min_std_dev_ms;
+
+    void add_interval(double interval_ms) {
+        if(num_intervals == intervals_ms.size()) {
+            const double oldest = intervals_ms[next_interval];
+            interval_sum -= oldest;
+            interval_square_sum -= oldest * oldest;
+        } else {
+            ++num_intervals;
+        }
+        intervals_ms[next_interval] = interval_ms;
+        interval_sum += interval_ms;
+        interval_square_sum += interval_ms * interval_ms;
+        next_interval = (next_interval + 1) % intervals_ms.size();
+    }
+
+public:
+    /**
+     * @param expected_interval_ms The interval to assume before any arrivals
+     * have been observed, e.g. the heartbeat period
+     * @param acceptable_pause_ms How much longer than the mean interval the
+     * node may be silent before phi starts to rise quickly
+     * @param min_std_dev_ms A floor on the standard deviation, so that a
+     * node that has been perfectly regular isn't suspected after a tiny delay
+     * @param window_size The number of intervals to keep
+     * @param start The time to treat as the first arrival
+     */
+    PhiAccrualDetector(double expected_interval_ms, double acceptable_pause_ms, double min_std_dev_ms,
+                       std::size_t window_size = 128, clock::time_point start = clock::now())
+            : intervals_ms(std::max(window_size, (std::size_t)1)),
+              last_arrival(start),
+              acceptable_pause_ms(acceptable_pause_ms),
+              min_std_dev_ms(min_std_dev_ms) {
+        add_interval(expected_interval_ms);
+    }
+
+    /** Records a sign of life from the node, observed at the given time. */
+    void heartbeat(clock::time_point now) {
+        add_interval(std::chrono::duration<double, std::milli>(now - last_arrival).count());
+        last_arrival = now;
+    }
+
+    /** @return The suspicion level of the node at the given time. */
+    double phi(clock::time_point now) const {
+        const double elapsed_ms = std::chrono::duration<double, std::milli>(now - last_arrival).count();
+        const double observed_mean = interval_sum / num_intervals;
+        const double variance = interval_square_sum / num_intervals - observed_mean * observed_mean;
+        const double std_dev = std::max(std::sqrt(std::max(variance, 0.0)), min_std_dev_ms);
+        const double mean = observed_mean + acceptable_pause_ms;
+        // Logistic approximation of the normal CDF, which stays accurate far into the tail
+        const double y = (elapsed_ms - mean) / std_dev;
+        const double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+        if(elapsed_ms > mean) {
+            return -std::log10(e / (1.0 + e));
+        } else {
+            return -std::log10(1.0 - 1.0 / (1.0 + e));
+        }
+    }
+};
+}
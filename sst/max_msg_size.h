@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+
 namespace sst {
+/** The default size of the largest message that fits in an SST multicast slot. */
 const static uint32_t max_msg_size = 10100;
 }
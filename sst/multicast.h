@@ -40,7 +40,11 @@ class multicast_group {
     // start indexes for sst fields it uses
     // need to know the range it can operate on
     const uint32_t num_received_offset;
-    const uint32_t slots_offset;
+    // offset in bytes of this group's slots within the slots field
+    const std::size_t slots_offset;
+    // size of the largest message, and of each slot that holds one
+    const uint32_t max_msg_size;
+    const std::size_t slot_size;
 
     // number of members
     const uint32_t num_members;
@@ -51,14 +55,18 @@ class multicast_group {
 
     std::thread timeout_thread;
 
+    volatile char* slot_of(uint32_t row, uint32_t slot) {
+        return sst->slots[row] + slots_offset + slot * slot_size;
+    }
+
     void initialize() {
         for(auto i : row_indices) {
             for(uint j = num_received_offset; j < num_received_offset + num_senders; ++j) {
                 sst->num_received_sst[i][j] = -1;
             }
-            for(uint j = slots_offset; j < slots_offset + window_size; ++j) {
-                sst->slots[i][j].buf[0] = 0;
-                sst->slots[i][j].next_seq = 0;
+            for(uint j = 0; j < window_size; ++j) {
+                trailer_of(slot_of(i, j), max_msg_size)->size = 0;
+                trailer_of(slot_of(i, j), max_msg_size)->next_seq = 0;
             }
         }
         sst->sync_with_members();
@@ -71,7 +79,8 @@ public:
                     uint32_t window_size,
                     std::vector<int> is_sender = {},
                     uint32_t num_received_offset = 0,
-                    uint32_t slots_offset = 0)
+                    std::size_t slots_offset = 0,
+                    uint32_t max_msg_size = ::sst::max_msg_size)
             : my_row(sst->get_local_index()),
               sst(sst),
               row_indices(row_indices),
@@ -85,6 +94,8 @@ public:
               }()),
               num_received_offset(num_received_offset),
               slots_offset(slots_offset),
+              max_msg_size(max_msg_size),
+              slot_size(::sst::slot_size(max_msg_size)),
               num_members(row_indices.size()),
               window_size(window_size) {
         // find my_member_index
@@ -121,8 +132,8 @@ public:
                 // std::cout << "queued_num " << queued_num << std::endl;
                 // std::cout << "Giving slot " << slot << std::endl;
                 // set size appropriately
-                sst->slots[my_row][slots_offset + slot].size = msg_size;
-                return sst->slots[my_row][slots_offset + slot].buf;
+                trailer_of(slot_of(my_row, slot), max_msg_size)->size = msg_size;
+                return payload_of(slot_of(my_row, slot), max_msg_size);
             } else {
                 long long int min_multicast_num = sst->num_received_sst[my_row][num_received_offset + my_member_index];
                 for(auto i : row_indices) {
@@ -145,10 +156,12 @@ public:
         // std::cout << "slot = " << slot << std::endl;
         // std::cout << "slots_offset = " << slots_offset << std::endl;
         num_sent++;
-        sst->slots[my_row][slots_offset + slot].next_seq++;
+        volatile MessageTrailer* trailer = trailer_of(slot_of(my_row, slot), max_msg_size);
+        trailer->next_seq++;
+        // only write the message, which is at the end of the slot, and the size and next_seq after it
         sst->put(
-                (char*)std::addressof(sst->slots[0][slots_offset + slot]) - sst->getBaseAddress(),
-                sizeof(Message));
+                (char*)slot_of(0, slot) - sst->getBaseAddress() + (slot_size - bytes_to_write(trailer->size)),
+                bytes_to_write(trailer->size));
     }
 
     void debug_print() {
@@ -156,8 +169,8 @@ public:
         using std::endl;
         for(auto i : row_indices) {
             cout << "Printing slots::next_seq" << endl;
-            for(uint j = slots_offset; j < slots_offset + window_size; ++j) {
-                cout << sst->slots[i][j].next_seq << " ";
+            for(uint j = 0; j < window_size; ++j) {
+                cout << trailer_of(slot_of(i, j), max_msg_size)->next_seq << " ";
             }
             cout << endl;
             cout << "Printing num_received_sst" << endl;
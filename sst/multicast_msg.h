@@ -1,11 +1,48 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include "max_msg_size.h"
 
 namespace sst {
-struct Message {
-    char buf[max_msg_size];
+/**
+ * The fields at the end of each multicast slot. A slot for messages of up to
+ * max_msg_size bytes is slot_size(max_msg_size) bytes long, and a message of
+ * size bytes is stored immediately before the trailer, so the message and
+ * trailer are contiguous and a send only needs to write those bytes. next_seq
+ * is the last word written, so once it changes the rest of the message is in
+ * place.
+ */
+struct MessageTrailer {
     uint32_t size;
     uint64_t next_seq;
 };
+
+static_assert(offsetof(MessageTrailer, next_seq) + sizeof(MessageTrailer::next_seq) == sizeof(MessageTrailer),
+              "next_seq must be the last bytes of a slot");
+
+/** @return The space for messages in a slot, rounded up so the trailer is aligned. */
+inline std::size_t message_space(uint32_t max_msg_size) {
+    return (max_msg_size + alignof(MessageTrailer) - 1) / alignof(MessageTrailer) * alignof(MessageTrailer);
+}
+
+/** @return The size of a slot that holds messages of up to max_msg_size bytes. */
+inline std::size_t slot_size(uint32_t max_msg_size) {
+    return message_space(max_msg_size) + sizeof(MessageTrailer);
+}
+
+inline volatile MessageTrailer* trailer_of(volatile char* slot, uint32_t max_msg_size) {
+    return (volatile MessageTrailer*)(slot + message_space(max_msg_size));
+}
+
+/** @return A pointer to the start of the message stored in a slot. */
+inline volatile char* payload_of(volatile char* slot, uint32_t max_msg_size) {
+    return slot + message_space(max_msg_size) - trailer_of(slot, max_msg_size)->size;
+}
+
+/** @return The number of bytes at the end of a slot that a send must write for a message of msg_size bytes. */
+inline std::size_t bytes_to_write(uint32_t msg_size) {
+    return msg_size + sizeof(MessageTrailer);
+}
 }
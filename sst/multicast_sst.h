@@ -5,12 +5,13 @@
 namespace sst {
 class multicast_sst : public SST<multicast_sst> {
 public:
-    SSTFieldVector<Message> slots;
+    /** The multicast slots, each slot_size(max_msg_size) bytes long */
+    SSTFieldVector<char> slots;
     SSTFieldVector<int64_t> num_received_sst;
     SSTField<bool> heartbeat;
-    multicast_sst(const SSTParams& parameters, uint32_t window_size)
+    multicast_sst(const SSTParams& parameters, uint32_t window_size, uint32_t max_msg_size = ::sst::max_msg_size)
             : SST<multicast_sst>(this, parameters),
-              slots(window_size),
+              slots(window_size * slot_size(max_msg_size)),
               num_received_sst(parameters.members.size()) {
         SSTInit(slots, num_received_sst, heartbeat);
     }
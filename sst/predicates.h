@@ -3,8 +3,11 @@
 #include <algorithm>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "sst.h"
 
@@ -29,49 +32,115 @@ template <class DerivedSST>
 class Predicates {
     using pred = std::function<bool(const DerivedSST&)>;
     using trig = std::function<void(DerivedSST&)>;
-    using pred_list = std::list<std::unique_ptr<std::pair<pred, std::shared_ptr<trig>>>>;
-    /** Predicate list for one-time predicates. */
-    pred_list one_time_predicates;
-    /** Predicate list for recurrent predicates */
-    pred_list recurrent_predicates;
-    /** Predicate list for transition predicates */
-    pred_list transition_predicates;
-    /** Contains one entry for every predicate in `transition_predicates`, in parallel. */
-    std::list<bool> transition_predicate_states;
+    /** A registered predicate and its trigger, along with the state the
+     * predicate evaluation thread keeps about it. */
+    struct predicate_entry {
+        pred predicate;
+        std::shared_ptr<trig> trigger;
+        /** The SST rows the predicate reads. If empty, the predicate may read
+         * state outside the SST, so it is evaluated on every pass. */
+        std::vector<uint32_t> input_rows;
+        /** True if the predicate must be evaluated on the next pass even if
+         * none of its input rows have changed. */
+        bool dirty;
+        /** For transition predicates, the value of the predicate the last
+         * time it was evaluated. */
+        bool last_state;
+
+        predicate_entry(pred predicate, std::shared_ptr<trig> trigger, std::vector<uint32_t> input_rows)
+                : predicate(predicate),
+                  trigger(trigger),
+                  input_rows(std::move(input_rows)),
+                  dirty(true),
+                  last_state(false) {}
+    };
+    using pred_list = std::list<std::unique_ptr<predicate_entry>>;
+    /**
+     * The predicates evaluated by one predicate evaluation thread. Each
+     * partition has its own lock, so triggers in different partitions can
+     * run at the same time.
+     */
+    struct partition {
+        /** Predicate list for one-time predicates. */
+        pred_list one_time_predicates;
+        /** Predicate list for recurrent predicates */
+        pred_list recurrent_predicates;
+        /** Predicate list for transition predicates */
+        pred_list transition_predicates;
+        std::mutex predicate_mutex;
+        /** Held by the evaluation thread while it runs one of this partition's
+         * triggers. It is taken before predicate_mutex is released, so a
+         * trigger can't start without it once its predicate is removed. */
+        std::mutex trigger_mutex;
+        /** The thread that evaluates this partition; set under predicate_mutex when it starts. */
+        std::thread::id evaluation_thread;
+    };
+    std::vector<std::unique_ptr<partition>> partitions;
     // SST needs to read these predicate lists directly
     friend class SST<DerivedSST>;
 
-    std::mutex predicate_mutex;
-
 public:
     class pred_handle {
         bool is_valid;
         typename pred_list::iterator iter;
         PredicateType type;
+        uint32_t partition_num;
         friend class Predicates;
 
     public:
-        pred_handle() : is_valid(false), type(PredicateType::ONE_TIME) {}
-        pred_handle(typename pred_list::iterator iter, PredicateType type)
-                : is_valid{true}, iter{iter}, type{type} {}
+        pred_handle() : is_valid(false), type(PredicateType::ONE_TIME), partition_num(0) {}
+        pred_handle(typename pred_list::iterator iter, PredicateType type, uint32_t partition_num)
+                : is_valid{true}, iter{iter}, type{type}, partition_num{partition_num} {}
         pred_handle(pred_handle&) = delete;
         pred_handle(pred_handle&& other)
-                : pred_handle(std::move(other.iter), other.type) {
+                : pred_handle(std::move(other.iter), other.type, other.partition_num) {
+            is_valid = other.is_valid;
             other.is_valid = false;
         }
         pred_handle& operator=(pred_handle&) = delete;
         pred_handle& operator=(pred_handle&& other) {
             iter = std::move(other.iter);
             type = other.type;
-            is_valid = true;
+            partition_num = other.partition_num;
+            is_valid = other.is_valid;
             other.is_valid = false;
             return *this;
         }
     };
 
+    /**
+     * @param num_partitions The number of partitions to divide the predicates
+     * into, each of which is evaluated by its own thread.
+     */
+    Predicates(uint32_t num_partitions = 1) {
+        for(uint32_t i = 0; i < std::max(num_partitions, 1u); ++i) {
+            partitions.emplace_back(std::make_unique<partition>());
+        }
+    }
+
+    /** Returns the number of partitions, and thus of predicate evaluation threads. */
+    uint32_t num_partitions() const { return partitions.size(); }
+
     /** Inserts a single (predicate, trigger) pair to the appropriate predicate list. */
     pred_handle insert(pred predicate, trig trigger,
-                       PredicateType type = PredicateType::ONE_TIME);
+                       PredicateType type = PredicateType::ONE_TIME) {
+        return insert(predicate, trigger, type, {});
+    }
+
+    /**
+     * Inserts a single (predicate, trigger) pair for a predicate that only
+     * reads the given rows of the SST. The predicate is only evaluated when
+     * one of those rows has been updated (by a put() from its owner, or by a
+     * trigger or put() on this node for the local row), or after it fires.
+     * The predicate must not depend on any state outside these rows.
+     *
+     * Predicates with the same partition key are always evaluated by the same
+     * thread, in the order they were inserted; predicates with different keys
+     * may be evaluated, and their triggers run, concurrently. Predicates
+     * inserted without a key are in the same partition as key 0.
+     */
+    pred_handle insert(pred predicate, trig trigger, PredicateType type,
+                       std::vector<uint32_t> input_rows, uint32_t partition_key = 0);
 
     /** Inserts a predicate with a list of triggers (which will be run in
      * sequence) to the appropriate predicate list. */
@@ -84,9 +153,22 @@ public:
                       type);
     }
 
-    /** Removes a (predicate, trigger) pair previously registered with insert(). */
+    /**
+     * Removes a (predicate, trigger) pair previously registered with insert().
+     * Triggers run without the partition's predicate lock, so the trigger may
+     * still be running on its evaluation thread when this returns; see
+     * wait_for_running_triggers.
+     */
     void remove(pred_handle& pred);
 
+    /**
+     * Waits for any trigger currently running on another partition's
+     * evaluation thread to return. Call this after removing predicates and
+     * before destroying anything their triggers use. It can be called from
+     * a trigger, since the caller's own partition is skipped.
+     */
+    void wait_for_running_triggers();
+
     /** Deletes all predicates, including evolvers and their triggers. */
     void clear();
 };
@@ -100,46 +182,66 @@ public:
  * @param trigger The trigger to execute when the predicate is true.
  * @param type The type of predicate being inserted; default is
  * PredicateType::ONE_TIME
+ * @param input_rows The SST rows the predicate reads
+ * @param partition_key A key, such as a subgroup number, identifying the
+ * predicates that must be evaluated by the same thread
  */
 template <class DerivedSST>
-auto Predicates<DerivedSST>::insert(pred predicate, trig trigger, PredicateType type) -> pred_handle {
-    std::lock_guard<std::mutex> lock(predicate_mutex);
+auto Predicates<DerivedSST>::insert(pred predicate, trig trigger, PredicateType type,
+                                    std::vector<uint32_t> input_rows,
+                                    uint32_t partition_key) -> pred_handle {
+    const uint32_t partition_num = partition_key % partitions.size();
+    partition& part = *partitions[partition_num];
+    std::lock_guard<std::mutex> lock(part.predicate_mutex);
+    auto entry = std::make_unique<predicate_entry>(predicate, std::make_shared<trig>(trigger),
+                                                   std::move(input_rows));
     if(type == PredicateType::ONE_TIME) {
-        one_time_predicates.push_back(std::make_unique<std::pair<pred, std::shared_ptr<trig>>>(
-                predicate, std::make_shared<trig>(trigger)));
-        return pred_handle(--one_time_predicates.end(), type);
+        part.one_time_predicates.push_back(std::move(entry));
+        return pred_handle(--part.one_time_predicates.end(), type, partition_num);
     } else if(type == PredicateType::RECURRENT) {
-        recurrent_predicates.push_back(std::make_unique<std::pair<pred, std::shared_ptr<trig>>>(
-                predicate, std::make_shared<trig>(trigger)));
-        return pred_handle(--recurrent_predicates.end(), type);
+        part.recurrent_predicates.push_back(std::move(entry));
+        return pred_handle(--part.recurrent_predicates.end(), type, partition_num);
     } else {
-        transition_predicates.push_back(std::make_unique<std::pair<pred, std::shared_ptr<trig>>>(
-                predicate, std::make_shared<trig>(trigger)));
-        transition_predicate_states.push_back(false);
-        return pred_handle(--transition_predicates.end(), type);
+        part.transition_predicates.push_back(std::move(entry));
+        return pred_handle(--part.transition_predicates.end(), type, partition_num);
     }
 }
 
 template <class DerivedSST>
 void Predicates<DerivedSST>::remove(pred_handle& handle) {
-    std::lock_guard<std::mutex> lock(predicate_mutex);
     if(!handle.is_valid) {
         return;
     }
+    std::lock_guard<std::mutex> lock(partitions[handle.partition_num]->predicate_mutex);
     handle.iter->reset();
     handle.is_valid = false;
 }
 
+template <class DerivedSST>
+void Predicates<DerivedSST>::wait_for_running_triggers() {
+    for(auto& part : partitions) {
+        {
+            std::lock_guard<std::mutex> lock(part->predicate_mutex);
+            if(part->evaluation_thread == std::this_thread::get_id()) {
+                continue;
+            }
+        }
+        std::lock_guard<std::mutex> trigger_lock(part->trigger_mutex);
+    }
+}
+
 template <class DerivedSST>
 void Predicates<DerivedSST>::clear() {
-    std::lock_guard<std::mutex> lock(predicate_mutex);
-    using ptr_to_pred = std::unique_ptr<std::pair<pred, std::shared_ptr<trig>>>;
-    std::for_each(one_time_predicates.begin(), one_time_predicates.end(),
-                  [](ptr_to_pred& ptr) { ptr.reset(); });
-    std::for_each(recurrent_predicates.begin(), recurrent_predicates.end(),
-                  [](ptr_to_pred& ptr) { ptr.reset(); });
-    std::for_each(transition_predicates.begin(), transition_predicates.end(),
-                  [](ptr_to_pred& ptr) { ptr.reset(); });
+    using ptr_to_pred = std::unique_ptr<predicate_entry>;
+    for(auto& part : partitions) {
+        std::lock_guard<std::mutex> lock(part->predicate_mutex);
+        std::for_each(part->one_time_predicates.begin(), part->one_time_predicates.end(),
+                      [](ptr_to_pred& ptr) { ptr.reset(); });
+        std::for_each(part->recurrent_predicates.begin(), part->recurrent_predicates.end(),
+                      [](ptr_to_pred& ptr) { ptr.reset(); });
+        std::for_each(part->transition_predicates.begin(), part->transition_predicates.end(),
+                      [](ptr_to_pred& ptr) { ptr.reset(); });
+    }
 }
 
 } /* namespace sst */
@@ -124,6 +124,7 @@ struct SSTParams {
     const failure_upcall_t failure_upcall;
     const std::vector<char> already_failed;
     const bool start_predicate_thread;
+    const uint32_t num_predicate_threads;
 
     /**
      *
@@ -140,17 +141,22 @@ struct SSTParams {
      * should be started immediately on construction of the SST. If false,
      * predicate evaluation will not start until start_predicate_evalution()
      * is called.
+     * @param num_predicate_threads The number of threads to evaluate
+     * predicates with; predicates are divided among them by the partition
+     * key they are inserted with.
      */
     SSTParams(const std::vector<uint32_t>& _members,
               const uint32_t my_node_id,
               const failure_upcall_t failure_upcall = nullptr,
               const std::vector<char> already_failed = {},
-              const bool start_predicate_thread = true)
+              const bool start_predicate_thread = true,
+              const uint32_t num_predicate_threads = 1)
             : members(_members),
               my_node_id(my_node_id),
               failure_upcall(failure_upcall),
               already_failed(already_failed),
-              start_predicate_thread(start_predicate_thread) {}
+              start_predicate_thread(start_predicate_thread),
+              num_predicate_threads(num_predicate_threads) {}
 };
 
 template <class DerivedSST>
@@ -160,7 +166,10 @@ private:
     void init_SSTFields(Fields&... fields) {
         rowLen = 0;
         compute_rowLen(rowLen, fields...);
-        rows = new char[rowLen * num_members];
+        //Each row ends with a version word, aligned so that it is read and written whole
+        row_version_offset = (rowLen + alignof(uint64_t) - 1) / alignof(uint64_t) * alignof(uint64_t);
+        rowLen = row_version_offset + sizeof(uint64_t);
+        rows = new char[rowLen * num_members]();
         // snapshot = new char[rowLen * num_members];
         volatile char* base = rows;
         set_bases_and_rowLens(base, rowLen, fields...);
@@ -171,7 +180,14 @@ private:
     std::vector<std::thread> background_threads;
     std::atomic<bool> thread_shutdown;
 
-    void detect();
+    /** Evaluates the predicates in one partition of predicates. */
+    void detect(uint32_t partition_num);
+    /** Reads the version word of every row, and records in row_changed which
+     * rows have been updated since last_row_versions. */
+    bool find_changed_rows(std::vector<uint64_t>& last_row_versions, std::vector<char>& row_changed) const;
+    /** Notes that the local row has changed, waking the predicate evaluation
+     * thread if it is idle. */
+    void mark_local_row_changed();
 
 public:
     Predicates<DerivedSST> predicates;
@@ -183,11 +199,26 @@ private:
     // char* snapshot;
     /** Length of each row in this SST, in bytes. */
     int rowLen;
+    /** Offset within each row of its version word. Every put() from a row's
+     * owner is followed by a write of a new version, so the predicate
+     * evaluation thread can tell which rows have changed. */
+    int row_version_offset;
+    /** The version last written to remote nodes along with a put(). */
+    std::atomic<uint64_t> put_version;
+    /** Incremented whenever the local row may have changed; each predicate
+     * evaluation thread compares it to the value it last saw. */
+    std::atomic<uint64_t> local_row_version;
+    /** Incremented whenever every predicate should be re-evaluated, e.g.
+     * after a failure. */
+    std::atomic<uint64_t> all_rows_version;
     /** List of nodes in the SST; indexes are row numbers, values are node IDs. */
     const std::vector<uint32_t>& members;
     /** Equal to members.size() */
     const unsigned int num_members;
     std::vector<uint32_t> all_indices;
+    /** For each row, the version of the last put() that wrote to it, so the
+     * failure detector can tell which remote nodes this node has been idle toward. */
+    std::vector<std::atomic<uint64_t>> last_put_versions;
     /** Index (row number) of this node in the SST. */
     unsigned int my_index;
     /** Maps node IDs to SST row indexes. */
@@ -217,19 +248,31 @@ private:
     std::mutex thread_start_mutex;
     /** Notified when the predicate evaluation thread should start. */
     std::condition_variable thread_start_cv;
+    /** The number of predicate evaluation threads waiting for changes after being idle. */
+    std::atomic<uint32_t> num_idle_detect_threads;
+    /** Mutex for detect_idle_cv. */
+    std::mutex detect_idle_mutex;
+    /** Notified when the local row changes while a predicate evaluation thread is idle. */
+    std::condition_variable detect_idle_cv;
 
 public:
     SST(DerivedSST* derived_class_pointer, const SSTParams& params)
             : derived_this(derived_class_pointer),
               thread_shutdown(false),
+              predicates(params.num_predicate_threads),
+              put_version(0),
+              local_row_version(0),
+              all_rows_version(0),
               members(params.members),
               num_members(members.size()),
               all_indices(num_members),
+              last_put_versions(num_members),
               my_node_id(params.my_node_id),
               row_is_frozen(num_members),
               failure_upcall(params.failure_upcall),
               res_vec(num_members),
-              thread_start(params.start_predicate_thread) {
+              thread_start(params.start_predicate_thread),
+              num_idle_detect_threads(0) {
         //Figure out my SST index
         for(uint32_t i = 0; i < num_members; ++i) {
             if(members[i] == my_node_id) {
@@ -278,8 +321,9 @@ public:
             }
         }
 
-        std::thread detector(&SST::detect, this);
-        background_threads.push_back(std::move(detector));
+        for(uint32_t partition_num = 0; partition_num < predicates.num_partitions(); ++partition_num) {
+            background_threads.emplace_back(&SST::detect, this, partition_num);
+        }
 
         std::cout << "Initialized SST and Started Threads" << std::endl;
     }
@@ -299,6 +343,21 @@ public:
     /** Returns the total number of rows in the table. */
     int get_num_rows() const { return num_members; }
 
+    /** Returns true if the row has been frozen, i.e. its node has been reported as failed. */
+    bool is_frozen(uint32_t row_index) const { return row_is_frozen[row_index]; }
+
+    /** Returns the version word of a row, which changes every time the row's
+     * owner puts to this node. */
+    uint64_t get_row_version(uint32_t row_index) const {
+        return *(volatile uint64_t*)(rows + row_index * rowLen + row_version_offset);
+    }
+
+    /** Returns the version of the last put() this node made to a row, which
+     * changes every time this node writes to the row's owner. */
+    uint64_t get_last_put_version(uint32_t row_index) const {
+        return last_put_versions[row_index].load(std::memory_order_relaxed);
+    }
+
     /** Gets the index of the local row in the table. */
     int get_local_index() const { return my_index; }
 
@@ -308,20 +367,20 @@ public:
 
     /** Writes the entire local row to all remote nodes. */
     void put() {
-        put(all_indices, 0, rowLen);
+        put(all_indices, 0, row_version_offset);
     }
 
     void put_with_completion() {
-        put_with_completion(all_indices, 0, rowLen);
+        put_with_completion(all_indices, 0, row_version_offset);
     }
 
     /** Writes the entire local row to some of the remote nodes. */
-    void put(std::vector<uint32_t> receiver_ranks) {
-        put(receiver_ranks, 0, rowLen);
+    void put(const std::vector<uint32_t>& receiver_ranks) {
+        put(receiver_ranks, 0, row_version_offset);
     }
 
-    void put_with_completion(std::vector<uint32_t> receiver_ranks) {
-        put_with_completion(receiver_ranks, 0, rowLen);
+    void put_with_completion(const std::vector<uint32_t>& receiver_ranks) {
+        put_with_completion(receiver_ranks, 0, row_version_offset);
     }
 
     /** Writes a contiguous subset of the local row to all remote nodes. */
@@ -334,9 +393,9 @@ public:
     }
 
     /** Writes a contiguous subset of the local row to some of the remote nodes. */
-    void put(std::vector<uint32_t> receiver_ranks, long long int offset, long long int size);
+    void put(const std::vector<uint32_t>& receiver_ranks, long long int offset, long long int size);
 
-    void put_with_completion(std::vector<uint32_t> receiver_ranks, long long int offset, long long int size);
+    void put_with_completion(const std::vector<uint32_t>& receiver_ranks, long long int offset, long long int size);
 
 private:
     using char_p = volatile char*;
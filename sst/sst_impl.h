@@ -6,11 +6,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <pthread.h>
+#include <string>
 #include <sys/time.h>
 #include <thread>
 #include <time.h>
@@ -51,36 +53,93 @@ void SST<DerivedSST>::start_predicate_evaluation() {
 }
 
 /**
- * This function is run in a detached background thread to detect predicate
- * events. It continuously evaluates predicates one by one, and runs the
- * trigger functions for each predicate that fires. In addition, it
- * continuously evaluates named functions one by one, and updates the local
- * row's observed values of those functions.
+ * This function is run in a background thread, one for each partition of the
+ * predicates, to detect predicate events. On each pass it checks which rows
+ * have changed since the last pass, using the version word at the end of each
+ * row, and evaluates only the predicates in its partition that read one of
+ * those rows, along with any predicates that did not declare their inputs or
+ * that fired on the previous pass. It runs the trigger functions for each
+ * predicate that fires.
  */
 template <typename DerivedSST>
-void SST<DerivedSST>::detect() {
-    pthread_setname_np(pthread_self(), "sst_detect");
+void SST<DerivedSST>::detect(uint32_t partition_num) {
+    std::string thread_name = "sst_detect";
+    if(predicates.num_partitions() > 1) {
+        thread_name += "_" + std::to_string(partition_num);
+    }
+    pthread_setname_np(pthread_self(), thread_name.c_str());
+    typename Predicates<DerivedSST>::partition& partition = *predicates.partitions[partition_num];
+    {
+        std::lock_guard<std::mutex> lock(partition.predicate_mutex);
+        partition.evaluation_thread = std::this_thread::get_id();
+    }
     if(!thread_start) {
         std::unique_lock<std::mutex> lock(thread_start_mutex);
         thread_start_cv.wait(lock, [this]() { return thread_start; });
     }
-    struct timespec last_time, cur_time;
-    clock_gettime(CLOCK_REALTIME, &last_time);
+    using namespace std::chrono_literals;
+    // how long to keep polling after the last predicate fired, and how often to poll after that
+    const auto idle_threshold = 1ms;
+    const auto idle_poll_interval = 50us;
+    auto last_fired_time = std::chrono::steady_clock::now();
+
+    std::vector<uint64_t> last_row_versions(num_members, 0);
+    std::vector<char> row_changed(num_members, false);
+    uint64_t last_local_row_version = 0;
+    uint64_t last_all_rows_version = 0;
+    bool trigger_ran = false;
 
     while(!thread_shutdown) {
+        bool any_row_changed = find_changed_rows(last_row_versions, row_changed);
+        // this partition's triggers, and other threads calling put(), change
+        // the local row without writing a new version to it
+        const uint64_t curr_local_row_version = local_row_version;
+        if(curr_local_row_version != last_local_row_version || trigger_ran) {
+            last_local_row_version = curr_local_row_version;
+            row_changed[my_index] = true;
+            any_row_changed = true;
+        }
+        const uint64_t curr_all_rows_version = all_rows_version;
+        if(curr_all_rows_version != last_all_rows_version) {
+            last_all_rows_version = curr_all_rows_version;
+            std::fill(row_changed.begin(), row_changed.end(), true);
+            any_row_changed = true;
+        }
+        trigger_ran = false;
+        auto needs_evaluation = [&](typename Predicates<DerivedSST>::predicate_entry& entry) {
+            if(entry.input_rows.empty() || entry.dirty) {
+                return true;
+            }
+            if(!any_row_changed) {
+                return false;
+            }
+            for(const uint32_t row : entry.input_rows) {
+                if(row_changed[row]) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
         bool predicate_fired = false;
         // Take the predicate lock before reading the predicate lists
-        std::unique_lock<std::mutex> predicates_lock(predicates.predicate_mutex);
+        std::unique_lock<std::mutex> predicates_lock(partition.predicate_mutex);
 
         // one time predicates need to be evaluated only until they become true
-        for(auto& pred : predicates.one_time_predicates) {
-            if(pred != nullptr && (pred->first(*derived_this) == true)) {
+        for(auto& pred : partition.one_time_predicates) {
+            if(pred == nullptr || !needs_evaluation(*pred)) {
+                continue;
+            }
+            pred->dirty = false;
+            if(pred->predicate(*derived_this) == true) {
                 predicate_fired = true;
                 // Copy the trigger pointer locally, so it can continue running without
                 // segfaulting even if this predicate gets deleted when we unlock predicates_lock
-                std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(pred->second);
+                std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(pred->trigger);
+                std::unique_lock<std::mutex> trigger_lock(partition.trigger_mutex);
                 predicates_lock.unlock();
                 (*trigger)(*derived_this);
+                trigger_lock.unlock();
                 predicates_lock.lock();
                 // erase the predicate as it was just found to be true
                 pred.reset();
@@ -88,75 +147,125 @@ void SST<DerivedSST>::detect() {
         }
 
         // recurrent predicates are evaluated each time they are found to be true
-        for(auto& pred : predicates.recurrent_predicates) {
-            if(pred != nullptr && (pred->first(*derived_this) == true)) {
+        for(auto& pred : partition.recurrent_predicates) {
+            if(pred == nullptr || !needs_evaluation(*pred)) {
+                continue;
+            }
+            pred->dirty = false;
+            if(pred->predicate(*derived_this) == true) {
                 predicate_fired = true;
-                std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(pred->second);
+                // the trigger may not have done all the work available, so check again on the next pass
+                pred->dirty = true;
+                std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(pred->trigger);
+                std::unique_lock<std::mutex> trigger_lock(partition.trigger_mutex);
                 predicates_lock.unlock();
                 (*trigger)(*derived_this);
+                trigger_lock.unlock();
                 predicates_lock.lock();
             }
         }
 
         // transition predicates are only evaluated when they change from false to true
-        // We need to use iterators here because we need to iterate over two lists in parallel
-        auto pred_it = predicates.transition_predicates.begin();
-        auto pred_state_it = predicates.transition_predicate_states.begin();
-        while(pred_it != predicates.transition_predicates.end()) {
-            if(*pred_it != nullptr) {
-                //*pred_state_it is the previous state of the predicate at *pred_it
-                bool curr_pred_state = (*pred_it)->first(*derived_this);
-                if(curr_pred_state == true && *pred_state_it == false) {
-                    predicate_fired = true;
-                    std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(
-                            (*pred_it)->second);
-                    predicates_lock.unlock();
-                    (*trigger)(*derived_this);
-                    predicates_lock.lock();
-                }
-                *pred_state_it = curr_pred_state;
-
-                ++pred_it;
-                ++pred_state_it;
+        for(auto& pred : partition.transition_predicates) {
+            if(pred == nullptr || !needs_evaluation(*pred)) {
+                continue;
             }
-        }
-
-        if(predicate_fired) {
-            // update last time
-            clock_gettime(CLOCK_REALTIME, &last_time);
-        } else {
-            clock_gettime(CLOCK_REALTIME, &cur_time);
-            // check if the system has been inactive for enough time to induce sleep
-            double time_elapsed_in_ms = (cur_time.tv_sec - last_time.tv_sec) * 1e3
-                                        + (cur_time.tv_nsec - last_time.tv_nsec) / 1e6;
-            if(time_elapsed_in_ms > 1) {
+            pred->dirty = false;
+            bool curr_pred_state = pred->predicate(*derived_this);
+            bool prev_pred_state = pred->last_state;
+            pred->last_state = curr_pred_state;
+            if(curr_pred_state == true && prev_pred_state == false) {
+                predicate_fired = true;
+                std::shared_ptr<typename Predicates<DerivedSST>::trig> trigger(pred->trigger);
+                std::unique_lock<std::mutex> trigger_lock(partition.trigger_mutex);
                 predicates_lock.unlock();
-                using namespace std::chrono_literals;
-                std::this_thread::sleep_for(1ms);
+                (*trigger)(*derived_this);
+                trigger_lock.unlock();
                 predicates_lock.lock();
             }
         }
+        predicates_lock.unlock();
+        trigger_ran = predicate_fired;
+
+        if(predicate_fired || any_row_changed) {
+            last_fired_time = std::chrono::steady_clock::now();
+        } else if(std::chrono::steady_clock::now() - last_fired_time > idle_threshold) {
+            // Remote writes can't wake this thread, so keep polling the row
+            // versions, but local changes end the wait immediately
+            std::unique_lock<std::mutex> idle_lock(detect_idle_mutex);
+            num_idle_detect_threads++;
+            detect_idle_cv.wait_for(idle_lock, idle_poll_interval, [&]() {
+                return local_row_version != last_local_row_version
+                       || all_rows_version != last_all_rows_version || thread_shutdown;
+            });
+            num_idle_detect_threads--;
+        }
         //Still to do: Clean up deleted predicates
     }
 }
 
 template <typename DerivedSST>
-void SST<DerivedSST>::put(std::vector<uint32_t> receiver_ranks, long long int offset, long long int size) {
+bool SST<DerivedSST>::find_changed_rows(std::vector<uint64_t>& last_row_versions,
+                                        std::vector<char>& row_changed) const {
+    bool any_row_changed = false;
+    for(unsigned int row = 0; row < num_members; ++row) {
+        uint64_t version = *(volatile uint64_t*)(rows + row * rowLen + row_version_offset);
+        row_changed[row] = (version != last_row_versions[row]);
+        if(row_changed[row]) {
+            last_row_versions[row] = version;
+            any_row_changed = true;
+        }
+    }
+    return any_row_changed;
+}
+
+template <typename DerivedSST>
+void SST<DerivedSST>::mark_local_row_changed() {
+    local_row_version++;
+    if(num_idle_detect_threads > 0) {
+        std::lock_guard<std::mutex> lock(detect_idle_mutex);
+        detect_idle_cv.notify_all();
+    }
+}
+
+/**
+ * Each write of the local row is followed by an inline write of a new
+ * version number to the end of the remote copy of the row. Since the writes
+ * on a queue pair are executed in order, a receiver that sees the new version
+ * also sees the data, and since inline writes copy the version when they are
+ * posted, no two version writes carry the same value. A row whose writes
+ * can't be posted is frozen, since its node can no longer be kept up to date.
+ */
+template <typename DerivedSST>
+void SST<DerivedSST>::put(const std::vector<uint32_t>& receiver_ranks, long long int offset, long long int size) {
+    const uint64_t version = ++put_version;
+    std::vector<uint32_t> failed_node_indexes;
     for(auto index : receiver_ranks) {
         // don't write to yourself or a frozen row
         if(index == my_index || row_is_frozen[index]) {
             continue;
         }
         // perform a remote RDMA write on the owner of the row
-        res_vec[index]->post_remote_write(0, offset, size);
+        if(!res_vec[index]->post_remote_write(0, offset, size)
+           || !res_vec[index]->post_remote_write_inline(0, row_version_offset, &version, sizeof(version))) {
+            failed_node_indexes.push_back(index);
+            continue;
+        }
+        last_put_versions[index].store(version, std::memory_order_relaxed);
+    }
+    mark_local_row_changed();
+
+    for(auto index : failed_node_indexes) {
+        std::cerr << "Could not post a write to row " << index << ". Freezing it" << std::endl;
+        freeze(index);
     }
-    return;
 }
 
 template <typename DerivedSST>
-void SST<DerivedSST>::put_with_completion(std::vector<uint32_t> receiver_ranks, long long int offset, long long int size) {
+void SST<DerivedSST>::put_with_completion(const std::vector<uint32_t>& receiver_ranks, long long int offset, long long int size) {
     unsigned int num_writes_posted = 0;
     std::vector<bool> posted_write_to(num_members, false);
+    std::vector<uint32_t> failed_node_indexes;
 
     const auto tid = std::this_thread::get_id();
     // get id first
@@ -164,13 +273,25 @@ void SST<DerivedSST>::put_with_completion(std::vector<uint32_t> receiver_ranks,
 
     util::polling_data.set_waiting(tid);
 
+    const uint64_t version = ++put_version;
+
     for(auto index : receiver_ranks) {
         // don't write to yourself or a frozen row
         if(index == my_index || row_is_frozen[index]) {
             continue;
         }
         // perform a remote RDMA write on the owner of the row
-        res_vec[index]->post_remote_write_with_completion(id, offset, size);
+        if(!res_vec[index]->post_remote_write_with_completion(id, offset, size)) {
+            std::cerr << "Could not post a write to row " << index << ". Freezing it" << std::endl;
+            failed_node_indexes.push_back(index);
+            continue;
+        }
+        // the inline write isn't signaled, but the queue pair is still broken if it fails
+        if(!res_vec[index]->post_remote_write_inline(id, row_version_offset, &version, sizeof(version))) {
+            std::cerr << "Could not post a write to row " << index << ". Freezing it" << std::endl;
+            failed_node_indexes.push_back(index);
+        }
+        last_put_versions[index].store(version, std::memory_order_relaxed);
         posted_write_to[index] = true;
         num_writes_posted++;
     }
@@ -178,8 +299,6 @@ void SST<DerivedSST>::put_with_completion(std::vector<uint32_t> receiver_ranks,
     // track which nodes haven't failed yet
     std::vector<bool> polled_successfully_from(num_members, false);
 
-    std::vector<uint32_t> failed_node_indexes;
-
     /** Completion Queue poll timeout in millisec */
     const int MAX_POLL_CQ_TIMEOUT = 2000;
     unsigned long start_time_msec;
@@ -238,6 +357,7 @@ void SST<DerivedSST>::put_with_completion(std::vector<uint32_t> receiver_ranks,
     }
 
     util::polling_data.reset_waiting(tid);
+    mark_local_row_changed();
 
     for(auto index : failed_node_indexes) {
         freeze(index);
@@ -255,6 +375,7 @@ void SST<DerivedSST>::freeze(int row_index) {
     }
     num_frozen++;
     res_vec[row_index].reset();
+    all_rows_version++;
     if(failure_upcall) {
         failure_upcall(members[row_index]);
     }
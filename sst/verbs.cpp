@@ -63,6 +63,10 @@ int ib_port = 1;
 int gid_idx = 0;
 
 static const int port = 22549;
+/** The number of requests each queue pair's send queue can hold. */
+static const uint32_t max_send_wr = 10000;
+/** One in this many otherwise unsignaled requests is signaled. */
+static const uint32_t signal_interval = max_send_wr / 4;
 tcp::tcp_connections *sst_connections;
 
 //  unsigned int max_time_to_completion = 0;
@@ -133,10 +137,11 @@ resources::resources(int r_index, char *write_addr, char *read_addr, int size_w,
     qp_init_attr.send_cq = g_res->cq;
     qp_init_attr.recv_cq = g_res->cq;
     // allow a lot of requests at a time
-    qp_init_attr.cap.max_send_wr = 10000;
+    qp_init_attr.cap.max_send_wr = max_send_wr;
     qp_init_attr.cap.max_recv_wr = 10000;
     qp_init_attr.cap.max_send_sge = 1;
     qp_init_attr.cap.max_recv_sge = 1;
+    qp_init_attr.cap.max_inline_data = max_inline_write_size;
     // create the queue pair
     qp = ibv_create_qp(g_res->pd, &qp_init_attr);
 
@@ -301,8 +306,14 @@ void resources::connect_qp() {
             "Could not sync in connect_qp after qp transition to RTS state");
 }
 
+bool resources::signal_next_post() {
+    return (++num_unsignaled_posts) % signal_interval == 0;
+}
+
 /**
  * This is used for both reads and writes.
+ * Requests posted without a completion are still signaled now and then, with
+ * flow_control_wr_id instead of id, so that they can't fill up the send queue.
  *
  * @param offset The offset within the remote buffer to start the operation at.
  * @param size The number of bytes to read or write.
@@ -336,6 +347,9 @@ int resources::post_remote_send(uint32_t id, long long int offset, long long int
     }
     if(completion) {
         sr.send_flags = IBV_SEND_SIGNALED;
+    } else if(signal_next_post()) {
+        sr.wr_id = flow_control_wr_id;
+        sr.send_flags = IBV_SEND_SIGNALED;
     }
     // set the remote rkey and virtual address
     sr.wr.rdma.remote_addr = remote_props.addr + offset;
@@ -351,29 +365,32 @@ int resources::post_remote_send(uint32_t id, long long int offset, long long int
 /**
  * @param size The number of bytes to read from remote memory.
  */
-void resources::post_remote_read(uint32_t id, long long int size) {
+bool resources::post_remote_read(uint32_t id, long long int size) {
     int rc = post_remote_send(id, 0, size, 0, false);
     check_for_error(
             !rc, "Could not post RDMA read, error code is " + std::to_string(rc) + " remote_index is " + std::to_string(remote_index));
+    return !rc;
 }
 /**
  * @param offset The offset, in bytes, of the remote memory buffer at which to
  * start reading.
  * @param size The number of bytes to read from remote memory.
  */
-void resources::post_remote_read(uint32_t id, long long int offset, long long int size) {
+bool resources::post_remote_read(uint32_t id, long long int offset, long long int size) {
     int rc = post_remote_send(id, offset, size, 0, false);
     check_for_error(
             !rc, "Could not post RDMA read, error code is " + std::to_string(rc) + " remote_index is " + std::to_string(remote_index));
+    return !rc;
 }
 /**
  * @param size The number of bytes to write from the local buffer to remote
  * memory.
  */
-void resources::post_remote_write(uint32_t id, long long int size) {
+bool resources::post_remote_write(uint32_t id, long long int size) {
     int rc = post_remote_send(id, 0, size, 1, false);
     check_for_error(
             !rc, "Could not post RDMA write (with no offset), error code is " + std::to_string(rc) + " remote_index is " + std::to_string(remote_index));
+    return !rc;
 }
 
 /**
@@ -382,22 +399,62 @@ void resources::post_remote_write(uint32_t id, long long int size) {
  * @param size The number of bytes to write from the local buffer into remote
  * memory.
  */
-void resources::post_remote_write(uint32_t id, long long int offset, long long int size) {
+bool resources::post_remote_write(uint32_t id, long long int offset, long long int size) {
     int rc = post_remote_send(id, offset, size, 1, false);
     check_for_error(
             !rc, "Could not post RDMA write with offset, error code is " + std::to_string(rc) + " remote_index is " + std::to_string(remote_index));
+    return !rc;
 }
 
-void resources::post_remote_write_with_completion(uint32_t id, long long int size) {
+bool resources::post_remote_write_with_completion(uint32_t id, long long int size) {
     int rc = post_remote_send(id, 0, size, 1, true);
     check_for_error(
             !rc, "Could not post RDMA write (with no offset) with completion, error code is " + std::to_string(rc) + " remote_index is " + std::to_string(remote_index));
+    return !rc;
 }
 
-void resources::post_remote_write_with_completion(uint32_t id, long long int offset, long long int size) {
+bool resources::post_remote_write_with_completion(uint32_t id, long long int offset, long long int size) {
     int rc = post_remote_send(id, offset, size, 1, true);
     check_for_error(
             !rc, "Could not post RDMA write with offset and completion, error code is " + std::to_string(rc) + " remote_index is " + std::to_string(remote_index));
+    return !rc;
+}
+
+/**
+ * Unlike the other writes, the data is copied when the write is posted rather
+ * than when it is executed, so the caller can change it immediately and
+ * writes posted later will never carry an earlier value.
+ * @param offset The offset, in bytes, of the remote memory buffer at which to
+ * start writing.
+ * @param data The data to write, which does not need to be in registered memory.
+ * @param size The number of bytes to write; at most max_inline_write_size.
+ */
+bool resources::post_remote_write_inline(uint32_t id, long long int offset, const void *data, uint32_t size) {
+    struct ibv_send_wr sr;
+    struct ibv_sge sge;
+    struct ibv_send_wr *bad_wr = NULL;
+
+    memset(&sge, 0, sizeof(sge));
+    sge.addr = (uintptr_t)data;
+    sge.length = size;
+    memset(&sr, 0, sizeof(sr));
+    sr.next = NULL;
+    sr.wr_id = id;
+    sr.sg_list = &sge;
+    sr.num_sge = 1;
+    sr.opcode = IBV_WR_RDMA_WRITE;
+    sr.send_flags = IBV_SEND_INLINE;
+    if(signal_next_post()) {
+        sr.wr_id = flow_control_wr_id;
+        sr.send_flags |= IBV_SEND_SIGNALED;
+    }
+    sr.wr.rdma.remote_addr = remote_props.addr + offset;
+    sr.wr.rdma.rkey = remote_props.rkey;
+
+    int rc = ibv_post_send(qp, &sr, &bad_wr);
+    check_for_error(
+            !rc, "Could not post inline RDMA write, error code is " + std::to_string(rc) + " remote_index is " + std::to_string(remote_index));
+    return !rc;
 }
 
 void polling_loop() {
@@ -405,6 +462,10 @@ void polling_loop() {
     std::cout << "Polling thread starting" << std::endl;
     while(!shutdown) {
         auto ce = verbs_poll_completion();
+        //No thread waits for the writes that were only signaled to free up the send queue
+        if(ce.first == flow_control_wr_id) {
+            continue;
+        }
         util::polling_data.insert_completion_entry(ce.first, ce.second);
     }
     std::cout << "Polling thread ending" << std::endl;
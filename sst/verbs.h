@@ -7,12 +7,21 @@
  * including the Resources class and global setup functions.
  */
 
+#include <atomic>
+#include <limits>
 #include <map>
 
 #include <infiniband/verbs.h>
 
 namespace sst {
 
+/** The largest write that can be posted with resources::post_remote_write_inline. */
+const uint32_t max_inline_write_size = 16;
+
+/** The work request ID of writes that are only signaled to free up space in
+ * the send queue. The polling thread discards their completions. */
+const uint32_t flow_control_wr_id = std::numeric_limits<uint32_t>::max();
+
 /** Structure to exchange the data needed to connect the Queue Pairs */
 struct cm_con_data_t {
     /** Buffer address */
@@ -43,6 +52,14 @@ private:
     void connect_qp();
     /** Post a remote RDMA operation. */
     int post_remote_send(uint32_t id, long long int offset, long long int size, int op, bool completion);
+    /** The number of unsignaled requests posted since the queue pair was created. */
+    std::atomic<uint32_t> num_unsignaled_posts{0};
+    /**
+     * Counts an otherwise unsignaled request, and says whether to signal it
+     * anyway. The send queue only frees the slots of unsignaled requests
+     * once a later signaled one completes, so without this it would fill up.
+     */
+    bool signal_next_post();
 
 public:
     /** Index of the remote node. */
@@ -70,18 +87,22 @@ public:
     /*
       wrapper functions that make up the user interface
       all call post_remote_send with different parameters
+      and return false if the request could not be posted
     */
     /** Post an RDMA read at the beginning address of remote memory. */
-    void post_remote_read(uint32_t id, long long int size);
+    bool post_remote_read(uint32_t id, long long int size);
     /** Post an RDMA read at an offset into remote memory. */
-    void post_remote_read(uint32_t id, long long int offset, long long int size);
+    bool post_remote_read(uint32_t id, long long int offset, long long int size);
     /** Post an RDMA write at the beginning address of remote memory. */
-    void post_remote_write(uint32_t id, long long int size);
+    bool post_remote_write(uint32_t id, long long int size);
     /** Post an RDMA write at an offset into remote memory. */
-    void post_remote_write(uint32_t id, long long int offset, long long int size);
-    void post_remote_write_with_completion(uint32_t id, long long int size);
+    bool post_remote_write(uint32_t id, long long int offset, long long int size);
+    bool post_remote_write_with_completion(uint32_t id, long long int size);
     /** Post an RDMA write at an offset into remote memory. */
-    void post_remote_write_with_completion(uint32_t id, long long int offset, long long int size);
+    bool post_remote_write_with_completion(uint32_t id, long long int offset, long long int size);
+    /** Post an RDMA write of a small local value, which is copied into the
+     * work request, at an offset into remote memory. */
+    bool post_remote_write_inline(uint32_t id, long long int offset, const void *data, uint32_t size);
 };
 
 bool add_node(uint32_t new_id, const std::string new_ip_addr);
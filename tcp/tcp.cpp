@@ -4,17 +4,43 @@
 #include <algorithm>
 #include <arpa/inet.h>
 #include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
 #include <unistd.h>
 
 namespace tcp {
 
 using namespace std;
 
-socket::socket(string servername, int port) {
+namespace {
+/** Connects sock to serv_addr, giving up if the connection is not made within timeout_ms. */
+bool connect_with_timeout(int sock, const sockaddr_in &serv_addr, int timeout_ms) {
+    const int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int result = connect(sock, (const sockaddr *)&serv_addr, sizeof(serv_addr));
+    if(result < 0 && errno == EINPROGRESS) {
+        pollfd connecting{sock, POLLOUT, 0};
+        int error = 0;
+        socklen_t error_size = sizeof(error);
+        result = (poll(&connecting, 1, timeout_ms) == 1
+                  && getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_size) == 0
+                  && error == 0)
+                         ? 0
+                         : -1;
+    }
+    fcntl(sock, F_SETFL, flags);
+    return result == 0;
+}
+}  // namespace
+
+socket::socket(string servername, int port, int timeout_ms) {
     sock = ::socket(AF_INET, SOCK_STREAM, 0);
     if(sock < 0) throw connection_failure();
 
@@ -33,8 +59,27 @@ socket::socket(string servername, int port) {
     bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr,
           server->h_length);
 
-    while(connect(sock, (sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
-        /* do nothing*/;
+    if(timeout_ms == 0) {
+        while(connect(sock, (sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+            /* do nothing*/;
+        return;
+    }
+    const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    while(true) {
+        const auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        if(connect_with_timeout(sock, serv_addr, std::max<int>(remaining.count(), 1))) {
+            return;
+        }
+        //A socket's state after a failed connect is unspecified, so retry with a new one
+        close(sock);
+        sock = -1;
+        if(chrono::steady_clock::now() >= deadline) {
+            throw connection_failure();
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+        sock = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(sock < 0) throw connection_failure();
+    }
 }
 socket::socket(socket &&s) : sock(s.sock), remote_ip(s.remote_ip) {
     s.sock = -1;
@@ -73,6 +118,33 @@ bool socket::read(char *buffer, size_t size) {
     return true;
 }
 
+bool socket::set_read_timeout(int timeout_ms) {
+    timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+ssize_t socket::read_available(char *buffer, size_t size) {
+    if(sock < 0) {
+        fprintf(stderr, "WARNING: Attempted to read from closed socket\n");
+        return -1;
+    }
+
+    while(true) {
+        ssize_t new_bytes = ::recv(sock, buffer, size, MSG_DONTWAIT);
+        if(new_bytes > 0) {
+            return new_bytes;
+        } else if(new_bytes == 0) {
+            return -1;
+        } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else if(errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
 bool socket::probe() {
     int count;
     ioctl(sock, FIONREAD, &count);
@@ -122,11 +194,16 @@ connection_listener::connection_listener(int port) {
         new int(listenfd), [](int *fd) { close(*fd); delete fd; });
 }
 
-socket connection_listener::accept() {
+socket connection_listener::accept(int timeout_ms) {
     char client_ip_cstr[INET6_ADDRSTRLEN + 1];
     struct sockaddr_storage client_addr_info;
     socklen_t len = sizeof client_addr_info;
 
+    if(timeout_ms > 0) {
+        pollfd listening{*fd, POLLIN, 0};
+        if(poll(&listening, 1, timeout_ms) != 1) throw connection_failure();
+    }
+
     int sock = ::accept(*fd, (struct sockaddr *)&client_addr_info, &len);
     if(sock < 0) throw connection_failure();
 
@@ -5,6 +5,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <sys/types.h>
 
 namespace tcp {
 
@@ -24,7 +25,12 @@ public:
     std::string remote_ip;
 
     socket() : sock(-1), remote_ip() {}
-    socket(std::string servername, int port);
+    /**
+     * Connects to a server, retrying until it starts listening.
+     * @param timeout_ms If nonzero, how long to keep trying before throwing
+     * connection_failure; if zero, retries forever.
+     */
+    socket(std::string servername, int port, int timeout_ms = 0);
     socket(socket&& s);
 
     socket& operator=(socket& s) = delete;
@@ -35,8 +41,21 @@ public:
     bool is_empty();
 
     bool read(char* buffer, size_t size);
+    /**
+     * Makes read() fail if it waits longer than timeout_ms milliseconds for
+     * more data; 0 lets it wait forever, which is the default.
+     */
+    bool set_read_timeout(int timeout_ms);
+    /**
+     * Reads up to size bytes that have already arrived, without blocking.
+     * @return The number of bytes read, which is 0 if none were available,
+     * or -1 if the connection has been closed or failed.
+     */
+    ssize_t read_available(char* buffer, size_t size);
     bool probe();
     bool write(char const* buffer, size_t size);
+    /** Returns the file descriptor of the socket, e.g. to register it with epoll. */
+    int get_fd() const { return sock; }
 
     template <class T>
     bool exchange(T local, T& remote) {
@@ -58,7 +77,12 @@ class connection_listener {
 
 public:
     explicit connection_listener(int port);
-    socket accept();
+    /**
+     * Waits for a connection and accepts it.
+     * @param timeout_ms If nonzero, how long to wait before throwing
+     * connection_failure; if zero, waits forever.
+     */
+    socket accept(int timeout_ms = 0);
 };
 }
 